@@ -0,0 +1,132 @@
+#!/bin/sh
+#
+#  Measure the cost of running commands, separately from the work
+#  the commands do.
+#
+#  This builds a throwaway configuration directory with no-op native
+#  and shell plugins, nested "-D" directories deep under bin/, and a
+#  DEFAULT fallback.  It then runs "-n" commands through recli, and
+#  recli prints percentiles for each phase of running them.
+#
+#  With "-c", the syntax is read from cache/syntax.txt.  Otherwise,
+#  recli asks every plugin for its syntax after each command.
+#
+#	bench-exec.sh [-n commands] [-D depth] [-c] [-k]
+#
+
+RECLI=${RECLI:-./recli}
+CC=${CC:-cc}
+COMMANDS=1000
+DEPTH=3
+CACHE=
+KEEP=
+
+while getopts "n:D:ck" opt
+do
+  case "$opt" in
+    n) COMMANDS="$OPTARG" ;;
+    D) DEPTH="$OPTARG" ;;
+    c) CACHE=1 ;;
+    k) KEEP=1 ;;
+    *) echo "Usage: $0 [-n commands] [-D depth] [-c] [-k]" >&2
+       exit 1
+       ;;
+  esac
+done
+
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/recli-bench.XXXXXX") || exit 1
+if [ "$KEEP" = "" ]
+then
+  trap 'rm -rf "$DIR"' EXIT
+else
+  echo "Keeping $DIR" >&2
+fi
+
+mkdir "$DIR/bin" "$DIR/cache" || exit 1
+echo "PATH=/usr/bin:/bin" > "$DIR/ENV"
+
+#
+#  bin/d1/d2/.../{native,shell}
+#
+SUB="$DIR/bin"
+PREFIX=
+i=1
+while [ "$i" -lt "$DEPTH" ]
+do
+  SUB="$SUB/d$i"
+  PREFIX="${PREFIX}d$i "
+  mkdir "$SUB" || exit 1
+  i=$((i + 1))
+done
+
+#
+#  The plugins print an empty syntax (i.e. just their own name),
+#  and one line of output when they're run.
+#
+cat > "$DIR/native.c" <<EOF
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+	if ((argc > 1) && (strcmp(argv[1], "--config") == 0)) {
+		printf("\n");
+		return 0;
+	}
+
+	printf("ok\n");
+	return 0;
+}
+EOF
+$CC -O2 -o "$SUB/native" "$DIR/native.c" || exit 1
+
+cat > "$SUB/shell" <<EOF
+#!/bin/sh
+if [ "\$1" = "--config" ]
+then
+  echo
+  exit 0
+fi
+echo ok
+EOF
+
+#
+#  Anything which isn't under bin/ runs DEFAULT, with all of the
+#  words.  Its syntax is the full command.
+#
+cat > "$DIR/bin/DEFAULT" <<EOF
+#!/bin/sh
+if [ "\$1" = "--config" ]
+then
+  echo "fallback STRING"
+  exit 0
+fi
+echo ok
+EOF
+chmod +x "$SUB/shell" "$DIR/bin/DEFAULT"
+
+if [ "$CACHE" != "" ]
+then
+  "$RECLI" -d "$DIR" -qX syntax < /dev/null | tr -d '\r' > "$DIR/cache/syntax.txt" || exit 1
+fi
+
+#
+#  Cycle through the three kinds of plugin.
+#
+i=0
+while [ "$i" -lt "$COMMANDS" ]
+do
+  case $((i % 3)) in
+    0) echo "${PREFIX}native" ;;
+    1) echo "${PREFIX}shell" ;;
+    2) echo "fallback foo" ;;
+  esac
+  i=$((i + 1))
+done > "$DIR/commands"
+
+"$RECLI" -d "$DIR" -X exec < "$DIR/commands" > "$DIR/output" || exit 1
+
+if [ "$(grep -c '^ok$' "$DIR/output")" != "$COMMANDS" ]
+then
+  echo "Warning: not all of the commands ran" >&2
+fi
@@ -0,0 +1,730 @@
+/*
+ * Benchmarks for the syntax engine, using synthetic grammars.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "recli.h"
+
+/*
+ *	recli-bench is linked with --wrap for the allocators, so that
+ *	we can count the allocations made by the syntax engine.
+ */
+static uint64_t bench_allocs = 0;
+
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	bench_allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	bench_allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	bench_allocs++;
+	return __real_realloc(ptr, size);
+}
+
+/*
+ *	How the grammar is generated.  The percentages are per word,
+ *	other than for the first word of a command, which is always
+ *	a keyword.
+ */
+typedef struct bench_config_t {
+	int		commands;
+	int		depth;		/* words per command */
+	int		fanout;		/* keywords at each depth */
+	int		datatypes;	/* % of words which are data types */
+	int		optional;	/* % of words which are [optional] */
+	int		repeat;		/* % of words which are repeated+ */
+	int		macros;		/* % of words which use a macro */
+	int		num_macros;
+	uint64_t	seed;
+	int		min_ms;		/* minimum run time of each benchmark */
+} bench_config_t;
+
+typedef struct bench_lines_t {
+	char		**lines;
+	int		num_lines;
+	int		size;
+} bench_lines_t;
+
+/*
+ *	A command which should match the syntax, already split into
+ *	words.
+ */
+typedef struct bench_input_t {
+	char		*line;
+	char		*partial;	/* for tab completion */
+	char		*buf;
+	int		argc;
+	char		*argv[256];
+} bench_input_t;
+
+typedef struct bench_t {
+	bench_config_t	*config;
+	bench_lines_t	grammar;
+	bench_lines_t	help;
+
+	bench_input_t	*inputs;
+	int		num_inputs;
+
+	const char	*syntax_file;
+	const char	*help_file;
+
+	cli_syntax_t	*syntax;
+	cli_syntax_t	*long_help;
+	cli_syntax_t	*short_help;
+} bench_t;
+
+/*
+ *	HOSTNAME and STRING also match the keywords, and the checker
+ *	takes the first alternative which matches.  Using them would
+ *	make some of the generated inputs match a different command.
+ */
+static const char *datatype_names[] = { "INTEGER", "IPADDR" };
+static const char *datatype_values[] = { "42", "192.0.2.1" };
+
+#define NUM_DATATYPES (sizeof(datatype_names) / sizeof(datatype_names[0]))
+
+/*
+ *	xorshift64*, so that a seed always gives the same grammar.
+ */
+static uint64_t bench_rand_state = 1;
+
+static uint32_t bench_rand(void)
+{
+	bench_rand_state ^= bench_rand_state >> 12;
+	bench_rand_state ^= bench_rand_state << 25;
+	bench_rand_state ^= bench_rand_state >> 27;
+
+	return (bench_rand_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static int bench_percent(int percent)
+{
+	return ((int) (bench_rand() % 100) < percent);
+}
+
+static void lines_add(bench_lines_t *l, const char *fmt, ...)
+{
+	va_list ap;
+	char buffer[8192];
+
+	va_start(ap, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, ap);
+	va_end(ap);
+
+	if (l->num_lines == l->size) {
+		l->size = (l->size + 16) * 2;
+		l->lines = realloc(l->lines, l->size * sizeof(l->lines[0]));
+		if (!l->lines) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+
+	l->lines[l->num_lines] = strdup(buffer);
+	if (!l->lines[l->num_lines]) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	l->num_lines++;
+}
+
+static void lines_free(bench_lines_t *l)
+{
+	int i;
+
+	for (i = 0; i < l->num_lines; i++) free(l->lines[i]);
+	free(l->lines);
+}
+
+static size_t append(char *buffer, size_t len, size_t used, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (used >= len) return used;
+
+	va_start(ap, fmt);
+	used += vsnprintf(buffer + used, len - used, fmt, ap);
+	va_end(ap);
+
+	return used;
+}
+
+/*
+ *	An optional macro would eat the word meant for the same macro
+ *	after it, so the same macro is never used twice in a row.
+ */
+static int bench_macro(const bench_config_t *c, int k, int last)
+{
+	int n = k % c->num_macros;
+
+	if ((n == last) && (c->num_macros > 1)) n = (n + 1) % c->num_macros;
+
+	return n;
+}
+
+/*
+ *	Generate the syntax, the help, and one matching input per
+ *	command.
+ */
+static void bench_generate(bench_t *b)
+{
+	int i, j, k, n, last;
+	size_t used, in_used;
+	char syntax[8192], input[8192];
+	bench_config_t *c = b->config;
+
+	bench_rand_state = c->seed ? c->seed : 1;
+
+	for (i = 0; i < c->num_macros; i++) {
+		lines_add(&b->grammar, "MACRO%d=(m%da|m%db|m%dc)", i, i, i, i);
+	}
+
+	b->inputs = calloc(c->commands, sizeof(b->inputs[0]));
+	if (!b->inputs) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < c->commands; i++) {
+		bench_input_t *in = &b->inputs[i];
+
+		used = in_used = 0;
+		last = -1;
+
+		for (j = 0; j < c->depth; j++) {
+			k = bench_rand() % c->fanout;
+
+			if (j > 0) {
+				used = append(syntax, sizeof(syntax), used, " ");
+				in_used = append(input, sizeof(input), in_used, " ");
+			}
+
+			/*
+			 *	Data types match almost anything, so
+			 *	they're never optional or repeated.
+			 *	Otherwise the inputs might not match.
+			 */
+			if ((j > 0) && bench_percent(c->datatypes)) {
+				n = bench_rand() % NUM_DATATYPES;
+				used = append(syntax, sizeof(syntax), used, "%s", datatype_names[n]);
+				in_used = append(input, sizeof(input), in_used, "%s", datatype_values[n]);
+				last = -1;
+				continue;
+			}
+
+			if ((j > 0) && bench_percent(c->optional)) {
+				if (c->num_macros && bench_percent(c->macros)) {
+					n = bench_macro(c, k, last);
+					last = n;
+					used = append(syntax, sizeof(syntax), used, "[MACRO%d]", n);
+					if (bench_rand() & 1) {
+						in_used = append(input, sizeof(input), in_used, "m%d%c", n, 'a' + (bench_rand() % 3));
+					}
+				} else {
+					used = append(syntax, sizeof(syntax), used, "[c%dw%d]", j, k);
+					if (bench_rand() & 1) {
+						in_used = append(input, sizeof(input), in_used, "c%dw%d", j, k);
+					}
+				}
+				continue;
+			}
+
+			if (c->num_macros && bench_percent(c->macros)) {
+				n = bench_macro(c, k, last);
+				last = n;
+				used = append(syntax, sizeof(syntax), used, "MACRO%d", n);
+				in_used = append(input, sizeof(input), in_used, "m%d%c", n, 'a' + (bench_rand() % 3));
+				continue;
+			}
+
+			used = append(syntax, sizeof(syntax), used, "c%dw%d", j, k);
+			in_used = append(input, sizeof(input), in_used, "c%dw%d", j, k);
+			last = -1;
+
+			if ((j > 0) && bench_percent(c->repeat)) {
+				used = append(syntax, sizeof(syntax), used, "+");
+				if (bench_rand() & 1) {
+					in_used = append(input, sizeof(input), in_used, " c%dw%d", j, k);
+				}
+			}
+		}
+
+		if ((used >= sizeof(syntax)) || (in_used >= sizeof(input))) {
+			fprintf(stderr, "Command %d is too long\n", i);
+			exit(1);
+		}
+
+		/*
+		 *	Skipped optional words can leave trailing spaces.
+		 */
+		while ((in_used > 0) && (input[in_used - 1] == ' ')) input[--in_used] = '\0';
+
+		lines_add(&b->grammar, "%s", syntax);
+
+		in->line = strdup(input);
+		in->partial = strdup(input);
+		in->buf = strdup(input);
+		if (!in->line || !in->partial || !in->buf) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+
+		/*
+		 *	Complete the last word from its first two
+		 *	characters.
+		 */
+		for (n = in_used; n > 0; n--) {
+			if (in->partial[n - 1] == ' ') break;
+		}
+		if ((n + 2) < (int) in_used) in->partial[n + 2] = '\0';
+
+		in->argc = str2argv(in->buf, strlen(in->buf), 256, in->argv);
+	}
+	b->num_inputs = c->commands;
+
+	for (i = 0; i < c->fanout; i++) {
+		lines_add(&b->help, "# c0w%d", i);
+		lines_add(&b->help, "    Short help for c0w%d.", i);
+		lines_add(&b->help, "");
+		lines_add(&b->help, "Help text for c0w%d.", i);
+		lines_add(&b->help, "");
+
+		for (j = 0; (j < c->fanout) && (j < 16); j++) {
+			lines_add(&b->help, "# c0w%d c1w%d", i, j);
+			lines_add(&b->help, "    Short help for c0w%d c1w%d.", i, j);
+			lines_add(&b->help, "");
+			lines_add(&b->help, "Help text for c0w%d c1w%d.", i, j);
+			lines_add(&b->help, "");
+		}
+	}
+}
+
+static const char *bench_write(bench_lines_t *l, const char *prefix)
+{
+	int i, fd;
+	FILE *fp;
+	char *filename;
+	const char *tmpdir;
+
+	tmpdir = getenv("TMPDIR");
+	if (!tmpdir) tmpdir = "/tmp";
+
+	filename = malloc(strlen(tmpdir) + strlen(prefix) + 32);
+	if (!filename) return NULL;
+
+	sprintf(filename, "%s/recli-bench-%s-XXXXXX", tmpdir, prefix);
+
+	fd = mkstemp(filename);
+	if (fd < 0) {
+		fprintf(stderr, "Failed creating %s: %s\n", filename, strerror(errno));
+		free(filename);
+		return NULL;
+	}
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		unlink(filename);
+		free(filename);
+		return NULL;
+	}
+
+	for (i = 0; i < l->num_lines; i++) fprintf(fp, "%s\n", l->lines[i]);
+
+	if (fclose(fp) != 0) {
+		unlink(filename);
+		free(filename);
+		return NULL;
+	}
+
+	return filename;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static long bench_peak_rss(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0) return -1;
+
+	return ru.ru_maxrss;	/* KB on Linux */
+}
+
+/*
+ *	One round of a benchmark.  Returns the number of operations,
+ *	or -1 on error.
+ */
+typedef int64_t (*bench_round_t)(bench_t *b);
+
+static int64_t round_parse_file(bench_t *b)
+{
+	cli_syntax_t *head = NULL;
+
+	if (syntax_parse_file(b->syntax_file, &head) < 0) return -1;
+	syntax_free(head);
+
+	return 1;
+}
+
+static int64_t round_merge(bench_t *b)
+{
+	int i;
+	char buffer[8192];
+	cli_syntax_t *head = NULL;
+
+	for (i = 0; i < b->grammar.num_lines; i++) {
+		strlcpy(buffer, b->grammar.lines[i], sizeof(buffer));
+
+		if (syntax_merge(&head, buffer) < 0) {
+			syntax_free(head);
+			return -1;
+		}
+	}
+
+	syntax_free(head);
+
+	return b->grammar.num_lines;
+}
+
+static int64_t round_parse_help(bench_t *b)
+{
+	cli_syntax_t *long_help = NULL, *short_help = NULL;
+
+	if (syntax_parse_help(b->help_file, &long_help, &short_help) < 0) return -1;
+	if (long_help) syntax_free(long_help);
+	if (short_help) syntax_free(short_help);
+
+	return 1;
+}
+
+static int64_t round_check(bench_t *b)
+{
+	int i;
+	const char *error;
+
+	for (i = 0; i < b->num_inputs; i++) {
+		(void) syntax_check(b->syntax, b->inputs[i].argc, b->inputs[i].argv,
+				    &error, NULL);
+	}
+
+	return b->num_inputs;
+}
+
+static int64_t round_tab_complete(bench_t *b)
+{
+	int i, j, num;
+	char *tabs[256];
+
+	for (i = 0; i < b->num_inputs; i++) {
+		num = syntax_tab_complete(b->syntax, b->inputs[i].partial,
+					  strlen(b->inputs[i].partial), 256, tabs);
+		for (j = 0; j < num; j++) free(tabs[j]);
+	}
+
+	return b->num_inputs;
+}
+
+static int64_t round_match_max(bench_t *b)
+{
+	int i;
+	cli_syntax_t *match;
+
+	for (i = 0; i < b->num_inputs; i++) {
+		match = syntax_match_max(b->syntax, b->inputs[i].argc, b->inputs[i].argv);
+		if (match) syntax_free(match);
+	}
+
+	return b->num_inputs;
+}
+
+static int64_t round_show_help(bench_t *b)
+{
+	int i;
+
+	for (i = 0; i < b->num_inputs; i++) {
+		(void) syntax_show_help(b->long_help, b->inputs[i].argc, b->inputs[i].argv);
+	}
+
+	return b->num_inputs;
+}
+
+/*
+ *	Run rounds until we've run for long enough, and print the
+ *	results as one JSON object per line.
+ */
+static int bench_run(bench_t *b, const char *name, bench_round_t round)
+{
+	int64_t ops, total;
+	uint64_t allocs;
+	double start, now;
+
+	total = 0;
+	allocs = bench_allocs;
+	start = now = bench_now();
+
+	do {
+		ops = round(b);
+		if (ops < 0) {
+			fprintf(stderr, "Failed running benchmark %s\n", name);
+			return -1;
+		}
+
+		total += ops;
+		now = bench_now();
+	} while ((now - start) < (b->config->min_ms / 1000.0));
+
+	allocs = bench_allocs - allocs;
+
+	printf("{\"bench\": \"%s\", \"commands\": %d, \"ops\": %lld, \"seconds\": %.6f, "
+	       "\"ops_per_sec\": %.1f, \"allocs_per_op\": %.2f, \"peak_rss_kb\": %ld}\n",
+	       name, b->config->commands, (long long) total, now - start,
+	       total / (now - start), total ? ((double) allocs / total) : 0.0,
+	       bench_peak_rss());
+	fflush(stdout);
+
+	return 0;
+}
+
+static void usage(char const *name, int rcode)
+{
+	FILE *out = stderr;
+
+	if (rcode == 0) out = stdout;
+
+	fprintf(out, "Usage: %s [-g | -H | -I] [-n commands] [-D depth] [-f fanout] [-t pct] [-o pct] [-r pct] [-m pct] [-M macros] [-S seed] [-T ms]\n", name);
+	fprintf(out, "  -g              Print the generated syntax, and exit\n");
+	fprintf(out, "  -H              Print the generated help, and exit\n");
+	fprintf(out, "  -I              Print the generated commands, and exit\n");
+	fprintf(out, "  -n <commands>   Number of commands in the syntax (default 1000)\n");
+	fprintf(out, "  -D <depth>      Words per command (default 4)\n");
+	fprintf(out, "  -f <fanout>     Different keywords at each depth (default 8)\n");
+	fprintf(out, "  -t <pct>        Percentage of words which are data types (default 10)\n");
+	fprintf(out, "  -o <pct>        Percentage of words which are optional (default 10)\n");
+	fprintf(out, "  -r <pct>        Percentage of words which are repeated (default 5)\n");
+	fprintf(out, "  -m <pct>        Percentage of words which use a macro (default 10)\n");
+	fprintf(out, "  -M <macros>     Number of macros (default 8)\n");
+	fprintf(out, "  -S <seed>       Random seed (default 1)\n");
+	fprintf(out, "  -T <ms>         Minimum run time of each benchmark (default 200)\n");
+	fprintf(out, "\n");
+	fprintf(out, "Results are printed as one JSON object per line.\n");
+	exit(rcode);
+}
+
+int main(int argc, char **argv)
+{
+	int c, i, rcode, rejected, print_inputs, print_help;
+	char const *progname;
+	const char *error;
+	bench_config_t config;
+	bench_t b;
+
+	recli_stdout = stdout;
+	recli_stderr = stderr;
+
+	progname = strrchr(argv[0], '/');
+	if (progname) {
+		progname++;
+	} else {
+		progname = argv[0];
+	}
+
+	config.commands = 1000;
+	config.depth = 4;
+	config.fanout = 8;
+	config.datatypes = 10;
+	config.optional = 10;
+	config.repeat = 5;
+	config.macros = 10;
+	config.num_macros = 8;
+	config.seed = 1;
+	config.min_ms = 200;
+
+	memset(&b, 0, sizeof(b));
+	b.config = &config;
+
+	rcode = 0;
+	print_inputs = 0;
+	print_help = 0;
+	while ((c = getopt(argc, argv, "gD:f:hHIm:M:n:o:r:S:t:T:")) != EOF) switch(c) {
+		case 'g':
+			rcode = 1;
+			break;
+
+		case 'H':
+			print_help = 1;
+			break;
+
+		case 'I':
+			print_inputs = 1;
+			break;
+
+		case 'D':
+			config.depth = atoi(optarg);
+			break;
+
+		case 'f':
+			config.fanout = atoi(optarg);
+			break;
+
+		case 'h':
+			usage(progname, 0);
+			break;
+
+		case 'm':
+			config.macros = atoi(optarg);
+			break;
+
+		case 'M':
+			config.num_macros = atoi(optarg);
+			break;
+
+		case 'n':
+			config.commands = atoi(optarg);
+			break;
+
+		case 'o':
+			config.optional = atoi(optarg);
+			break;
+
+		case 'r':
+			config.repeat = atoi(optarg);
+			break;
+
+		case 'S':
+			config.seed = strtoull(optarg, NULL, 10);
+			break;
+
+		case 't':
+			config.datatypes = atoi(optarg);
+			break;
+
+		case 'T':
+			config.min_ms = atoi(optarg);
+			break;
+
+		default:
+			usage(progname, 1);
+			break;
+		}
+
+	if ((config.commands <= 0) || (config.depth <= 0) || (config.depth > 64) ||
+	    (config.fanout <= 0) || (config.num_macros < 0)) {
+		usage(progname, 1);
+	}
+
+	if (recli_datatypes_init() < 0) exit(1);
+
+	bench_generate(&b);
+
+	if (rcode) {
+		for (i = 0; i < b.grammar.num_lines; i++) printf("%s\n", b.grammar.lines[i]);
+		exit(0);
+	}
+
+	if (print_help) {
+		for (i = 0; i < b.help.num_lines; i++) printf("%s\n", b.help.lines[i]);
+		exit(0);
+	}
+
+	if (print_inputs) {
+		for (i = 0; i < b.num_inputs; i++) printf("%s\n", b.inputs[i].line);
+		exit(0);
+	}
+
+	b.syntax_file = bench_write(&b.grammar, "syntax");
+	b.help_file = bench_write(&b.help, "help");
+	if (!b.syntax_file || !b.help_file) exit(1);
+
+	rcode = 1;
+
+	if (bench_run(&b, "syntax_parse_file", round_parse_file) < 0) goto done;
+	if (bench_run(&b, "syntax_merge", round_merge) < 0) goto done;
+	if (bench_run(&b, "syntax_parse_help", round_parse_help) < 0) goto done;
+
+	/*
+	 *	Load the syntax and help the same way recli does.
+	 */
+	if (syntax_parse_file(b.syntax_file, &b.syntax) < 0) goto done;
+	if (syntax_parse_help(b.help_file, &b.long_help, &b.short_help) < 0) goto done;
+
+	syntax_freeze(b.syntax);
+	syntax_freeze(b.long_help);
+	syntax_freeze(b.short_help);
+	syntax_pack(b.syntax);
+
+	/*
+	 *	The generated commands should almost all match.  The
+	 *	checker doesn't backtrack, so an optional word merged
+	 *	with a required one can reject an input or two.  If
+	 *	many don't match, the numbers below aren't measuring
+	 *	much.
+	 */
+	rejected = 0;
+	for (i = 0; i < b.num_inputs; i++) {
+		if (syntax_check(b.syntax, b.inputs[i].argc, b.inputs[i].argv,
+				 &error, NULL) != b.inputs[i].argc) {
+			rejected++;
+		}
+	}
+	if (rejected) {
+		fprintf(stderr, "Warning: %d of %d generated commands do not match the syntax\n",
+			rejected, b.num_inputs);
+	}
+
+	if (bench_run(&b, "syntax_check", round_check) < 0) goto done;
+	if (bench_run(&b, "syntax_tab_complete", round_tab_complete) < 0) goto done;
+	if (bench_run(&b, "syntax_match_max", round_match_max) < 0) goto done;
+	if (bench_run(&b, "syntax_show_help", round_show_help) < 0) goto done;
+
+	rcode = 0;
+
+done:
+	unlink(b.syntax_file);
+	unlink(b.help_file);
+
+	for (i = 0; i < b.num_inputs; i++) {
+		free(b.inputs[i].line);
+		free(b.inputs[i].partial);
+		free(b.inputs[i].buf);
+	}
+	free(b.inputs);
+	lines_free(&b.grammar);
+	lines_free(&b.help);
+
+	if (b.short_help) syntax_free(b.short_help);
+	if (b.long_help) syntax_free(b.long_help);
+	if (b.syntax) syntax_free(b.syntax);
+
+	syntax_free(NULL);
+
+	return rcode;
+}
@@ -0,0 +1,325 @@
+/*
+ * Offline validation of command files.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "recli.h"
+
+/*
+ *	The input is read in batches of lines.  Each batch is split
+ *	across the worker threads, which write their verdicts into
+ *	their own output buffers.  The buffers are then written out
+ *	in order, so the results stream out in input order.
+ */
+#define CHECK_BATCH_LINES	(64 * 1024)
+#define CHECK_MAX_THREADS	(64)
+
+typedef struct check_batch_t {
+	char		*text;		/* all of the lines, NUL separated */
+	size_t		text_len;
+	size_t		text_size;
+
+	size_t		*lines;		/* offset of each line in "text" */
+	int		num_lines;
+	int		first_lineno;
+} check_batch_t;
+
+typedef struct check_worker_t {
+	pthread_t	thread;
+	int		running;
+
+	recli_config_t	*config;
+	const char	*filename;
+	check_batch_t	*batch;
+	int		start, end;	/* lines in the batch to check */
+
+	char		*out;		/* verdicts for those lines */
+	size_t		out_len;
+	size_t		out_size;
+
+	int		errors;
+} check_worker_t;
+
+static void worker_printf(check_worker_t *w, const char *fmt, ...) PRINTF_LIKE(2);
+
+static void worker_printf(check_worker_t *w, const char *fmt, ...)
+{
+	int len;
+	va_list args;
+
+	for (;;) {
+		va_start(args, fmt);
+		len = vsnprintf(w->out + w->out_len, w->out_size - w->out_len,
+				fmt, args);
+		va_end(args);
+
+		if (len < 0) return;
+
+		if ((w->out_len + len) < w->out_size) {
+			w->out_len += len;
+			return;
+		}
+
+		w->out_size = (w->out_size + len) * 2;
+		w->out = realloc(w->out, w->out_size);
+		if (!w->out) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+}
+
+static void worker_error(check_worker_t *w, int lineno, const char *line,
+			 size_t offset, const char *msg)
+{
+	w->errors++;
+	worker_printf(w, "%s:%d: %s\n%s\n%*s^\n", w->filename, lineno, msg,
+		      line, (int) offset, "");
+}
+
+/*
+ *	Check one line.  The words are copied into "buffer", which is
+ *	at least as large as the line.
+ */
+static void check_line(check_worker_t *w, int lineno, const char *line,
+		       char *buffer)
+{
+	int i, c, argc;
+	size_t len, offset;
+	const char *error;
+	char *argv[256 + 1];
+	recli_token_t tokens[256];
+
+	len = strlen(line);
+
+	argc = str2tokens(line, len, 256, tokens, &offset);
+	if (argc == 0) return;
+
+	if (argc < 0) {
+		worker_error(w, lineno, line, offset, "Parse error");
+		return;
+	}
+
+	for (i = 0; i < argc; i++) {
+		argv[i] = buffer + tokens[i].offset;
+		memcpy(argv[i], line + tokens[i].offset, tokens[i].length);
+		argv[i][tokens[i].length] = '\0';
+	}
+	argv[argc] = NULL;
+
+	if (w->config->syntax) {
+		c = syntax_check(w->config->syntax, argc, argv, &error, NULL);
+		if (c < 0) {
+			if (-c == argc) {
+				offset = tokens[argc - 1].offset;
+
+			} else if (-c > argc) {
+				offset = len;
+
+			} else {
+				offset = tokens[-c - 1].offset;
+			}
+
+			worker_error(w, lineno, line, offset,
+				     error ? error : "Parse error");
+			return;
+		}
+
+		if (c < argc) {
+			worker_error(w, lineno, line, tokens[c].offset,
+				     "Unexpected text");
+			return;
+		}
+
+		if (c > argc) {
+			worker_error(w, lineno, line, len,
+				     "Incomplete command");
+			return;
+		}
+	}
+
+	if (!permission_enforce(w->config->permissions, argc, argv)) {
+		worker_error(w, lineno, line, 0, "No permission");
+	}
+}
+
+static void *check_worker(void *ctx)
+{
+	int i;
+	size_t maxlen = 0;
+	char *buffer = NULL;
+	check_worker_t *w = ctx;
+	check_batch_t *batch = w->batch;
+
+	for (i = w->start; i < w->end; i++) {
+		const char *line = batch->text + batch->lines[i];
+		size_t len = strlen(line);
+
+		if (len >= maxlen) {
+			maxlen = (len + 1) * 2;
+			free(buffer);
+			buffer = malloc(maxlen);
+			if (!buffer) {
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+		}
+
+		check_line(w, batch->first_lineno + i, line, buffer);
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+static int batch_add(check_batch_t *batch, const char *line, size_t len)
+{
+	if ((batch->text_len + len + 1) > batch->text_size) {
+		char *p;
+		size_t size;
+
+		size = batch->text_size * 2;
+		if (size < (batch->text_len + len + 1)) size = (batch->text_len + len + 1) * 2;
+
+		p = realloc(batch->text, size);
+		if (!p) return -1;
+
+		batch->text = p;
+		batch->text_size = size;
+	}
+
+	memcpy(batch->text + batch->text_len, line, len + 1);
+	batch->lines[batch->num_lines++] = batch->text_len;
+	batch->text_len += len + 1;
+
+	return 0;
+}
+
+/*
+ *	Check every line of a file against the syntax and
+ *	permissions, without running anything.  Partial commands are
+ *	reported as incomplete, as each line is checked by itself.
+ *
+ *	Returns the number of lines which failed, or -1 on error.
+ */
+int recli_check_file(recli_config_t *config, const char *filename,
+		     int num_threads)
+{
+	int i, errors, lineno;
+	int done = 0;
+	char *line;
+	size_t len;
+	recli_input_t input;
+	check_batch_t batch;
+	check_worker_t workers[CHECK_MAX_THREADS];
+
+	if (num_threads <= 0) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (num_threads <= 0) num_threads = 1;
+	}
+	if (num_threads > CHECK_MAX_THREADS) num_threads = CHECK_MAX_THREADS;
+
+	if (strcmp(filename, "-") == 0) {
+		recli_input_init(&input, STDIN_FILENO);
+		filename = "stdin";
+
+	} else if (recli_input_open(&input, filename) < 0) {
+		fprintf(stderr, "Failed opening %s: %s\n",
+			filename, strerror(errno));
+		return -1;
+	}
+
+	memset(&batch, 0, sizeof(batch));
+	batch.lines = malloc(CHECK_BATCH_LINES * sizeof(batch.lines[0]));
+	if (!batch.lines) {
+		recli_input_free(&input);
+		return -1;
+	}
+
+	memset(workers, 0, sizeof(workers));
+	errors = 0;
+	lineno = 0;
+
+	while (!done) {
+		int per_thread, threads;
+
+		batch.num_lines = 0;
+		batch.text_len = 0;
+		batch.first_lineno = lineno + 1;
+
+		while (batch.num_lines < CHECK_BATCH_LINES) {
+			line = recli_input_line(&input, &len);
+			if (!line) {
+				done = 1;
+				break;
+			}
+
+			if (batch_add(&batch, line, len) < 0) {
+				fprintf(stderr, "Out of memory\n");
+				errors = -1;
+				goto finish;
+			}
+			lineno++;
+		}
+
+		if (!batch.num_lines) break;
+
+		/*
+		 *	Don't start threads for tiny batches.
+		 */
+		threads = num_threads;
+		if (threads > ((batch.num_lines + 1023) / 1024)) {
+			threads = (batch.num_lines + 1023) / 1024;
+		}
+		per_thread = (batch.num_lines + threads - 1) / threads;
+
+		for (i = 0; i < threads; i++) {
+			check_worker_t *w = &workers[i];
+
+			w->config = config;
+			w->filename = filename;
+			w->batch = &batch;
+			w->start = i * per_thread;
+			w->end = w->start + per_thread;
+			if (w->end > batch.num_lines) w->end = batch.num_lines;
+			w->out_len = 0;
+			w->errors = 0;
+			w->running = 0;
+
+			if ((threads > 1) &&
+			    (pthread_create(&w->thread, NULL, check_worker, w) == 0)) {
+				w->running = 1;
+				continue;
+			}
+
+			check_worker(w);
+		}
+
+		for (i = 0; i < threads; i++) {
+			check_worker_t *w = &workers[i];
+
+			if (w->running) pthread_join(w->thread, NULL);
+
+			if (w->out_len) fwrite(w->out, 1, w->out_len, stdout);
+			errors += w->errors;
+		}
+	}
+
+	printf("%d lines checked, %d errors\n", lineno, errors);
+
+finish:
+	fflush(stdout);
+
+	for (i = 0; i < CHECK_MAX_THREADS; i++) free(workers[i].out);
+	free(batch.lines);
+	free(batch.text);
+	recli_input_free(&input);
+
+	return errors;
+}
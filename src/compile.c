@@ -0,0 +1,151 @@
+/*
+ * Compile a syntax, help and permissions into C source.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "recli.h"
+
+static void usage(char const *name, int rcode)
+{
+	FILE *out = stderr;
+
+	if (rcode == 0) out = stdout;
+
+	fprintf(out, "Usage: %s -s syntax.txt [-H help.md] [-p perm.txt] [-d config_dir] [-o output.c]\n", name);
+	fprintf(out, "  -d <config_dir> Configuration directory for the compiled program\n");
+	fprintf(out, "  -s syntax.txt   Compile the syntax in 'syntax.txt'\n");
+	fprintf(out, "  -H help.md      Compile the help text in 'help.md'\n");
+	fprintf(out, "  -p perm.txt     Compile the permissions in 'perm.txt'\n");
+	fprintf(out, "  -o output.c     Write the C source to 'output.c', instead of stdout\n");
+	exit(rcode);
+}
+
+int main(int argc, char **argv)
+{
+	int c, num_nodes, num_permissions;
+	int roots[3];
+	char const *progname;
+	char const *dir = NULL;
+	char const *syntax_file = NULL;
+	char const *help_file = NULL;
+	char const *output_file = NULL;
+	char const *permission_file = NULL;
+	cli_syntax_t *syntax = NULL;
+	cli_syntax_t *long_help = NULL;
+	cli_syntax_t *short_help = NULL;
+	cli_permission_t *permissions = NULL;
+	FILE *fp;
+
+	recli_stdout = stdout;
+	recli_stderr = stderr;
+
+	progname = strrchr(argv[0], '/');
+	if (progname) {
+		progname++;
+	} else {
+		progname = argv[0];
+	}
+
+	while ((c = getopt(argc, argv, "d:hH:o:p:s:")) != EOF) switch(c) {
+		case 'd':
+			dir = optarg;
+			break;
+
+		case 'h':
+			usage(progname, 0);
+			break;
+
+		case 'H':
+			help_file = optarg;
+			break;
+
+		case 'o':
+			output_file = optarg;
+			break;
+
+		case 'p':
+			permission_file = optarg;
+			break;
+
+		case 's':
+			syntax_file = optarg;
+			break;
+
+		default:
+			usage(progname, 1);
+			break;
+		}
+
+	if (!syntax_file) usage(progname, 1);
+
+	/*
+	 *	Use the same parsers as recli, so that the compiled
+	 *	syntax is the same as the one recli would load.
+	 */
+	if (syntax_parse_file(syntax_file, &syntax) < 0) exit(1);
+
+	if (help_file &&
+	    (syntax_parse_help(help_file, &long_help, &short_help) < 0)) exit(1);
+
+	if (permission_file &&
+	    (permission_parse_file(permission_file, &permissions) < 0)) exit(1);
+
+	if (output_file) {
+		fp = fopen(output_file, "w");
+		if (!fp) {
+			fprintf(stderr, "Failed opening %s: %s\n",
+				output_file, strerror(errno));
+			exit(1);
+		}
+	} else {
+		fp = stdout;
+	}
+
+	fprintf(fp, "/*\n * Compiled from %s by recli-compile.  Do not edit.\n */\n",
+		syntax_file);
+	fprintf(fp, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <strings.h>\n#include \"recli.h\"\n\n");
+
+	num_nodes = syntax_compile(fp, syntax, long_help, short_help, roots);
+	if (num_nodes < 0) {
+		fprintf(stderr, "Failed compiling %s\n", syntax_file);
+		if (output_file) unlink(output_file);
+		exit(1);
+	}
+
+	num_permissions = permission_compile(fp, permissions);
+
+	fprintf(fp, "const recli_static_t recli_static = {\n");
+	if (dir) {
+		fprintf(fp, "\t");
+		fprint_cstring(fp, dir);
+		fprintf(fp, ",\n\n");
+	} else {
+		fprintf(fp, "\tNULL,\n\n");
+	}
+	fprintf(fp, "\trecli_static_nodes, %d,\n", num_nodes);
+	fprintf(fp, "\t%d, %d, %d,\n", roots[0], roots[1], roots[2]);
+	fprintf(fp, "\t%s,\n", (roots[0] >= 0) ? "recli_static_check" : "NULL");
+	fprintf(fp, "\trecli_static_permissions, %d\n", num_permissions);
+	fprintf(fp, "};\n");
+
+	if (fflush(fp) != 0) {
+		fprintf(stderr, "Failed writing output: %s\n", strerror(errno));
+		if (output_file) unlink(output_file);
+		exit(1);
+	}
+	if (output_file) fclose(fp);
+
+	permission_free(permissions);
+	if (short_help) syntax_free(short_help);
+	if (long_help) syntax_free(long_help);
+	if (syntax) syntax_free(syntax);
+
+	syntax_free(NULL);
+
+	return 0;
+}
@@ -252,13 +252,12 @@ static ssize_t parse_hostname(const char *buffer, const char **error)
 }
 
 
-static ssize_t parse_string(const char *buffer, UNUSED const char **error)
+/*
+ *	The input words come from str2tokens(), which has already
+ *	matched the quotes.  So any word is a valid string.
+ */
+static ssize_t parse_string(UNUSED const char *buffer, UNUSED const char **error)
 {
-	if ((*buffer == '"') || (*buffer == '\'') || (*buffer == '`')) {
-		if (strquotelen(buffer) > 0) return 1;
-		return 0;
-	}
-
 	return 1;
 }
 
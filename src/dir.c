@@ -41,15 +41,12 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <signal.h>
+#include <time.h>
 #include <pwd.h>
 
 #include "recli.h"
 
-/*
- *	For recli.c
- */
-pid_t child_pid = -1;
-
 static int load_envp(const char *dir, recli_config_t *config)
 {
 	int argc;
@@ -123,15 +120,14 @@ static int load_envp(const char *dir, recli_config_t *config)
 typedef struct rbuf_t {
 	char buffer[8192];
 	char *start, *append;
-	cli_syntax_t **phead;
+	cli_syntax_t **phead;		/* NULL for stderr */
 	recli_fprintf_t old_fprintf;
-	void *old_ctx;
+	void *old_stdout, *old_stderr;
+	struct rbuf_t *err;
 	int rcode;
 } rbuf_t;
 
 
-static rbuf_t buf_out, buf_err;
-
 static int recli_fprintf_syntax(void *ctx, const char *fmt, ...)
 {
 	int rcode;
@@ -147,8 +143,8 @@ static int recli_fprintf_syntax(void *ctx, const char *fmt, ...)
 	/*
 	 *	If we're called for stderr, dump it to the caller.
 	 */
-	if (b == &buf_err) {
-		return b->old_fprintf(b->old_ctx, "%s", b->buffer);
+	if (!b->phead) {
+		return b->old_fprintf(b->old_stderr, "%s", b->buffer);
 	}
 
 	for (p = b->append; *p != '\0'; p++) {
@@ -167,16 +163,16 @@ static int recli_fprintf_syntax(void *ctx, const char *fmt, ...)
 	 *	Errors go to the caller, not to us.
 	 */
 	recli_fprintf = b->old_fprintf;
-	recli_stdout = buf_out.old_ctx;
-	recli_stderr = buf_err.old_ctx;
+	recli_stdout = b->old_stdout;
+	recli_stderr = b->old_stderr;
 
 	if (syntax_merge(b->phead, b->start) < 0) {
 		b->rcode = -1;
 	}
 
 	recli_fprintf = recli_fprintf_syntax;
-	recli_stdout = &buf_out;
-	recli_stderr = &buf_err;
+	recli_stdout = b;
+	recli_stderr = b->err;
 
 	return rcode;
 }
@@ -194,6 +190,7 @@ int recli_exec_syntax(cli_syntax_t **phead, const char *dir, char *program,
 	int rcode = 0;
 	char *p;
 	char *argv[4];
+	rbuf_t buf_out, buf_err;
 
 	argv[0] = program;
 	argv[1] = "--config";
@@ -201,14 +198,14 @@ int recli_exec_syntax(cli_syntax_t **phead, const char *dir, char *program,
 	argv[3] = NULL;
 
 	buf_out.old_fprintf = recli_fprintf;
-	buf_out.old_ctx = recli_stdout;
+	buf_out.old_stdout = recli_stdout;
+	buf_out.old_stderr = recli_stderr;
+	buf_out.err = &buf_err;
 	buf_out.rcode = 0;
 	buf_out.phead = phead;
 	buf_out.append = buf_out.buffer;
 
-	buf_err.old_fprintf = recli_fprintf;
-	buf_err.old_ctx = recli_stderr;
-	buf_err.rcode = 0;
+	buf_err = buf_out;
 	buf_err.phead = NULL;
 	buf_err.append = buf_err.buffer;
 
@@ -239,11 +236,11 @@ int recli_exec_syntax(cli_syntax_t **phead, const char *dir, char *program,
 	p = strchr(argv[0], '/');
 	if (p) argv[0] = p + 1;
 
-	rcode = recli_exec(dir, 0, 3, argv, envp);
+	rcode = recli_exec(dir, 0, 3, argv, envp, NULL, NULL, NULL);
 
 	recli_fprintf = buf_out.old_fprintf;
-	recli_stdout = buf_out.old_ctx;
-	recli_stderr = buf_err.old_ctx;
+	recli_stdout = buf_out.old_stdout;
+	recli_stderr = buf_out.old_stderr;
 
 	return rcode;
 }
@@ -316,9 +313,12 @@ int recli_load_dirs(cli_syntax_t **phead, const char *name, size_t skip,
 int recli_load_syntax(recli_config_t *config)
 {
 	struct stat statbuf;
+	time_t scanned;
 	cli_syntax_t *head = NULL;
 	char buffer[8192];
 
+	if (config->static_syntax) return 0;
+
 	snprintf(buffer, sizeof(buffer), "%s/cache/syntax.txt", config->dir);
 	if (stat(buffer, &statbuf) == 0) {
 		if (config->syntax_inode == statbuf.st_ino) return 0;
@@ -326,12 +326,32 @@ int recli_load_syntax(recli_config_t *config)
 		if (syntax_parse_file(buffer, &head) < 0) return -1;
 
 		config->syntax_inode = statbuf.st_ino;
+		config->bin_scanned = 0;
 	} else {
 		snprintf(buffer, sizeof(buffer), "%s/bin/", config->dir);
 
+		/*
+		 *	Scanning runs every plugin.  A server does that
+		 *	again only when one is added, removed or renamed.
+		 *	bin/ may change again in the second it was scanned,
+		 *	so that second doesn't count as unchanged.
+		 */
+		scanned = 0;
+		if (config->scan_changes && (stat(buffer, &statbuf) == 0)) {
+			if (config->syntax && config->bin_scanned &&
+			    (statbuf.st_ino == config->bin_inode) &&
+			    (statbuf.st_mtime < config->bin_scanned)) return 0;
+
+			scanned = time(NULL);
+		}
+
 		if (recli_load_dirs(&head, buffer, strlen(buffer),
 			    config->envp) < 0) return -1;
 
+		config->syntax_inode = 0;
+		config->bin_scanned = scanned;
+		config->bin_inode = statbuf.st_ino;
+
 		/*
 		 *	FIXME: dump syntax to cache/syntax.txt file, and
 		 *	update cached inode, rather than needing external
@@ -339,6 +359,23 @@ int recli_load_syntax(recli_config_t *config)
 		 */
 	}
 
+	syntax_freeze(head);
+	syntax_pack(head);
+
+	/*
+	 *	Once sessions are using the syntax, publish a new
+	 *	snapshot.  The old one is freed when the last session
+	 *	moves off of it.
+	 */
+	if (config->snapshot) {
+		recli_snapshot_t *snap;
+
+		snap = recli_snapshot_alloc(head, config->long_help, config->short_help);
+		if (!snap) return -1;
+
+		recli_snapshot_publish(&config->snapshot, snap);
+	}
+
 	if (config->syntax) syntax_free(config->syntax);
 	config->syntax = head;
 
@@ -351,20 +388,29 @@ int recli_bootstrap(recli_config_t *config)
 	int rcode;
 	struct stat statbuf;
 	char buffer[8192];
+	recli_clock_t when;
 
 	if (!config || !config->dir) {
 		recli_fprintf(recli_stderr, "No configuration directory\n");
 		return -1;
 	}
 
+	/*
+	 *	Each phase starts when the previous one finishes.
+	 */
+	recli_clock_start(&when);
+
 	config->envp[0] = NULL;
 	if (load_envp(config->dir, config) < 0) {
 		return -1;
 	}
+	recli_startup_done("load_envp", &when);
 
 	recli_datatypes_init();
+	recli_startup_done("recli_datatypes_init", &when);
 
 	if (recli_load_syntax(config) < 0) return -1;
+	recli_startup_done("recli_load_syntax", &when);
 
 	if (!config->long_help && !config->short_help) {
 		snprintf(buffer, sizeof(buffer), "%s/help.md", config->dir);
@@ -374,6 +420,7 @@ int recli_bootstrap(recli_config_t *config)
 			}
 		}
 	}
+	recli_startup_done("syntax_parse_help", &when);
 
 	snprintf(buffer, sizeof(buffer), "%s/banner.txt", config->dir);
 	if (stat(buffer, &statbuf) >= 0) {
@@ -390,6 +437,7 @@ int recli_bootstrap(recli_config_t *config)
 
 		fclose(fp);
 	}
+	recli_startup_done("banner", &when);
 
 	if (!config->permissions) {
 		char *name = NULL;
@@ -412,10 +460,33 @@ int recli_bootstrap(recli_config_t *config)
 			if (rcode == 0) exit(0);
 		}
 	}
+	recli_startup_done("permission_parse_file", &when);
+
+	snprintf(buffer, sizeof(buffer), "%s/rest.txt", config->dir);
+	if (!config->rest && (stat(buffer, &statbuf) >= 0)) {
+		if (recli_rest_parse_file(buffer, &config->rest) < 0) return -1;
+	}
+	recli_startup_done("recli_rest_parse_file", &when);
 
 	return 0;
 }
 
+static void cloexec(int fd)
+{
+#ifdef FD_CLOEXEC
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFD, NULL)) < 0)  {
+		return;
+	}
+
+	flags |= FD_CLOEXEC;
+	if (fcntl(fd, F_SETFD, flags) < 0) {
+		return;
+	}
+#endif
+}
+
 static void nonblock(int fd)
 {
 #ifdef O_NONBLOCK
@@ -435,19 +506,34 @@ static void nonblock(int fd)
 #endif
 }
 
-int recli_exec(const char *rundir, int interactive, int argc, char *argv[], char *const envp[])
+/*
+ *	Time from "*when" to now, and move "*when" to now.
+ */
+static void phase_done(recli_times_t *times, recli_phase_t phase, uint64_t *when)
+{
+	uint64_t now;
+
+	if (!times) return;
+
+	now = recli_now();
+	times->ns[phase] = now - *when;
+	*when = now;
+}
+
+/*
+ *	Find the program for a command in the "bin" directory.  Each
+ *	word is a subdirectory, until we reach a file, or a DEFAULT
+ *	program.  The rest of the words are its arguments.
+ */
+static int exec_resolve(const char *rundir, int argc, char *argv[],
+			char *buffer, size_t bufsize, char *my_argv[])
 {
 	int index = 0;
-	int status;
 	size_t out;
-	int pd[2], epd[2];
-	char *p, *q, buffer[1024];	
+	char *p, *q;
 	struct stat sbuf;
-	char *my_argv[256];
 
-	if (!rundir || (argc == 0)) return 0;
-
-	out = snprintf(buffer, sizeof(buffer), "%s", rundir);
+	out = snprintf(buffer, bufsize, "%s", rundir);
 
 	if (stat(buffer, &sbuf) < 0) {
 		recli_fprintf(recli_stderr, "Error reading '%s': %s\n",
@@ -457,13 +543,13 @@ int recli_exec(const char *rundir, int interactive, int argc, char *argv[], char
 
 	p = q =  buffer + out;
 	while (argc && ((sbuf.st_mode & S_IFDIR) != 0)) {
-		out = snprintf(p, buffer + sizeof(buffer) - p, "/%s",
+		out = snprintf(p, buffer + bufsize - p, "/%s",
 			       argv[index]);
 		p += out;
 		index++;
 
 		if (stat(buffer, &sbuf) < 0) {
-			snprintf(q, sizeof(buffer) - (q - buffer), "/DEFAULT");
+			snprintf(q, bufsize - (q - buffer), "/DEFAULT");
 			if (stat(buffer, &sbuf) < 0) {
 				for (index = 0; index < argc; index++) {
 					recli_fprintf(recli_stdout, "%s ",
@@ -487,6 +573,109 @@ run:
 	memcpy(&my_argv[1], &argv[index], sizeof(argv[0]) * (argc - index));
 	my_argv[argc - index + 1] = NULL;
 
+	return 0;
+}
+
+/*
+ *	In the child: point stdin at /dev/null, and stdout and stderr
+ *	at the pipes, unless the command is interactive.  Then run it.
+ */
+static void NEVER_RETURNS exec_child(int interactive, int pd[2], int epd[2],
+				     char *buffer, char *my_argv[], char *const envp[])
+{
+	sigset_t mask;
+
+	/*
+	 *	The server blocks signals which it reads from a signalfd.
+	 */
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	if (!interactive) {
+		int devnull;
+
+		devnull = open("/dev/null", O_RDWR);
+		if (devnull < 0) {
+			recli_fprintf(recli_stderr, "Failed opening /dev/null: %s\n",
+				      strerror(errno));
+			exit(1);
+		}
+		dup2(devnull, STDIN_FILENO);
+
+		close(epd[0]);	/* reading FD */
+		if (dup2(epd[1], STDERR_FILENO) != STDERR_FILENO) {
+			recli_fprintf(recli_stderr, "Failed duping stderr: %s\n",
+				      strerror(errno));
+			exit(1);
+		}
+
+		close(pd[0]);	/* reading FD */
+		if (dup2(pd[1], STDOUT_FILENO) != STDOUT_FILENO) {
+			recli_fprintf(recli_stderr, "Failed duping stdout: %s\n",
+				      strerror(errno));
+			exit(1);
+		}
+
+		close(devnull);
+	}
+
+	/*
+	 *	FIXME: closefrom(3)
+	 */
+
+	if (!envp || !envp[0]) {
+		execvp(buffer, my_argv);
+	} else {
+		execve(buffer, my_argv, envp);
+	}
+	fprintf(stderr, "Failed running %s: %s\n",
+		buffer, strerror(errno));
+	exit(1);	/* if exec faild, exit. */
+}
+
+/*
+ *	Run a command from the "bin" directory.  If "filter" is given,
+ *	its stdout goes through the filter.  If "child" is given, it
+ *	holds the PID of the command while it runs, so that signals
+ *	can be passed on.  If "times" is given, it's filled in with how
+ *	long each part took.
+ */
+int recli_exec(const char *rundir, int interactive, int argc, char *argv[], char *const envp[],
+	       recli_filter_t *filter, pid_t *child, recli_times_t *times)
+{
+	int index = 0;
+	int status;
+	pid_t child_pid;
+	int pd[2], epd[2], xpd[2];
+	char *p, buffer[1024];	
+	char data[65536];	/* a pipe's worth of output */
+	char *my_argv[256];
+	uint64_t when = 0;
+	uint64_t forked, relayed = 0;
+	size_t bytes = 0;
+	char program[32];
+
+	if (!rundir || (argc == 0)) return 0;
+
+	if (times) {
+		memset(times, 0, sizeof(*times));
+		when = recli_now();
+	}
+
+	if (exec_resolve(rundir, argc, argv, buffer, sizeof(buffer), my_argv) < 0) return -1;
+
+	phase_done(times, RECLI_PHASE_RESOLVE, &when);
+
+	/*
+	 *	When timing, the child holds a close-on-exec pipe.  We
+	 *	see EOF on it as soon as exec() succeeds (or the child
+	 *	exits).
+	 */
+	xpd[0] = xpd[1] = -1;
+	if (times && (pipe(xpd) == 0)) {
+		cloexec(xpd[1]);
+	}
+
 	if (!interactive) {
 		if (pipe(pd) != 0) {
 			recli_fprintf(recli_stderr, "Failed opening stdout pipe: %s\n",
@@ -503,48 +692,22 @@ run:
 		}
 	}
 
+	/*
+	 *	"buffer" is re-used below, so save the program name for
+	 *	the trace.
+	 */
+	forked = recli_trace_now();
+	if (forked) {
+		p = strrchr(buffer, '/');
+		strlcpy(program, p ? p + 1 : buffer, sizeof(program));
+	}
+
 	child_pid = fork();
+	if (child && (child_pid > 0)) *child = child_pid;
 	if (child_pid == 0) {		/* child */
-		if (!interactive) {
-			int devnull;
-
-			devnull = open("/dev/null", O_RDWR);
-			if (devnull < 0) {
-				recli_fprintf(recli_stderr, "Failed opening /dev/null: %s\n",
-					      strerror(errno));
-				exit(1);
-			}
-			dup2(devnull, STDIN_FILENO);
-
-			close(epd[0]);	/* reading FD */
-			if (dup2(epd[1], STDERR_FILENO) != STDERR_FILENO) {
-				recli_fprintf(recli_stderr, "Failed duping stderr: %s\n",
-					      strerror(errno));
-				exit(1);
-			}
-
-			close(pd[0]);	/* reading FD */
-			if (dup2(pd[1], STDOUT_FILENO) != STDOUT_FILENO) {
-				recli_fprintf(recli_stderr, "Failed duping stdout: %s\n",
-					      strerror(errno));
-				exit(1);
-			}
-
-			close(devnull);
-		}
-
-		/*
-		 *	FIXME: closefrom(3)
-		 */
+		if (xpd[0] >= 0) close(xpd[0]);
 
-		if (!envp || !envp[0]) {
-			execvp(buffer, my_argv);
-		} else {
-			execve(buffer, my_argv, envp);
-		}
-		fprintf(stderr, "Failed running %s: %s\n",
-			buffer, strerror(errno));
-		exit(1);	/* if exec faild, exit. */
+		exec_child(interactive, pd, epd, buffer, my_argv, envp);
 	}
 
 	if (!interactive) {
@@ -554,6 +717,21 @@ run:
 		close(epd[1]);
 	}
 
+	if (xpd[1] >= 0) close(xpd[1]);
+
+	phase_done(times, RECLI_PHASE_FORK, &when);
+
+	if (xpd[0] >= 0) {
+		if (child_pid > 0) {
+			while ((read(xpd[0], buffer, 1) < 0) && (errno == EINTR)) {
+				/* nothing */
+			}
+		}
+		close(xpd[0]);
+
+		phase_done(times, RECLI_PHASE_EXEC, &when);
+	}
+
 	if (child_pid < 0) {
 		if (!interactive) {
 			assert(pd[0] >= 0);
@@ -568,6 +746,8 @@ run:
 	}
 
 	if (!interactive) {
+		relayed = recli_trace_now();
+
 		nonblock(pd[0]);
 		nonblock(epd[0]);
 
@@ -596,7 +776,7 @@ run:
 			}
 
 			if ((pd[0] >= 0) && FD_ISSET(pd[0], &fds)) {
-				num = read(pd[0], buffer, sizeof(buffer) - 1);
+				num = read(pd[0], data, sizeof(data) - 1);
 				if (num == 0) {
 				close_stdout:
 					assert(pd[0] >= 0);
@@ -607,14 +787,20 @@ run:
 					if (errno != EINTR) goto close_stdout;
 					/* else ignore it */
 
+				} else if (filter) {
+					data[num] = '\0';
+					recli_filter_write(filter, data, num);
+					bytes += num;
+
 				} else {
-					buffer[num] = '\0';
-					recli_fprintf(recli_stdout, "%s", buffer);
+					data[num] = '\0';
+					recli_fprintf(recli_stdout, "%s", data);
+					bytes += num;
 				}
 			}
 
 			if ((epd[0] >= 0) && FD_ISSET(epd[0], &fds)) {
-				num = read(epd[0], buffer, sizeof(buffer) - 1);
+				num = read(epd[0], data, sizeof(data) - 1);
 				if (num == 0) {
 				close_stderr:
 					assert(epd[0] >= 0);
@@ -626,15 +812,27 @@ run:
 					/* else ignore it */
 
 				} else {
-					buffer[num] = '\0';
-					recli_fprintf(recli_stderr, "%s", buffer);
+					data[num] = '\0';
+					recli_fprintf(recli_stderr, "%s", data);
+					bytes += num;
 				}
 			}
 		}
+
+		phase_done(times, RECLI_PHASE_RELAY, &when);
+		recli_trace_span("exec", "relay", 0, relayed, "bytes", bytes, NULL, 0);
 	}
 
 	waitpid(child_pid, &status, 0);
-	child_pid = -1;
+
+	/*
+	 *	The child gets its own track, named after the program.
+	 */
+	recli_trace_span("exec", program, child_pid, forked,
+			 "pid", child_pid, "status", WEXITSTATUS(status));
+	if (child) *child = -1;
+
+	phase_done(times, RECLI_PHASE_WAIT, &when);
 
 	index = -1;
 	if (WEXITSTATUS(status) == 0) {
@@ -649,3 +847,68 @@ run:
 	return index;
 }
 
+/*
+ *	Start a command from the "bin" directory, without waiting for
+ *	it.  Its stdout and stderr are non-blocking pipes, which the
+ *	caller reads until EOF, before reaping the child.  Returns the
+ *	PID of the child, or -1 on error.
+ */
+pid_t recli_spawn(const char *rundir, int argc, char *argv[], char *const envp[],
+		  int *out_fd, int *err_fd)
+{
+	pid_t child_pid;
+	int pd[2], epd[2];
+	char buffer[1024];
+	char *my_argv[256];
+
+	if (!rundir || (argc == 0)) return -1;
+
+	if (exec_resolve(rundir, argc, argv, buffer, sizeof(buffer), my_argv) < 0) return -1;
+
+	if (pipe(pd) != 0) {
+		recli_fprintf(recli_stderr, "Failed opening stdout pipe: %s\n",
+			      strerror(errno));
+		return -1;
+	}
+
+	if (pipe(epd) != 0) {
+		close(pd[0]);
+		close(pd[1]);
+		recli_fprintf(recli_stderr, "Failed opening stderr pipe: %s\n",
+			      strerror(errno));
+		return -1;
+	}
+
+	/*
+	 *	The child gets its own process group, so that a ^C at
+	 *	the terminal doesn't reach it, and so that it can be
+	 *	killed along with anything it starts.
+	 */
+	child_pid = fork();
+	if (child_pid == 0) {
+		setpgid(0, 0);
+		exec_child(0, pd, epd, buffer, my_argv, envp);
+	}
+	if (child_pid > 0) setpgid(child_pid, child_pid);
+
+	close(pd[1]);
+	close(epd[1]);
+
+	if (child_pid < 0) {
+		close(pd[0]);
+		close(epd[0]);
+		recli_fprintf(recli_stderr, "Failed forking program: %s\n",
+			      strerror(errno));
+		return -1;
+	}
+
+	cloexec(pd[0]);
+	cloexec(epd[0]);
+	nonblock(pd[0]);
+	nonblock(epd[0]);
+
+	*out_fd = pd[0];
+	*err_fd = epd[0];
+
+	return child_pid;
+}
@@ -0,0 +1,507 @@
+/*
+ * Filters on the output of a command, after a '|'.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <regex.h>
+#include "recli.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ *	Output filters, after a '|' at the end of a command:
+ *
+ *		include PATTERN		lines which match
+ *		exclude PATTERN		lines which don't match
+ *		begin PATTERN		everything from the first match
+ *		section PATTERN		matching lines, and the indented
+ *					lines under them
+ *		count			the number of lines
+ *
+ *	A pattern with any of ".[]()*+?^$\{}|" in it is an extended
+ *	regular expression.  Anything else is a plain string, which is
+ *	searched for in whole blocks of output, and not line by line.
+ *
+ *	The output is filtered as it arrives.  Only the start of a line
+ *	which hasn't ended yet is kept.
+ */
+typedef enum filter_type_t {
+	FILTER_INCLUDE = 0,
+	FILTER_EXCLUDE,
+	FILTER_BEGIN,
+	FILTER_SECTION,
+	FILTER_COUNT
+} filter_type_t;
+
+static const struct {
+	const char	*name;
+	filter_type_t	type;
+} filter_names[] = {
+	{ "include",	FILTER_INCLUDE },
+	{ "exclude",	FILTER_EXCLUDE },
+	{ "begin",	FILTER_BEGIN },
+	{ "section",	FILTER_SECTION },
+	{ "count",	FILTER_COUNT },
+	{ NULL, 0 }
+};
+
+#define FILTER_STAGES_MAX	(8)
+#define FILTER_LINE_MAX		(1024 * 1024)	/* longer lines are split */
+
+typedef struct filter_stage_t {
+	filter_type_t	type;
+	char		*pattern;
+	size_t		len;
+	int		is_regex;
+	regex_t		regex;
+	int		active;		/* "begin" has matched, or in a "section" */
+	uint64_t	count;
+} filter_stage_t;
+
+struct recli_filter_t {
+	recli_fprintf_t	fprintf;	/* where the output goes */
+	void		*out;
+
+	int		num_stages;
+	filter_stage_t	stage[FILTER_STAGES_MAX];
+
+	char		*partial;	/* a line which hasn't ended yet */
+	size_t		partial_len;
+	size_t		partial_size;
+};
+
+/*
+ *	Find "needle" in [p, end).  For each 16 possible starts, the
+ *	first and last bytes of the needle are compared at once, and
+ *	only the starts where both match are checked in full.
+ */
+static const char *filter_search(const char *p, const char *end,
+				 const char *needle, size_t len)
+{
+	const char *last;
+
+	if ((size_t) (end - p) < len) return NULL;
+	if (len == 1) return memchr(p, needle[0], end - p);
+
+	last = end - len;	/* the last possible start */
+
+#ifdef __SSE2__
+	{
+		const __m128i first = _mm_set1_epi8(needle[0]);
+		const __m128i final = _mm_set1_epi8(needle[len - 1]);
+
+		while ((last - p) >= 15) {
+			__m128i a, b;
+			int mask;
+
+			a = _mm_loadu_si128((const __m128i *) p);
+			b = _mm_loadu_si128((const __m128i *) (p + len - 1));
+
+			mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+							       _mm_cmpeq_epi8(b, final)));
+			while (mask) {
+				int bit = __builtin_ctz(mask);
+
+				if (memcmp(p + bit + 1, needle + 1, len - 2) == 0) return p + bit;
+				mask &= mask - 1;
+			}
+
+			p += 16;
+		}
+	}
+#endif
+
+	while (p <= last) {
+		p = memchr(p, needle[0], (last - p) + 1);
+		if (!p) return NULL;
+
+		if (memcmp(p + 1, needle + 1, len - 1) == 0) return p;
+		p++;
+	}
+
+	return NULL;
+}
+
+/*
+ *	Find a match in [p, end).  Regular expressions are compiled with
+ *	REG_NEWLINE, so they can be run over many lines at once, and
+ *	still only match within one.
+ */
+static const char *filter_find(filter_stage_t *st, const char *p, const char *end)
+{
+	regmatch_t m;
+
+	if (!st->is_regex) return filter_search(p, end, st->pattern, st->len);
+
+#ifdef REG_STARTEND
+	m.rm_so = 0;
+	m.rm_eo = end - p;
+	if (regexec(&st->regex, p, 1, &m, REG_STARTEND) != 0) return NULL;
+
+	return p + m.rm_so;
+#else
+	{
+		int rcode;
+		char *copy;
+
+		copy = strndup(p, end - p);
+		if (!copy) return NULL;
+
+		rcode = regexec(&st->regex, copy, 1, &m, 0);
+		free(copy);
+		if (rcode != 0) return NULL;
+
+		return p + m.rm_so;
+	}
+#endif
+}
+
+/*
+ *	Find the first line in [p, end) which matches.  Returns its
+ *	start, and sets "next" to the line after it.
+ */
+static const char *filter_next(filter_stage_t *st, const char *p, const char *end,
+			       const char **next)
+{
+	const char *m, *lf;
+
+	/*
+	 *	A regex such as "^" or "x*" matches the empty string
+	 *	after the last line, too.
+	 */
+	if (p >= end) return NULL;
+
+	m = filter_find(st, p, end);
+	if (!m || (m >= end)) return NULL;
+
+	lf = memchr(m, '\n', end - m);
+	*next = lf ? lf + 1 : end;
+
+	while ((m > p) && (m[-1] != '\n')) m--;
+	return m;
+}
+
+/*
+ *	Give some complete lines to filter "i", or print them if
+ *	they've been through all of the filters.
+ */
+static void filter_lines(recli_filter_t *f, int i, const char *p, const char *end)
+{
+	const char *m, *next, *run, *lf;
+	filter_stage_t *st;
+
+	if (p == end) return;
+
+	if (i == f->num_stages) {
+		f->fprintf(f->out, "%.*s", (int) (end - p), p);
+		return;
+	}
+
+	st = &f->stage[i];
+
+	switch (st->type) {
+	case FILTER_INCLUDE:
+		/*
+		 *	Adjacent matching lines are passed on together.
+		 */
+		run = next = p;
+		while ((m = filter_next(st, p, end, &next)) != NULL) {
+			if (m != p) {
+				filter_lines(f, i + 1, run, p);
+				run = m;
+			}
+			p = next;
+		}
+		filter_lines(f, i + 1, run, p);
+		break;
+
+	case FILTER_EXCLUDE:
+		while ((m = filter_next(st, p, end, &next)) != NULL) {
+			filter_lines(f, i + 1, p, m);
+			p = next;
+		}
+		filter_lines(f, i + 1, p, end);
+		break;
+
+	case FILTER_BEGIN:
+		if (!st->active) {
+			p = filter_next(st, p, end, &next);
+			if (!p) return;
+
+			st->active = 1;
+		}
+		filter_lines(f, i + 1, p, end);
+		break;
+
+	case FILTER_SECTION:
+		run = p;
+		while (p < end) {
+			lf = memchr(p, '\n', end - p);
+
+			if ((*p != ' ') && (*p != '\t')) {
+				int match = (filter_find(st, p, lf) != NULL);
+
+				if (match != st->active) {
+					if (st->active) filter_lines(f, i + 1, run, p);
+					st->active = match;
+					run = p;
+				}
+			}
+
+			p = lf + 1;
+		}
+		if (st->active) filter_lines(f, i + 1, run, end);
+		break;
+
+	case FILTER_COUNT:
+		while ((p = memchr(p, '\n', end - p)) != NULL) {
+			st->count++;
+			p++;
+		}
+		break;
+	}
+}
+
+/*
+ *	Copy a pattern, without its quotes.  In a quoted pattern, only
+ *	the quote and backslash are escaped, so that regular
+ *	expressions keep their backslashes.
+ */
+static char *filter_unquote(const char *word)
+{
+	char *out, *q;
+	const char *p, *end;
+	size_t len = strlen(word);
+
+	out = q = malloc(len + 1);
+	if (!out) return NULL;
+
+	p = word;
+	end = word + len;
+	if ((len >= 2) && ((*p == '"') || (*p == '\'') || (*p == '`')) && (end[-1] == *p)) {
+		p++;
+		end--;
+
+		while (p < end) {
+			if ((*p == '\\') && ((p + 1) < end) &&
+			    ((p[1] == '\\') || (p[1] == *word))) p++;
+			*q++ = *p++;
+		}
+		*q = '\0';
+		return out;
+	}
+
+	memcpy(out, word, len + 1);
+	return out;
+}
+
+/*
+ *	Parse the filters in "| name [pattern] | ...".  Returns 0 on
+ *	success.  On error, returns minus the number of the word which
+ *	is wrong, counting from 1, and sets "error".  The output of the
+ *	filters goes to where recli_fprintf() goes now.
+ */
+int recli_filter_parse(int argc, char *argv[], recli_filter_t **pfilter,
+		       const char **error)
+{
+	int i, n, rcode;
+	recli_filter_t *f;
+	filter_stage_t *st;
+	static char regex_error[256];
+
+	f = calloc(1, sizeof(*f));
+	if (!f) {
+		*error = "Out of memory";
+		return -1;
+	}
+
+	f->fprintf = recli_fprintf;
+	f->out = recli_stdout;
+
+	i = 0;
+	while (i < argc) {
+		if (strcmp(argv[i], "|") != 0) {
+			*error = "Expected '|'";
+			goto fail;
+		}
+		i++;
+
+		if ((f->num_stages > 0) &&
+		    (f->stage[f->num_stages - 1].type == FILTER_COUNT)) {
+			*error = "Nothing can follow 'count'";
+			goto fail;
+		}
+
+		if (f->num_stages == FILTER_STAGES_MAX) {
+			*error = "Too many filters";
+			goto fail;
+		}
+
+		if (i == argc) {
+			*error = "Expected a filter";
+			goto fail;
+		}
+
+		for (n = 0; filter_names[n].name != NULL; n++) {
+			if (strcmp(argv[i], filter_names[n].name) == 0) break;
+		}
+		if (!filter_names[n].name) {
+			*error = "Unknown filter";
+			goto fail;
+		}
+		i++;
+
+		st = &f->stage[f->num_stages++];
+		st->type = filter_names[n].type;
+		if (st->type == FILTER_COUNT) continue;
+
+		if ((i == argc) || (strcmp(argv[i], "|") == 0)) {
+			*error = "Expected a pattern";
+			goto fail;
+		}
+
+		st->pattern = filter_unquote(argv[i]);
+		if (!st->pattern) {
+			*error = "Out of memory";
+			goto fail;
+		}
+		st->len = strlen(st->pattern);
+
+		if (!st->len) {
+			*error = "Empty pattern";
+			goto fail;
+		}
+
+		if (strpbrk(st->pattern, ".[]()*+?^$\\{}|") != NULL) {
+			rcode = regcomp(&st->regex, st->pattern, REG_EXTENDED | REG_NEWLINE);
+			if (rcode != 0) {
+				regerror(rcode, &st->regex, regex_error, sizeof(regex_error));
+				*error = regex_error;
+				goto fail;
+			}
+			st->is_regex = 1;
+		}
+		i++;
+	}
+
+	*pfilter = f;
+	return 0;
+
+fail:
+	recli_filter_free(f);
+	return -(i + 1);
+}
+
+/*
+ *	Add to the line which hasn't ended yet.  It's kept NUL
+ *	terminated, for regexec().
+ */
+static int filter_save(recli_filter_t *f, const char *p, size_t len)
+{
+	if ((f->partial_size - f->partial_len) <= len) {
+		char *q;
+		size_t size = f->partial_size ? f->partial_size : 1024;
+
+		while ((size - f->partial_len) <= len) size *= 2;
+
+		q = realloc(f->partial, size);
+		if (!q) return -1;
+
+		f->partial = q;
+		f->partial_size = size;
+	}
+
+	memcpy(f->partial + f->partial_len, p, len);
+	f->partial_len += len;
+	f->partial[f->partial_len] = '\0';
+	return 0;
+}
+
+/*
+ *	Filter some output.  It doesn't have to be whole lines.
+ */
+void recli_filter_write(recli_filter_t *f, const char *data, size_t len)
+{
+	const char *p, *end, *lf;
+
+	p = data;
+	end = data + len;
+
+	/*
+	 *	Finish the line from last time.
+	 */
+	if (f->partial_len) {
+		lf = memchr(p, '\n', len);
+		if (lf) lf++;
+
+		if (filter_save(f, p, (lf ? lf : end) - p) < 0) return;
+		p = lf ? lf : end;
+
+		if (!lf) {
+			if (f->partial_len < FILTER_LINE_MAX) return;
+			if (filter_save(f, "\n", 1) < 0) return;
+		}
+
+		filter_lines(f, 0, f->partial, f->partial + f->partial_len);
+		f->partial_len = 0;
+	}
+
+	/*
+	 *	The whole lines are filtered where they are, and the
+	 *	start of the last one is saved.
+	 */
+	lf = end;
+	while ((lf > p) && (lf[-1] != '\n')) lf--;
+
+	filter_lines(f, 0, p, lf);
+
+	if (lf < end) (void) filter_save(f, lf, end - lf);
+}
+
+/*
+ *	The output has ended.  Filter the last line, and print the
+ *	counts.
+ */
+void recli_filter_done(recli_filter_t *f)
+{
+	int i;
+
+	if (f->partial_len) recli_filter_write(f, "\n", 1);
+
+	for (i = 0; i < f->num_stages; i++) {
+		if (f->stage[i].type != FILTER_COUNT) continue;
+
+		f->fprintf(f->out, "%" PRIu64 "\n", f->stage[i].count);
+	}
+}
+
+/*
+ *	Send the output somewhere else.
+ */
+void recli_filter_output(recli_filter_t *f, recli_fprintf_t func, void *out)
+{
+	f->fprintf = func;
+	f->out = out;
+}
+
+void recli_filter_free(recli_filter_t *f)
+{
+	int i;
+
+	if (!f) return;
+
+	for (i = 0; i < f->num_stages; i++) {
+		if (f->stage[i].is_regex) regfree(&f->stage[i].regex);
+		free(f->stage[i].pattern);
+	}
+
+	free(f->partial);
+	free(f);
+}
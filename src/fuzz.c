@@ -0,0 +1,668 @@
+/*
+ * Differential fuzzing of the syntax engine.
+ *
+ * See LICENSE for licence details.
+ *
+ * Each input is turned into a small random grammar, and a few
+ * commands to check against it.  Now and then a line is broken, so
+ * that the parser sees syntax errors.  The grammar is then loaded
+ * in several ways, and the results are compared:
+ *
+ *	- merging the lines in order, and in reverse order, gives a
+ *	  syntax which accepts the same commands
+ *	- so does parsing the output of syntax_printf()
+ *	- the words which syntax_tab_complete() offers are the words
+ *	  which syntax_check() accepts
+ *	- syntax_check() gives the same answer before and after the
+ *	  syntax is frozen and packed
+ *	- no nodes are left after syntax_free(NULL)
+ *
+ * The first three only hold when syntax_lint() has no warnings.
+ * Any difference prints the grammar and the command, and aborts.
+ *
+ * With -DRECLI_LIBFUZZER, this is a libFuzzer target:
+ *
+ *	clang -g -fsanitize=fuzzer,address -DRECLI_LIBFUZZER -o recli-libfuzzer \
+ *		fuzz.c syntax.c permission.c datatypes.c util.c input.c strlcpy.c linenoise.c
+ *
+ * Otherwise, "recli-fuzz file ..." runs each file once, which is
+ * what AFL wants, and "recli-fuzz" with no files runs random inputs
+ * until it's stopped, printing the executions per second.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "recli.h"
+
+#define FUZZ_LINES	(6)
+#define FUZZ_INPUTS	(8)
+#define FUZZ_WORDS	(6)
+
+/*
+ *	Few words, so that the lines have prefixes in common, and
+ *	merging them has something to do.
+ */
+static const char *grammar_words[] = {
+	"a", "b", "c", "d", "e", "INTEGER"
+};
+
+static const char *input_words[] = {
+	"a", "b", "c", "d", "e", "1"
+};
+
+#define NUM_GRAMMAR_WORDS (sizeof(grammar_words) / sizeof(grammar_words[0]))
+#define NUM_INPUT_WORDS (sizeof(input_words) / sizeof(input_words[0]))
+
+typedef struct fuzz_input_t {
+	int		argc;
+	char		*argv[FUZZ_WORDS];
+} fuzz_input_t;
+
+typedef struct fuzz_t {
+	const uint8_t	*data;
+	size_t		size;
+	size_t		used;
+
+	int		num_lines;
+	char		lines[FUZZ_LINES][256];
+	char		*p;		/* where the current line is written */
+	char		*end;
+
+	int		num_inputs;
+	fuzz_input_t	inputs[FUZZ_INPUTS];
+} fuzz_t;
+
+/*
+ *	Take the next choice from the input.  Past the end of it,
+ *	every choice is 0, which always picks something simple.
+ */
+static int fuzz_pick(fuzz_t *f, int num)
+{
+	if (f->used >= f->size) return 0;
+
+	return f->data[f->used++] % num;
+}
+
+static void fuzz_add(fuzz_t *f, const char *fmt, ...)
+{
+	int len;
+	va_list args;
+
+	va_start(args, fmt);
+	len = vsnprintf(f->p, f->end - f->p, fmt, args);
+	va_end(args);
+
+	if (len < 0) return;
+	if (len >= (f->end - f->p)) len = (f->end - f->p) - 1;
+
+	f->p += len;
+}
+
+static void fuzz_sequence(fuzz_t *f, int depth);
+
+/*
+ *	One word, optional part, alternation or repetition.  Deeper
+ *	down, words are more likely.
+ */
+static void fuzz_element(fuzz_t *f, int depth)
+{
+	int i, num;
+	const char *word;
+
+	switch ((depth > 2) ? 0 : fuzz_pick(f, 10)) {
+	default:
+		fuzz_add(f, "%s", grammar_words[fuzz_pick(f, NUM_GRAMMAR_WORDS)]);
+		break;
+
+	case 6:
+		fuzz_add(f, "[");
+		fuzz_sequence(f, depth + 1);
+		fuzz_add(f, "]");
+		break;
+
+	case 7:
+		num = 2 + fuzz_pick(f, 2);
+
+		fuzz_add(f, "(");
+		for (i = 0; i < num; i++) {
+			if (i) fuzz_add(f, "|");
+			fuzz_sequence(f, depth + 1);
+		}
+		fuzz_add(f, ")");
+		break;
+
+	case 8:
+		/*
+		 *	Not both picks in the arguments: they'd be taken
+		 *	in whatever order the compiler likes, and the same
+		 *	input would give different grammars.
+		 */
+		word = grammar_words[fuzz_pick(f, NUM_GRAMMAR_WORDS - 1)];
+		fuzz_add(f, "%s%c", word, fuzz_pick(f, 2) ? '+' : '*');
+		break;
+	}
+}
+
+static void fuzz_sequence(fuzz_t *f, int depth)
+{
+	int i, num;
+
+	num = 1 + fuzz_pick(f, 3);
+
+	for (i = 0; i < num; i++) {
+		if (i) fuzz_add(f, " ");
+		fuzz_element(f, depth);
+	}
+}
+
+/*
+ *	Break a line now and then, so that the parser sees syntax
+ *	errors, too.
+ */
+static void fuzz_mutate(fuzz_t *f, char *line)
+{
+	size_t len, where;
+	static const char special[] = "()[]|+* ";
+
+	len = strlen(line);
+	where = fuzz_pick(f, len + 1);
+
+	if (fuzz_pick(f, 2) && (where < len)) {
+		memmove(line + where, line + where + 1, len - where);
+		return;
+	}
+
+	if ((len + 1) >= sizeof(f->lines[0])) return;
+
+	memmove(line + where + 1, line + where, len - where + 1);
+	line[where] = special[fuzz_pick(f, sizeof(special) - 1)];
+}
+
+/*
+ *	Every line starts with a word, as real commands do.
+ */
+static void fuzz_generate(fuzz_t *f)
+{
+	int i, j;
+
+	f->num_lines = 1 + fuzz_pick(f, FUZZ_LINES);
+
+	for (i = 0; i < f->num_lines; i++) {
+		f->p = f->lines[i];
+		f->end = f->lines[i] + sizeof(f->lines[i]);
+
+		fuzz_add(f, "%s ", grammar_words[fuzz_pick(f, NUM_GRAMMAR_WORDS - 1)]);
+		fuzz_sequence(f, 0);
+
+		if (fuzz_pick(f, 8) == 0) fuzz_mutate(f, f->lines[i]);
+	}
+
+	f->num_inputs = 1 + fuzz_pick(f, FUZZ_INPUTS);
+
+	for (i = 0; i < f->num_inputs; i++) {
+		fuzz_input_t *in = &f->inputs[i];
+
+		in->argc = 1 + fuzz_pick(f, FUZZ_WORDS);
+		for (j = 0; j < in->argc; j++) {
+			in->argv[j] = (char *) input_words[fuzz_pick(f, NUM_INPUT_WORDS)];
+		}
+	}
+}
+
+/*
+ *	syntax_printf() writes through recli_fprintf().  Capture it.
+ */
+static char capture[65536];
+static size_t capture_used;
+
+static int fuzz_fprintf(void *ctx, const char *fmt, ...)
+{
+	int len;
+	va_list args;
+
+	if (ctx != capture) return 0;
+
+	va_start(args, fmt);
+	len = vsnprintf(capture + capture_used, sizeof(capture) - capture_used, fmt, args);
+	va_end(args);
+
+	if (len < 0) return len;
+
+	capture_used += len;
+	if (capture_used >= sizeof(capture)) capture_used = sizeof(capture) - 1;
+
+	return len;
+}
+
+static void fuzz_print_input(const fuzz_input_t *in, int argc)
+{
+	int i;
+
+	fprintf(stderr, "input:");
+	for (i = 0; i < argc; i++) fprintf(stderr, " %s", in->argv[i]);
+	fprintf(stderr, "\n");
+}
+
+static void fuzz_fail(const fuzz_t *f, const char *msg, const fuzz_input_t *in, int argc)
+{
+	int i;
+
+	fprintf(stderr, "FAILED: %s\n", msg);
+	fprintf(stderr, "grammar:\n");
+	for (i = 0; i < f->num_lines; i++) fprintf(stderr, "\t%s\n", f->lines[i]);
+	if (in) fuzz_print_input(in, argc);
+
+	abort();
+}
+
+/*
+ *	Merge the lines, in order or in reverse.  Lines which aren't
+ *	valid, or which conflict with earlier lines, are skipped.
+ *	"used" says which lines were merged.
+ */
+static cli_syntax_t *fuzz_merge(const fuzz_t *f, int reverse, int *used)
+{
+	int i, j;
+	char buffer[256];
+	cli_syntax_t *head = NULL;
+
+	*used = 0;
+	for (i = 0; i < f->num_lines; i++) {
+		j = reverse ? (f->num_lines - 1 - i) : i;
+
+		strlcpy(buffer, f->lines[j], sizeof(buffer));
+		if (syntax_merge(&head, buffer) < 0) continue;
+
+		*used |= (1 << j);
+	}
+
+	return head;
+}
+
+/*
+ *	The completions for the first "argc" words of an input,
+ *	which have to be a valid prefix.  Each completion is the
+ *	whole line, plus the next word (which may be empty), plus a
+ *	space.
+ */
+static int fuzz_complete(cli_syntax_t *head, const fuzz_input_t *in, int argc,
+			 char *next[], int max)
+{
+	int i, num;
+	char *p, *tabs[256];
+	char line[256];
+
+	p = line;
+	*p = '\0';
+	for (i = 0; i < argc; i++) {
+		p += snprintf(p, line + sizeof(line) - p, "%s ", in->argv[i]);
+	}
+
+	num = syntax_tab_complete(head, line, strlen(line), 256, tabs);
+
+	for (i = 0; i < num; i++) {
+		if (i < max) {
+			p = tabs[i] + strlen(tabs[i]);
+			if ((p > tabs[i]) && (p[-1] == ' ')) *--p = '\0';
+			next[i] = strdup(tabs[i] + strlen(line));
+		}
+		free(tabs[i]);
+	}
+
+	return (num < max) ? num : max;
+}
+
+/*
+ *	For each prefix of the input which syntax_check() accepts, the
+ *	words which syntax_tab_complete() offers next are the words
+ *	which syntax_check() accepts.  Data types and "..." are offered
+ *	by name, and accept anything that they match.
+ *
+ *	This only holds when syntax_lint() is happy.  When a word can
+ *	go two ways, syntax_check() and completion may pick different
+ *	ones.
+ */
+static void fuzz_check_complete(const fuzz_t *f, cli_syntax_t *head, const fuzz_input_t *in)
+{
+	int i, j, k, num, rcode, offered, wild;
+	const char *error;
+	char *next[256];
+	fuzz_input_t try;
+
+	try = *in;
+
+	for (k = 0; k < in->argc; k++) {
+		if (k > 0) {
+			rcode = syntax_check(head, k, try.argv, &error, NULL);
+			if (rcode < k) return;
+		}
+
+		num = fuzz_complete(head, in, k, next, 256);
+
+		wild = 0;
+		for (j = 0; j < num; j++) {
+			if ((strcmp(next[j], "...") == 0) || (strcmp(next[j], "INTEGER") == 0)) wild = 1;
+		}
+
+		for (i = 0; i < (int) NUM_INPUT_WORDS; i++) {
+			try.argv[k] = (char *) input_words[i];
+
+			offered = 0;
+			for (j = 0; !offered && (j < num); j++) {
+				if (strcmp(next[j], input_words[i]) == 0) offered = 1;
+			}
+			if (wild && (strcmp(input_words[i], "1") == 0)) offered = 1;
+
+			rcode = syntax_check(head, k + 1, try.argv, &error, NULL);
+			if ((rcode >= (k + 1)) == offered) continue;
+
+			if (!offered && wild) continue;
+
+			for (j = 0; j < num; j++) free(next[j]);
+
+			if (offered) {
+				fuzz_fail(f, "syntax_tab_complete() offers a word which syntax_check() rejects",
+					  &try, k + 1);
+			}
+			fuzz_fail(f, "syntax_check() accepts a word which syntax_tab_complete() doesn't offer",
+				  &try, k + 1);
+		}
+
+		for (j = 0; j < num; j++) free(next[j]);
+
+		try.argv[k] = in->argv[k];
+	}
+}
+
+/*
+ *	Two heads accept the same commands, as far as we can tell from
+ *	every command of up to three words, and the inputs.
+ */
+static int fuzz_same(const fuzz_t *f, cli_syntax_t *a, cli_syntax_t *b,
+		     fuzz_input_t *in)
+{
+	int i, j, k;
+	const char *error;
+
+	if (a == b) return 1;
+	if (!a || !b) return 0;
+
+	for (i = 0; i < f->num_inputs; i++) {
+		*in = f->inputs[i];
+
+		if (syntax_check(a, in->argc, in->argv, &error, NULL) !=
+		    syntax_check(b, in->argc, in->argv, &error, NULL)) return 0;
+	}
+
+	for (i = 0; i < (int) (NUM_INPUT_WORDS * NUM_INPUT_WORDS * NUM_INPUT_WORDS); i++) {
+		for (j = 1; j <= 3; j++) {
+			k = i;
+			for (in->argc = 0; in->argc < j; in->argc++) {
+				in->argv[in->argc] = (char *) input_words[k % NUM_INPUT_WORDS];
+				k /= NUM_INPUT_WORDS;
+			}
+
+			if (syntax_check(a, in->argc, in->argv, &error, NULL) !=
+			    syntax_check(b, in->argc, in->argv, &error, NULL)) return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void fuzz_one(const uint8_t *data, size_t size)
+{
+	int i, used_a, used_b, lint_a, lint_b;
+	int before[FUZZ_INPUTS];
+	const char *error;
+	cli_syntax_t *a, *b, *c;
+	fuzz_input_t in;
+	fuzz_t f;
+
+	memset(&f, 0, sizeof(f));
+	f.data = data;
+	f.size = size;
+
+	fuzz_generate(&f);
+
+	a = fuzz_merge(&f, 0, &used_a);
+	b = fuzz_merge(&f, 1, &used_b);
+
+	/*
+	 *	Lines which conflict depend on what came before them, so
+	 *	the order only has to agree when all of them were used.
+	 *	The merged syntax isn't always the same shape, e.g.
+	 *	"a ([b]|c)" and "a [(b|c)]", but it has to accept the same
+	 *	commands.
+	 *
+	 *	When syntax_lint() complains, syntax_check() takes the
+	 *	first alternative which matches, and that depends on the
+	 *	order, too.
+	 */
+	lint_a = a ? syntax_lint(a) : 0;
+	lint_b = b ? syntax_lint(b) : 0;
+
+	if ((used_a == used_b) && !lint_a && !lint_b && !fuzz_same(&f, a, b, &in)) {
+		fuzz_fail(&f, "syntax_merge() depends on the order of the lines",
+			  &in, in.argc);
+	}
+	if (b) syntax_free(b);
+
+	if (a) {
+		char buffer[sizeof(capture)];
+
+		capture_used = 0;
+		capture[0] = '\0';
+		recli_stdout = capture;
+		syntax_printf(a);
+		recli_stdout = NULL;
+
+		strlcpy(buffer, capture, sizeof(buffer));
+		c = NULL;
+		if (syntax_merge(&c, buffer) < 0) {
+			fprintf(stderr, "printed:\n\t%s\n", capture);
+			fuzz_fail(&f, "the output of syntax_printf() doesn't parse", NULL, 0);
+		}
+		if (!lint_a && !fuzz_same(&f, a, c, &in)) {
+			fprintf(stderr, "printed:\n\t%s\n", capture);
+			fuzz_fail(&f, "the output of syntax_printf() parses to a different syntax",
+				  &in, in.argc);
+		}
+		if (c) syntax_free(c);
+
+		for (i = 0; i < f.num_inputs; i++) {
+			if (!lint_a) fuzz_check_complete(&f, a, &f.inputs[i]);
+
+			before[i] = syntax_check(a, f.inputs[i].argc, f.inputs[i].argv, &error, NULL);
+		}
+
+		/*
+		 *	The packed checker has to give the same answers.
+		 */
+		syntax_freeze(a);
+		syntax_pack(a);
+
+		for (i = 0; i < f.num_inputs; i++) {
+			if (syntax_check(a, f.inputs[i].argc, f.inputs[i].argv, &error, NULL) != before[i]) {
+				fuzz_fail(&f, "syntax_check() changed after syntax_pack()",
+					  &f.inputs[i], f.inputs[i].argc);
+			}
+		}
+
+		syntax_free(a);
+	}
+
+	syntax_free(NULL);
+
+	if (syntax_num_nodes() != 0) {
+		fuzz_fail(&f, "nodes are left after syntax_free(NULL)", NULL, 0);
+	}
+
+	/*
+	 *	syntax_free(NULL) frees the data types, too.
+	 */
+	if (recli_datatypes_init() < 0) abort();
+}
+
+static int fuzz_init(void)
+{
+	recli_fprintf = fuzz_fprintf;
+	recli_stdout = NULL;
+	recli_stderr = NULL;
+
+	return recli_datatypes_init();
+}
+
+#ifdef RECLI_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static int initialized = 0;
+
+	if (!initialized) {
+		if (fuzz_init() < 0) abort();
+		initialized = 1;
+	}
+
+	fuzz_one(data, size);
+	return 0;
+}
+
+#else
+
+static uint64_t fuzz_seed;
+
+static uint64_t fuzz_random(void)
+{
+	fuzz_seed ^= fuzz_seed << 13;
+	fuzz_seed ^= fuzz_seed >> 7;
+	fuzz_seed ^= fuzz_seed << 17;
+
+	return fuzz_seed;
+}
+
+static double fuzz_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static int fuzz_file(const char *filename)
+{
+	FILE *fp;
+	size_t size;
+	uint8_t data[4096];
+
+	if (strcmp(filename, "-") == 0) {
+		fp = stdin;
+	} else {
+		fp = fopen(filename, "r");
+		if (!fp) {
+			fprintf(stderr, "Failed opening %s: %s\n", filename, strerror(errno));
+			return -1;
+		}
+	}
+
+	size = fread(data, 1, sizeof(data), fp);
+	if (fp != stdin) fclose(fp);
+
+	fuzz_one(data, size);
+	return 0;
+}
+
+static void usage(const char *name, int rcode)
+{
+	FILE *out = rcode ? stderr : stdout;
+
+	fprintf(out, "Usage: %s [-n execs] [-t seconds] [-s seed] [file ...]\n", name);
+	fprintf(out, "  -n <execs>      Stop after this many random inputs.\n");
+	fprintf(out, "  -t <seconds>    Stop after this many seconds.\n");
+	fprintf(out, "  -s <seed>       Seed for the random inputs.\n");
+	fprintf(out, "  file ...        Run each file (or '-' for stdin) once.\n");
+	exit(rcode);
+}
+
+int main(int argc, char **argv)
+{
+	int c, i;
+	uint64_t execs, max_execs = 0;
+	double start, last, now, max_seconds = 0;
+	uint8_t data[256];
+	char const *progname = argv[0];
+
+	fuzz_seed = (uint64_t) time(NULL) * 2654435761u + getpid();
+
+	while ((c = getopt(argc, argv, "hn:s:t:")) != EOF) switch (c) {
+		case 'n':
+			max_execs = strtoull(optarg, NULL, 10);
+			break;
+
+		case 's':
+			fuzz_seed = strtoull(optarg, NULL, 10);
+			break;
+
+		case 't':
+			max_seconds = atof(optarg);
+			break;
+
+		case 'h':
+			usage(progname, 0);
+			break;
+
+		default:
+			usage(progname, 1);
+			break;
+		}
+
+	if (fuzz_init() < 0) exit(1);
+
+	if (optind < argc) {
+		for (i = optind; i < argc; i++) {
+			if (fuzz_file(argv[i]) < 0) exit(1);
+		}
+		exit(0);
+	}
+
+	if (!fuzz_seed) fuzz_seed = 1;
+	fprintf(stderr, "seed %llu\n", (unsigned long long) fuzz_seed);
+
+	/*
+	 *	Soak: random inputs, printing one JSON line every ten
+	 *	seconds, and one at the end.
+	 */
+	start = last = fuzz_now();
+	for (execs = 0; !max_execs || (execs < max_execs); execs++) {
+		size_t size;
+
+		size = fuzz_random() % sizeof(data);
+		for (i = 0; i < (int) size; i++) data[i] = fuzz_random();
+
+		fuzz_one(data, size);
+
+		if ((execs & 63) != 0) continue;
+
+		now = fuzz_now();
+		if (max_seconds && ((now - start) >= max_seconds)) break;
+
+		if ((now - last) >= 10) {
+			printf("{\"execs\": %llu, \"seconds\": %.1f, \"execs_per_sec\": %.0f}\n",
+			       (unsigned long long) execs, now - start, execs / (now - start));
+			fflush(stdout);
+			last = now;
+		}
+	}
+
+	now = fuzz_now();
+	printf("{\"execs\": %llu, \"seconds\": %.1f, \"execs_per_sec\": %.0f}\n",
+	       (unsigned long long) execs, now - start, execs / (now - start));
+
+	return 0;
+}
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Buffered line input, for when we're not talking to a terminal.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "recli.h"
+
+#define INPUT_BLOCK_SIZE (64 * 1024)
+
+void recli_input_init(recli_input_t *in, int fd)
+{
+	memset(in, 0, sizeof(*in));
+	in->fd = fd;
+}
+
+/*
+ *	Open a file for reading.  Regular files are mapped into
+ *	memory, so that lines can be returned without copying them.
+ *	The mapping is private, so terminating the lines in place
+ *	doesn't change the file.  Anything else is read in blocks.
+ *
+ *	Returns 0 on success, or -1 on error, with errno set.
+ */
+int recli_input_open(recli_input_t *in, const char *filename)
+{
+	int fd;
+	void *map;
+	struct stat st;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return -1;
+
+	recli_input_init(in, fd);
+	in->owns_fd = 1;
+
+	if ((fstat(fd, &st) < 0) || !S_ISREG(st.st_mode) ||
+	    (st.st_size == 0)) {
+		return 0;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fd, 0);
+	if (map == MAP_FAILED) return 0;
+
+#ifdef MADV_SEQUENTIAL
+	(void) madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	in->buffer = map;
+	in->bufsize = in->end = st.st_size;
+	in->mapped = 1;
+	in->eof = 1;
+
+	return 0;
+}
+
+void recli_input_free(recli_input_t *in)
+{
+	if (in->mapped) {
+		munmap(in->buffer, in->bufsize);
+	} else {
+		free(in->buffer);
+	}
+	free(in->tail);
+	if (in->owns_fd) close(in->fd);
+	memset(in, 0, sizeof(*in));
+	in->fd = -1;
+}
+
+/*
+ *	Read another block into the buffer.  Returns the number of
+ *	bytes read, 0 on EOF, or -1 on error.
+ */
+static ssize_t input_fill(recli_input_t *in)
+{
+	ssize_t num;
+
+	/*
+	 *	Move the partial line to the start of the buffer.
+	 */
+	if (in->start > 0) {
+		memmove(in->buffer, in->buffer + in->start, in->end - in->start);
+		in->end -= in->start;
+		in->start = 0;
+	}
+
+	/*
+	 *	Always leave room for a trailing NUL.  If the partial
+	 *	line fills the buffer, then grow it.
+	 */
+	if ((in->bufsize - in->end) < (INPUT_BLOCK_SIZE / 2)) {
+		char *p;
+		size_t size;
+
+		size = in->bufsize * 2;
+		if (size < INPUT_BLOCK_SIZE) size = INPUT_BLOCK_SIZE;
+
+		p = realloc(in->buffer, size);
+		if (!p) return -1;
+
+		in->buffer = p;
+		in->bufsize = size;
+	}
+
+	do {
+		num = read(in->fd, in->buffer + in->end,
+			   in->bufsize - in->end - 1);
+	} while ((num < 0) && (errno == EINTR));
+
+	if (num > 0) in->end += num;
+
+	return num;
+}
+
+/*
+ *	Return the next line of input, without the trailing LF.  The
+ *	line is NUL terminated in place, and is valid until the next
+ *	call.  Lines may be of any length.
+ *
+ *	Returns NULL on EOF or error.
+ */
+char *recli_input_line(recli_input_t *in, size_t *len)
+{
+	char *line, *p;
+	size_t searched = 0;
+
+	for (;;) {
+		if (in->end > in->start) {
+			line = in->buffer + in->start;
+
+			p = memchr(line + searched, '\n', in->end - in->start - searched);
+			if (p) {
+				*p = '\0';
+				in->start = (p + 1) - in->buffer;
+				goto done;
+			}
+
+			searched = in->end - in->start;
+		}
+
+		if (in->eof) break;
+
+		if (input_fill(in) <= 0) in->eof = 1;
+	}
+
+	/*
+	 *	EOF.  Return any trailing text which doesn't end in LF.
+	 */
+	if (in->end == in->start) return NULL;
+
+	line = in->buffer + in->start;
+	p = in->buffer + in->end;
+
+	/*
+	 *	There may be no room after the end of the mapping, so
+	 *	the last line is copied.
+	 */
+	if (in->mapped) {
+		size_t size = in->end - in->start;
+
+		in->tail = malloc(size + 1);
+		if (!in->tail) return NULL;
+
+		memcpy(in->tail, line, size);
+		line = in->tail;
+		p = line + size;
+	}
+
+	*p = '\0';
+	in->start = in->end;
+
+done:
+	in->lineno++;
+	if (len) *len = p - line;
+	return line;
+}
@@ -119,6 +119,9 @@
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
 #define USE_TERMIOS
 #define HAVE_UNISTD_H
 #endif
@@ -159,8 +162,19 @@ static int history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN;
 static int history_len = 0;
 static char **history = NULL;
 
+#ifdef USE_TERMIOS
+/* Shared history: how much of which file we have already seen */
+static off_t history_offset = 0;
+static ino_t history_inode = 0;
+#endif
+
 static linenoiseHistoryCallback *historyCallback = NULL;
 
+/* Other FDs to watch while waiting for a key */
+#define LINENOISE_MAX_WATCH 64
+static linenoiseWatchCallback *watchCallback = NULL;
+static linenoiseEventCallback *eventCallback = NULL;
+
 /* Structure to contain the status of the current (being edited) line */
 struct current {
     char *buf;  /* Current buffer. Always null terminated */
@@ -346,12 +360,56 @@ static int fd_read_char(int fd, int timeout)
     return c;
 }
 
+static void refreshLine(const char *prompt, struct current *current);
+
+/**
+ * Waits for a key, calling the event callback when any of the
+ * watched FDs are readable.  Anything which the callback prints
+ * appears above the line being edited, which is then redrawn.
+ *
+ * Returns -1 on error or interrupt, as fd_read_char() does.
+ */
+static int fd_wait(struct current *current)
+{
+    int i, n, rcode;
+    int fds[LINENOISE_MAX_WATCH];
+    struct pollfd p[LINENOISE_MAX_WATCH + 1];
+
+    while (1) {
+        n = watchCallback(fds, LINENOISE_MAX_WATCH);
+        if (n <= 0) return 0;
+
+        p[0].fd = current->fd;
+        p[0].events = POLLIN;
+        for (i = 0; i < n; i++) {
+            p[i + 1].fd = fds[i];
+            p[i + 1].events = POLLIN;
+        }
+
+        rcode = poll(p, n + 1, -1);
+        if (rcode <= 0) return -1;
+        if (p[0].revents) return 0;
+
+        cursorToLeft(current);
+        eraseEol(current);
+        disableRawMode(current);
+
+        eventCallback();
+        fflush(stdout);
+
+        if (enableRawMode(current) < 0) return -1;
+        refreshLine(current->prompt, current);
+    }
+}
+
 /**
  * Reads a complete utf-8 character
  * and returns the unicode value, or -1 on error.
  */
 static int fd_read(struct current *current)
 {
+    if (watchCallback && (fd_wait(current) < 0)) return -1;
+
 #ifdef USE_UTF8
     char buf[4];
     int n;
@@ -1346,36 +1404,92 @@ int linenoiseHistorySetMaxLen(int len) {
     return 1;
 }
 
+/* Encode one history entry into 'out', which must have room for
+ * 2 * strlen(str) + 2 bytes.  Returns the number of bytes written,
+ * including the trailing newline. */
+static size_t historyEncode(char *out, const char *str) {
+    char *p = out;
+
+    /* Need to encode backslash, nl and cr */
+    while (*str) {
+        if (*str == '\\') {
+            *p++ = '\\';
+            *p++ = '\\';
+        }
+        else if (*str == '\n') {
+            *p++ = '\\';
+            *p++ = 'n';
+        }
+        else if (*str == '\r') {
+            *p++ = '\\';
+            *p++ = 'r';
+        }
+        else {
+            *p++ = *str;
+        }
+        str++;
+    }
+    *p++ = '\n';
+
+    return p - out;
+}
+
+/* Decode one line read from a history file, in place. */
+static void historyDecode(char *buf) {
+    char *src, *dest;
+
+    /* Decode backslash escaped values */
+    for (src = dest = buf; *src; src++) {
+        char ch = *src;
+
+        if (ch == '\\') {
+            src++;
+            if (*src == 'n') {
+                ch = '\n';
+            }
+            else if (*src == 'r') {
+                ch = '\r';
+            } else {
+                ch = *src;
+            }
+        }
+        *dest++ = ch;
+    }
+    /* Remove trailing newline */
+    if (dest != buf && (dest[-1] == '\n' || dest[-1] == '\r')) {
+        dest--;
+    }
+    *dest = 0;
+}
+
 /* Save the history in the specified file. On success 0 is returned
  * otherwise -1 is returned. */
-int linenoiseHistorySave(const char *filename) {
-    FILE *fp = fopen(filename,"w");
-    int j;
+static int historyWrite(FILE *fp) {
+    int j, rc = 0;
 
-    if (fp == NULL) return -1;
     for (j = 0; j < history_len; j++) {
-        const char *str = history[j];
-        /* Need to encode backslash, nl and cr */
-        while (*str) {
-            if (*str == '\\') {
-                fputs("\\\\", fp);
-            }
-            else if (*str == '\n') {
-                fputs("\\n", fp);
-            }
-            else if (*str == '\r') {
-                fputs("\\r", fp);
-            }
-            else {
-                fputc(*str, fp);
-            }
-            str++;
+        size_t len = strlen(history[j]);
+        char *buf = (char *)malloc(2 * len + 2);
+
+        if (!buf) {
+            rc = -1;
+            break;
         }
-        fputc('\n', fp);
+        len = historyEncode(buf, history[j]);
+        if (fwrite(buf, 1, len, fp) != len) rc = -1;
+        free(buf);
+        if (rc < 0) break;
     }
 
-    fclose(fp);
-    return 0;
+    if (fclose(fp) != 0) rc = -1;
+    return rc;
+}
+
+int linenoiseHistorySave(const char *filename) {
+    FILE *fp = fopen(filename,"w");
+
+    if (fp == NULL) return -1;
+    return historyWrite(fp);
 }
 
 /* Load the history from the specified file. If the file does not exist
@@ -1390,37 +1504,236 @@ int linenoiseHistoryLoad(const char *filename) {
     if (fp == NULL) return -1;
 
     while (fgets(buf,LINENOISE_MAX_LINE,fp) != NULL) {
-        char *src, *dest;
+        historyDecode(buf);
+        linenoiseHistoryAdd(buf);
+    }
+    fclose(fp);
+    return 0;
+}
+
+#ifdef USE_TERMIOS
+/* Shared history.
+ *
+ * Many sessions may append to the same history file.  Each one
+ * remembers the inode of the file, and how far into it has been
+ * read.  New entries written by other sessions are then picked up
+ * by reading only the tail of the file.  Writers take an exclusive
+ * lock and append a whole entry with one write(), so readers (who
+ * take a shared lock) never see partial lines.
+ *
+ * When the file grows too large, it is rewritten from the in-memory
+ * history and renamed into place.  Other sessions see the inode
+ * change, and re-read the new (small) file from the start.
+ */
+#define LINENOISE_HISTORY_SHARED_MAX (256 * 1024)
 
-        /* Decode backslash escaped values */
-        for (src = dest = buf; *src; src++) {
-            char ch = *src;
+/* Read new entries from 'fd', which is locked.  Returns 0 on success,
+ * or -1 on error. */
+static int historyReadTail(int fd) {
+    struct stat st;
+    char *buf, *p, *q, *end;
+    size_t size;
+    ssize_t n;
 
-            if (ch == '\\') {
-                src++;
-                if (*src == 'n') {
-                    ch = '\n';
-                }
-                else if (*src == 'r') {
-                    ch = '\r';
-                } else {
-                    ch = *src;
-                }
-            }
-            *dest++ = ch;
+    if (fstat(fd, &st) < 0) return -1;
+
+    /* Someone replaced or truncated the file.  Start over. */
+    if ((st.st_ino != history_inode) || (st.st_size < history_offset)) {
+        int j;
+
+        for (j = 0; j < history_len; j++) free(history[j]);
+        history_len = 0;
+        history_offset = 0;
+        history_inode = st.st_ino;
+    }
+
+    if (st.st_size == history_offset) return 0;
+
+    size = st.st_size - history_offset;
+    buf = (char *)malloc(size + 1);
+    if (!buf) return -1;
+
+    p = buf;
+    end = buf + size;
+    while (p < end) {
+        n = pread(fd, p, end - p, history_offset + (p - buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            free(buf);
+            return -1;
+        }
+        if (n == 0) break;
+        p += n;
+    }
+    end = p;
+
+    /* Only consume complete lines */
+    for (p = buf; p < end; p = q + 1) {
+        q = (char *)memchr(p, '\n', end - p);
+        if (!q) break;
+
+        *q = '\0';
+        historyDecode(p);
+        linenoiseHistoryAdd(p);
+    }
+
+    history_offset += p - buf;
+    free(buf);
+    return 0;
+}
+
+/* Open the shared history file, and lock it.  Because the file may
+ * be renamed over while we wait for the lock, check that the locked
+ * file is still the one with that name. */
+static int historyOpenLocked(const char *filename, int flags, int lock) {
+    int fd;
+    struct stat st_fd, st_name;
+
+    for (;;) {
+        fd = open(filename, flags, 0600);
+        if (fd < 0) return -1;
+
+        if (flock(fd, lock) < 0) {
+            close(fd);
+            return -1;
         }
-        /* Remove trailing newline */
-        if (dest != buf && (dest[-1] == '\n' || dest[-1] == '\r')) {
-            dest--;
+
+        if ((fstat(fd, &st_fd) == 0) && (stat(filename, &st_name) == 0) &&
+            (st_fd.st_ino == st_name.st_ino) &&
+            (st_fd.st_dev == st_name.st_dev)) {
+            return fd;
         }
-        *dest = 0;
 
-        linenoiseHistoryAdd(buf);
+        close(fd);
     }
-    fclose(fp);
+}
+
+/* Pick up any entries which other sessions have added to the shared
+ * history file since we last looked.  The common case of "nothing
+ * changed" costs one stat().
+ *
+ * Returns 0 on success, or -1 on error. */
+int linenoiseHistorySync(const char *filename) {
+    struct stat st;
+    int fd, rcode;
+
+    if (stat(filename, &st) < 0) {
+        if (errno == ENOENT) return 0;
+        return -1;
+    }
+
+    if ((st.st_ino == history_inode) && (st.st_size == history_offset)) {
+        return 0;
+    }
+
+    fd = historyOpenLocked(filename, O_RDONLY, LOCK_SH);
+    if (fd < 0) return -1;
+
+    rcode = historyReadTail(fd);
+    close(fd);
+    return rcode;
+}
+
+/* Rewrite the shared history file from the in-memory history.  The
+ * caller holds the lock on the old file. */
+static void historyCompact(const char *filename) {
+    int fd;
+    FILE *fp;
+    char *tmp;
+    size_t len = strlen(filename);
+
+    tmp = (char *)malloc(len + 5);
+    if (!tmp) return;
+
+    memcpy(tmp, filename, len);
+    memcpy(tmp + len, ".new", 5);
+
+    /* The history is private.  Don't let the umask decide, and don't
+     * follow a link someone else left in place of a stale file. */
+    unlink(tmp);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        free(tmp);
+        return;
+    }
+
+    fp = fdopen(fd, "w");
+    if (!fp) {
+        close(fd);
+        goto fail;
+    }
+
+    if ((historyWrite(fp) == 0) && (rename(tmp, filename) == 0)) {
+        struct stat st;
+
+        if (stat(filename, &st) == 0) {
+            history_inode = st.st_ino;
+            history_offset = st.st_size;
+        }
+        free(tmp);
+        return;
+    }
+
+fail:
+    unlink(tmp);
+    free(tmp);
+}
+
+/* Add a line to the history, and append it to the shared history
+ * file.  Entries added by other sessions are read first, so that the
+ * in-memory history has the same order as the file.
+ *
+ * Returns 0 on success, or -1 on error. */
+int linenoiseHistoryAppend(const char *filename, const char *line) {
+    int fd, rcode = -1;
+    size_t len;
+    ssize_t n;
+    char *buf;
+
+    fd = historyOpenLocked(filename, O_RDWR | O_CREAT | O_APPEND, LOCK_EX);
+    if (fd < 0) {
+        linenoiseHistoryAdd(line);
+        return -1;
+    }
+
+    historyReadTail(fd);
+    linenoiseHistoryAdd(line);
+
+    len = strlen(line);
+    buf = (char *)malloc(2 * len + 2);
+    if (!buf) goto done;
+
+    len = historyEncode(buf, line);
+    do {
+        n = write(fd, buf, len);
+    } while ((n < 0) && (errno == EINTR));
+    free(buf);
+
+    if (n != (ssize_t) len) goto done;
+
+    history_offset += len;
+    rcode = 0;
+
+    if (history_offset > LINENOISE_HISTORY_SHARED_MAX) {
+        historyCompact(filename);
+    }
+
+done:
+    close(fd);
+    return rcode;
+}
+#else
+int linenoiseHistorySync(const char *filename) {
+    (void) filename;
     return 0;
 }
 
+int linenoiseHistoryAppend(const char *filename, const char *line) {
+    linenoiseHistoryAdd(line);
+    return linenoiseHistorySave(filename);
+}
+#endif
+
 /* Provide access to the history buffer.
  *
  * If 'len' is not NULL, the length is stored in *len.
@@ -1445,3 +1758,11 @@ void linenoiseSetHistoryCallback(linenoiseHistoryCallback *fn)
 {
 	historyCallback = fn;
 }
+
+/* Register callbacks for other FDs to watch while waiting for a key.
+ * "watch" fills in the FDs, and "event" is called when any of them
+ * are readable. */
+void linenoiseSetWatchCallback(linenoiseWatchCallback *watch, linenoiseEventCallback *event) {
+    watchCallback = watch;
+    eventCallback = event;
+}
@@ -54,11 +54,17 @@ void linenoiseSetCharacterCallback(linenoiseCharacterCallback *, char);
 typedef const char *(linenoiseHistoryCallback)(const char *);
 void linenoiseSetHistoryCallback(linenoiseHistoryCallback *);
 
+typedef int(linenoiseWatchCallback)(int *fds, int max_fds);
+typedef void(linenoiseEventCallback)(void);
+void linenoiseSetWatchCallback(linenoiseWatchCallback *, linenoiseEventCallback *);
+
 char *linenoise(const char *prompt);
 int linenoiseHistoryAdd(const char *line);
 int linenoiseHistorySetMaxLen(int len);
 int linenoiseHistorySave(const char *filename);
 int linenoiseHistoryLoad(const char *filename);
+int linenoiseHistoryAppend(const char *filename, const char *line);
+int linenoiseHistorySync(const char *filename);
 void linenoiseHistoryFree(void);
 char **linenoiseHistory(int *len);
 int linenoiseCols(void);
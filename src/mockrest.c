@@ -0,0 +1,295 @@
+/*
+ * A stand-in REST server, for testing the commands in rest.txt.
+ *
+ * See LICENSE for licence details.
+ */
+#define _GNU_SOURCE		/* strcasestr() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ *	Each request gets "METHOD path" and any body back, as text.
+ *	Some paths do more:
+ *
+ *		/stats		connections and requests so far
+ *		/status/NNN	responds with status NNN
+ *		/chunked/...	the response is chunked
+ *		/close/...	the connection is closed after the response
+ *		/hang/...	there's no response
+ *		/big/NNN	responds with status 500, and NNN bytes of body
+ *		/huge/...	the response has a chunk too large to read
+ *		/badlength/...	the response has a bad Content-Length
+ */
+#define MOCK_CONNS	(64)
+
+typedef struct mock_conn_t {
+	int		fd;
+	char		*buffer;
+	size_t		len;
+	size_t		size;
+} mock_conn_t;
+
+static mock_conn_t conns[MOCK_CONNS];
+static unsigned long connections = 0;
+static unsigned long requests = 0;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: recli-mockrest (/path/to/socket | port)\n");
+	exit(1);
+}
+
+static int mock_listen(const char *addr)
+{
+	int fd;
+
+	if (strchr(addr, '/') != NULL) {
+		struct sockaddr_un sun;
+
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(addr) >= sizeof(sun.sun_path)) usage();
+		strcpy(sun.sun_path, addr);
+
+		unlink(addr);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((fd < 0) || (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0)) {
+			fprintf(stderr, "Failed binding %s: %s\n", addr, strerror(errno));
+			exit(1);
+		}
+
+	} else {
+		int on = 1;
+		struct sockaddr_in sin;
+
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(atoi(addr));
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if ((fd < 0) || (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0)) {
+			fprintf(stderr, "Failed binding %s: %s\n", addr, strerror(errno));
+			exit(1);
+		}
+	}
+
+	if (listen(fd, 16) < 0) {
+		fprintf(stderr, "Failed listening on %s: %s\n", addr, strerror(errno));
+		exit(1);
+	}
+
+	return fd;
+}
+
+static void mock_close(mock_conn_t *conn)
+{
+	close(conn->fd);
+	free(conn->buffer);
+	memset(conn, 0, sizeof(*conn));
+	conn->fd = -1;
+}
+
+static void mock_write(int fd, const char *buf, size_t len)
+{
+	ssize_t num;
+
+	while (len > 0) {
+		num = send(fd, buf, len, MSG_NOSIGNAL);
+		if (num <= 0) return;
+		buf += num;
+		len -= num;
+	}
+}
+
+/*
+ *	Answer each complete request in the buffer.  Returns -1 if the
+ *	connection should be closed.
+ */
+static int mock_respond(mock_conn_t *conn)
+{
+	char *end, *p, *path, *method;
+	size_t header_len, body_len;
+	char body[8192], reply[16384];
+	int status, len, closing;
+
+	while ((end = strstr(conn->buffer, "\r\n\r\n")) != NULL) {
+		header_len = (end + 4) - conn->buffer;
+
+		body_len = 0;
+		p = strcasestr(conn->buffer, "\r\nContent-Length:");
+		if (p && (p < end)) body_len = strtoul(p + 17, NULL, 10);
+
+		if ((conn->len - header_len) < body_len) return 0;
+
+		method = conn->buffer;
+		p = strchr(method, ' ');
+		if (!p) return -1;
+		*p = '\0';
+		path = p + 1;
+		p = strchr(path, ' ');
+		if (!p) return -1;
+		*p = '\0';
+
+		requests++;
+		status = 200;
+		closing = ((strncmp(path, "/close/", 7) == 0) ||
+			   (strncmp(path, "/huge/", 6) == 0) ||
+			   (strncmp(path, "/badlength/", 11) == 0));
+
+		if (strcmp(path, "/stats") == 0) {
+			len = snprintf(body, sizeof(body), "connections %lu requests %lu\n",
+				       connections, requests);
+
+		} else if (strncmp(path, "/status/", 8) == 0) {
+			status = atoi(path + 8);
+			len = snprintf(body, sizeof(body), "status %d\n", status);
+
+		} else {
+			len = snprintf(body, sizeof(body), "%s %s%s%.*s\n", method, path,
+				       body_len ? " " : "", (int) body_len,
+				       conn->buffer + header_len);
+		}
+		if (len >= (int) sizeof(body)) len = sizeof(body) - 1;
+
+		if (strncmp(path, "/hang/", 6) == 0) {
+			len = 0;
+
+		} else if (strncmp(path, "/big/", 5) == 0) {
+			size_t size = strtoul(path + 5, NULL, 10);
+
+			len = snprintf(reply, sizeof(reply),
+				       "HTTP/1.1 500 Failed\r\nContent-Length: %lu\r\n\r\n",
+				       (unsigned long) size);
+			mock_write(conn->fd, reply, len);
+
+			memset(reply, 'x', sizeof(reply));
+			while (size > 0) {
+				len = (size < sizeof(reply)) ? size : sizeof(reply);
+				mock_write(conn->fd, reply, len);
+				size -= len;
+			}
+			len = 0;
+
+		} else if (strncmp(path, "/huge/", 6) == 0) {
+			len = snprintf(reply, sizeof(reply),
+				       "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+				       "ffffffffffffffff\r\n%s", body);
+
+		} else if (strncmp(path, "/badlength/", 11) == 0) {
+			len = snprintf(reply, sizeof(reply),
+				       "HTTP/1.1 200 OK\r\nContent-Length: %dx\r\n\r\n%s",
+				       len, body);
+
+		} else if (strncmp(path, "/chunked/", 9) == 0) {
+			int half = len / 2;
+
+			len = snprintf(reply, sizeof(reply),
+				       "HTTP/1.1 %d OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+				       "%x\r\n%.*s\r\n%x\r\n%s\r\n0\r\n\r\n",
+				       status, half, half, body, len - half, body + half);
+		} else {
+			len = snprintf(reply, sizeof(reply),
+				       "HTTP/1.1 %d %s\r\nContent-Length: %d\r\n%s\r\n%s",
+				       status, (status < 300) ? "OK" : "Failed", len,
+				       closing ? "Connection: close\r\n" : "", body);
+		}
+		if (len) mock_write(conn->fd, reply, len);
+
+		if (closing) return -1;
+
+		memmove(conn->buffer, conn->buffer + header_len + body_len,
+			conn->len - header_len - body_len + 1);
+		conn->len -= header_len + body_len;
+	}
+
+	return 0;
+}
+
+static void mock_read(mock_conn_t *conn)
+{
+	ssize_t num;
+
+	if ((conn->size - conn->len) < 4096) {
+		conn->size = conn->size ? conn->size * 2 : 8192;
+		conn->buffer = realloc(conn->buffer, conn->size);
+		if (!conn->buffer) exit(1);
+	}
+
+	num = read(conn->fd, conn->buffer + conn->len, conn->size - conn->len - 1);
+	if (num <= 0) {
+		mock_close(conn);
+		return;
+	}
+
+	conn->len += num;
+	conn->buffer[conn->len] = '\0';
+
+	if (mock_respond(conn) < 0) mock_close(conn);
+}
+
+int main(int argc, char **argv)
+{
+	int i, n, listener;
+	struct pollfd fds[MOCK_CONNS + 1];
+
+	if (argc != 2) usage();
+
+	signal(SIGPIPE, SIG_IGN);
+
+	listener = mock_listen(argv[1]);
+
+	for (i = 0; i < MOCK_CONNS; i++) conns[i].fd = -1;
+
+	for (;;) {
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+
+		for (i = 0; i < MOCK_CONNS; i++) {
+			fds[i + 1].fd = conns[i].fd;
+			fds[i + 1].events = POLLIN;
+		}
+
+		n = poll(fds, MOCK_CONNS + 1, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		for (i = 0; i < MOCK_CONNS; i++) {
+			if (fds[i + 1].revents) mock_read(&conns[i]);
+		}
+
+		if (fds[0].revents) {
+			int fd = accept(listener, NULL, NULL);
+
+			if (fd < 0) continue;
+
+			for (i = 0; i < MOCK_CONNS; i++) {
+				if (conns[i].fd < 0) break;
+			}
+			if (i == MOCK_CONNS) {
+				close(fd);
+				continue;
+			}
+
+			conns[i].fd = fd;
+			connections++;
+		}
+	}
+
+	return 0;
+}
@@ -57,7 +57,11 @@ int permission_enforce(cli_permission_t *head, int argc, char *argv[])
 		int match = 1;
 
 		for (i = 0; i < this->argc; i++) {
-			if (i > argc) {
+			/*
+			 *	The rule is longer than the command.
+			 */
+			if (i >= argc) {
+				match = 0;
 				break;
 			}
 
@@ -91,21 +95,19 @@ int permission_enforce(cli_permission_t *head, int argc, char *argv[])
 }
 
 
-static cli_permission_t *permission_parse_line(const char *buf)
+static cli_permission_t *permission_parse_line(const char *buf, size_t len)
 {
-	size_t len;
 	cli_permission_t *this;
 	int argc;
 	char *argv[256];
 	char *buffer;
 
-	len = strlen(buf);
 	if (len == 0) return NULL;
 
 	buffer = malloc(len + 1);
 	memcpy(buffer, buf, len + 1);
 	argc = str2argv(buffer, len, 256, argv);
-	if (argc == 0) {
+	if (argc <= 0) {
 		free(buffer);
 		return NULL;
 	}
@@ -128,15 +130,14 @@ static cli_permission_t *permission_parse_line(const char *buf)
 
 int permission_parse_file(const char *filename, cli_permission_t **phead)
 {
-	int lineno;
-	FILE *fp;
-	char buffer[1024];
+	char *buffer;
+	size_t len;
+	recli_input_t input;
 	cli_permission_t *head, *this, **last;
 
 	if (!filename || !phead) return -1;
 
-	fp = fopen(filename, "r");
-	if (!fp) {
+	if (recli_input_open(&input, filename) < 0) {
 		recli_fprintf(recli_stderr, "Failed opening %s: %s\n",
 			filename, strerror(errno));
 		return -1;
@@ -144,26 +145,24 @@ int permission_parse_file(const char *filename, cli_permission_t **phead)
 
 	head = NULL;
 	last = &head;
-	lineno = 0;
 
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+	while ((buffer = recli_input_line(&input, &len)) != NULL) {
 		char *p;
-		lineno++;
-
-		p = strchr(buffer, '\r');
-		if (p) *p = '\0';
 
-		p = strchr(buffer, '\n');
-		if (p) *p = '\0';
+		p = memchr(buffer, '\r', len);
+		if (p) {
+			*p = '\0';
+			len = p - buffer;
+		}
 
-		this = permission_parse_line(buffer);
+		this = permission_parse_line(buffer, len);
 		if (!this) continue;
-		this->lineno = lineno;
+		this->lineno = input.lineno;
 		*last = this;
 		last = &this->next;
 	}
 
-	fclose(fp);
+	recli_input_free(&input);
 	*phead = head;
 
 	/*
@@ -191,3 +190,79 @@ void permission_free(cli_permission_t *head)
 		free(this);
 	}
 }
+
+/*
+ *	Write the permissions out as C source, with each rule already
+ *	split into words.
+ *
+ *	Returns the number of rules.
+ */
+int permission_compile(FILE *fp, cli_permission_t *head)
+{
+	int i, num;
+	cli_permission_t *this;
+
+	for (this = head, num = 0; this != NULL; this = this->next, num++) {
+		fprintf(fp, "static const char * const recli_static_perm_%d[] = { ", num);
+		for (i = 0; i < this->argc; i++) {
+			fprint_cstring(fp, this->argv[i]);
+			fprintf(fp, ", ");
+		}
+		fprintf(fp, "NULL };\n");
+	}
+
+	fprintf(fp, "\nstatic const recli_static_permission_t recli_static_permissions[] = {\n");
+
+	for (this = head, num = 0; this != NULL; this = this->next, num++) {
+		fprintf(fp, "\t{ %d, %d, %d, recli_static_perm_%d },\n",
+			this->allowed, this->lineno, this->argc, num);
+	}
+
+	fprintf(fp, "\t{ 0, 0, 0, NULL }\n};\n\n");
+
+	return num;
+}
+
+/*
+ *	Create the permissions for a compiled syntax.  The words point
+ *	to the compiled strings, so nothing is copied.
+ *
+ *	Returns the same as permission_parse_file().
+ */
+int permission_load_static(const recli_static_t *in, cli_permission_t **phead)
+{
+	int i;
+	cli_permission_t *head, *this, **last;
+
+	if (!in->num_permissions) return 1;
+
+	head = NULL;
+	last = &head;
+
+	for (i = 0; i < in->num_permissions; i++) {
+		const recli_static_permission_t *p = &in->permissions[i];
+
+		this = calloc(sizeof(*this) + (sizeof(this->argv[0]) * (p->argc - 1)), 1);
+		if (!this) {
+			permission_free(head);
+			return -1;
+		}
+
+		this->allowed = p->allowed;
+		this->lineno = p->lineno;
+		this->argc = p->argc;
+		memcpy(this->argv, p->argv, sizeof(this->argv[0]) * p->argc);
+
+		*last = this;
+		last = &this->next;
+	}
+
+	*phead = head;
+
+	if (!head->next && !head->allowed && (head->argc == 1) &&
+	    (strcmp(head->argv[0], "*") == 0)) {
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,500 @@
+/*
+ * Keystroke latency of interactive recli, measured over a pty.
+ *
+ * See LICENSE for licence details.
+ */
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/*
+ *	The kinds of keystroke, and what they exercise in recli.
+ */
+typedef enum pty_key_t {
+	KEY_TYPE = 0,		/* linenoisePrompt() inserting a character */
+	KEY_TAB,		/* completeLine() */
+	KEY_HELP,		/* the '?' callback */
+	KEY_HISTORY,		/* up arrow */
+	KEY_PASTE,		/* a whole line in one write */
+	KEY_ENTER,		/* running the command, and the next prompt */
+	KEY_MAX
+} pty_key_t;
+
+static const char *key_names[KEY_MAX] = {
+	"type",
+	"tab",
+	"help",
+	"history",
+	"paste",
+	"enter"
+};
+
+typedef struct pty_stats_t {
+	uint64_t	*samples;	/* ns from the write to the end of the output */
+	int		num;
+	int		size;
+	uint64_t	in_bytes;
+	uint64_t	out_bytes;
+	uint64_t	syscalls;
+	int		silent;		/* no output at all */
+} pty_stats_t;
+
+typedef struct pty_bench_t {
+	int		fd;		/* master side of the pty */
+	pid_t		pid;
+	int		settle_ms;	/* output is done after this much quiet */
+	int		have_io;	/* /proc/PID/io is readable */
+	pty_stats_t	stats[KEY_MAX];
+} pty_bench_t;
+
+static uint64_t pty_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/*
+ *	Read and write system calls made by recli so far.
+ */
+static int pty_syscalls(pty_bench_t *pb, uint64_t *count)
+{
+	FILE *fp;
+	char buffer[256];
+	unsigned long long n;
+
+	snprintf(buffer, sizeof(buffer), "/proc/%d/io", (int) pb->pid);
+	fp = fopen(buffer, "r");
+	if (!fp) return -1;
+
+	*count = 0;
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		if ((sscanf(buffer, "syscr: %llu", &n) == 1) ||
+		    (sscanf(buffer, "syscw: %llu", &n) == 1)) {
+			*count += n;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/*
+ *	Read output until there's none for "settle_ms".  Returns the
+ *	number of bytes read, and the time the last one arrived.
+ */
+static ssize_t pty_drain(pty_bench_t *pb, int first_ms, uint64_t *last)
+{
+	int timeout = first_ms;
+	ssize_t total = 0;
+	char buffer[65536];
+
+	for (;;) {
+		int rcode;
+		ssize_t num;
+		struct pollfd pfd;
+
+		pfd.fd = pb->fd;
+		pfd.events = POLLIN;
+
+		rcode = poll(&pfd, 1, timeout);
+		if (rcode < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (rcode == 0) break;
+
+		num = read(pb->fd, buffer, sizeof(buffer));
+		if (num < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EIO) break; /* recli exited */
+			return -1;
+		}
+		if (num == 0) break;
+
+		if (last) *last = pty_now();
+		total += num;
+		timeout = pb->settle_ms;
+	}
+
+	return total;
+}
+
+/*
+ *	Send one keystroke, and wait for recli to finish drawing.
+ */
+static int pty_key(pty_bench_t *pb, pty_key_t key, const char *data, size_t len)
+{
+	ssize_t out;
+	uint64_t start, last, before, after;
+	pty_stats_t *s = &pb->stats[key];
+
+	if (pb->have_io && (pty_syscalls(pb, &before) < 0)) pb->have_io = 0;
+
+	start = last = pty_now();
+	if (write(pb->fd, data, len) != (ssize_t) len) return -1;
+
+	out = pty_drain(pb, 1000, &last);
+	if (out < 0) return -1;
+
+	if (pb->have_io && (pty_syscalls(pb, &after) < 0)) pb->have_io = 0;
+
+	if (out == 0) {
+		s->silent++;
+		return 0;
+	}
+
+	if (s->num == s->size) {
+		uint64_t *p;
+
+		s->size = s->size ? s->size * 2 : 1024;
+		p = realloc(s->samples, s->size * sizeof(p[0]));
+		if (!p) return -1;
+		s->samples = p;
+	}
+
+	s->samples[s->num++] = last - start;
+	s->in_bytes += len;
+	s->out_bytes += out;
+	if (pb->have_io) s->syscalls += after - before;
+
+	return 0;
+}
+
+/*
+ *	Send keys which set up the next test, but aren't measured.
+ */
+static int pty_send(pty_bench_t *pb, const char *data)
+{
+	size_t len = strlen(data);
+
+	if (write(pb->fd, data, len) != (ssize_t) len) return -1;
+
+	return (pty_drain(pb, 1000, NULL) < 0) ? -1 : 0;
+}
+
+static int pty_start(pty_bench_t *pb, const char *recli, char *const argv[], const char *home)
+{
+	int slave;
+	char *name;
+	struct winsize ws;
+
+	pb->fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (pb->fd < 0) {
+		fprintf(stderr, "Failed opening pty: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if ((grantpt(pb->fd) < 0) || (unlockpt(pb->fd) < 0) ||
+	    ((name = ptsname(pb->fd)) == NULL)) {
+		fprintf(stderr, "Failed setting up pty: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Linenoise asks the terminal for its size.
+	 */
+	memset(&ws, 0, sizeof(ws));
+	ws.ws_row = 24;
+	ws.ws_col = 80;
+
+	pb->pid = fork();
+	if (pb->pid < 0) {
+		fprintf(stderr, "Failed forking: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (pb->pid == 0) {
+		setsid();
+
+		slave = open(name, O_RDWR);
+		if (slave < 0) _exit(1);
+
+		ioctl(slave, TIOCSWINSZ, &ws);
+
+		dup2(slave, STDIN_FILENO);
+		dup2(slave, STDOUT_FILENO);
+		dup2(slave, STDERR_FILENO);
+		if (slave > STDERR_FILENO) close(slave);
+		close(pb->fd);
+
+		/*
+		 *	Keep the history out of the real home directory.
+		 */
+		setenv("HOME", home, 1);
+		setenv("TERM", "xterm", 1);
+
+		execv(recli, argv);
+		_exit(1);
+	}
+
+	/*
+	 *	Wait for the first prompt.
+	 */
+	if (pty_drain(pb, 5000, NULL) <= 0) {
+		fprintf(stderr, "No prompt from %s\n", recli);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sample_cmp(const void *one, const void *two)
+{
+	const uint64_t *a = one;
+	const uint64_t *b = two;
+
+	if (*a < *b) return -1;
+	if (*a > *b) return +1;
+	return 0;
+}
+
+static double percentile(const uint64_t *sorted, int num, int pct)
+{
+	int rank;
+
+	rank = (num * pct + 99) / 100;
+	if (rank < 1) rank = 1;
+
+	return sorted[rank - 1] / 1000.0;
+}
+
+static void pty_print(pty_bench_t *pb, int syntax_lines)
+{
+	int i;
+
+	for (i = 0; i < KEY_MAX; i++) {
+		pty_stats_t *s = &pb->stats[i];
+
+		if (!s->num) continue;
+
+		qsort(s->samples, s->num, sizeof(s->samples[0]), sample_cmp);
+
+		printf("{\"key\": \"%s\", \"syntax_lines\": %d, \"count\": %d, \"silent\": %d, "
+		       "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, "
+		       "\"in_bytes_per_key\": %.1f, \"out_bytes_per_key\": %.1f",
+		       key_names[i], syntax_lines, s->num, s->silent,
+		       percentile(s->samples, s->num, 50),
+		       percentile(s->samples, s->num, 90),
+		       percentile(s->samples, s->num, 99),
+		       s->samples[s->num - 1] / 1000.0,
+		       (double) s->in_bytes / s->num,
+		       (double) s->out_bytes / s->num);
+		if (pb->have_io) {
+			printf(", \"syscalls_per_key\": %.1f", (double) s->syscalls / s->num);
+		}
+		printf("}\n");
+	}
+}
+
+/*
+ *	One round for each input line:
+ *
+ *	- type it one character at a time, press '?', and run it
+ *	- type the first two characters, and press TAB
+ *	- bring it back with the up arrow
+ *	- paste it in one go, and run it again
+ */
+static int pty_line(pty_bench_t *pb, const char *line)
+{
+	size_t i, len;
+
+	len = strlen(line);
+	if (!len) return 0;
+
+	for (i = 0; i < len; i++) {
+		if (pty_key(pb, KEY_TYPE, line + i, 1) < 0) return -1;
+	}
+	if (pty_key(pb, KEY_HELP, "?", 1) < 0) return -1;
+	if (pty_key(pb, KEY_ENTER, "\r", 1) < 0) return -1;
+
+	if (len > 2) {
+		if (write(pb->fd, line, 2) != 2) return -1;
+		if (pty_drain(pb, 1000, NULL) < 0) return -1;
+		if (pty_key(pb, KEY_TAB, "\t", 1) < 0) return -1;
+		if (pty_send(pb, "\025") < 0) return -1;
+	}
+
+	if (pty_key(pb, KEY_HISTORY, "\033[A", 3) < 0) return -1;
+	if (pty_send(pb, "\025") < 0) return -1;
+
+	if (pty_key(pb, KEY_PASTE, line, len) < 0) return -1;
+	if (pty_key(pb, KEY_ENTER, "\r", 1) < 0) return -1;
+
+	return 0;
+}
+
+static int count_lines(const char *filename)
+{
+	int c, lines = 0;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if (!fp) return -1;
+
+	while ((c = getc(fp)) != EOF) {
+		if (c == '\n') lines++;
+	}
+
+	fclose(fp);
+	return lines;
+}
+
+static void usage(char const *name, int rcode)
+{
+	FILE *out = stderr;
+
+	if (rcode == 0) out = stdout;
+
+	fprintf(out, "Usage: %s -s syntax.txt -i inputs.txt [-H help.md] [-n lines] [-w ms] [-r recli]\n", name);
+	fprintf(out, "  -s <syntax>     Syntax to load into recli\n");
+	fprintf(out, "  -i <inputs>     Commands to type, one per line\n");
+	fprintf(out, "  -H <help>       Help file to load into recli\n");
+	fprintf(out, "  -n <lines>      Number of input lines to use (default 50)\n");
+	fprintf(out, "  -w <ms>         Output is finished after this much quiet (default 5)\n");
+	fprintf(out, "  -r <recli>      Program to run (default ./recli)\n");
+	fprintf(out, "\n");
+	fprintf(out, "  recli-bench -g, -H and -I generate the syntax, help and inputs.\n");
+	fprintf(out, "  Results are printed as one JSON object per key type.\n");
+	exit(rcode);
+}
+
+int main(int argc, char **argv)
+{
+	int c, i, n, max_lines, status;
+	char const *progname;
+	const char *syntax_file = NULL, *input_file = NULL, *help_file = NULL;
+	const char *recli = "./recli";
+	char *recli_argv[8];
+	char home[] = "/tmp/recli-pty.XXXXXX";
+	char buffer[4096];
+	FILE *fp;
+	pty_bench_t pb;
+
+	progname = strrchr(argv[0], '/');
+	if (progname) {
+		progname++;
+	} else {
+		progname = argv[0];
+	}
+
+	memset(&pb, 0, sizeof(pb));
+	pb.settle_ms = 5;
+	max_lines = 50;
+
+	while ((c = getopt(argc, argv, "hH:i:n:r:s:w:")) != EOF) switch(c) {
+		case 'h':
+			usage(progname, 0);
+			break;
+
+		case 'H':
+			help_file = optarg;
+			break;
+
+		case 'i':
+			input_file = optarg;
+			break;
+
+		case 'n':
+			max_lines = atoi(optarg);
+			break;
+
+		case 'r':
+			recli = optarg;
+			break;
+
+		case 's':
+			syntax_file = optarg;
+			break;
+
+		case 'w':
+			pb.settle_ms = atoi(optarg);
+			break;
+
+		default:
+			usage(progname, 1);
+			break;
+		}
+
+	if (!syntax_file || !input_file || (max_lines <= 0) || (pb.settle_ms <= 0)) {
+		usage(progname, 1);
+	}
+
+	fp = fopen(input_file, "r");
+	if (!fp) {
+		fprintf(stderr, "Failed opening %s: %s\n", input_file, strerror(errno));
+		exit(1);
+	}
+
+	if (!mkdtemp(home)) {
+		fprintf(stderr, "Failed creating %s: %s\n", home, strerror(errno));
+		exit(1);
+	}
+
+	n = 0;
+	recli_argv[n++] = "recli";
+	recli_argv[n++] = "-s";
+	recli_argv[n++] = (char *) syntax_file;
+	if (help_file) {
+		recli_argv[n++] = "-H";
+		recli_argv[n++] = (char *) help_file;
+	}
+	recli_argv[n] = NULL;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (pty_start(&pb, recli, recli_argv, home) < 0) goto done;
+
+	pb.have_io = 1;
+
+	for (i = 0; (i < max_lines) && fgets(buffer, sizeof(buffer), fp); i++) {
+		char *p;
+
+		p = strchr(buffer, '\n');
+		if (p) *p = '\0';
+
+		if (pty_line(&pb, buffer) < 0) {
+			fprintf(stderr, "Failed talking to recli: %s\n", strerror(errno));
+			break;
+		}
+	}
+
+	pty_print(&pb, count_lines(syntax_file));
+
+	/*
+	 *	^D on an empty line exits.
+	 */
+	pty_send(&pb, "\004");
+	close(pb.fd);
+
+done:
+	fclose(fp);
+
+	if (pb.pid > 0) waitpid(pb.pid, &status, 0);
+
+	snprintf(buffer, sizeof(buffer), "%s/.recli/recli_history.txt", home);
+	unlink(buffer);
+	snprintf(buffer, sizeof(buffer), "%s/.recli", home);
+	rmdir(buffer);
+	rmdir(home);
+
+	for (i = 0; i < KEY_MAX; i++) free(pb.stats[i].samples);
+
+	return 0;
+}
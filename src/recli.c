@@ -32,61 +32,26 @@ static recli_config_t config = {
 	.permissions = NULL
 };
 
-static char *prompt_full = "";
-static char *prompt_ctx = "";
 static char *history_file = NULL;
+static int history_shared = 0;
+static syntax_counters_t counted;
 
 /*
- *	Admins can type a partial command, in which case it's put on
- *	the stack, and the prompt changes to include the partial
- *	command.  We want to track these partial commands, but also
- *	limit the size of the stack.
+ *	The engine is in librecli.  This is the line editing, the
+ *	history, and the command-line options around one session.
  */
-typedef struct ctx_stack_t {
-	char		*prompt;
-
-	char		*buf;
-	size_t		len;
-	size_t		bufsize;
-
-	char		*argv_buf;
-	size_t		argv_bufsize;
-
-	int		argc;
-	char		**argv;
-
-	int		total_argc;
-	int		max_argc;
-
-	cli_syntax_t	*syntax;
-	cli_syntax_t	*short_help;
-	cli_syntax_t	*long_help;
-} ctx_stack_t;
-
-
-static char ctx_line_buf[8192];	/* full line of whatever the user entered */
-static char ctx_argv_buf[8192];	/* copy of the above, split into argv */
-static char *ctx_argv[256];	/* where the argvs are */
-
-#define CTX_STACK_MAX (32)
-
-static int ctx_stack_index = 0;
-static ctx_stack_t ctx_stack_array[CTX_STACK_MAX];
-static ctx_stack_t *ctx_stack = NULL;
-
-extern pid_t child_pid;
-
-typedef void (*builtin_func_t)(int , char **);
-
-typedef struct builtin_t {
-	char const	*name;
-	builtin_func_t	function;
-} builtin_t;
+static recli_session_t *session = NULL;
 
 static void catch_sigquit(int sig)
 {
+	pid_t child_pid = recli_session_child(session);
+
+	/*
+	 *	A job brought back with "fg" has its own process
+	 *	group, so the terminal doesn't signal it.
+	 */
 	if (child_pid > 1) {
-		kill(child_pid, sig);
+		if (kill(-child_pid, sig) < 0) kill(child_pid, sig);
 	}
 
 	/*
@@ -106,6 +71,15 @@ static int set_signal(int sig, sig_t func)
 	return sigaction(sig, &act, NULL);
 }
 
+/*
+ *	Print the statistics on SIGUSR1, even while we're waiting for
+ *	input.
+ */
+static void catch_sigusr1(UNUSED int sig)
+{
+	recli_session_write_steps(session, STDERR_FILENO);
+}
+
 #ifndef NO_COMPLETION
 void completion(const char *buf, linenoiseCompletions *lc)
 {
@@ -115,7 +89,7 @@ void completion(const char *buf, linenoiseCompletions *lc)
 
 	if (in_string) return;
 
-	num = syntax_tab_complete(ctx_stack->syntax, buf, strlen(buf), 256, tabs);
+	num = recli_session_complete(session, buf, 256, tabs);
 	if (num == 0) return;
 	
 	for (i = 0; i < num; i++) {
@@ -172,407 +146,81 @@ int foundquote(const char *buf, size_t len, char c)
  */
 static int short_help(const char *line, size_t len, UNUSED char c)
 {
-	int argc;
-	char *argv[256];
-	char buffer[1024];
-
 	/*
 	 *	In a quoted string, don't do anything.
 	 */
 	if (in_string) return 0;
 
-	recli_fprintf(recli_stdout, "?\r\n");
-
-	if (!ctx_stack->short_help) {
-	do_print:
-		syntax_print_lines(ctx_stack->syntax);
-		return 1;
-	}
-	
-	memcpy(buffer, line, len + 1);
-	argc = str2argv(buffer, len, 256, argv);
-
-	if (argc < 0) goto do_print;
-
-	if (ctx_stack_index > 0) {
-		ctx_stack_t *c = &ctx_stack_array[ctx_stack_index - 1];
-
-		recli_fprintf(recli_stdout, "%s - ", c->argv[c->argc - 1]);
-	}
-	syntax_print_context_help(ctx_stack->short_help, argc, argv);
-	syntax_print_context_help_subcommands(ctx_stack->syntax, ctx_stack->short_help, argc, argv);
-
-	return 1;
+	return recli_session_short_help(session, line, len);
 }
 
 
 static const char *history_callback(const char *buffer)
 {
-	int i, j;
-	const char *p;
-
-	if (ctx_stack_index == 0) return buffer;
-
-	p = buffer;
-
-	for (i = 0; i < ctx_stack_index; i++) {
-		ctx_stack_t *c;
-
-		c = &ctx_stack_array[i];
-
-		for (j = 0; j < c->argc; j++) {
-			size_t len;
-
-			len = strlen(c->argv[j]);
-
-			if ((strncmp(c->argv[j], p, len) == 0) && isspace((int) p[len])) {
-				p += len + 1;
-				continue;
-			}
-
-			return p;
-		}
-	}
-
-
-	return p;
-}
-
-
-/*
- *	Stack functions
- */
-static void ctx_stack_pop(void)
-{
-	if (ctx_stack_index == 0) return;
-
-	assert(ctx_stack->syntax != NULL);
-	syntax_free(ctx_stack->syntax);
-	if (ctx_stack->long_help) syntax_free(ctx_stack->long_help);
-	if (ctx_stack->short_help) syntax_free(ctx_stack->short_help);
-
-	ctx_stack_index--;
-	ctx_stack--;
-
-	/*
-	 *	Reset buffers, etc. for the previous context.
-	 */
-	ctx_stack->buf[0] = '\0';
-	ctx_stack->argv_buf[0] = '\0';
-	ctx_stack->argv[0] = NULL;
-	ctx_stack->argc = 0;
+	return recli_session_strip_context(session, buffer);
 }
 
 /*
- *	The user-entered string is already in ctx_stack->buf
+ *	Called by the session for each line which it checked.
  */
-static void ctx_stack_push(int argc)
+static void history_save(UNUSED void *ctx, const char *line)
 {
-	size_t len;
-	ctx_stack_t *next;
-	cli_syntax_t *match;
-
-	if (ctx_stack_index >= (CTX_STACK_MAX - 1)) return;
-
-	next = ctx_stack + 1;
-
-	match = syntax_match_max(ctx_stack->syntax, argc, ctx_stack->argv);
-	assert(match != NULL);
-
-	next->syntax = syntax_skip_prefix(match, argc);
-	assert(next->syntax != NULL);
-	syntax_free(match);
-
-	if (ctx_stack->short_help) {
-		match = syntax_match_max(ctx_stack->short_help, argc, ctx_stack->argv);
-		if (match) {
-			next->short_help = syntax_skip_prefix(match, argc);
-			syntax_free(match);
-		} else {
-			next->short_help = NULL;
-		}
-	} else {
-		next->short_help = NULL;
-	}
-
-	if (ctx_stack->long_help) {
-		match = syntax_match_max(ctx_stack->long_help, argc, ctx_stack->argv);
-		if (match) {
-			next->long_help = syntax_skip_prefix(match, argc);
-			syntax_free(match);
-		} else {
-			next->long_help = NULL;
-		}
+	if (history_file && history_shared) {
+		linenoiseHistoryAppend(history_file, line);
 	} else {
-		next->long_help = NULL;
-	}
-
-	len = strlen(ctx_stack->buf);
-
-	ctx_stack->buf[len++] = ' ';
-	ctx_stack->buf[len] = '\0';
-	ctx_stack->argc = argc;
-
-	ctx_stack->len = len;
-
-	next->buf = ctx_stack->buf + len;
-	next->bufsize = ctx_stack->bufsize - len;
-
-	next->argv_buf = &ctx_argv_buf[0] + (next->buf - &ctx_line_buf[0]);
-	next->argv_bufsize = next->bufsize;
+		linenoiseHistoryAdd(line);
 
-	next->argv = ctx_stack->argv + argc;
-	next->argv[0] = NULL;
-
-	next->max_argc = ctx_stack->max_argc - argc;
-	next->argc = 0;
-	next->total_argc = ctx_stack->total_argc + argc;
-
-	next->prompt = prompt_ctx;
-
-	ctx_stack_index++;
-	ctx_stack = next;
-}
-
-
-/*
- *	Builtin commands
- */
-static void builtin_help(int argc, char **argv)
-{
-	int rcode;
-	char const *help;
-	char const *error;
-
-	/*
-	 *	Show the current syntax
-	 */
-	if ((argc >= 1) && (strcmp(argv[0], "syntax") == 0)) {
-		syntax_print_lines(ctx_stack->syntax);
-		return;
-	}
-
-	rcode = syntax_check(ctx_stack->syntax, argc, argv, &error, NULL);
-	if (rcode < 0) {
-		if (!error) {
-			fprintf(stderr, "Invalid input\n");
-		} else {
-			fprintf(stderr, "Invalid input in word %d - '%s'\n", -rcode, error);
-		}
-
-		return;
-	}
-
-	if (!ctx_stack->long_help) return;
-
-	/*
-	 *	Print short help text first
-	 */
-	syntax_print_context_help(ctx_stack->long_help, argc, argv);
-
-	help = syntax_show_help(ctx_stack->long_help, argc, argv);
-	if (!help) {
-		recli_fprintf(recli_stdout, "\r\n");
-	} else {
-		recli_fprintf_words(recli_stdout, "%s", help);
+		if (history_file) linenoiseHistorySave(history_file);
 	}
-
-	return;
 }
 
 /*
- *	The built-in commands don't bother checking for too
- *	much input.  They also take priority over user
- *	commands.
+ *	While a line is being edited, the output of background jobs is
+ *	read, and finished jobs are announced above the line.
  */
-static void builtin_end(UNUSED int argc, UNUSED char *argv[])
+static int job_fds(int *fds, int max_fds)
 {
-	while (ctx_stack_index > 0) ctx_stack_pop();
+	return recli_session_job_fds(session, fds, max_fds);
 }
 
-static void builtin_exit(UNUSED int argc, UNUSED char *argv[])
+static void job_event(void)
 {
-	if (ctx_stack_index == 0) {
-		exit(0);
-	}
-
-	ctx_stack_pop();
-
-	recli_fprintf(recli_stdout, "%s\n", ctx_line_buf);
+	recli_session_jobs_update(session, 1);
 }
 
-static void builtin_quit(UNUSED int argc, UNUSED char *argv[])
+/*
+ *	With "-X count", print the work which the syntax engine did
+ *	for each line.  That includes any TAB completion or help while
+ *	the line was being edited.
+ */
+static int process(char *line)
 {
-	exit(0);
-}
-
-static builtin_t builtin_commands[] = {
-	{ "end", builtin_end },
-	{ "exit", builtin_exit },
-	{ "help", builtin_help },
-	{ "logout", builtin_quit },
-	{ "quit", builtin_quit },
-	{ NULL, NULL }
-};
-
-static char const *spaces = "                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                ";
-
-static void process(int tty, char *line)
-{
-	int i, c, argc;
-	int runit = 1;
-	int needs_tty = 0;
-	size_t len = strlen(line);
-	const char *error;
-	char **argv;
-
-	if (!len) return;
-
-	if (len >= ctx_stack->bufsize) {
-		fprintf(stderr, "line too long\r\n");
-		return;
-	}
-
-	/*
-	 *	Copy the text to the two buffers.
-	 */
-	memcpy(ctx_stack->buf, line, len + 1);
-	memcpy(ctx_stack->argv_buf, line, len + 1);
-
-	argv = ctx_stack->argv;
-
-	argc = str2argv(ctx_stack->argv_buf, len, ctx_stack->max_argc, argv);
-	if (!argc) return;
-
-	if (argc < 0) {
-		fprintf(stderr, "%s\n", ctx_stack->buf);
-		fprintf(stderr, "%.*s^", -argc, spaces);
-		fprintf(stderr, " Parse error.\n");
-		return;
-	}
-
-	for (i = 0; builtin_commands[i].name != NULL; i++) {
-		if (strcmp(argv[0], builtin_commands[i].name) == 0) {
-			builtin_commands[i].function(argc - 1, argv + 1);
-			return;
-		}
-	}
-
-	/*
-	 *	c < 0 - error in argument -C
-	 *	c == argc, parsed it completely
-	 *	c > argc, add new context
-	 */
-	c = syntax_check(ctx_stack->syntax, argc, argv, &error, &needs_tty);
-
-	if (c < 0) {
-		/*
-		 *	FIXME: check against argc
-		 *
-		 *	FIXME: check against stack
-		 *
-		 *	if we have "x y" on the stack
-		 *	and type in an erroneous "z",
-		 *	the c here will be -3, not -1.
-		 */
-		fprintf(stderr, "%s\n", ctx_stack->buf);
-
-		if (-c == argc) {
-			fprintf(stderr, "%.*s^", (int) (ctx_stack->argv[argc - 1] - ctx_stack->argv_buf), spaces);
-
-		} else if (-c > argc) {
-			fprintf(stderr, "%.*s^", (int) strlen(ctx_stack->buf), spaces);
-
-		} else {
-			fprintf(stderr, "%.*s^", (int) (ctx_stack->argv[-c - 1] - ctx_stack->argv_buf), spaces);
-		}
-
-		if (!error) error = "Parse error";
-
-		fprintf(stderr, " %s.\n", error);
-		
-		runit = 0;
-		goto add_line;
-	}
-
-	/*
-	 *	We reached the end of the syntax before the end of the input
-	 */
-	if (c < argc) {
-		fprintf(stderr, "%s\n", ctx_stack->buf);
-		fprintf(stderr, "%.*s^", (int) (ctx_stack->argv[c] - ctx_stack->argv_buf), spaces);
-
-		fprintf(stderr, " Unexpected text.\n");
-		runit = 0;
-		goto add_line;
-	}
-
-	/*
-	 *	FIXME: figure out which thing we didn't have permission for.
-	 *
-	 *	Note that we check the permissions on the FULL arguments, because that's how it works.
-	 */
-	if (!permission_enforce(config.permissions, ctx_stack->total_argc + argc,
-				ctx_argv)) {
-		fprintf(stderr, "%s\n", line);
-		fprintf(stderr, "^ - No permission\n");
-		runit = 0;
-		goto add_line;
-	}
-
-	/*
-	 *	Got N commands, wanted M > N in order to do anything.
-	 */
-	if (c > argc) {
-		runit = 0;
-
-		if (ctx_stack_index >= (CTX_STACK_MAX - 1)) {
-			c = -1;
-			goto add_line;
-		}
-
-		ctx_stack_push(argc);
-		return;
-	}
-
-	runit = 1;
-
-add_line:
-	if (tty) {
-		/*
-		 *	Save the FULL text in the history.
-		 */
-		linenoiseHistoryAdd(ctx_line_buf);
-
-		if (history_file) linenoiseHistorySave(history_file);
-	}
-
-	if (runit && config.dir) {
-		char buffer[8192];
-
-		snprintf(buffer, sizeof(buffer), "%s/bin/",
-			 config.dir);
-		
-#if 0
-		printf("RUNNING %s\n", buffer);
-		for (int i = 0; i <  ctx_stack->total_argc + argc; i++) {
-			printf("\t%d %s\n", i, ctx_argv[i]);
-		}
-#endif
-
-		recli_exec(buffer, needs_tty, ctx_stack->total_argc + argc,
-			   ctx_argv, config.envp);
-		recli_load_syntax(&config);
-
-		/* If the config was reloaded, update the stack */
-		if (config.syntax != ctx_stack->syntax) {
-			while (ctx_stack_index > 0) ctx_stack_pop();
-			ctx_stack->syntax = config.syntax;
-		}
-
-		fflush(stdout);
-		fflush(stderr);
-	}
+	int done;
+	syntax_counters_t used;
+
+	done = recli_session_process(session, line);
+
+	if (!syntax_counting) return done;
+
+#define USED(_x) used._x = syntax_counters._x - counted._x
+	USED(checks);
+	USED(check_nodes);
+	USED(matches);
+	USED(match_nodes);
+	USED(prefixes);
+	USED(prefix_nodes);
+	USED(skips);
+	USED(memo_hits);
+	USED(backtracks);
+	USED(datatypes);
+	USED(allocs);
+#undef USED
+
+	fflush(stdout);
+	recli_counters_print(stderr, line, &used);
+	counted = syntax_counters;
+
+	return done;
 }
 
 static void usage(char const *name, int rcode)
@@ -583,6 +231,7 @@ static void usage(char const *name, int rcode)
 
 	fprintf(out, "Usage: %s [-d config_dir]\n", name);
 	fprintf(out, "  -d <config_dir>	Configuration file directory, defaults to '%s'\n", config.dir);
+	fprintf(out, "  -S              Share command history with other sessions\n");
 	fprintf(out, "\n");
 	fprintf(out, "  Additional options which should be used only for testing,\n");
 	fprintf(out, "  as they will ignore the configuration directory\n");
@@ -591,10 +240,54 @@ static void usage(char const *name, int rcode)
 	fprintf(out, "  -H help.txt     Load 'help.txt' as the help text file.\n");
 	fprintf(out, "  -s syntax.txt   Load syntax from 'syntax.txt'\n");
 	fprintf(out, "  -p perm.txt     Load permissions from 'perm.txt'\n");
-	fprintf(out, "  -X <flag>       Add debugging.  Valid flags are 'syntax'\n");
+	fprintf(out, "  -X <flag>       Add debugging.  Valid flags are 'syntax', 'lint'\n");
+	fprintf(out, "                  to warn about ambiguous alternatives in the syntax,\n");
+	fprintf(out, "                  'exec' to print how long running commands took, and\n");
+	fprintf(out, "                  'stats' to print the size of the syntax, and to time\n");
+	fprintf(out, "                  each step of processing a line.  The times are printed\n");
+	fprintf(out, "                  on exit, on SIGUSR1, and by \"show stats\".\n");
+	fprintf(out, "                  'count' prints how many nodes the syntax engine visited\n");
+	fprintf(out, "                  for each line.\n");
+	fprintf(out, "                  'trace=file' writes a Chrome trace of the session to\n");
+	fprintf(out, "                  'file' on exit, as does setting RECLI_TRACE=file.\n");
+	fprintf(out, "\n");
+	fprintf(out, "  --check <file>  Check each line of 'file' (or '-' for stdin) against\n");
+	fprintf(out, "                  the syntax and permissions, without running anything.\n");
+	fprintf(out, "  --threads <num> Number of threads to use for --check.\n");
+	fprintf(out, "  --startup-profile\n");
+	fprintf(out, "                  Print the wall clock and CPU time of each phase of\n");
+	fprintf(out, "                  starting up.\n");
+	fprintf(out, "  --daemon <addr> Serve sessions on 'addr', until SIGINT or SIGTERM.\n");
+	fprintf(out, "                  A path is a UNIX socket, anything else is a TCP\n");
+	fprintf(out, "                  'port', 'host:port' or '[host]:port'.  A port on\n");
+	fprintf(out, "                  its own is on the loopback address, and '*:port'\n");
+	fprintf(out, "                  is on every address.  May be given more than once.\n");
+	fprintf(out, "  --client <addr> Connect to a server started with --daemon.\n");
 	exit(rcode);
 }
 
+/*
+ *	Defined if a syntax compiled by recli-compile is linked in.
+ */
+extern const recli_static_t recli_static WEAK;
+
+#define OPT_CHECK	(256)
+#define OPT_THREADS	(257)
+#define OPT_STARTUP_PROFILE	(258)
+#define OPT_DAEMON	(259)
+#define OPT_CLIENT	(260)
+
+#define MAX_DAEMONS	(16)
+
+static const struct option long_options[] = {
+	{ "check", required_argument, NULL, OPT_CHECK },
+	{ "threads", required_argument, NULL, OPT_THREADS },
+	{ "startup-profile", no_argument, NULL, OPT_STARTUP_PROFILE },
+	{ "daemon", required_argument, NULL, OPT_DAEMON },
+	{ "client", required_argument, NULL, OPT_CLIENT },
+	{ NULL, 0, NULL, 0 }
+};
+
 int main(int argc, char **argv)
 {
 	int c, rcode;
@@ -603,6 +296,16 @@ int main(int argc, char **argv)
 	char *line;
 	int tty = 1;
 	int debug_syntax = 0;
+	int lint_syntax = 0;
+	int count_syntax = 0;
+	int session_flags = 0;
+	int dir_set = 0;
+	char const *check_file = NULL;
+	int check_threads = 0;
+	char const *daemons[MAX_DAEMONS];
+	int num_daemons = 0;
+	char const *client = NULL;
+	recli_clock_t startup, when;
 
 #ifndef NO_COMPLETION
 	linenoiseSetCompletionCallback(completion);
@@ -611,6 +314,9 @@ int main(int argc, char **argv)
 	recli_stdout = stdout;
 	recli_stderr = stderr;
 
+	line = getenv("RECLI_TRACE");
+	if (line && *line && (recli_trace_open(line) < 0)) exit(1);
+
 	progname = strrchr(argv[0], '/');
 	if (progname) {
 		progname++;
@@ -618,9 +324,10 @@ int main(int argc, char **argv)
 		progname = argv[0];
 	}
 
-	while ((c = getopt(argc, argv, "d:hH:p:qr:s:P:X:")) != EOF) switch(c) {
+	while ((c = getopt_long(argc, argv, "d:hH:p:qr:s:SP:X:", long_options, NULL)) != EOF) switch(c) {
 		case 'd':
 			config.dir = optarg;
+			dir_set = 1;
 			break;
 
 		case 'h':
@@ -648,6 +355,10 @@ int main(int argc, char **argv)
 			config.dir = NULL;
 			break;
 
+		case 'S':
+			history_shared = 1;
+			break;
+
 		case 'P':
 			config.prompt = optarg;
 			break;
@@ -656,6 +367,46 @@ int main(int argc, char **argv)
 			if (strcmp(optarg, "syntax") == 0) {
 				debug_syntax = 1;
 			}
+			if (strcmp(optarg, "lint") == 0) {
+				lint_syntax = 1;
+			}
+			if (strcmp(optarg, "exec") == 0) {
+				session_flags |= RECLI_SESSION_EXEC_TIMES;
+			}
+			if (strcmp(optarg, "stats") == 0) {
+				session_flags |= RECLI_SESSION_STEP_TIMES;
+			}
+			if (strcmp(optarg, "count") == 0) {
+				count_syntax = 1;
+			}
+			if ((strncmp(optarg, "trace=", 6) == 0) &&
+			    (recli_trace_open(optarg + 6) < 0)) {
+				exit(1);
+			}
+			break;
+
+		case OPT_CHECK:
+			check_file = optarg;
+			break;
+
+		case OPT_THREADS:
+			check_threads = atoi(optarg);
+			break;
+
+		case OPT_STARTUP_PROFILE:
+			recli_startup_profile = 1;
+			break;
+
+		case OPT_DAEMON:
+			if (num_daemons == MAX_DAEMONS) {
+				fprintf(stderr, "Too many addresses for --daemon\n");
+				exit(1);
+			}
+			daemons[num_daemons++] = optarg;
+			break;
+
+		case OPT_CLIENT:
+			client = optarg;
 			break;
 		    
 		default:
@@ -663,32 +414,60 @@ int main(int argc, char **argv)
 			break;
 		}
 
+	/*
+	 *	The server has the configuration, not us.
+	 */
+	if (client) exit(recli_client(client) < 0);
+
+	recli_clock_start(&startup);
+
 	argc -= (optind - 1);
 	argv += (optind - 1);
 
-	if (!isatty(STDIN_FILENO)) {
+	/*
+	 *	A server prompts each session, whatever our stdin is.
+	 */
+	if (num_daemons) {
+		tty = 0;
+		if (!config.prompt) config.prompt = progname;
+		config.scan_changes = 1; /* as recli_server() does */
+
+	} else if (!isatty(STDIN_FILENO)) {
 		config.prompt = "";
 		tty = 0;
 	}
 
-	if (tty) {
-		/*
-		 *	The default prompt is the program name.
-		 */
-		if (!config.prompt) config.prompt = progname;
+	/*
+	 *	The default prompt is the program name.
+	 */
+	if (tty && !config.prompt) config.prompt = progname;
+
+	/*
+	 *	Use the compiled syntax, help and permissions, unless
+	 *	we were told to load a syntax.  The configuration
+	 *	directory is the one given to recli-compile, unless
+	 *	we were told to use a different one.
+	 */
+	if (&recli_static && !config.syntax) {
+		if (syntax_load_static(&recli_static, &config.syntax,
+				       &config.long_help, &config.short_help) < 0) {
+			exit(1);
+		}
 
-		prompt_full = malloc(256);
-		snprintf(prompt_full, 256, "%s> ", config.prompt);
+		rcode = permission_load_static(&recli_static, &config.permissions);
+		if (rcode < 0) exit(1);
+		if (rcode == 0) exit(0);
 
-		prompt_ctx = malloc(256);
-		snprintf(prompt_ctx, 256, "%s ...> ", config.prompt);
+		config.static_syntax = 1;
+		if (!dir_set) config.dir = recli_static.dir;
 	}
 
 	/*
 	 *	No config dir and we're NOT named "recli".
 	 *	Look in /etc/recli/FOO for our configuration.
 	 */
-	if (!config.dir && (strcmp(progname, "recli") != 0)) {
+	if (!config.dir && !config.static_syntax &&
+	    (strcmp(progname, "recli") != 0)) {
 		line = malloc(2048);
 		snprintf(line, 2048, "/etc/recli/%s", progname);
 		config.dir = line;
@@ -712,7 +491,18 @@ int main(int argc, char **argv)
 
 			 snprintf(history_file, 8192, "%s/.recli/%s_history.txt", home, progname);
 
-			 linenoiseHistoryLoad(history_file); /* Load the history at startup */
+			 /*
+			  *	Load the history at startup.  Shared
+			  *	history is read incrementally, so that we
+			  *	can pick up other sessions' entries later.
+			  */
+			 recli_clock_start(&when);
+			 if (history_shared) {
+				 linenoiseHistorySync(history_file);
+			 } else {
+				 linenoiseHistoryLoad(history_file);
+			 }
+			 recli_startup_done("history", &when);
 		 }
 
 		 linenoiseSetHistoryCallback(history_callback);
@@ -729,16 +519,70 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/*
+	 *	Nothing changes the syntax or the help after this,
+	 *	other than reloading it.
+	 */
+	recli_clock_start(&when);
+	syntax_freeze(config.syntax);
+	syntax_freeze(config.long_help);
+	syntax_freeze(config.short_help);
+	if (!config.static_syntax) syntax_pack(config.syntax);
+	recli_startup_done("syntax_pack", &when);
+
+	recli_startup_done("startup", &startup);
+	if (recli_startup_profile) recli_startup_print(stderr);
+
 	if (debug_syntax) {
 		syntax_printf(config.syntax);printf("\r\n");
 	}
 
+	if (lint_syntax) syntax_lint(config.syntax);
+
+	if (session_flags & RECLI_SESSION_STEP_TIMES) syntax_print_stats(stderr, config.syntax);
+
 	if (!config.dir && !config.banner && tty) {
 		recli_fprintf(recli_stdout, "Welcome to ReCLI\nCopyright (C) 2016 Alan DeKok\n\nType \"help\" for help, or use '?' for context-sensitive help.\n");
-	}	
+	}
+
+	if (check_file) {
+		rcode = recli_check_file(&config, check_file, check_threads);
+		exit(rcode != 0);
+	}
+
+	if (num_daemons) {
+		if (quit) exit(0);
+
+		rcode = recli_server(&config, num_daemons, daemons);
+
+		recli_snapshot_publish(&config.snapshot, NULL);
+		recli_snapshot_reclaim();
+		permission_free(config.permissions);
+		recli_rest_free(config.rest);
+		syntax_free(NULL);
+
+		exit(rcode != 0);
+	}
+
+	/*
+	 *	The syntax and help are published as a snapshot, which
+	 *	is replaced when the syntax is reloaded.
+	 */
+	session = recli_session_alloc(&config, session_flags);
+	if (!session) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	if (tty) recli_session_history(session, history_save, NULL);
 
 	if (quit) goto done;
 
+	/*
+	 *	Not for "--check", which may use threads.
+	 */
+	syntax_counting = count_syntax;
+
 #ifdef SIGPIPE
 	signal(SIGPIPE, SIG_IGN);
 #endif
@@ -747,40 +591,70 @@ int main(int argc, char **argv)
 	set_signal(SIGQUIT, catch_sigquit);
 
 	/*
-	 *	Set up the stack.
+	 *	Restart reads which are interrupted by SIGUSR1, so that
+	 *	we don't lose the line being edited.
 	 */
-	ctx_stack_index = 0;
-	ctx_stack = &ctx_stack_array[0];
+	if (session_flags & RECLI_SESSION_STEP_TIMES) {
+		struct sigaction act;
+
+		memset(&act, 0, sizeof(act));
+		act.sa_flags = SA_RESTART;
+		sigemptyset(&act.sa_mask);
+		act.sa_handler = catch_sigusr1;
+		sigaction(SIGUSR1, &act, NULL);
+	}
 
-	ctx_stack->argv = ctx_argv;
-	ctx_stack->argc = 0;
-	ctx_stack->total_argc = 0;
-	ctx_stack->max_argc = sizeof(ctx_argv) / sizeof(ctx_argv[0]);
-	
-	ctx_stack->buf = ctx_line_buf;
-	ctx_stack->bufsize = sizeof(ctx_line_buf);
+	if (!tty) {
+		recli_input_t input;
+
+		/*
+		 *	Not a terminal: read the input in large blocks,
+		 *	and skip all of the line editing.  Flush stdout
+		 *	before each line, so that the output is ordered
+		 *	the same as with a prompt.
+		 */
+		recli_input_init(&input, STDIN_FILENO);
 
-	ctx_stack->argv_buf = ctx_argv_buf;
-	ctx_stack->argv_bufsize = sizeof(ctx_argv_buf);
+		while ((line = recli_input_line(&input, NULL)) != NULL) {
+			fflush(stdout);
+			recli_session_jobs_update(session, 0);
+			if (process(line)) break;
+		}
 
-	ctx_stack->syntax = config.syntax;
-	ctx_stack->long_help = config.long_help;
-	ctx_stack->short_help = config.short_help;
+		recli_input_free(&input);
+		recli_session_jobs_wait(session);
+		goto done;
+	}
 
-	ctx_stack->prompt = prompt_full;
+	linenoiseSetWatchCallback(job_fds, job_event);
 
-	while ((line = linenoise(ctx_stack->prompt)) != NULL) {
-		process(tty, line);
+	for (;;) {
+		if (history_file && history_shared) linenoiseHistorySync(history_file);
+
+		recli_session_jobs_update(session, 1);
+
+		line = linenoise(recli_session_prompt(session));
+		if (!line) break;
+
+		if (process(line)) {
+			free(line);
+			break;
+		}
 		free(line);
 	}
 
 done:
-	while (ctx_stack_index > 0) ctx_stack_pop();
+	recli_session_print_exec(session, stderr);
+
+	fflush(stdout);
+	recli_session_write_steps(session, STDERR_FILENO);
+
+	recli_session_free(session);
 
-	if (config.short_help) syntax_free(config.short_help);
-	if (config.long_help) syntax_free(config.long_help);
-	syntax_free(config.syntax);
+	recli_snapshot_publish(&config.snapshot, NULL);
+	recli_snapshot_reclaim();
 	permission_free(config.permissions);
+	recli_rest_free(config.rest);
 
 	syntax_free(NULL);
 
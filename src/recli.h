@@ -1,9 +1,20 @@
 #include "linenoise.h"
 #include <stdarg.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include "datatypes.h"
 
+typedef struct recli_token_t {
+	size_t		offset;		/* from the start of the line */
+	size_t		length;
+	char		quote;		/* quote character, or 0 for a bare word */
+	int		escaped;	/* a quoted string contains backslashes */
+} recli_token_t;
+
 extern ssize_t strquotelen(const char *str);
+extern int str2tokens(const char *buf, size_t len, int max_tokens,
+		      recli_token_t *tokens, size_t *error);
+#define STR2ARGV_MAX (256)
 extern int str2argv(char *buf, size_t len, int max_argc, char *argv[]);
 extern void print_argv(int argc, char *argv[]);
 extern void print_argv_string(int argc, char *argv[]);
@@ -14,6 +25,24 @@ extern void *recli_stdout;
 extern void *recli_stderr;
 extern recli_fprintf_t recli_fprintf;
 
+typedef struct recli_input_t {
+	int		fd;
+	char		*buffer;
+	size_t		bufsize;
+	size_t		start;		/* start of the next line */
+	size_t		end;		/* end of the data read so far */
+	int		eof;
+	int		lineno;
+	int		mapped;		/* buffer is an mmap() of the file */
+	int		owns_fd;
+	char		*tail;		/* copy of a last line with no LF */
+} recli_input_t;
+
+extern void recli_input_init(recli_input_t *in, int fd);
+extern int recli_input_open(recli_input_t *in, const char *filename);
+extern char *recli_input_line(recli_input_t *in, size_t *len);
+extern void recli_input_free(recli_input_t *in);
+
 typedef struct cli_permission_t cli_permission_t;
 
 extern int permission_enforce(cli_permission_t *head, int argc, char *argv[]);
@@ -22,9 +51,45 @@ extern void permission_free(cli_permission_t *head);
 
 typedef struct cli_syntax_t cli_syntax_t;
 
+/*
+ *	On error, syntax_merge() leaves *phead alone, and the caller
+ *	still owns it.
+ */
 extern int syntax_merge(cli_syntax_t **phead, char *str);
 extern int syntax_parse_file(const char *filename, cli_syntax_t **);
 extern void syntax_free(cli_syntax_t *);
+extern int syntax_num_nodes(void);
+extern void syntax_freeze(cli_syntax_t *head);
+extern void syntax_collect(cli_syntax_t *roots[], int num_roots);
+extern int syntax_pack(cli_syntax_t *head);
+
+typedef struct syntax_image_t syntax_image_t;
+
+extern const syntax_image_t *syntax_image(const cli_syntax_t *head);
+extern int syntax_image_check(const syntax_image_t *img, int argc, char *argv[],
+			      const char **error, int *flags);
+extern int syntax_lint(cli_syntax_t *head);
+extern int syntax_print_stats(void *ctx, cli_syntax_t *head);
+
+/*
+ *	Work done by the syntax engine, for "-X count".
+ */
+typedef struct syntax_counters_t {
+	uint64_t	checks;		/* calls to syntax_check() */
+	uint64_t	check_nodes;	/* nodes it visited */
+	uint64_t	matches;	/* words given to syntax_match_word() */
+	uint64_t	match_nodes;	/* nodes it visited */
+	uint64_t	prefixes;	/* calls to syntax_prefix_words() */
+	uint64_t	prefix_nodes;	/* nodes it visited */
+	uint64_t	skips;		/* nodes skipped by their FIRST sets */
+	uint64_t	memo_hits;
+	uint64_t	backtracks;	/* trying the next alternative */
+	uint64_t	datatypes;	/* data type parser calls */
+	uint64_t	allocs;		/* nodes allocated */
+} syntax_counters_t;
+
+extern int syntax_counting;
+extern syntax_counters_t syntax_counters;
 
 typedef ssize_t (*recli_datatype_parse_t)(const char*, const char **);
 
@@ -32,6 +97,37 @@ extern int syntax_parse(const char *buffer, cli_syntax_t **out);
 extern int syntax_parse_add(const char *name, recli_datatype_parse_t callback);
 extern int syntax_check(cli_syntax_t *syntax, int argc, char *argv[],
 			const char **fail, int *flags);
+
+/*
+ *	Results of checking (node, argc) during one syntax_check(),
+ *	so that backtracking doesn't check the same thing twice.
+ */
+typedef struct syntax_memo_entry_t {
+	const void	*node;
+	int		argc;
+	int		words;
+	int		flags;
+	const char	*error;
+} syntax_memo_entry_t;
+
+#define SYNTAX_MEMO_FIXED	(64)
+
+typedef struct syntax_memo_t {
+	int			num_entries;
+	int			size;
+	syntax_memo_entry_t	*table;
+	const char		*word;		/* last word given to syntax_memo_word() */
+	uint64_t		word_mask;
+	syntax_memo_entry_t	fixed[SYNTAX_MEMO_FIXED];
+} syntax_memo_t;
+
+extern void syntax_memo_init(syntax_memo_t *memo);
+extern uint64_t syntax_memo_word(syntax_memo_t *memo, const char *word);
+extern const syntax_memo_entry_t *syntax_memo_find(const syntax_memo_t *memo,
+						   const void *node, int argc);
+extern void syntax_memo_add(syntax_memo_t *memo, const void *node, int argc,
+			    int words, const char *error, int flags);
+extern void syntax_memo_free(syntax_memo_t *memo);
 extern cli_syntax_t *syntax_match_max(cli_syntax_t *head, int argc, char *argv[]);
 extern void syntax_printf(const cli_syntax_t *syntax);
 extern void syntax_print_lines(const cli_syntax_t *this);
@@ -51,6 +147,9 @@ typedef struct recli_datatype_t {
 extern recli_datatype_t recli_datatypes[];
 extern int recli_datatypes_init(void);
 
+typedef struct recli_snapshot_t recli_snapshot_t;
+typedef struct recli_rest_t recli_rest_t;
+
 typedef struct recli_config_t {
 	const char *dir;		/* config directory (-d) */
 	const char *prompt;		/* top-level prompt (-P) */
@@ -58,17 +157,264 @@ typedef struct recli_config_t {
 	char	   *envp[128];		/* environment from [dir]/ENV */
 	cli_syntax_t *syntax;		/* parsed syntax structure */
 	ino_t		syntax_inode;	/* inode number of syntax file */
+	int		scan_changes;	/* only scan bin/ again when it changes */
+	time_t		bin_scanned;	/* when bin/ was last scanned */
+	ino_t		bin_inode;
 	cli_syntax_t	*long_help;	/* parsed long help from (-H) or [dir]/help.md */
 	cli_syntax_t	*short_help;	/* parsed short help from (-H) or [dir]/help.md */
 	cli_permission_t *permissions;	/* perms parsed from [dir]/permissions/[user].txt */
+	int		static_syntax;	/* syntax was compiled in, don't reload it */
+	recli_snapshot_t *snapshot;	/* published syntax and help, for sessions */
+	recli_rest_t	*rest;		/* commands sent to [dir]/rest.txt's endpoint */
 } recli_config_t;
 
+/*
+ *	An immutable version of the syntax and help.  The current one
+ *	is published in the configuration, and each session pins the
+ *	one it's using.  Pinning doesn't lock, so other threads can
+ *	check commands against a snapshot while a new one is published.
+ *	A snapshot is freed once nothing has it pinned.
+ *
+ *	Allocating, publishing, and recli_snapshot_reclaim() change the
+ *	syntax nodes, so they're done by the thread which owns them.
+ */
+struct recli_snapshot_t {
+	int			refcount;	/* pins, and one for being published */
+	uint64_t		version;
+
+	cli_syntax_t		*syntax;
+	cli_syntax_t		*long_help;
+	cli_syntax_t		*short_help;
+	const syntax_image_t	*image;		/* packed syntax, or NULL */
+
+	uint64_t		retired;	/* epoch when it was unpinned */
+	recli_snapshot_t	*next_retired;
+	recli_snapshot_t	*next_live;
+};
+
+extern recli_snapshot_t *recli_snapshot_alloc(cli_syntax_t *syntax, cli_syntax_t *long_help,
+					      cli_syntax_t *short_help);
+extern void recli_snapshot_publish(recli_snapshot_t **published, recli_snapshot_t *snap);
+extern recli_snapshot_t *recli_snapshot_pin(recli_snapshot_t **published);
+extern void recli_snapshot_unpin(recli_snapshot_t *snap);
+extern int recli_snapshot_check(const recli_snapshot_t *snap, int argc, char *argv[],
+				const char **error, int *flags);
+extern int recli_snapshot_reclaim(void);
+extern int recli_snapshot_roots(cli_syntax_t *roots[], int max_roots);
+
+/*
+ *	Syntaxes, help and permissions compiled into C by
+ *	recli-compile.  The nodes are in dependency order, so each
+ *	node refers only to nodes before it.
+ */
+typedef struct recli_static_node_t {
+	int		type;
+	const char	*name;		/* word, help text, or data type */
+	int		first;		/* child nodes, or -1 */
+	int		next;		/* or index into recli_datatypes[] */
+	int		min, max;
+	int		length;		/* help text flag */
+} recli_static_node_t;
+
+typedef struct recli_static_permission_t {
+	int		allowed;
+	int		lineno;
+	int		argc;
+	const char * const *argv;
+} recli_static_permission_t;
+
+typedef int (*recli_static_check_t)(int argc, char *argv[],
+				    const char **error, int *flags);
+
+typedef struct recli_static_t {
+	const char			*dir;		/* config directory, or NULL */
+
+	const recli_static_node_t	*nodes;
+	int				num_nodes;
+	int				syntax;		/* root nodes, or -1 */
+	int				long_help;
+	int				short_help;
+	recli_static_check_t		check;		/* matcher for "syntax" */
+
+	const recli_static_permission_t	*permissions;
+	int				num_permissions;
+} recli_static_t;
+
+extern int syntax_compile(FILE *fp, cli_syntax_t *syntax,
+			  cli_syntax_t *long_help, cli_syntax_t *short_help,
+			  int *roots);
+extern int syntax_load_static(const recli_static_t *in, cli_syntax_t **psyntax,
+			      cli_syntax_t **plong, cli_syntax_t **pshort);
+extern int permission_compile(FILE *fp, cli_permission_t *head);
+extern int permission_load_static(const recli_static_t *in, cli_permission_t **phead);
+extern void fprint_cstring(FILE *fp, const char *str);
+
+extern int recli_check_file(recli_config_t *config, const char *filename,
+			    int num_threads);
+
 extern int recli_bootstrap(recli_config_t *config);
 int recli_load_syntax(recli_config_t *config);
 int recli_exec_syntax(cli_syntax_t **phead, const char *dir, char *program,
 		      char *const envp[]);
+
+/*
+ *	The parts of running a command, for "-X exec".
+ */
+typedef enum recli_phase_t {
+	RECLI_PHASE_RESOLVE = 0,	/* stat() walk through bin/ */
+	RECLI_PHASE_FORK,		/* pipes and fork() */
+	RECLI_PHASE_EXEC,		/* until the child has called exec() */
+	RECLI_PHASE_RELAY,		/* copying the output */
+	RECLI_PHASE_WAIT,		/* waitpid() */
+	RECLI_PHASE_RELOAD,		/* recli_load_syntax() afterwards */
+	RECLI_PHASE_MAX
+} recli_phase_t;
+
+typedef struct recli_times_t {
+	uint64_t	ns[RECLI_PHASE_MAX];
+} recli_times_t;
+
+typedef struct recli_stats_t {
+	uint64_t	*samples[RECLI_PHASE_MAX + 1];	/* and the total */
+	int		num;
+	int		size;
+} recli_stats_t;
+
+extern uint64_t recli_now(void);
+extern void recli_stats_add(recli_stats_t *stats, const recli_times_t *times);
+extern void recli_stats_print(FILE *fp, const recli_stats_t *stats);
+extern void recli_stats_free(recli_stats_t *stats);
+
+/*
+ *	The steps of processing one line of input, for "-X stats".
+ */
+typedef enum recli_step_t {
+	RECLI_STEP_TOKENIZE = 0,	/* splitting the line into words */
+	RECLI_STEP_BUILTIN,		/* running a builtin command */
+	RECLI_STEP_CHECK,		/* syntax_check() */
+	RECLI_STEP_PERMISSION,		/* permission_enforce() */
+	RECLI_STEP_HISTORY,		/* saving the line to the history */
+	RECLI_STEP_EXEC,		/* recli_exec() */
+	RECLI_STEP_RELOAD,		/* recli_load_syntax() afterwards */
+	RECLI_STEP_MAX
+} recli_step_t;
+
+/*
+ *	Log-linear histogram of times in nanoseconds.  Each power of
+ *	two is split into RECLI_HIST_SUB buckets, so every bucket is
+ *	within 1/RECLI_HIST_SUB of the times it counts.
+ */
+#define RECLI_HIST_SUB_BITS	(4)
+#define RECLI_HIST_SUB		(1 << RECLI_HIST_SUB_BITS)
+#define RECLI_HIST_BUCKETS	((64 - RECLI_HIST_SUB_BITS + 1) * RECLI_HIST_SUB)
+
+typedef struct recli_hist_t {
+	uint64_t	count;
+	uint64_t	sum;
+	uint64_t	max;
+	uint32_t	bucket[RECLI_HIST_BUCKETS];
+} recli_hist_t;
+
+extern const char *recli_step_names[RECLI_STEP_MAX];
+extern void recli_hist_add(recli_hist_t *hist, uint64_t ns);
+extern void recli_hist_write(int fd, const recli_hist_t hist[RECLI_STEP_MAX]);
+extern void recli_hist_print(void *ctx, const recli_hist_t hist[RECLI_STEP_MAX]);
+extern void recli_counters_print(void *ctx, const char *line, const syntax_counters_t *c);
+
+/*
+ *	Wall clock and CPU time, for "--startup-profile".  The CPU
+ *	time of children is counted once they have been waited for.
+ */
+typedef struct recli_clock_t {
+	uint64_t	wall;
+	uint64_t	cpu;
+	uint64_t	child_cpu;
+} recli_clock_t;
+
+extern int recli_startup_profile;
+extern void recli_clock_start(recli_clock_t *clock);
+extern void recli_startup_done(const char *name, recli_clock_t *clock);
+extern void recli_startup_print(FILE *fp);
+
+/*
+ *	Tracing, for "-X trace=file" or RECLI_TRACE=file.
+ */
+extern int recli_trace_open(const char *filename);
+extern void recli_json_string(FILE *fp, const char *str);
+extern uint64_t recli_trace_now(void);
+extern void recli_trace_span(const char *cat, const char *name, int tid, uint64_t start,
+			     const char *arg1, int64_t value1,
+			     const char *arg2, int64_t value2);
+
+/*
+ *	Filters on the output of a command, after a '|'.
+ */
+typedef struct recli_filter_t recli_filter_t;
+
+extern int recli_filter_parse(int argc, char *argv[], recli_filter_t **pfilter,
+			      const char **error);
+extern void recli_filter_write(recli_filter_t *filter, const char *data, size_t len);
+extern void recli_filter_done(recli_filter_t *filter);
+extern void recli_filter_output(recli_filter_t *filter, recli_fprintf_t func, void *out);
+extern void recli_filter_free(recli_filter_t *filter);
+
 extern int recli_exec(const char *rundir, int interactive, int argc, char *argv[],
-		      char *const envp[]);
+		      char *const envp[], recli_filter_t *filter, pid_t *child,
+		      recli_times_t *times);
+extern pid_t recli_spawn(const char *rundir, int argc, char *argv[], char *const envp[],
+			 int *out_fd, int *err_fd);
+
+/*
+ *	One user's session: the snapshot it's using, the context stack,
+ *	and where the output goes.  The configuration and the syntax
+ *	nodes are shared by all of the sessions in a process.
+ */
+typedef struct recli_session_t recli_session_t;
+typedef void (*recli_history_t)(void *ctx, const char *line);
+typedef void (*recli_run_t)(void *ctx, const char *rundir, int interactive,
+			    int argc, char *argv[], char *const envp[],
+			    recli_filter_t *filter);
+
+#define RECLI_SESSION_EXEC_TIMES	(1 << 0)	/* -X exec */
+#define RECLI_SESSION_STEP_TIMES	(1 << 1)	/* -X stats */
+
+extern recli_session_t *recli_session_alloc(recli_config_t *config, int flags);
+extern void recli_session_free(recli_session_t *s);
+extern void recli_session_output(recli_session_t *s, recli_fprintf_t func,
+				 void *out, void *err);
+extern void recli_session_history(recli_session_t *s, recli_history_t func, void *ctx);
+extern void recli_session_run(recli_session_t *s, recli_run_t func, void *ctx);
+extern int recli_session_process(recli_session_t *s, char *line);
+extern void recli_session_reload(recli_session_t *s);
+extern int recli_session_job_fds(const recli_session_t *s, int fds[], int max_fds);
+extern void recli_session_jobs_update(recli_session_t *s, int notify);
+extern void recli_session_jobs_wait(recli_session_t *s);
+extern const char *recli_session_prompt(const recli_session_t *s);
+extern pid_t recli_session_child(const recli_session_t *s);
+extern int recli_session_complete(recli_session_t *s, const char *buf,
+				  int max_tabs, char *tabs[]);
+extern int recli_session_short_help(recli_session_t *s, const char *line, size_t len);
+extern const char *recli_session_strip_context(const recli_session_t *s, const char *buffer);
+extern void recli_session_print_exec(const recli_session_t *s, FILE *fp);
+extern void recli_session_write_steps(const recli_session_t *s, int fd);
+
+/*
+ *	Many sessions on UNIX and TCP sockets, in one process.
+ */
+extern int recli_socket(const char *addr, int listening);
+
+/*
+ *	Commands which are HTTP requests to a local endpoint, instead
+ *	of programs.
+ */
+extern int recli_rest_parse_file(const char *filename, recli_rest_t **prest);
+extern int recli_rest_match(const recli_rest_t *rest, int argc, char *argv[]);
+extern int recli_rest_run(recli_rest_t *rest, int argc, char *argv[],
+			  recli_filter_t *filter);
+extern void recli_rest_timeout(recli_rest_t *rest, int msec);
+extern void recli_rest_free(recli_rest_t *rest);
+extern int recli_server(recli_config_t *config, int num_addrs, const char *addrs[]);
+extern int recli_client(const char *addr);
 
 #ifdef __linux__
 size_t strlcpy(char *dst, const char *src, size_t siz);
@@ -81,10 +427,12 @@ size_t strlcpy(char *dst, const char *src, size_t siz);
 # define PRINTF_LIKE(n) __attribute__ ((format(printf, n, n+1)))
 # define NEVER_RETURNS __attribute__ ((noreturn))
 # define UNUSED __attribute__ ((unused))
+# define WEAK __attribute__ ((weak))
 # define BLANK_FORMAT " "	/* GCC_LINT whines about empty formats */
 #else
 # define PRINTF_LIKE(n)	/* ignore */
 # define NEVER_RETURNS /* ignore */
 # define UNUSED /* ignore */
+# define WEAK /* ignore */
 # define BLANK_FORMAT ""
 #endif
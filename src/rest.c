@@ -0,0 +1,843 @@
+/*
+ * Run commands as HTTP requests to a local REST endpoint.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "recli.h"
+
+/*
+ *	Each line of [dir]/rest.txt is either a setting:
+ *
+ *		endpoint /var/run/foo.sock
+ *		content-type application/json
+ *
+ *	or a rule, which sends the commands starting with the words
+ *	before the "=" to the endpoint.  "*" matches any word.
+ *
+ *		show interface * = GET /interfaces/$3
+ *		set hostname * = PUT /hostname "{\"name\": \"$3\"}"
+ *
+ *	The first rule which matches is used.  $1 through $9 are words
+ *	of the command, $* is the words after the ones in the rule, and
+ *	$$ is a '$'.  Words are percent-encoded in the path.  In the
+ *	body, they're escaped for the content type: as the inside of a
+ *	string for JSON, and percent-encoded for a form.  For any other
+ *	type, they're copied as-is.
+ */
+#define REST_POOL_MAX		(8)
+#define REST_TIMEOUT		(10000)		/* milliseconds, per request */
+#define REST_HEADER_MAX		(65536)
+#define REST_BODY_MAX		(16 * 1024 * 1024)
+
+typedef enum rest_encode_t {
+	REST_ENCODE_NONE = 0,
+	REST_ENCODE_PATH,
+	REST_ENCODE_JSON,
+	REST_ENCODE_FORM
+} rest_encode_t;
+
+typedef struct rest_rule_t {
+	struct rest_rule_t *next;
+	int		lineno;
+	char		*method;
+	char		*path;		/* template */
+	char		*body;		/* template, or NULL */
+	int		argc;		/* words before the "=" */
+	char		*argv[1];
+} rest_rule_t;
+
+/*
+ *	Idle connections are kept open, so that a command is one round
+ *	trip, without connecting.  The sessions in a process are all
+ *	run from one thread, so the pool isn't locked.
+ */
+struct recli_rest_t {
+	char		*endpoint;
+	char		*host;		/* for the Host header */
+	char		*content_type;
+	rest_encode_t	body_encode;	/* from the content type */
+	rest_rule_t	*rules;
+	int		timeout;	/* milliseconds */
+	int		idle[REST_POOL_MAX];
+	int		num_idle;
+};
+
+typedef struct rest_buf_t {
+	char		*data;
+	size_t		len;
+	size_t		size;
+} rest_buf_t;
+
+static int buf_grow(rest_buf_t *buf, size_t len)
+{
+	char *p;
+	size_t size;
+
+	if ((buf->size - buf->len) > len) return 0;
+
+	size = buf->size ? buf->size : 1024;
+	while ((size - buf->len) <= len) {
+		if (size > (SIZE_MAX / 2)) {
+			errno = ENOMEM;
+			return -1;
+		}
+		size *= 2;
+	}
+
+	p = realloc(buf->data, size);
+	if (!p) return -1;
+
+	buf->data = p;
+	buf->size = size;
+	return 0;
+}
+
+static int buf_append(rest_buf_t *buf, const char *str, size_t len)
+{
+	if (buf_grow(buf, len) < 0) return -1;
+
+	memcpy(buf->data + buf->len, str, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+	return 0;
+}
+
+static int buf_printf(rest_buf_t *buf, const char *fmt, ...) PRINTF_LIKE(2);
+static int buf_printf(rest_buf_t *buf, const char *fmt, ...)
+{
+	int len;
+	va_list ap;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	if ((len < 0) || (buf_grow(buf, len) < 0)) return -1;
+
+	va_start(ap, fmt);
+	vsnprintf(buf->data + buf->len, len + 1, fmt, ap);
+	va_end(ap);
+
+	buf->len += len;
+	return 0;
+}
+
+/*
+ *	Copy a word, without its quotes or escapes.
+ */
+static char *rest_unquote(const char *word, const recli_token_t *token)
+{
+	char *out, *q;
+	const char *p, *end;
+
+	out = q = malloc(token->length + 1);
+	if (!out) return NULL;
+
+	p = word;
+	end = word + token->length;
+	if ((token->quote == '"') || (token->quote == '\'')) {
+		p++;
+		end--;
+	}
+
+	if (!token->escaped) {
+		memcpy(out, p, end - p);
+		out[end - p] = '\0';
+		return out;
+	}
+
+	while (p < end) {
+		if ((*p == '\\') && ((p + 1) < end)) p++;
+		*q++ = *p++;
+	}
+	*q = '\0';
+
+	return out;
+}
+
+static int rest_parse_line(recli_rest_t *rest, rest_rule_t ***last,
+			   const char *filename, int lineno, char *buffer, size_t len)
+{
+	int i, argc, eq;
+	size_t error;
+	recli_token_t tokens[256];
+	char *words[256];
+	rest_rule_t *rule;
+
+	argc = str2tokens(buffer, len, 256, tokens, &error);
+	if (argc < 0) {
+		recli_fprintf(recli_stderr, "%s:%d: Parse error at offset %zu\n",
+			      filename, lineno, error);
+		return -1;
+	}
+	if (argc == 0) return 0;
+
+	for (i = 0; i < argc; i++) {
+		words[i] = buffer + tokens[i].offset;
+		words[i][tokens[i].length] = '\0';
+	}
+
+	if (argc == 2) {
+		char **p = NULL;
+
+		if (strcmp(words[0], "endpoint") == 0) p = &rest->endpoint;
+		if (strcmp(words[0], "content-type") == 0) p = &rest->content_type;
+
+		if (p) {
+			free(*p);
+			*p = rest_unquote(words[1], &tokens[1]);
+			return 0;
+		}
+	}
+
+	for (eq = 0; eq < argc; eq++) {
+		if (!tokens[eq].quote && (strcmp(words[eq], "=") == 0)) break;
+	}
+
+	if ((eq == 0) || (eq == argc) || ((argc - eq) < 3) || ((argc - eq) > 4)) {
+		recli_fprintf(recli_stderr, "%s:%d: Expected 'words ... = METHOD /path [body]'\n",
+			      filename, lineno);
+		return -1;
+	}
+
+	rule = calloc(1, sizeof(*rule) + sizeof(rule->argv[0]) * eq);
+	if (!rule) return -1;
+
+	rule->lineno = lineno;
+	rule->argc = eq;
+	for (i = 0; i < eq; i++) rule->argv[i] = strdup(words[i]);
+	rule->method = strdup(words[eq + 1]);
+	rule->path = rest_unquote(words[eq + 2], &tokens[eq + 2]);
+	if ((argc - eq) == 4) rule->body = rest_unquote(words[eq + 3], &tokens[eq + 3]);
+
+	**last = rule;
+	*last = &rule->next;
+	return 0;
+}
+
+/*
+ *	How long a request can take, from sending it to reading all of
+ *	the response.  The caller waits for all of it.
+ */
+void recli_rest_timeout(recli_rest_t *rest, int msec)
+{
+	rest->timeout = msec;
+}
+
+void recli_rest_free(recli_rest_t *rest)
+{
+	int i;
+	rest_rule_t *rule, *next;
+
+	if (!rest) return;
+
+	for (rule = rest->rules; rule != NULL; rule = next) {
+		next = rule->next;
+
+		for (i = 0; i < rule->argc; i++) free(rule->argv[i]);
+		free(rule->method);
+		free(rule->path);
+		free(rule->body);
+		free(rule);
+	}
+
+	for (i = 0; i < rest->num_idle; i++) close(rest->idle[i]);
+
+	free(rest->endpoint);
+	free(rest->host);
+	free(rest->content_type);
+	free(rest);
+}
+
+/*
+ *	Read the rules.  Returns 0 on success, or -1 on error.
+ */
+int recli_rest_parse_file(const char *filename, recli_rest_t **prest)
+{
+	char *buffer;
+	size_t len;
+	recli_input_t input;
+	recli_rest_t *rest;
+	rest_rule_t **last;
+
+	if (recli_input_open(&input, filename) < 0) {
+		recli_fprintf(recli_stderr, "Failed opening %s: %s\n",
+			      filename, strerror(errno));
+		return -1;
+	}
+
+	rest = calloc(1, sizeof(*rest));
+	if (!rest) {
+		recli_input_free(&input);
+		return -1;
+	}
+	rest->timeout = REST_TIMEOUT;
+	last = &rest->rules;
+
+	while ((buffer = recli_input_line(&input, &len)) != NULL) {
+		if (rest_parse_line(rest, &last, filename, input.lineno, buffer, len) < 0) {
+			recli_input_free(&input);
+			recli_rest_free(rest);
+			return -1;
+		}
+	}
+	recli_input_free(&input);
+
+	if (!rest->endpoint) {
+		recli_fprintf(recli_stderr, "%s: No 'endpoint' was given\n", filename);
+		recli_rest_free(rest);
+		return -1;
+	}
+
+	if (!rest->content_type) rest->content_type = strdup("application/json");
+
+	/*
+	 *	"application/json", or a suffix such as
+	 *	"application/problem+json".
+	 */
+	if ((strncasecmp(rest->content_type, "application/json", 16) == 0) ||
+	    (strstr(rest->content_type, "+json") != NULL)) {
+		rest->body_encode = REST_ENCODE_JSON;
+	} else if (strncasecmp(rest->content_type, "application/x-www-form-urlencoded", 33) == 0) {
+		rest->body_encode = REST_ENCODE_FORM;
+	}
+
+	/*
+	 *	UNIX sockets don't have a host name.
+	 */
+	if (strchr(rest->endpoint, '/') != NULL) {
+		rest->host = strdup("localhost");
+	} else {
+		rest->host = strdup(rest->endpoint);
+	}
+
+	*prest = rest;
+	return 0;
+}
+
+/*
+ *	Add a word, escaped for where it's going.
+ */
+static int rest_escape(rest_buf_t *out, const char *word, rest_encode_t encode)
+{
+	const unsigned char *q;
+
+	if (encode == REST_ENCODE_NONE) return buf_append(out, word, strlen(word));
+
+	for (q = (const unsigned char *) word; *q; q++) {
+		if (encode == REST_ENCODE_JSON) {
+			if ((*q == '"') || (*q == '\\')) {
+				if (buf_printf(out, "\\%c", *q) < 0) return -1;
+			} else if (*q < ' ') {
+				if (buf_printf(out, "\\u%04x", *q) < 0) return -1;
+			} else {
+				if (buf_append(out, (const char *) q, 1) < 0) return -1;
+			}
+			continue;
+		}
+
+		if (isalnum(*q) || (*q == '-') || (*q == '.') ||
+		    (*q == '_') || (*q == '~')) {
+			if (buf_append(out, (const char *) q, 1) < 0) return -1;
+		} else {
+			if (buf_printf(out, "%%%02X", *q) < 0) return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *	Fill in a template.  In a path, words are percent-encoded, and
+ *	$* separates them with '/'.  In a body, it separates them with
+ *	a space.
+ */
+static int rest_expand(rest_buf_t *out, const char *tmpl, rest_encode_t encode,
+		       int skip, int argc, char *argv[])
+{
+	int i, first, last, rcode;
+	const char *p;
+
+	for (p = tmpl; *p; p++) {
+		if ((*p != '$') || !p[1]) {
+			if (buf_append(out, p, 1) < 0) return -1;
+			continue;
+		}
+
+		p++;
+		if (*p == '$') {
+			if (buf_append(out, "$", 1) < 0) return -1;
+			continue;
+		}
+
+		if ((*p >= '1') && (*p <= '9')) {
+			first = last = *p - '1';
+		} else if (*p == '*') {
+			first = skip;
+			last = argc - 1;
+		} else {
+			if (buf_append(out, p - 1, 2) < 0) return -1;
+			continue;
+		}
+
+		for (i = first; (i <= last) && (i < argc); i++) {
+			char *word;
+			recli_token_t token;
+
+			if (i > first) {
+				const char *sep = " ";
+
+				if (encode == REST_ENCODE_PATH) sep = "/";
+				if (encode == REST_ENCODE_FORM) sep = "+";
+
+				if (buf_append(out, sep, 1) < 0) return -1;
+			}
+
+			/*
+			 *	The words were checked by str2tokens(), so
+			 *	a leading quote has a matching one at the end.
+			 */
+			token.offset = 0;
+			token.length = strlen(argv[i]);
+			token.quote = '\0';
+			if ((token.length >= 2) &&
+			    ((*argv[i] == '"') || (*argv[i] == '\''))) {
+				token.quote = *argv[i];
+			}
+			token.escaped = (strchr(argv[i], '\\') != NULL);
+
+			word = rest_unquote(argv[i], &token);
+			if (!word) return -1;
+
+			rcode = rest_escape(out, word, encode);
+			free(word);
+			if (rcode < 0) return -1;
+		}
+	}
+
+	return 0;
+}
+
+static rest_rule_t *rest_match(const recli_rest_t *rest, int argc, char *argv[])
+{
+	int i;
+	rest_rule_t *rule;
+
+	for (rule = rest->rules; rule != NULL; rule = rule->next) {
+		if (rule->argc > argc) continue;
+
+		for (i = 0; i < rule->argc; i++) {
+			if (strcmp(rule->argv[i], "*") == 0) continue;
+			if (strcmp(rule->argv[i], argv[i]) != 0) break;
+		}
+
+		if (i == rule->argc) return rule;
+	}
+
+	return NULL;
+}
+
+/*
+ *	Read more of the response.  Returns the number of bytes read,
+ *	0 on EOF, or -1 on error, or if the deadline has passed.
+ */
+static ssize_t rest_fill(int fd, rest_buf_t *in, uint64_t deadline)
+{
+	ssize_t num;
+	struct pollfd pfd;
+
+	if (buf_grow(in, 8192) < 0) return -1;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		int rcode, msec;
+		uint64_t now = recli_now();
+
+		/*
+		 *	Round up, so that we don't spin for the last
+		 *	millisecond.
+		 */
+		msec = (now < deadline) ? (int) ((deadline - now + 999999) / 1000000) : 0;
+
+		rcode = poll(&pfd, 1, msec);
+		if ((rcode < 0) && (errno == EINTR)) continue;
+		if (rcode <= 0) {
+			if (rcode == 0) errno = ETIMEDOUT;
+			return -1;
+		}
+
+		num = read(fd, in->data + in->len, in->size - in->len - 1);
+		if ((num < 0) && (errno == EINTR)) continue;
+		break;
+	}
+
+	if (num > 0) {
+		in->len += num;
+		in->data[in->len] = '\0';
+	}
+
+	return num;
+}
+
+typedef struct rest_response_t {
+	int		status;
+	size_t		reason;		/* offset in "in", which may move */
+	int		reason_len;
+	rest_buf_t	in;		/* headers, and the body if not chunked */
+	rest_buf_t	chunks;		/* the body, if chunked */
+	const char	*body;
+	size_t		body_len;
+	int		keepalive;
+	int		received;	/* any of the response */
+} rest_response_t;
+
+/*
+ *	Find a header, and return its value.
+ */
+static const char *rest_header(const char *headers, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p;
+
+	for (p = strstr(headers, "\r\n"); p && (p[2] != '\r'); p = strstr(p + 2, "\r\n")) {
+		if ((strncasecmp(p + 2, name, len) == 0) && (p[2 + len] == ':')) {
+			p += 2 + len + 1;
+			while ((*p == ' ') || (*p == '\t')) p++;
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ *	Parse a chunk size, or a Content-Length.  Anything but digits,
+ *	then optional white space, and a chunk extension or the end of
+ *	the line, is an error.  So is a size over REST_BODY_MAX.
+ */
+static int rest_size(const char *p, int base, size_t *size)
+{
+	char *end;
+	unsigned long value;
+
+	if (!((base == 16) ? isxdigit((uint8_t) *p) : isdigit((uint8_t) *p))) goto fail;
+
+	errno = 0;
+	value = strtoul(p, &end, base);
+	if ((errno == ERANGE) || (value > REST_BODY_MAX)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	while ((*end == ' ') || (*end == '\t')) end++;
+	if ((*end != '\r') && !((base == 16) && (*end == ';'))) goto fail;
+
+	*size = value;
+	return 0;
+
+fail:
+	errno = EPROTO;
+	return -1;
+}
+
+/*
+ *	Read one response.  Returns 0 on success, or -1 on error.
+ */
+static int rest_response(int fd, const char *method, uint64_t deadline,
+			 rest_response_t *r)
+{
+	ssize_t num;
+	size_t header_len, need;
+	char *p, *end;
+	const char *value;
+
+	/*
+	 *	The headers.
+	 */
+	for (;;) {
+		if (r->in.len) {
+			p = strstr(r->in.data, "\r\n\r\n");
+			if (p) break;
+		}
+
+		if (r->in.len > REST_HEADER_MAX) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+
+		num = rest_fill(fd, &r->in, deadline);
+		if (num <= 0) {
+			if (num == 0) errno = ECONNRESET;
+			return -1;
+		}
+		r->received = 1;
+	}
+	header_len = (p + 4) - r->in.data;
+
+	if ((strncmp(r->in.data, "HTTP/1.", 7) != 0) || !isdigit((uint8_t) r->in.data[9])) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	r->status = strtol(r->in.data + 9, &end, 10);
+	while (*end == ' ') end++;
+	r->reason = end - r->in.data;
+	r->reason_len = strstr(end, "\r\n") - end;
+
+	r->keepalive = (r->in.data[7] == '1');
+	value = rest_header(r->in.data, "Connection");
+	if (value && (strncasecmp(value, "close", 5) == 0)) r->keepalive = 0;
+
+	r->body = r->in.data + header_len;
+	r->body_len = 0;
+
+	if ((strcmp(method, "HEAD") == 0) || (r->status < 200) ||
+	    (r->status == 204) || (r->status == 304)) {
+		return 0;
+	}
+
+	/*
+	 *	Chunks are copied out, so that the body is contiguous.
+	 */
+	value = rest_header(r->in.data, "Transfer-Encoding");
+	if (value && (strncasecmp(value, "chunked", 7) == 0)) {
+		size_t pos = header_len;
+		size_t size;
+
+		for (;;) {
+			while (!(end = strstr(r->in.data + pos, "\r\n"))) {
+				num = rest_fill(fd, &r->in, deadline);
+				if (num <= 0) goto short_read;
+			}
+
+			if (rest_size(r->in.data + pos, 16, &size) < 0) return -1;
+			if (size > (REST_BODY_MAX - r->chunks.len)) {
+				errno = EMSGSIZE;
+				return -1;
+			}
+			pos = (end + 2) - r->in.data;
+
+			if (size == 0) {
+				/*
+				 *	Skip any trailers.
+				 */
+				for (;;) {
+					while (!(end = strstr(r->in.data + pos, "\r\n"))) {
+						num = rest_fill(fd, &r->in, deadline);
+						if (num <= 0) goto short_read;
+					}
+					if (end == (r->in.data + pos)) break;
+					pos = (end + 2) - r->in.data;
+				}
+				break;
+			}
+
+			while ((r->in.len - pos) < (size + 2)) {
+				num = rest_fill(fd, &r->in, deadline);
+				if (num <= 0) goto short_read;
+			}
+
+			if (buf_append(&r->chunks, r->in.data + pos, size) < 0) return -1;
+			pos += size + 2;
+		}
+
+		r->body = r->chunks.data ? r->chunks.data : "";
+		r->body_len = r->chunks.len;
+		return 0;
+	}
+
+	value = rest_header(r->in.data, "Content-Length");
+	if (value) {
+		if (rest_size(value, 10, &need) < 0) return -1;
+
+		while ((r->in.len - header_len) < need) {
+			num = rest_fill(fd, &r->in, deadline);
+			if (num <= 0) goto short_read;
+		}
+
+		r->body = r->in.data + header_len;
+		r->body_len = need;
+		return 0;
+	}
+
+	/*
+	 *	No length: the body ends when the connection does.
+	 */
+	r->keepalive = 0;
+	while ((num = rest_fill(fd, &r->in, deadline)) > 0) {
+		/* nothing */
+	}
+	if (num < 0) return -1;
+
+	r->body = r->in.data + header_len;
+	r->body_len = r->in.len - header_len;
+	return 0;
+
+short_read:
+	if (num == 0) errno = ECONNRESET;
+	return -1;
+}
+
+/*
+ *	Send the request, and read the response.  A pooled connection
+ *	may have been closed by the server while it was idle, so if
+ *	nothing comes back on one, try again with a new connection.
+ */
+static int rest_request(recli_rest_t *rest, const char *method, const rest_buf_t *req,
+			rest_response_t *r)
+{
+	int fd, pooled, error;
+	ssize_t num;
+	size_t sent;
+	uint64_t deadline = recli_now() + ((uint64_t) rest->timeout * 1000000);
+
+	for (;;) {
+		pooled = (rest->num_idle > 0);
+		if (pooled) {
+			fd = rest->idle[--rest->num_idle];
+		} else {
+			int on = 1;
+
+			fd = recli_socket(rest->endpoint, 0);
+			if (fd < 0) return -1;
+
+			(void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		}
+
+		for (sent = 0; sent < req->len; sent += num) {
+			num = send(fd, req->data + sent, req->len - sent, MSG_NOSIGNAL);
+			if (num < 0) {
+				if (errno == EINTR) {
+					num = 0;
+					continue;
+				}
+				break;
+			}
+		}
+
+		if ((sent == req->len) && (rest_response(fd, method, deadline, r) == 0)) break;
+
+		error = errno;
+		close(fd);
+		errno = error;
+
+		/*
+		 *	If it timed out, the request may have been
+		 *	acted on, so it isn't sent again.
+		 */
+		if (pooled && !r->received && (errno != ETIMEDOUT)) {
+			r->in.len = 0;
+			continue;
+		}
+
+		recli_fprintf(recli_stderr, "Failed talking to '%s': %s\n",
+			      rest->endpoint, strerror(errno));
+		return -1;
+	}
+
+	if (r->keepalive && (rest->num_idle < REST_POOL_MAX)) {
+		rest->idle[rest->num_idle++] = fd;
+	} else {
+		close(fd);
+	}
+
+	return 0;
+}
+
+/*
+ *	Whether a command is a request to the endpoint, rather than a
+ *	program.
+ */
+int recli_rest_match(const recli_rest_t *rest, int argc, char *argv[])
+{
+	return (rest_match(rest, argc, argv) != NULL);
+}
+
+/*
+ *	Run a command as a request to the endpoint, and print the
+ *	response body, through "filter" if it's given.
+ *
+ *	Returns -1 if no rule matches the command, 0 if the request
+ *	succeeded, or 1 if it failed.  The error has been printed.
+ */
+int recli_rest_run(recli_rest_t *rest, int argc, char *argv[],
+		   recli_filter_t *filter)
+{
+	int rcode = 1;
+	rest_rule_t *rule;
+	rest_buf_t path, body, req;
+	rest_response_t r;
+
+	rule = rest_match(rest, argc, argv);
+	if (!rule) return -1;
+
+	memset(&path, 0, sizeof(path));
+	memset(&body, 0, sizeof(body));
+	memset(&req, 0, sizeof(req));
+	memset(&r, 0, sizeof(r));
+
+	if ((rest_expand(&path, rule->path, REST_ENCODE_PATH, rule->argc, argc, argv) < 0) ||
+	    (rule->body && (rest_expand(&body, rule->body, rest->body_encode,
+					rule->argc, argc, argv) < 0))) {
+		recli_fprintf(recli_stderr, "Out of memory\n");
+		goto done;
+	}
+
+	if (buf_printf(&req, "%s %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: recli\r\n",
+		       rule->method, path.data, rest->host) < 0) goto oom;
+
+	if (rule->body) {
+		if (buf_printf(&req, "Content-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+			       rest->content_type, body.len) < 0) goto oom;
+		if (buf_append(&req, body.data ? body.data : "", body.len) < 0) goto oom;
+
+	} else if (buf_printf(&req, "\r\n") < 0) {
+	oom:
+		recli_fprintf(recli_stderr, "Out of memory\n");
+		goto done;
+	}
+
+	if (rest_request(rest, rule->method, &req, &r) < 0) goto done;
+
+	if ((r.status >= 200) && (r.status < 300)) {
+		rcode = 0;
+		if (r.body_len && filter) {
+			recli_filter_write(filter, r.body, r.body_len);
+
+		} else if (r.body_len) {
+			recli_fprintf(recli_stdout, "%.*s", (int) r.body_len, r.body);
+			if (r.body[r.body_len - 1] != '\n') recli_fprintf(recli_stdout, "\n");
+		}
+	} else {
+		recli_fprintf(recli_stderr, "%s %s failed: %d %.*s\n",
+			      rule->method, path.data, r.status, r.reason_len,
+			      r.in.data + r.reason);
+		if (r.body_len) {
+			recli_fprintf(recli_stderr, "%.*s", (int) r.body_len, r.body);
+			if (r.body[r.body_len - 1] != '\n') recli_fprintf(recli_stderr, "\n");
+		}
+	}
+
+done:
+	free(path.data);
+	free(body.data);
+	free(req.data);
+	free(r.in.data);
+	free(r.chunks.data);
+
+	return rcode;
+}
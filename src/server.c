@@ -0,0 +1,896 @@
+/*
+ * Serve many sessions over UNIX and TCP sockets, from one event loop.
+ *
+ * See LICENSE for licence details.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE		/* accept4() */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "recli.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#endif
+
+/*
+ *	An address with a '/' in it is a UNIX socket.  Anything else
+ *	is a TCP port, "host:port", or "[host]:port".  Without a host,
+ *	it's the loopback address.  The host "*" listens on every
+ *	address.  Returns a socket which is bound and listening, or
+ *	connected.
+ */
+int recli_socket(const char *addr, int listening)
+{
+	int fd, rcode;
+	char host[256];
+	const char *port, *p;
+	struct addrinfo hints, *ai, *res;
+
+	if (strchr(addr, '/') != NULL) {
+		struct sockaddr_un sun;
+		struct stat sbuf;
+
+		if (strlen(addr) >= sizeof(sun.sun_path)) {
+			recli_fprintf(recli_stderr, "Socket path '%s' is too long\n", addr);
+			return -1;
+		}
+
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path, addr);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) goto error;
+
+		if (!listening) {
+			if (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) goto close_error;
+			return fd;
+		}
+
+		/*
+		 *	Remove the socket from a previous server, but
+		 *	nothing else.
+		 */
+		if ((stat(addr, &sbuf) == 0) && S_ISSOCK(sbuf.st_mode)) unlink(addr);
+
+		if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) goto close_error;
+		if (listen(fd, SOMAXCONN) < 0) goto close_error;
+		return fd;
+	}
+
+	host[0] = '\0';
+	port = addr;
+
+	if (addr[0] == '[') {
+		p = strchr(addr, ']');
+		if (!p || (p[1] != ':') || ((size_t) (p - addr) > sizeof(host))) goto bad_addr;
+
+		memcpy(host, addr + 1, p - addr - 1);
+		host[p - addr - 1] = '\0';
+		port = p + 2;
+
+	} else if ((p = strrchr(addr, ':')) != NULL) {
+		if ((size_t) (p - addr) >= sizeof(host)) goto bad_addr;
+
+		memcpy(host, addr, p - addr);
+		host[p - addr] = '\0';
+		port = p + 1;
+	}
+
+	if (!*port) {
+	bad_addr:
+		recli_fprintf(recli_stderr, "Invalid address '%s'\n", addr);
+		return -1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	/*
+	 *	Anyone who can connect can run commands, so other
+	 *	hosts have to be asked for.
+	 */
+	if (strcmp(host, "*") == 0) {
+		host[0] = '\0';
+		if (listening) hints.ai_flags = AI_PASSIVE;
+	}
+
+	rcode = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+	if (rcode != 0) {
+		recli_fprintf(recli_stderr, "Failed looking up '%s': %s\n",
+			      addr, gai_strerror(rcode));
+		return -1;
+	}
+
+	/*
+	 *	Use the first address which works.
+	 */
+	fd = -1;
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0) continue;
+
+		if (!listening) {
+			if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+
+		} else {
+			int on = 1;
+
+			(void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+			if ((bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) &&
+			    (listen(fd, SOMAXCONN) == 0)) break;
+		}
+
+		rcode = errno;
+		close(fd);
+		errno = rcode;
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0) goto error;
+
+	return fd;
+
+close_error:
+	rcode = errno;
+	close(fd);
+	errno = rcode;
+
+error:
+	recli_fprintf(recli_stderr, "Failed %s '%s': %s\n",
+		      listening ? "listening on" : "connecting to",
+		      addr, strerror(errno));
+	return -1;
+}
+
+/*
+ *	Relay stdin to the server, and the server's output to stdout,
+ *	until the server closes the connection.
+ */
+int recli_client(const char *addr)
+{
+	int fd;
+	int stdin_open = 1;
+	ssize_t num;
+	char buffer[8192];
+	struct pollfd fds[2];
+
+	fd = recli_socket(addr, 0);
+	if (fd < 0) return -1;
+
+	for (;;) {
+		fds[0].fd = fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = stdin_open ? STDIN_FILENO : -1;
+		fds[1].events = POLLIN;
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		if (fds[0].revents != 0) {
+			num = read(fd, buffer, sizeof(buffer));
+			if (num <= 0) break;
+
+			if (write(STDOUT_FILENO, buffer, num) != num) break;
+		}
+
+		if (stdin_open && (fds[1].revents != 0)) {
+			num = read(STDIN_FILENO, buffer, sizeof(buffer));
+			if (num <= 0) {
+				stdin_open = 0;
+				shutdown(fd, SHUT_WR);
+				continue;
+			}
+
+			if (write(fd, buffer, num) != num) break;
+		}
+	}
+
+	close(fd);
+	return 0;
+}
+
+#ifdef __linux__
+/*
+ *	Each session holds a connection, and only a few small buffers
+ *	while it's idle.  The buffers are allocated as data arrives,
+ *	and freed when it has all been used.
+ */
+#define SERVER_LINE_MAX		(8192)		/* longest input line */
+#define SERVER_INPUT_MAX	(4 * SERVER_LINE_MAX) /* stop reading the connection */
+#define SERVER_OUTPUT_MAX	(256 * 1024)	/* stop reading the command */
+#define SERVER_READ_SIZE	(16384)
+#define SERVER_EVENTS		(64)
+#define SERVER_REST_TIMEOUT	(1000)		/* milliseconds */
+
+typedef enum server_fd_type_t {
+	SERVER_LISTEN = 0,
+	SERVER_SIGNAL,
+	SERVER_CONN,
+	SERVER_STDOUT,
+	SERVER_STDERR
+} server_fd_type_t;
+
+typedef struct server_conn_t server_conn_t;
+
+/*
+ *	What epoll tells us about.
+ */
+typedef struct server_fd_t {
+	server_fd_type_t type;
+	int		fd;
+	uint32_t	events;		/* which epoll has now */
+	server_conn_t	*conn;
+} server_fd_t;
+
+typedef struct server_buf_t {
+	char		*data;
+	size_t		start;
+	size_t		end;
+	size_t		size;
+} server_buf_t;
+
+struct server_conn_t {
+	server_conn_t	*next;		/* all connections */
+	server_conn_t	*prev;
+
+	server_fd_t	sock;
+	server_fd_t	out;		/* the command's stdout and stderr */
+	server_fd_t	err;
+	pid_t		child;		/* the command, until it's reaped */
+	recli_filter_t	*filter;	/* on its stdout, owned by the session */
+
+	recli_session_t	*session;
+
+	server_buf_t	input;		/* lines which haven't been run */
+	server_buf_t	output;		/* waiting for the connection */
+
+	int		eof;		/* no more input */
+	int		done;		/* close once the output is sent */
+	int		closed;		/* freed after this batch of events */
+};
+
+typedef struct server_t {
+	int		epfd;
+	recli_config_t	*config;
+	server_conn_t	*conns;
+	server_conn_t	*closed;
+	char		*banner;	/* sent to each new session */
+	int		num_conns;
+	int		exiting;
+} server_t;
+
+static int buf_reserve(server_buf_t *buf, size_t len)
+{
+	char *p;
+	size_t size;
+
+	if ((buf->size - buf->end) >= len) return 0;
+
+	/*
+	 *	Move the data to the start, if that makes enough room.
+	 */
+	if (buf->start > 0) {
+		memmove(buf->data, buf->data + buf->start, buf->end - buf->start);
+		buf->end -= buf->start;
+		buf->start = 0;
+
+		if ((buf->size - buf->end) >= len) return 0;
+	}
+
+	size = buf->size ? buf->size : 1024;
+	while ((size - buf->end) < len) size *= 2;
+
+	p = realloc(buf->data, size);
+	if (!p) return -1;
+
+	buf->data = p;
+	buf->size = size;
+	return 0;
+}
+
+static void buf_consume(server_buf_t *buf, size_t len)
+{
+	buf->start += len;
+	if (buf->start < buf->end) return;
+
+	free(buf->data);
+	memset(buf, 0, sizeof(*buf));
+}
+
+/*
+ *	The session's output goes to the connection.
+ */
+static int conn_fprintf(void *ctx, const char *fmt, ...)
+{
+	int len;
+	va_list ap;
+	server_conn_t *conn = ctx;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	if ((len <= 0) || (buf_reserve(&conn->output, len + 1) < 0)) return 0;
+
+	va_start(ap, fmt);
+	vsnprintf(conn->output.data + conn->output.end, len + 1, fmt, ap);
+	va_end(ap);
+
+	conn->output.end += len;
+	return len;
+}
+
+/*
+ *	Tell epoll which events we want, if that changed.  An FD with
+ *	no events is removed, as epoll would still tell us about a
+ *	hangup, over and over.
+ */
+static int server_watch(server_t *srv, server_fd_t *sfd, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if ((sfd->fd < 0) || (sfd->events == events)) return 0;
+
+	if (!events) {
+		(void) epoll_ctl(srv->epfd, EPOLL_CTL_DEL, sfd->fd, NULL);
+		sfd->events = 0;
+		return 0;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = sfd;
+
+	if (epoll_ctl(srv->epfd, sfd->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+		      sfd->fd, &ev) < 0) {
+		return -1;
+	}
+
+	sfd->events = events;
+	return 0;
+}
+
+/*
+ *	A child which hasn't exec'd yet may still have a copy of the
+ *	FD, so closing it isn't enough to remove it from epoll.
+ */
+static void server_del(server_t *srv, server_fd_t *sfd)
+{
+	if (sfd->fd < 0) return;
+
+	if (sfd->events) (void) epoll_ctl(srv->epfd, EPOLL_CTL_DEL, sfd->fd, NULL);
+	close(sfd->fd);
+	sfd->fd = -1;
+	sfd->events = 0;
+}
+
+/*
+ *	Called by the session to run a command.  Its output is read
+ *	by the event loop.
+ */
+static void conn_run(void *ctx, const char *rundir, UNUSED int interactive,
+		     int argc, char *argv[], char *const envp[], recli_filter_t *filter)
+{
+	server_conn_t *conn = ctx;
+	int out_fd, err_fd;
+	pid_t pid;
+
+	pid = recli_spawn(rundir, argc, argv, envp, &out_fd, &err_fd);
+	if (pid < 0) return;
+
+	conn->child = pid;
+	conn->filter = filter;
+	conn->out.fd = out_fd;
+	conn->err.fd = err_fd;
+}
+
+/*
+ *	Other events in this batch may still refer to the connection,
+ *	so it's only freed by server_gc().
+ */
+static void conn_close(server_t *srv, server_conn_t *conn)
+{
+	server_del(srv, &conn->sock);
+	server_del(srv, &conn->out);
+	server_del(srv, &conn->err);
+
+	/*
+	 *	The command is reaped with all of the others.
+	 */
+	if (conn->child > 0) kill(conn->child, SIGTERM);
+
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		srv->conns = conn->next;
+	}
+	if (conn->next) conn->next->prev = conn->prev;
+	srv->num_conns--;
+
+	conn->closed = 1;
+	conn->next = srv->closed;
+	srv->closed = conn;
+}
+
+static void server_gc(server_t *srv)
+{
+	server_conn_t *conn;
+
+	while ((conn = srv->closed) != NULL) {
+		srv->closed = conn->next;
+
+		recli_session_free(conn->session);
+		free(conn->input.data);
+		free(conn->output.data);
+		free(conn);
+	}
+}
+
+static int conn_busy(const server_conn_t *conn)
+{
+	return (conn->child > 0) || (conn->out.fd >= 0) || (conn->err.fd >= 0);
+}
+
+static void conn_prompt(server_conn_t *conn)
+{
+	conn_fprintf(conn, "%s", recli_session_prompt(conn->session));
+}
+
+/*
+ *	Run the complete lines, until one starts a command.
+ */
+static void conn_process(server_conn_t *conn)
+{
+	char *line, *p;
+	size_t len;
+
+	while (!conn->done && !conn_busy(conn)) {
+		line = conn->input.data + conn->input.start;
+		len = conn->input.end - conn->input.start;
+		if (!len) break;
+
+		p = memchr(line, '\n', len);
+		if (!p) {
+			if (!conn->eof) {
+				if (len >= SERVER_LINE_MAX) {
+					conn_fprintf(conn, "Line is too long\r\n");
+					conn->done = 1;
+				}
+				break;
+			}
+
+			/*
+			 *	The last line doesn't end in LF.
+			 */
+			if (buf_reserve(&conn->input, 1) < 0) {
+				conn->done = 1;
+				break;
+			}
+			line = conn->input.data + conn->input.start;
+			p = line + len;
+		}
+
+		*p = '\0';
+		len = (p - line) + 1;
+		if ((p > line) && (p[-1] == '\r')) p[-1] = '\0';
+
+		conn->done = recli_session_process(conn->session, line);
+		buf_consume(&conn->input, len);
+
+		if (conn->done) break;
+
+		/*
+		 *	conn_update() watches the command's output.
+		 */
+		if (conn_busy(conn)) break;
+
+		conn_prompt(conn);
+	}
+
+	if (conn->eof && !conn_busy(conn) && (conn->input.end == conn->input.start)) {
+		conn->done = 1;
+	}
+}
+
+/*
+ *	Send what we can, and decide what to wait for next.  Returns -1
+ *	if the connection was closed.
+ */
+static int conn_update(server_t *srv, server_conn_t *conn)
+{
+	ssize_t num;
+	uint32_t events;
+
+	while (conn->output.end > conn->output.start) {
+		num = send(conn->sock.fd, conn->output.data + conn->output.start,
+			   conn->output.end - conn->output.start, MSG_NOSIGNAL);
+		if (num < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+
+			conn_close(srv, conn);
+			return -1;
+		}
+
+		buf_consume(&conn->output, num);
+	}
+
+	if (conn->done && (conn->output.end == conn->output.start) && !conn_busy(conn)) {
+		conn_close(srv, conn);
+		return -1;
+	}
+
+	events = 0;
+	if (!conn->eof && !conn->done &&
+	    ((conn->input.end - conn->input.start) < SERVER_INPUT_MAX)) {
+		events |= EPOLLIN;
+	}
+	if (conn->output.end > conn->output.start) events |= EPOLLOUT;
+	server_watch(srv, &conn->sock, events);
+
+	/*
+	 *	Stop reading the command if the user isn't reading its
+	 *	output.
+	 */
+	events = ((conn->output.end - conn->output.start) < SERVER_OUTPUT_MAX) ? EPOLLIN : 0;
+	server_watch(srv, &conn->out, events);
+	server_watch(srv, &conn->err, events);
+
+	return 0;
+}
+
+/*
+ *	The command has finished, and its output has been read.
+ */
+static void conn_finished(server_conn_t *conn)
+{
+	if (conn_busy(conn)) return;
+
+	conn->filter = NULL;
+	recli_session_reload(conn->session);
+
+	if (conn->done) return;
+
+	conn_prompt(conn);
+	conn_process(conn);
+}
+
+static void conn_read(server_conn_t *conn)
+{
+	ssize_t num;
+
+	if (buf_reserve(&conn->input, SERVER_READ_SIZE) < 0) {
+		conn->done = 1;
+		return;
+	}
+
+	num = read(conn->sock.fd, conn->input.data + conn->input.end,
+		   conn->input.size - conn->input.end);
+	if (num < 0) {
+		if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+
+		/*
+		 *	Nowhere for the output to go.
+		 */
+		conn->eof = conn->done = 1;
+		buf_consume(&conn->input, conn->input.end - conn->input.start);
+		buf_consume(&conn->output, conn->output.end - conn->output.start);
+		return;
+	}
+
+	if (num == 0) {
+		conn->eof = 1;
+	} else {
+		conn->input.end += num;
+	}
+
+	conn_process(conn);
+}
+
+/*
+ *	Relay the command's stdout or stderr to the connection.  A
+ *	filter on stdout prints to the connection itself.
+ */
+static void conn_relay(server_t *srv, server_conn_t *conn, server_fd_t *sfd)
+{
+	ssize_t num;
+
+	if (conn->filter && (sfd->type == SERVER_STDOUT)) {
+		char data[SERVER_READ_SIZE];
+
+		num = read(sfd->fd, data, sizeof(data) - 1);
+		if (num < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			num = 0;
+		}
+
+		if (num > 0) {
+			data[num] = '\0';
+			recli_filter_write(conn->filter, data, num);
+			return;
+		}
+
+	} else if (buf_reserve(&conn->output, SERVER_READ_SIZE) < 0) {
+		num = 0;
+	} else {
+		num = read(sfd->fd, conn->output.data + conn->output.end,
+			   conn->output.size - conn->output.end);
+		if (num < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			num = 0;
+		}
+	}
+
+	if (num > 0) {
+		conn->output.end += num;
+		return;
+	}
+
+	server_del(srv, sfd);
+	conn_finished(conn);
+}
+
+static void server_accept(server_t *srv, server_fd_t *listener)
+{
+	int fd;
+	server_conn_t *conn;
+
+	fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) return;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn) {
+		close(fd);
+		return;
+	}
+
+	conn->sock.type = SERVER_CONN;
+	conn->sock.fd = fd;
+	conn->sock.conn = conn;
+	conn->out.type = SERVER_STDOUT;
+	conn->out.fd = -1;
+	conn->out.conn = conn;
+	conn->err.type = SERVER_STDERR;
+	conn->err.fd = -1;
+	conn->err.conn = conn;
+
+	conn->session = recli_session_alloc(srv->config, 0);
+	if (!conn->session || (server_watch(srv, &conn->sock, EPOLLIN) < 0)) {
+		recli_session_free(conn->session);
+		close(fd);
+		free(conn);
+		return;
+	}
+
+	recli_session_output(conn->session, conn_fprintf, conn, conn);
+	recli_session_run(conn->session, conn_run, conn);
+
+	conn->next = srv->conns;
+	if (conn->next) conn->next->prev = conn;
+	srv->conns = conn;
+	srv->num_conns++;
+
+	if (srv->banner) conn_fprintf(conn, "%s", srv->banner);
+	conn_prompt(conn);
+	conn_update(srv, conn);
+}
+
+/*
+ *	The banner was printed when the configuration was loaded, so
+ *	read it again for the sessions.
+ */
+static char *server_banner(recli_config_t *config)
+{
+	int fd;
+	ssize_t num;
+	char *banner;
+	struct stat sbuf;
+	char buffer[8192];
+
+	if (config->banner) return strdup(config->banner);
+
+	if (!config->dir) return NULL;
+
+	snprintf(buffer, sizeof(buffer), "%s/banner.txt", config->dir);
+	fd = open(buffer, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+
+	banner = NULL;
+	if ((fstat(fd, &sbuf) == 0) && (sbuf.st_size > 0) &&
+	    ((banner = malloc(sbuf.st_size + 1)) != NULL)) {
+		num = read(fd, banner, sbuf.st_size);
+		if (num < 0) num = 0;
+		banner[num] = '\0';
+	}
+	close(fd);
+
+	return banner;
+}
+
+/*
+ *	Reap the commands which have finished.
+ */
+static void server_reap(server_t *srv, server_fd_t *sfd)
+{
+	pid_t pid;
+	int status;
+	struct signalfd_siginfo info;
+	server_conn_t *conn;
+
+	while (read(sfd->fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo != SIGCHLD) srv->exiting = 1;
+	}
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (conn = srv->conns; conn != NULL; conn = conn->next) {
+			if (conn->child != pid) continue;
+
+			conn->child = 0;
+			conn_finished(conn);
+			conn_update(srv, conn);
+			break;
+		}
+	}
+}
+
+/*
+ *	Serve sessions on each of the addresses, until SIGINT or
+ *	SIGTERM.  The sessions share the configuration, and each
+ *	command which they run is relayed from the event loop.
+ *	Commands are never given a terminal.
+ */
+int recli_server(recli_config_t *config, int num_addrs, const char *addrs[])
+{
+	int i, n, rcode = -1;
+	sigset_t mask;
+	server_t srv;
+	server_fd_t *listeners, sig;
+	struct epoll_event events[SERVER_EVENTS];
+
+	memset(&srv, 0, sizeof(srv));
+	srv.config = config;
+
+	/*
+	 *	Every session reloads the syntax after each command,
+	 *	which mustn't mean running every plugin each time.
+	 */
+	config->scan_changes = 1;
+
+	/*
+	 *	REST commands are run from the event loop, and every
+	 *	session waits for them.  So a stuck endpoint can only
+	 *	hold the server up for a short time.
+	 */
+	if (config->rest) recli_rest_timeout(config->rest, SERVER_REST_TIMEOUT);
+	srv.banner = server_banner(config);
+	memset(&sig, 0, sizeof(sig));
+	sig.fd = -1;
+
+	listeners = calloc(num_addrs, sizeof(listeners[0]));
+	if (!listeners) return -1;
+	for (i = 0; i < num_addrs; i++) listeners[i].fd = -1;
+
+	srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (srv.epfd < 0) {
+		recli_fprintf(recli_stderr, "Failed creating epoll: %s\n", strerror(errno));
+		goto done;
+	}
+
+	for (i = 0; i < num_addrs; i++) {
+		listeners[i].type = SERVER_LISTEN;
+		listeners[i].fd = recli_socket(addrs[i], 1);
+		if (listeners[i].fd < 0) goto done;
+
+		if (server_watch(&srv, &listeners[i], EPOLLIN) < 0) goto done;
+	}
+
+	/*
+	 *	Children and signals to stop are events, too.  The
+	 *	commands get the default signal mask back when they're
+	 *	run.
+	 */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	sig.type = SERVER_SIGNAL;
+	sig.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if ((sig.fd < 0) || (server_watch(&srv, &sig, EPOLLIN) < 0)) {
+		recli_fprintf(recli_stderr, "Failed creating signalfd: %s\n", strerror(errno));
+		goto done;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	while (!srv.exiting) {
+		n = epoll_wait(srv.epfd, events, SERVER_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			recli_fprintf(recli_stderr, "Failed waiting for events: %s\n", strerror(errno));
+			goto done;
+		}
+
+		for (i = 0; i < n; i++) {
+			server_fd_t *sfd = events[i].data.ptr;
+			server_conn_t *conn = sfd->conn;
+
+			if (conn && conn->closed) continue;
+
+			switch (sfd->type) {
+			case SERVER_LISTEN:
+				server_accept(&srv, sfd);
+				continue;
+
+			case SERVER_SIGNAL:
+				server_reap(&srv, sfd);
+				continue;
+
+			case SERVER_CONN:
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+					conn_read(conn);
+				}
+				break;
+
+			case SERVER_STDOUT:
+			case SERVER_STDERR:
+				conn_relay(&srv, conn, sfd);
+				break;
+			}
+
+			conn_update(&srv, conn);
+		}
+
+		server_gc(&srv);
+	}
+
+	rcode = 0;
+
+done:
+	while (srv.conns) conn_close(&srv, srv.conns);
+	server_gc(&srv);
+
+	for (i = 0; i < num_addrs; i++) {
+		if (listeners[i].fd < 0) continue;
+
+		close(listeners[i].fd);
+		if (strchr(addrs[i], '/') != NULL) unlink(addrs[i]);
+	}
+	free(listeners);
+
+	if (sig.fd >= 0) close(sig.fd);
+	if (srv.epfd >= 0) close(srv.epfd);
+	free(srv.banner);
+
+	return rcode;
+}
+#else
+int recli_server(UNUSED recli_config_t *config, UNUSED int num_addrs,
+		 UNUSED const char *addrs[])
+{
+	recli_fprintf(recli_stderr, "The server needs epoll\n");
+	return -1;
+}
+#endif
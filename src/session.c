@@ -0,0 +1,1519 @@
+/*
+ * A command line session: the context stack, builtins, and running
+ * commands.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "recli.h"
+
+/*
+ *	Admins can type a partial command, in which case it's put on
+ *	the stack, and the prompt changes to include the partial
+ *	command.  We want to track these partial commands, but also
+ *	limit the size of the stack.
+ */
+typedef struct ctx_stack_t {
+	char		*prompt;
+
+	char		*buf;
+	size_t		len;
+	size_t		bufsize;
+
+	char		*argv_buf;
+	size_t		argv_bufsize;
+
+	int		argc;
+	char		**argv;
+
+	int		total_argc;
+	int		max_argc;
+
+	cli_syntax_t	*syntax;
+	cli_syntax_t	*short_help;
+	cli_syntax_t	*long_help;
+} ctx_stack_t;
+
+#define CTX_STACK_MAX (32)
+
+/*
+ *	The line buffers are only needed while a line is being
+ *	processed, or there's a partial command on the stack.  An idle
+ *	session doesn't have them, so that a server can hold many
+ *	sessions.
+ */
+typedef struct session_buffers_t {
+	char		line[8192];	/* full line of whatever the user entered */
+	char		argv_buf[8192];	/* copy of the above, split into argv */
+	char		*argv[256];	/* where the argvs are */
+} session_buffers_t;
+
+/*
+ *	A command which was run with '&'.  Its output is kept until
+ *	"fg" shows it.  A job with a lot of output waiting isn't read
+ *	any more, so it stops when the pipe fills up.
+ */
+#define SESSION_JOBS_MAX	(16)
+#define SESSION_JOB_OUTPUT_MAX	(1024 * 1024)
+
+typedef struct session_job_t {
+	pid_t		pid;		/* 0 for a free slot, -1 once it's reaped */
+	int		status;		/* from waitpid() */
+	int		out_fd;
+	int		err_fd;
+	recli_filter_t	*filter;	/* on its stdout */
+	char		*command;
+
+	char		*output;	/* which hasn't been shown */
+	size_t		len;
+	size_t		size;
+
+	int		notified;	/* "[N] Done" was printed */
+} session_job_t;
+
+/*
+ *	Everything which one user's session changes.  The syntax nodes
+ *	are shared by all sessions, so the sessions must all be used
+ *	from one thread.
+ */
+struct recli_session_t {
+	recli_session_t	*next;		/* all of the sessions */
+	recli_config_t	*config;	/* shared with other sessions */
+	recli_snapshot_t *snap;		/* syntax and help we're using */
+	int		flags;
+	int		done;		/* "quit", or "exit" at the top */
+
+	recli_fprintf_t	fprintf;	/* output sinks */
+	void		*out;
+	void		*err;
+
+	recli_history_t	history;
+	void		*history_ctx;
+
+	recli_run_t	run;		/* runs commands instead of recli_exec() */
+	void		*run_ctx;
+	recli_filter_t	*filter;	/* on the output of the command "run" has */
+
+	pid_t		child_pid;	/* command being run, or -1 */
+
+	session_job_t	*jobs;		/* SESSION_JOBS_MAX, once there's one */
+	int		last_job;	/* the one "fg" and "kill" use by default */
+
+	char		prompt_full[256];
+	char		prompt_ctx[256];
+
+	recli_stats_t	exec_stats;
+	recli_hist_t	*step_hist;	/* RECLI_STEP_MAX, for RECLI_SESSION_STEP_TIMES */
+
+	session_buffers_t *buffers;
+
+	int		ctx_stack_index;
+	ctx_stack_t	ctx_stack_array[CTX_STACK_MAX];
+	ctx_stack_t	*ctx_stack;
+};
+
+/*
+ *	The library prints through recli_fprintf(), so point that at
+ *	the session's sinks while it's doing anything.
+ */
+typedef struct session_sinks_t {
+	recli_fprintf_t	fprintf;
+	void		*out;
+	void		*err;
+} session_sinks_t;
+
+static void session_update(recli_session_t *s);
+
+static void session_enter(recli_session_t *s, session_sinks_t *old)
+{
+	session_update(s);
+
+	old->fprintf = recli_fprintf;
+	old->out = recli_stdout;
+	old->err = recli_stderr;
+
+	recli_fprintf = s->fprintf;
+	recli_stdout = s->out;
+	recli_stderr = s->err;
+}
+
+static void session_leave(session_sinks_t *old)
+{
+	recli_fprintf = old->fprintf;
+	recli_stdout = old->out;
+	recli_stderr = old->err;
+}
+
+static recli_session_t *sessions = NULL;
+
+typedef void (*builtin_func_t)(recli_session_t *, int , char **);
+
+typedef struct builtin_t {
+	char const	*name;
+	char const	*arg;		/* second word, if any */
+	builtin_func_t	function;
+} builtin_t;
+
+/*
+ *	Finish one step of processing a line, and start the next one.
+ */
+static void step_done(recli_session_t *s, recli_step_t step, uint64_t *when)
+{
+	uint64_t now;
+
+	if (!*when) return;
+
+	recli_trace_span("command", recli_step_names[step], 0, *when, NULL, 0, NULL, 0);
+
+	now = recli_now();
+	if (s->step_hist) recli_hist_add(&s->step_hist[step], now - *when);
+	*when = now;
+}
+
+/*
+ *	Stack functions
+ */
+
+/*
+ *	Frozen nodes only become garbage when a snapshot is freed.  If
+ *	a context was holding on to some of them at the time, they're
+ *	collected again once the contexts are popped.
+ */
+static int collect_held = 0;
+
+/*
+ *	Free the frozen syntax nodes which are no longer used by any
+ *	snapshot, or by any context on the stack of any session.
+ */
+static void session_collect(void)
+{
+	int i, num, max;
+	cli_syntax_t **roots;
+	recli_session_t *s;
+
+	if ((recli_snapshot_reclaim() == 0) && !collect_held) return;
+
+	collect_held = 0;
+	max = recli_snapshot_roots(NULL, 0);
+	for (s = sessions; s != NULL; s = s->next) {
+		max += 3 * (s->ctx_stack_index + 1);
+	}
+
+	roots = malloc(max * sizeof(roots[0]));
+	if (!roots) {
+		collect_held = 1; /* try again later */
+		return;
+	}
+
+	num = recli_snapshot_roots(roots, max);
+	for (s = sessions; s != NULL; s = s->next) {
+		if (s->ctx_stack_index > 0) collect_held = 1;
+
+		for (i = 0; i <= s->ctx_stack_index; i++) {
+			roots[num++] = s->ctx_stack_array[i].syntax;
+			roots[num++] = s->ctx_stack_array[i].long_help;
+			roots[num++] = s->ctx_stack_array[i].short_help;
+		}
+	}
+
+	syntax_collect(roots, num);
+	free(roots);
+}
+
+/*
+ *	Move to the published snapshot, if there's a newer one.  A
+ *	session which is in a context keeps the snapshot it has until
+ *	it leaves, so that a reload doesn't throw away what it has
+ *	typed.
+ */
+static void session_update(recli_session_t *s)
+{
+	recli_snapshot_t *snap;
+	ctx_stack_t *ctx_stack = &s->ctx_stack_array[0];
+
+	if (s->ctx_stack_index > 0) return;
+
+	if (s->snap == __atomic_load_n(&s->config->snapshot, __ATOMIC_ACQUIRE)) return;
+
+	snap = recli_snapshot_pin(&s->config->snapshot);
+	if (!snap) return;
+
+	recli_snapshot_unpin(s->snap);
+	s->snap = snap;
+
+	ctx_stack->syntax = snap->syntax;
+	ctx_stack->long_help = snap->long_help;
+	ctx_stack->short_help = snap->short_help;
+
+	session_collect();
+}
+
+static void ctx_stack_pop(recli_session_t *s)
+{
+	ctx_stack_t *ctx_stack = s->ctx_stack;
+
+	if (s->ctx_stack_index == 0) return;
+
+	assert(ctx_stack->syntax != NULL);
+	syntax_free(ctx_stack->syntax);
+	if (ctx_stack->long_help) syntax_free(ctx_stack->long_help);
+	if (ctx_stack->short_help) syntax_free(ctx_stack->short_help);
+
+	s->ctx_stack_index--;
+	ctx_stack = --s->ctx_stack;
+
+	/*
+	 *	Reset buffers, etc. for the previous context.
+	 */
+	ctx_stack->buf[0] = '\0';
+	ctx_stack->argv_buf[0] = '\0';
+	ctx_stack->argv[0] = NULL;
+	ctx_stack->argc = 0;
+
+	session_collect();
+}
+
+/*
+ *	The user-entered string is already in ctx_stack->buf
+ */
+static void ctx_stack_push(recli_session_t *s, int argc)
+{
+	size_t len;
+	ctx_stack_t *ctx_stack = s->ctx_stack;
+	ctx_stack_t *next;
+	cli_syntax_t *match;
+
+	if (s->ctx_stack_index >= (CTX_STACK_MAX - 1)) return;
+
+	next = ctx_stack + 1;
+
+	match = syntax_match_max(ctx_stack->syntax, argc, ctx_stack->argv);
+	assert(match != NULL);
+
+	next->syntax = syntax_skip_prefix(match, argc);
+	assert(next->syntax != NULL);
+	syntax_free(match);
+	syntax_freeze(next->syntax);
+
+	if (ctx_stack->short_help) {
+		match = syntax_match_max(ctx_stack->short_help, argc, ctx_stack->argv);
+		if (match) {
+			next->short_help = syntax_skip_prefix(match, argc);
+			syntax_free(match);
+		} else {
+			next->short_help = NULL;
+		}
+	} else {
+		next->short_help = NULL;
+	}
+
+	if (ctx_stack->long_help) {
+		match = syntax_match_max(ctx_stack->long_help, argc, ctx_stack->argv);
+		if (match) {
+			next->long_help = syntax_skip_prefix(match, argc);
+			syntax_free(match);
+		} else {
+			next->long_help = NULL;
+		}
+	} else {
+		next->long_help = NULL;
+	}
+
+	len = strlen(ctx_stack->buf);
+
+	ctx_stack->buf[len++] = ' ';
+	ctx_stack->buf[len] = '\0';
+	ctx_stack->argc = argc;
+
+	ctx_stack->len = len;
+
+	next->buf = ctx_stack->buf + len;
+	next->bufsize = ctx_stack->bufsize - len;
+
+	next->argv_buf = &s->buffers->argv_buf[0] + (next->buf - &s->buffers->line[0]);
+	next->argv_bufsize = next->bufsize;
+
+	next->argv = ctx_stack->argv + argc;
+	next->argv[0] = NULL;
+
+	next->max_argc = ctx_stack->max_argc - argc;
+	next->argc = 0;
+	next->total_argc = ctx_stack->total_argc + argc;
+
+	next->prompt = s->prompt_ctx;
+
+	s->ctx_stack_index++;
+	s->ctx_stack = next;
+}
+
+
+/*
+ *	Builtin commands
+ */
+static void builtin_help(recli_session_t *s, int argc, char **argv)
+{
+	int rcode;
+	char const *help;
+	char const *error;
+	ctx_stack_t *ctx_stack = s->ctx_stack;
+
+	/*
+	 *	Show the current syntax
+	 */
+	if ((argc >= 1) && (strcmp(argv[0], "syntax") == 0)) {
+		syntax_print_lines(ctx_stack->syntax);
+		return;
+	}
+
+	rcode = syntax_check(ctx_stack->syntax, argc, argv, &error, NULL);
+	if (rcode < 0) {
+		if (!error) {
+			recli_fprintf(recli_stderr, "Invalid input\n");
+		} else {
+			recli_fprintf(recli_stderr, "Invalid input in word %d - '%s'\n", -rcode, error);
+		}
+
+		return;
+	}
+
+	if (!ctx_stack->long_help) return;
+
+	/*
+	 *	Print short help text first
+	 */
+	syntax_print_context_help(ctx_stack->long_help, argc, argv);
+
+	help = syntax_show_help(ctx_stack->long_help, argc, argv);
+	if (!help) {
+		recli_fprintf(recli_stdout, "\r\n");
+	} else {
+		recli_fprintf_words(recli_stdout, "%s", help);
+	}
+
+	return;
+}
+
+/*
+ *	The built-in commands don't bother checking for too
+ *	much input.  They also take priority over user
+ *	commands.
+ */
+static void builtin_end(recli_session_t *s, UNUSED int argc, UNUSED char *argv[])
+{
+	while (s->ctx_stack_index > 0) ctx_stack_pop(s);
+}
+
+static void builtin_exit(recli_session_t *s, UNUSED int argc, UNUSED char *argv[])
+{
+	if (s->ctx_stack_index == 0) {
+		s->done = 1;
+		return;
+	}
+
+	ctx_stack_pop(s);
+
+	recli_fprintf(recli_stdout, "%s\n", s->buffers->line);
+}
+
+static void builtin_quit(recli_session_t *s, UNUSED int argc, UNUSED char *argv[])
+{
+	s->done = 1;
+}
+
+static void builtin_show_stats(recli_session_t *s, UNUSED int argc, UNUSED char *argv[])
+{
+	syntax_print_stats(recli_stdout, s->ctx_stack->syntax);
+
+	if (syntax_counting) recli_counters_print(recli_stdout, NULL, &syntax_counters);
+
+	if (!s->step_hist) return;
+
+	recli_hist_print(recli_stdout, s->step_hist);
+}
+
+/*
+ *	Background jobs
+ */
+static int job_append(session_job_t *job, const char *data, size_t len)
+{
+	if ((job->size - job->len) < len) {
+		char *p;
+		size_t size = job->size ? job->size : 1024;
+
+		while ((size - job->len) < len) size *= 2;
+
+		p = realloc(job->output, size);
+		if (!p) return -1;
+
+		job->output = p;
+		job->size = size;
+	}
+
+	memcpy(job->output + job->len, data, len);
+	job->len += len;
+	return 0;
+}
+
+/*
+ *	Where the filter on a job's stdout prints to.
+ */
+static int job_fprintf(void *ctx, const char *fmt, ...)
+{
+	int len;
+	char buffer[1024], *p;
+	va_list ap;
+	session_job_t *job = ctx;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+	va_end(ap);
+	if (len <= 0) return 0;
+
+	if (len < (int) sizeof(buffer)) return (job_append(job, buffer, len) < 0) ? 0 : len;
+
+	p = malloc(len + 1);
+	if (!p) return 0;
+
+	va_start(ap, fmt);
+	vsnprintf(p, len + 1, fmt, ap);
+	va_end(ap);
+
+	if (job_append(job, p, len) < 0) len = 0;
+	free(p);
+
+	return len;
+}
+
+/*
+ *	Read what's waiting on one of a job's pipes, unless it has
+ *	too much output waiting already.
+ */
+static void job_read(session_job_t *job, int *fd, int is_stdout)
+{
+	ssize_t num;
+	char data[16384];
+
+	while (job->len < SESSION_JOB_OUTPUT_MAX) {
+		num = read(*fd, data, sizeof(data) - 1);
+		if (num < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			num = 0;
+		}
+
+		if (num == 0) {
+			close(*fd);
+			*fd = -1;
+
+			if (is_stdout && job->filter) recli_filter_done(job->filter);
+			return;
+		}
+
+		data[num] = '\0';
+		if (is_stdout && job->filter) {
+			recli_filter_write(job->filter, data, num);
+		} else {
+			(void) job_append(job, data, num);
+		}
+	}
+}
+
+/*
+ *	Commands may change the syntax, so it's reloaded when a job
+ *	finishes, as it is after other commands.
+ */
+static void job_reap(recli_session_t *s, session_job_t *job, int wait)
+{
+	if (job->pid <= 0) return;
+
+	if (waitpid(job->pid, &job->status, wait ? 0 : WNOHANG) != job->pid) return;
+
+	job->pid = -1;
+
+	recli_load_syntax(s->config);
+	session_update(s);
+}
+
+static int job_finished(const session_job_t *job)
+{
+	return (job->pid < 0) && (job->out_fd < 0) && (job->err_fd < 0);
+}
+
+static void job_free(session_job_t *job)
+{
+	if (job->out_fd >= 0) close(job->out_fd);
+	if (job->err_fd >= 0) close(job->err_fd);
+
+	recli_filter_free(job->filter);
+	free(job->command);
+	free(job->output);
+
+	memset(job, 0, sizeof(*job));
+}
+
+static void job_print(recli_session_t *s, session_job_t *job)
+{
+	char state[32];
+
+	if (!job_finished(job)) {
+		strcpy(state, "Running");
+
+	} else if (WIFSIGNALED(job->status)) {
+		strcpy(state, "Killed");
+
+	} else if (WEXITSTATUS(job->status) != 0) {
+		snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(job->status));
+
+	} else {
+		strcpy(state, "Done");
+	}
+
+	recli_fprintf(recli_stdout, "[%d] %-8s %s", (int) (job - s->jobs) + 1, state,
+		      job->command);
+	if (job->len) recli_fprintf(recli_stdout, " (%zu bytes of output)", job->len);
+	recli_fprintf(recli_stdout, "\n");
+}
+
+/*
+ *	Read the output of the jobs, and reap the ones which have
+ *	finished.  Optionally say which ones have finished.
+ */
+static void jobs_update(recli_session_t *s, int notify)
+{
+	int i;
+	session_job_t *job;
+
+	if (!s->jobs) return;
+
+	for (i = 0; i < SESSION_JOBS_MAX; i++) {
+		job = &s->jobs[i];
+		if (!job->pid) continue;
+
+		if (job->out_fd >= 0) job_read(job, &job->out_fd, 1);
+		if (job->err_fd >= 0) job_read(job, &job->err_fd, 0);
+		job_reap(s, job, 0);
+
+		if (!notify || job->notified || !job_finished(job)) continue;
+
+		job_print(s, job);
+		job->notified = 1;
+		if (!job->len) job_free(job);
+	}
+}
+
+/*
+ *	Run a command in the background.  Its stdout goes through the
+ *	filter, if there is one.
+ */
+static void job_start(recli_session_t *s, const char *command, const char *rundir,
+		      int argc, char *argv[], char *const envp[], recli_filter_t *filter)
+{
+	int i;
+	session_job_t *job;
+
+	if (!s->jobs) {
+		s->jobs = calloc(SESSION_JOBS_MAX, sizeof(s->jobs[0]));
+		if (!s->jobs) goto oom;
+	}
+
+	/*
+	 *	Make room by forgetting about finished jobs which have
+	 *	no output waiting.
+	 */
+	for (i = 0; i < SESSION_JOBS_MAX; i++) {
+		if (!s->jobs[i].pid) break;
+	}
+	if (i == SESSION_JOBS_MAX) {
+		jobs_update(s, 0);
+
+		for (i = 0; i < SESSION_JOBS_MAX; i++) {
+			job = &s->jobs[i];
+			if (job_finished(job) && !job->len) break;
+		}
+		if (i == SESSION_JOBS_MAX) {
+			recli_fprintf(recli_stderr, "Too many jobs\n");
+			recli_filter_free(filter);
+			return;
+		}
+
+		job_free(&s->jobs[i]);
+	}
+
+	job = &s->jobs[i];
+	job->out_fd = job->err_fd = -1;
+
+	job->command = strdup(command);
+	if (!job->command) {
+	oom:
+		recli_fprintf(recli_stderr, "Out of memory\n");
+		recli_filter_free(filter);
+		return;
+	}
+
+	job->pid = recli_spawn(rundir, argc, argv, envp, &job->out_fd, &job->err_fd);
+	if (job->pid < 0) {
+		job->pid = 0;
+		recli_filter_free(filter);
+		job_free(job);
+		return;
+	}
+
+	if (filter) {
+		recli_filter_output(filter, job_fprintf, job);
+		job->filter = filter;
+	}
+
+	s->last_job = i;
+	recli_fprintf(recli_stdout, "[%d] %d\n", i + 1, (int) job->pid);
+}
+
+/*
+ *	"fg 2", "fg %2", or "fg" for the last job which was started.
+ */
+static session_job_t *job_find(recli_session_t *s, int argc, char *argv[])
+{
+	int i;
+	char *end;
+	const char *p;
+
+	if (argc == 0) {
+		if (s->jobs && s->jobs[s->last_job].pid) return &s->jobs[s->last_job];
+
+		for (i = SESSION_JOBS_MAX - 1; s->jobs && (i >= 0); i--) {
+			if (s->jobs[i].pid) return &s->jobs[i];
+		}
+
+		recli_fprintf(recli_stderr, "No current job\n");
+		return NULL;
+	}
+
+	p = argv[0];
+	if (*p == '%') p++;
+
+	i = strtol(p, &end, 10);
+	if (!*p || *end || (i < 1) || (i > SESSION_JOBS_MAX) ||
+	    !s->jobs || !s->jobs[i - 1].pid) {
+		recli_fprintf(recli_stderr, "No such job: %s\n", argv[0]);
+		return NULL;
+	}
+
+	return &s->jobs[i - 1];
+}
+
+static void builtin_jobs(recli_session_t *s, UNUSED int argc, UNUSED char *argv[])
+{
+	int i;
+	session_job_t *job;
+
+	jobs_update(s, 0);
+
+	for (i = 0; s->jobs && (i < SESSION_JOBS_MAX); i++) {
+		job = &s->jobs[i];
+		if (!job->pid) continue;
+
+		job_print(s, job);
+		if (job_finished(job) && !job->len) job_free(job);
+	}
+}
+
+/*
+ *	Print the output which the job has so far, and then the rest
+ *	of it as it arrives, until the job exits.  A ^C is passed on
+ *	to it, as for other commands.
+ */
+static void job_wait(recli_session_t *s, session_job_t *job)
+{
+	int n;
+	struct pollfd fds[2];
+
+	s->child_pid = job->pid;
+
+	for (;;) {
+		if (job->len) {
+			recli_fprintf(recli_stdout, "%.*s", (int) job->len, job->output);
+			job->len = 0;
+		}
+
+		if ((job->out_fd < 0) && (job->err_fd < 0)) break;
+
+		fds[0].fd = job->out_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = job->err_fd;
+		fds[1].events = POLLIN;
+
+		n = poll(fds, 2, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		if (job->out_fd >= 0) job_read(job, &job->out_fd, 1);
+		if (job->err_fd >= 0) job_read(job, &job->err_fd, 0);
+	}
+
+	job_reap(s, job, 1);
+	s->child_pid = -1;
+
+	job_free(job);
+}
+
+static void builtin_fg(recli_session_t *s, int argc, char *argv[])
+{
+	session_job_t *job;
+
+	job = job_find(s, argc, argv);
+	if (!job) return;
+
+	job_wait(s, job);
+}
+
+static void builtin_kill(recli_session_t *s, int argc, char *argv[])
+{
+	session_job_t *job;
+
+	job = job_find(s, argc, argv);
+	if (!job || (job->pid < 0)) return;
+
+	/*
+	 *	The job has its own process group, unless it exec'd
+	 *	before we could give it one.
+	 */
+	if (kill(-job->pid, SIGTERM) < 0) kill(job->pid, SIGTERM);
+}
+
+/*
+ *	"show stats" is a builtin, but "show" on its own, or with
+ *	anything else, is left to the syntax.
+ */
+static builtin_t builtin_commands[] = {
+	{ "end", NULL, builtin_end },
+	{ "exit", NULL, builtin_exit },
+	{ "fg", NULL, builtin_fg },
+	{ "help", NULL, builtin_help },
+	{ "jobs", NULL, builtin_jobs },
+	{ "kill", NULL, builtin_kill },
+	{ "logout", NULL, builtin_quit },
+	{ "quit", NULL, builtin_quit },
+	{ "show", "stats", builtin_show_stats },
+	{ NULL, NULL, NULL }
+};
+
+/*
+ *	Give the top of the stack its line buffers.
+ */
+static int session_buffers(recli_session_t *s)
+{
+	ctx_stack_t *ctx_stack = &s->ctx_stack_array[0];
+
+	assert(s->ctx_stack_index == 0);
+
+	s->buffers = malloc(sizeof(*s->buffers));
+	if (!s->buffers) return -1;
+
+	s->buffers->line[0] = '\0';
+	s->buffers->argv_buf[0] = '\0';
+	s->buffers->argv[0] = NULL;
+
+	ctx_stack->argv = s->buffers->argv;
+	ctx_stack->max_argc = sizeof(s->buffers->argv) / sizeof(s->buffers->argv[0]);
+
+	ctx_stack->buf = s->buffers->line;
+	ctx_stack->bufsize = sizeof(s->buffers->line);
+
+	ctx_stack->argv_buf = s->buffers->argv_buf;
+	ctx_stack->argv_bufsize = sizeof(s->buffers->argv_buf);
+
+	return 0;
+}
+
+/*
+ *	Back at the top, so the line buffers aren't needed.
+ */
+static void session_release(recli_session_t *s)
+{
+	ctx_stack_t *ctx_stack = &s->ctx_stack_array[0];
+
+	if (!s->buffers || (s->ctx_stack_index > 0)) return;
+
+	free(s->buffers);
+	s->buffers = NULL;
+
+	ctx_stack->argv = NULL;
+	ctx_stack->buf = NULL;
+	ctx_stack->argv_buf = NULL;
+	ctx_stack->bufsize = ctx_stack->argv_bufsize = 0;
+	ctx_stack->max_argc = 0;
+}
+
+static char const *spaces = "                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                ";
+
+static void process_line(recli_session_t *s, char *line)
+{
+	int i, c, argc;
+	int runit = 1;
+	int needs_tty = 0;
+	int background = 0;	/* where the '&' is */
+	size_t len = strlen(line);
+	size_t offset;
+	const char *error;
+	char **argv;
+	recli_token_t tokens[256];
+	uint64_t step;
+	recli_filter_t *filter = NULL;
+	ctx_stack_t *ctx_stack = s->ctx_stack;
+
+	if (!len) return;
+
+	if (!s->buffers && (session_buffers(s) < 0)) {
+		recli_fprintf(recli_stderr, "Out of memory\r\n");
+		return;
+	}
+
+	step = s->step_hist ? recli_now() : recli_trace_now();
+
+	if (len >= ctx_stack->bufsize) {
+		recli_fprintf(recli_stderr, "line too long\r\n");
+		return;
+	}
+
+	/*
+	 *	Copy the text to the line buffer, and split it into
+	 *	tokens there.  Only the tokens are copied to the argv
+	 *	buffer, at the same offsets as in the line buffer.
+	 */
+	memcpy(ctx_stack->buf, line, len + 1);
+
+	argc = str2tokens(ctx_stack->buf, len, ctx_stack->max_argc, tokens, &offset);
+	if (!argc) return;
+
+	if (argc < 0) {
+		recli_fprintf(recli_stderr, "%s\n", ctx_stack->buf);
+		recli_fprintf(recli_stderr, "%.*s^", (int) offset, spaces);
+		recli_fprintf(recli_stderr, " Parse error.\n");
+		return;
+	}
+
+	argv = ctx_stack->argv;
+
+	for (i = 0; i < argc; i++) {
+		char *p = ctx_stack->argv_buf + tokens[i].offset;
+
+		memcpy(p, ctx_stack->buf + tokens[i].offset, tokens[i].length);
+		p[tokens[i].length] = '\0';
+		argv[i] = p;
+	}
+
+	step_done(s, RECLI_STEP_TOKENIZE, &step);
+
+	for (i = 0; builtin_commands[i].name != NULL; i++) {
+		int words = 1;
+
+		if (strcmp(argv[0], builtin_commands[i].name) != 0) continue;
+
+		if (builtin_commands[i].arg) {
+			if ((argc < 2) || (strcmp(argv[1], builtin_commands[i].arg) != 0)) continue;
+			words++;
+		}
+
+		builtin_commands[i].function(s, argc - words, argv + words);
+		step_done(s, RECLI_STEP_BUILTIN, &step);
+		return;
+	}
+
+	/*
+	 *	A '&' at the end runs the command in the background.
+	 */
+	if ((argc > 1) && !tokens[argc - 1].quote && (strcmp(argv[argc - 1], "&") == 0)) {
+		if (s->run) {
+			recli_fprintf(recli_stderr, "%s\n", ctx_stack->buf);
+			recli_fprintf(recli_stderr, "%.*s^", (int) tokens[argc - 1].offset, spaces);
+			recli_fprintf(recli_stderr, " Commands can't be run in the background here.\n");
+			runit = 0;
+			goto add_line;
+		}
+
+		argc--;
+		background = argc;
+	}
+
+	/*
+	 *	A '|' ends the command, and the output filters follow it.
+	 */
+	for (i = 0; i < argc; i++) {
+		if (!tokens[i].quote && (strcmp(argv[i], "|") == 0)) break;
+	}
+
+	if (i < argc) {
+		c = (i == 0) ? -1 : recli_filter_parse(argc - i, argv + i, &filter, &error);
+		if (c < 0) {
+			if (i == 0) error = "Expected a command";
+			c = i - c - 1;
+
+			recli_fprintf(recli_stderr, "%s\n", ctx_stack->buf);
+			recli_fprintf(recli_stderr, "%.*s^", (int) ((c < argc) ? tokens[c].offset : len),
+				      spaces);
+			recli_fprintf(recli_stderr, " %s.\n", error);
+
+			runit = 0;
+			goto add_line;
+		}
+
+		argc = i;
+	}
+
+	/*
+	 *	c < 0 - error in argument -C
+	 *	c == argc, parsed it completely
+	 *	c > argc, add new context
+	 */
+	c = syntax_check(ctx_stack->syntax, argc, argv, &error, &needs_tty);
+	step_done(s, RECLI_STEP_CHECK, &step);
+
+	if (c < 0) {
+		/*
+		 *	FIXME: check against argc
+		 *
+		 *	FIXME: check against stack
+		 *
+		 *	if we have "x y" on the stack
+		 *	and type in an erroneous "z",
+		 *	the c here will be -3, not -1.
+		 */
+		recli_fprintf(recli_stderr, "%s\n", ctx_stack->buf);
+
+		if (-c == argc) {
+			recli_fprintf(recli_stderr, "%.*s^", (int) tokens[argc - 1].offset, spaces);
+
+		} else if (-c > argc) {
+			recli_fprintf(recli_stderr, "%.*s^", (int) strlen(ctx_stack->buf), spaces);
+
+		} else {
+			recli_fprintf(recli_stderr, "%.*s^", (int) tokens[-c - 1].offset, spaces);
+		}
+
+		if (!error) error = "Parse error";
+
+		recli_fprintf(recli_stderr, " %s.\n", error);
+		
+		runit = 0;
+		goto add_line;
+	}
+
+	/*
+	 *	We reached the end of the syntax before the end of the input
+	 */
+	if (c < argc) {
+		recli_fprintf(recli_stderr, "%s\n", ctx_stack->buf);
+		recli_fprintf(recli_stderr, "%.*s^", (int) tokens[c].offset, spaces);
+
+		recli_fprintf(recli_stderr, " Unexpected text.\n");
+		runit = 0;
+		goto add_line;
+	}
+
+	if ((filter || background) && ((c > argc) || needs_tty)) {
+		if (c > argc) {
+			error = "The command isn't complete";
+		} else if (filter) {
+			error = "The output of an interactive command can't be filtered";
+		} else {
+			error = "An interactive command can't be run in the background";
+		}
+
+		recli_fprintf(recli_stderr, "%s\n", ctx_stack->buf);
+		recli_fprintf(recli_stderr, "%.*s^", (int) tokens[argc].offset, spaces);
+		recli_fprintf(recli_stderr, " %s.\n", error);
+		runit = 0;
+		goto add_line;
+	}
+
+	/*
+	 *	REST requests are made while we wait, so they can't be
+	 *	jobs.
+	 */
+	if (background && s->config->rest &&
+	    recli_rest_match(s->config->rest, ctx_stack->total_argc + argc, s->buffers->argv)) {
+		recli_fprintf(recli_stderr, "%s\n", ctx_stack->buf);
+		recli_fprintf(recli_stderr, "%.*s^", (int) tokens[background].offset, spaces);
+		recli_fprintf(recli_stderr, " A REST command can't be run in the background.\n");
+		runit = 0;
+		goto add_line;
+	}
+
+	/*
+	 *	FIXME: figure out which thing we didn't have permission for.
+	 *
+	 *	Note that we check the permissions on the FULL arguments, because that's how it works.
+	 */
+	if (!permission_enforce(s->config->permissions, ctx_stack->total_argc + argc,
+				s->buffers->argv)) {
+		recli_fprintf(recli_stderr, "%s\n", line);
+		recli_fprintf(recli_stderr, "^ - No permission\n");
+		runit = 0;
+		step_done(s, RECLI_STEP_PERMISSION, &step);
+		goto add_line;
+	}
+	step_done(s, RECLI_STEP_PERMISSION, &step);
+
+	/*
+	 *	Got N commands, wanted M > N in order to do anything.
+	 */
+	if (c > argc) {
+		runit = 0;
+
+		if (s->ctx_stack_index >= (CTX_STACK_MAX - 1)) {
+			c = -1;
+			goto add_line;
+		}
+
+		ctx_stack_push(s, argc);
+		return;
+	}
+
+	runit = 1;
+
+add_line:
+	/*
+	 *	Save the FULL text in the history.
+	 */
+	if (s->history) {
+		s->history(s->history_ctx, s->buffers->line);
+		step_done(s, RECLI_STEP_HISTORY, &step);
+	}
+
+	if (runit && s->config->dir) {
+		char buffer[8192];
+		recli_times_t times;
+		uint64_t when;
+		int exec_timing = (s->flags & RECLI_SESSION_EXEC_TIMES) != 0;
+
+		/*
+		 *	REST commands don't change the syntax, so it
+		 *	isn't reloaded.  They're run while we wait, for
+		 *	no longer than the REST timeout.  On a server,
+		 *	that's short, as every session waits, too.
+		 */
+		if (s->config->rest &&
+		    (recli_rest_run(s->config->rest, ctx_stack->total_argc + argc,
+				    s->buffers->argv, filter) >= 0)) {
+			if (filter) recli_filter_done(filter);
+			recli_filter_free(filter);
+			step_done(s, RECLI_STEP_EXEC, &step);
+			return;
+		}
+
+		snprintf(buffer, sizeof(buffer), "%s/bin/",
+			 s->config->dir);
+
+		/*
+		 *	The job is named by the text of the command,
+		 *	without the '&'.
+		 */
+		if (background) {
+			char *p = ctx_stack->buf + tokens[background].offset;
+
+			while ((p > s->buffers->line) && isspace((int) p[-1])) p--;
+			*p = '\0';
+
+			job_start(s, s->buffers->line, buffer, ctx_stack->total_argc + argc,
+				  s->buffers->argv, s->config->envp, filter);
+			step_done(s, RECLI_STEP_EXEC, &step);
+			return;
+		}
+
+		/*
+		 *	The filter is finished when the command is, in
+		 *	recli_session_reload().
+		 */
+		if (s->run) {
+			recli_filter_free(s->filter);
+			s->filter = filter;
+
+			s->run(s->run_ctx, buffer, needs_tty, ctx_stack->total_argc + argc,
+			       s->buffers->argv, s->config->envp, filter);
+			step_done(s, RECLI_STEP_EXEC, &step);
+			return;
+		}
+
+		recli_exec(buffer, needs_tty, ctx_stack->total_argc + argc,
+			   s->buffers->argv, s->config->envp, filter, &s->child_pid,
+			   exec_timing ? &times : NULL);
+		if (filter) recli_filter_done(filter);
+		step_done(s, RECLI_STEP_EXEC, &step);
+
+		when = exec_timing ? recli_now() : 0;
+		recli_load_syntax(s->config);
+		if (exec_timing) {
+			times.ns[RECLI_PHASE_RELOAD] = recli_now() - when;
+			recli_stats_add(&s->exec_stats, &times);
+		}
+		step_done(s, RECLI_STEP_RELOAD, &step);
+
+		/* If the syntax was reloaded, move to it */
+		session_update(s);
+
+		fflush(stdout);
+		fflush(stderr);
+	}
+
+	recli_filter_free(filter);
+}
+
+/*
+ *	Create a session.  The configuration can be shared by many
+ *	sessions, and must outlive them.  If it doesn't have a
+ *	published snapshot yet, its syntax and help are published.
+ *	The output goes to wherever recli_fprintf() goes now, until
+ *	recli_session_output() says otherwise.
+ */
+recli_session_t *recli_session_alloc(recli_config_t *config, int flags)
+{
+	recli_session_t *s;
+	ctx_stack_t *ctx_stack;
+	const char *prompt;
+
+	if (!config->snapshot) {
+		recli_snapshot_t *snap;
+
+		snap = recli_snapshot_alloc(config->syntax, config->long_help,
+					    config->short_help);
+		if (!snap) return NULL;
+
+		recli_snapshot_publish(&config->snapshot, snap);
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s) return NULL;
+
+	s->config = config;
+	s->flags = flags;
+
+	s->fprintf = recli_fprintf;
+	s->out = recli_stdout;
+	s->err = recli_stderr;
+
+	s->child_pid = -1;
+
+	if (flags & RECLI_SESSION_STEP_TIMES) {
+		s->step_hist = calloc(RECLI_STEP_MAX, sizeof(s->step_hist[0]));
+		if (!s->step_hist) {
+			free(s);
+			return NULL;
+		}
+	}
+
+	s->snap = recli_snapshot_pin(&config->snapshot);
+
+	prompt = config->prompt;
+	if (!prompt) prompt = "recli";
+
+	snprintf(s->prompt_full, sizeof(s->prompt_full), "%s> ", prompt);
+	snprintf(s->prompt_ctx, sizeof(s->prompt_ctx), "%s ...> ", prompt);
+
+	/*
+	 *	Set up the stack.
+	 */
+	s->ctx_stack_index = 0;
+	s->ctx_stack = ctx_stack = &s->ctx_stack_array[0];
+
+	ctx_stack->argc = 0;
+	ctx_stack->total_argc = 0;
+
+	ctx_stack->syntax = s->snap->syntax;
+	ctx_stack->long_help = s->snap->long_help;
+	ctx_stack->short_help = s->snap->short_help;
+
+	ctx_stack->prompt = s->prompt_full;
+
+	s->next = sessions;
+	sessions = s;
+
+	return s;
+}
+
+void recli_session_free(recli_session_t *s)
+{
+	int i;
+	recli_session_t **last;
+
+	if (!s) return;
+
+	while (s->ctx_stack_index > 0) ctx_stack_pop(s);
+	session_release(s);
+
+	for (last = &sessions; *last != s; last = &(*last)->next) {
+		/* nothing */
+	}
+	*last = s->next;
+
+	recli_snapshot_unpin(s->snap);
+	session_collect();
+
+	/*
+	 *	Jobs which are still running are hung up on.
+	 */
+	for (i = 0; s->jobs && (i < SESSION_JOBS_MAX); i++) {
+		session_job_t *job = &s->jobs[i];
+
+		if ((job->pid > 0) && (kill(-job->pid, SIGHUP) < 0)) kill(job->pid, SIGHUP);
+		job_free(job);
+	}
+	free(s->jobs);
+
+	recli_filter_free(s->filter);
+	recli_stats_free(&s->exec_stats);
+	free(s->step_hist);
+	free(s);
+}
+
+void recli_session_output(recli_session_t *s, recli_fprintf_t func,
+			  void *out, void *err)
+{
+	s->fprintf = func;
+	s->out = out;
+	s->err = err;
+}
+
+/*
+ *	Commands are given to "func" to run, instead of being run and
+ *	waited for.  Its stdout should be given to recli_filter_write(),
+ *	if there's a filter.  When the command has finished, call
+ *	recli_session_reload().  The arguments are only valid during
+ *	the call, and the filter until recli_session_reload().
+ */
+void recli_session_run(recli_session_t *s, recli_run_t func, void *ctx)
+{
+	s->run = func;
+	s->run_ctx = ctx;
+}
+
+/*
+ *	Called with the full text of each line which was checked, so
+ *	that it can be saved in the history.
+ */
+void recli_session_history(recli_session_t *s, recli_history_t func, void *ctx)
+{
+	s->history = func;
+	s->history_ctx = ctx;
+}
+
+/*
+ *	Process one line of input.  Returns 1 if the session is done,
+ *	and 0 otherwise.
+ */
+int recli_session_process(recli_session_t *s, char *line)
+{
+	session_sinks_t old;
+
+	if (s->done) return 1;
+
+	session_enter(s, &old);
+	process_line(s, line);
+	session_release(s);
+	session_leave(&old);
+
+	return s->done;
+}
+
+/*
+ *	A command given to the recli_run_t function has finished.  Finish
+ *	its filter, and pick up any change to the syntax which it made.
+ */
+void recli_session_reload(recli_session_t *s)
+{
+	session_sinks_t old;
+
+	session_enter(s, &old);
+	if (s->filter) {
+		recli_filter_done(s->filter);
+		recli_filter_free(s->filter);
+		s->filter = NULL;
+	}
+	recli_load_syntax(s->config);
+	session_update(s);
+	session_leave(&old);
+}
+
+/*
+ *	The pipes of the background jobs, which the caller should poll
+ *	for reading, and call recli_session_jobs_update() when any are
+ *	readable.  Jobs with a lot of output waiting aren't included.
+ */
+int recli_session_job_fds(const recli_session_t *s, int fds[], int max_fds)
+{
+	int i, num = 0;
+	const session_job_t *job;
+
+	for (i = 0; s->jobs && (i < SESSION_JOBS_MAX); i++) {
+		job = &s->jobs[i];
+		if (!job->pid || (job->len >= SESSION_JOB_OUTPUT_MAX)) continue;
+
+		if ((job->out_fd >= 0) && (num < max_fds)) fds[num++] = job->out_fd;
+		if ((job->err_fd >= 0) && (num < max_fds)) fds[num++] = job->err_fd;
+	}
+
+	return num;
+}
+
+/*
+ *	Read the output of the background jobs, without waiting.  If
+ *	"notify" is set, print "[N] Done" for the ones which have
+ *	finished.
+ */
+void recli_session_jobs_update(recli_session_t *s, int notify)
+{
+	session_sinks_t old;
+
+	if (!s->jobs) return;
+
+	session_enter(s, &old);
+	jobs_update(s, notify);
+	session_leave(&old);
+}
+
+/*
+ *	Wait for each of the background jobs in turn, and print their
+ *	output, as "fg" does.  When the input isn't a terminal, this is
+ *	called at the end of it, so that the jobs aren't hung up on.
+ */
+void recli_session_jobs_wait(recli_session_t *s)
+{
+	int i;
+	session_sinks_t old;
+
+	if (!s->jobs) return;
+
+	session_enter(s, &old);
+	for (i = 0; i < SESSION_JOBS_MAX; i++) {
+		if (s->jobs[i].pid) job_wait(s, &s->jobs[i]);
+	}
+	session_leave(&old);
+}
+
+const char *recli_session_prompt(const recli_session_t *s)
+{
+	return s->ctx_stack->prompt;
+}
+
+pid_t recli_session_child(const recli_session_t *s)
+{
+	return s->child_pid;
+}
+
+int recli_session_complete(recli_session_t *s, const char *buf,
+			   int max_tabs, char *tabs[])
+{
+	int num;
+	session_sinks_t old;
+
+	session_enter(s, &old);
+	num = syntax_tab_complete(s->ctx_stack->syntax, buf, strlen(buf), max_tabs, tabs);
+	session_leave(&old);
+
+	return num;
+}
+
+/*
+ *	'?' was typed at the end of "line".
+ */
+int recli_session_short_help(recli_session_t *s, const char *line, size_t len)
+{
+	int argc;
+	char *argv[256];
+	char buffer[1024];
+	session_sinks_t old;
+	ctx_stack_t *ctx_stack = s->ctx_stack;
+
+	session_enter(s, &old);
+
+	recli_fprintf(recli_stdout, "?\r\n");
+
+	if (!ctx_stack->short_help) {
+	do_print:
+		syntax_print_lines(ctx_stack->syntax);
+		goto done;
+	}
+
+	if (len >= sizeof(buffer)) goto do_print;
+	
+	memcpy(buffer, line, len + 1);
+	argc = str2argv(buffer, len, 256, argv);
+
+	if (argc < 0) goto do_print;
+
+	if (s->ctx_stack_index > 0) {
+		ctx_stack_t *c = &s->ctx_stack_array[s->ctx_stack_index - 1];
+
+		recli_fprintf(recli_stdout, "%s - ", c->argv[c->argc - 1]);
+	}
+	syntax_print_context_help(ctx_stack->short_help, argc, argv);
+	syntax_print_context_help_subcommands(ctx_stack->syntax, ctx_stack->short_help, argc, argv);
+
+done:
+	session_leave(&old);
+	return 1;
+}
+
+/*
+ *	Skip the words of the contexts on the stack at the start of a
+ *	line from the history.
+ */
+const char *recli_session_strip_context(const recli_session_t *s, const char *buffer)
+{
+	int i, j;
+	const char *p;
+
+	if (s->ctx_stack_index == 0) return buffer;
+
+	p = buffer;
+
+	for (i = 0; i < s->ctx_stack_index; i++) {
+		const ctx_stack_t *c;
+
+		c = &s->ctx_stack_array[i];
+
+		for (j = 0; j < c->argc; j++) {
+			size_t len;
+
+			len = strlen(c->argv[j]);
+
+			if ((strncmp(c->argv[j], p, len) == 0) && isspace((int) p[len])) {
+				p += len + 1;
+				continue;
+			}
+
+			return p;
+		}
+	}
+
+
+	return p;
+}
+
+/*
+ *	For RECLI_SESSION_EXEC_TIMES and RECLI_SESSION_STEP_TIMES.
+ *	The step times are written with write(), so that they can be
+ *	printed from a signal handler.
+ */
+void recli_session_print_exec(const recli_session_t *s, FILE *fp)
+{
+	if (!(s->flags & RECLI_SESSION_EXEC_TIMES)) return;
+
+	recli_stats_print(fp, &s->exec_stats);
+}
+
+void recli_session_write_steps(const recli_session_t *s, int fd)
+{
+	if (!s->step_hist) return;
+
+	recli_hist_write(fd, s->step_hist);
+}
@@ -0,0 +1,290 @@
+/*
+ * Versioned snapshots of the syntax, which sessions share.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "recli.h"
+
+/*
+ *	Snapshots are reclaimed by epoch.  A thread which is pinning a
+ *	snapshot first copies the global epoch into its reader slot.
+ *	Each snapshot which is unpinned for the last time advances the
+ *	epoch, and remembers the epoch before that.  It can be freed
+ *	once every reader slot is idle, or has a later epoch, as no
+ *	pin in progress can then be looking at it.
+ *
+ *	The reader slots are padded to a cache line each, so that
+ *	threads pinning snapshots don't slow each other down.
+ */
+#define SNAPSHOT_READERS	(256)
+
+typedef struct snapshot_reader_t {
+	uint64_t	epoch;		/* 0 when not pinning */
+	int		used;
+	char		pad[64 - sizeof(uint64_t) - sizeof(int)];
+} snapshot_reader_t;
+
+static snapshot_reader_t readers[SNAPSHOT_READERS];
+static __thread snapshot_reader_t *reader = NULL;
+static pthread_key_t reader_key;
+static pthread_once_t reader_once = PTHREAD_ONCE_INIT;
+
+static uint64_t epoch = 1;
+static uint64_t versions = 0;
+
+static recli_snapshot_t *retired = NULL;	/* unpinned, pushed by any thread */
+
+/*
+ *	The rest is only changed with the mutex held.
+ */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static recli_snapshot_t *pending = NULL;	/* retired, but maybe still seen */
+static recli_snapshot_t *live = NULL;		/* everything not yet freed */
+
+static void reader_release(void *ctx)
+{
+	snapshot_reader_t *r = ctx;
+
+	__atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
+}
+
+static void reader_init(void)
+{
+	pthread_key_create(&reader_key, reader_release);
+}
+
+/*
+ *	Find a reader slot for this thread.  It's given back when the
+ *	thread exits.
+ */
+static snapshot_reader_t *reader_get(void)
+{
+	int i;
+
+	if (reader) return reader;
+
+	pthread_once(&reader_once, reader_init);
+
+	for (i = 0; i < SNAPSHOT_READERS; i++) {
+		int unused = 0;
+
+		if (!__atomic_compare_exchange_n(&readers[i].used, &unused, 1, 0,
+						 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) continue;
+
+		reader = &readers[i];
+		pthread_setspecific(reader_key, reader);
+		return reader;
+	}
+
+	return NULL;
+}
+
+/*
+ *	Create a snapshot of a syntax and its help.  They are frozen,
+ *	and belong to the snapshot.  The syntax should already have
+ *	been packed, if it's going to be.  The caller has the one
+ *	reference, which recli_snapshot_publish() takes over.
+ */
+recli_snapshot_t *recli_snapshot_alloc(cli_syntax_t *syntax, cli_syntax_t *long_help,
+				       cli_syntax_t *short_help)
+{
+	recli_snapshot_t *snap;
+
+	snap = calloc(1, sizeof(*snap));
+	if (!snap) return NULL;
+
+	syntax_freeze(syntax);
+	syntax_freeze(long_help);
+	syntax_freeze(short_help);
+
+	snap->refcount = 1;
+	snap->syntax = syntax;
+	snap->long_help = long_help;
+	snap->short_help = short_help;
+	snap->image = syntax_image(syntax);
+
+	pthread_mutex_lock(&mutex);
+	snap->version = ++versions;
+	snap->next_live = live;
+	live = snap;
+	pthread_mutex_unlock(&mutex);
+
+	return snap;
+}
+
+/*
+ *	Replace the published snapshot.  Sessions which have the old
+ *	one pinned keep using it.  "snap" may be NULL, to publish
+ *	nothing.
+ */
+void recli_snapshot_publish(recli_snapshot_t **published, recli_snapshot_t *snap)
+{
+	recli_snapshot_t *old;
+
+	old = __atomic_exchange_n(published, snap, __ATOMIC_SEQ_CST);
+	recli_snapshot_unpin(old);
+}
+
+/*
+ *	Pin the published snapshot.  A published snapshot always has
+ *	a reference, so if the count has already dropped to zero, it
+ *	has been replaced, and we look again.
+ */
+recli_snapshot_t *recli_snapshot_pin(recli_snapshot_t **published)
+{
+	int refs;
+	recli_snapshot_t *snap;
+	snapshot_reader_t *r;
+
+	r = reader_get();
+
+	/*
+	 *	Out of reader slots, so keep the snapshots from being
+	 *	freed the slow way.
+	 */
+	if (!r) pthread_mutex_lock(&mutex);
+
+	for (;;) {
+		if (r) __atomic_store_n(&r->epoch, __atomic_load_n(&epoch, __ATOMIC_SEQ_CST),
+					__ATOMIC_SEQ_CST);
+
+		snap = __atomic_load_n(published, __ATOMIC_SEQ_CST);
+		if (!snap) break;
+
+		refs = __atomic_load_n(&snap->refcount, __ATOMIC_RELAXED);
+		while (refs > 0) {
+			if (__atomic_compare_exchange_n(&snap->refcount, &refs, refs + 1, 1,
+							__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+		}
+
+		if (refs > 0) break;
+	}
+
+	if (r) {
+		__atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+	} else {
+		pthread_mutex_unlock(&mutex);
+	}
+
+	return snap;
+}
+
+/*
+ *	Drop a pin.  The last one puts the snapshot on the retired
+ *	list, for recli_snapshot_reclaim() to free.
+ */
+void recli_snapshot_unpin(recli_snapshot_t *snap)
+{
+	recli_snapshot_t *head;
+
+	if (!snap) return;
+
+	if (__atomic_sub_fetch(&snap->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+	snap->retired = __atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST);
+
+	head = __atomic_load_n(&retired, __ATOMIC_RELAXED);
+	do {
+		snap->next_retired = head;
+	} while (!__atomic_compare_exchange_n(&retired, &head, snap, 1,
+					      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ *	Check a command against a pinned snapshot.  With a packed
+ *	syntax, this is safe to call from any thread.
+ */
+int recli_snapshot_check(const recli_snapshot_t *snap, int argc, char *argv[],
+			 const char **error, int *flags)
+{
+	if (snap->image) return syntax_image_check(snap->image, argc, argv, error, flags);
+
+	return syntax_check(snap->syntax, argc, argv, error, flags);
+}
+
+/*
+ *	Free the retired snapshots which nothing can be looking at.
+ *	Their nodes are freed by the next syntax_collect() which
+ *	doesn't include them in its roots.  Returns how many were
+ *	freed.
+ */
+int recli_snapshot_reclaim(void)
+{
+	int i, freed = 0;
+	uint64_t oldest, e;
+	recli_snapshot_t *snap, *next, **last;
+
+	pthread_mutex_lock(&mutex);
+
+	snap = __atomic_exchange_n(&retired, NULL, __ATOMIC_ACQUIRE);
+	while (snap) {
+		next = snap->next_retired;
+		snap->next_retired = pending;
+		pending = snap;
+		snap = next;
+	}
+
+	if (!pending) goto done;
+
+	oldest = UINT64_MAX;
+	for (i = 0; i < SNAPSHOT_READERS; i++) {
+		e = __atomic_load_n(&readers[i].epoch, __ATOMIC_SEQ_CST);
+		if (e && (e < oldest)) oldest = e;
+	}
+
+	last = &pending;
+	while ((snap = *last) != NULL) {
+		recli_snapshot_t **p;
+
+		if (snap->retired >= oldest) {
+			last = &snap->next_retired;
+			continue;
+		}
+
+		*last = snap->next_retired;
+
+		for (p = &live; *p != snap; p = &(*p)->next_live) {
+			/* nothing */
+		}
+		*p = snap->next_live;
+
+		free(snap);
+		freed++;
+	}
+
+done:
+	pthread_mutex_unlock(&mutex);
+
+	return freed;
+}
+
+/*
+ *	The syntax and help of every snapshot which hasn't been freed,
+ *	for syntax_collect().  Returns how many roots there are, which
+ *	may be more than "max_roots".
+ */
+int recli_snapshot_roots(cli_syntax_t *roots[], int max_roots)
+{
+	int num = 0;
+	recli_snapshot_t *snap;
+
+	pthread_mutex_lock(&mutex);
+
+	for (snap = live; snap != NULL; snap = snap->next_live) {
+		if ((num + 3) <= max_roots) {
+			roots[num] = snap->syntax;
+			roots[num + 1] = snap->long_help;
+			roots[num + 2] = snap->short_help;
+		}
+		num += 3;
+	}
+
+	pthread_mutex_unlock(&mutex);
+
+	return num;
+}
@@ -0,0 +1,451 @@
+/*
+ * Timing of processing and running commands.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "recli.h"
+
+static const char *phase_names[RECLI_PHASE_MAX + 1] = {
+	"resolve",
+	"fork",
+	"exec",
+	"relay",
+	"wait",
+	"reload",
+	"total"
+};
+
+uint64_t recli_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/*
+ *	Save the times for one command.  The samples are kept, so
+ *	that we can print exact percentiles at the end.
+ */
+void recli_stats_add(recli_stats_t *stats, const recli_times_t *times)
+{
+	int i;
+	uint64_t total;
+
+	if (stats->num == stats->size) {
+		int size;
+
+		size = stats->size ? stats->size * 2 : 256;
+
+		for (i = 0; i <= RECLI_PHASE_MAX; i++) {
+			uint64_t *p;
+
+			p = realloc(stats->samples[i], size * sizeof(p[0]));
+			if (!p) return;
+
+			stats->samples[i] = p;
+		}
+
+		stats->size = size;
+	}
+
+	total = 0;
+	for (i = 0; i < RECLI_PHASE_MAX; i++) {
+		stats->samples[i][stats->num] = times->ns[i];
+		total += times->ns[i];
+	}
+	stats->samples[RECLI_PHASE_MAX][stats->num] = total;
+
+	stats->num++;
+}
+
+static int sample_cmp(const void *one, const void *two)
+{
+	const uint64_t *a = one;
+	const uint64_t *b = two;
+
+	if (*a < *b) return -1;
+	if (*a > *b) return +1;
+	return 0;
+}
+
+/*
+ *	Nearest-rank percentile of sorted samples, in microseconds.
+ */
+static double percentile(const uint64_t *sorted, int num, int pct)
+{
+	int rank;
+
+	rank = (num * pct + 99) / 100;
+	if (rank < 1) rank = 1;
+
+	return sorted[rank - 1] / 1000.0;
+}
+
+/*
+ *	Print one JSON object per phase, the same as recli-bench.
+ */
+void recli_stats_print(FILE *fp, const recli_stats_t *stats)
+{
+	int i;
+	uint64_t *sorted;
+
+	if (!stats->num) return;
+
+	sorted = malloc(stats->num * sizeof(sorted[0]));
+	if (!sorted) return;
+
+	for (i = 0; i <= RECLI_PHASE_MAX; i++) {
+		memcpy(sorted, stats->samples[i], stats->num * sizeof(sorted[0]));
+		qsort(sorted, stats->num, sizeof(sorted[0]), sample_cmp);
+
+		fprintf(fp, "{\"phase\": \"%s\", \"count\": %d, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}\n",
+			phase_names[i], stats->num,
+			percentile(sorted, stats->num, 50),
+			percentile(sorted, stats->num, 90),
+			percentile(sorted, stats->num, 99),
+			sorted[stats->num - 1] / 1000.0);
+	}
+
+	free(sorted);
+}
+
+void recli_stats_free(recli_stats_t *stats)
+{
+	int i;
+
+	for (i = 0; i <= RECLI_PHASE_MAX; i++) {
+		free(stats->samples[i]);
+		stats->samples[i] = NULL;
+	}
+
+	stats->num = stats->size = 0;
+}
+
+const char *recli_step_names[RECLI_STEP_MAX] = {
+	"tokenize",
+	"builtin",
+	"check",
+	"permission",
+	"history",
+	"exec",
+	"reload"
+};
+
+/*
+ *	Counting a time is a few shifts and adds, so that it can be
+ *	done for every line without anyone noticing.
+ */
+void recli_hist_add(recli_hist_t *hist, uint64_t ns)
+{
+	int shift, bucket;
+
+	if (ns < RECLI_HIST_SUB) {
+		bucket = ns;
+	} else {
+		shift = 63 - __builtin_clzll(ns) - RECLI_HIST_SUB_BITS;
+		bucket = ((shift + 1) << RECLI_HIST_SUB_BITS) +
+			((ns >> shift) & (RECLI_HIST_SUB - 1));
+	}
+
+	hist->bucket[bucket]++;
+	hist->count++;
+	hist->sum += ns;
+	if (ns > hist->max) hist->max = ns;
+}
+
+/*
+ *	The largest time which is counted in a bucket.
+ */
+static uint64_t hist_bucket_max(int bucket)
+{
+	int shift;
+
+	if (bucket < RECLI_HIST_SUB) return bucket;
+
+	shift = (bucket >> RECLI_HIST_SUB_BITS) - 1;
+
+	return ((((uint64_t) RECLI_HIST_SUB + (bucket & (RECLI_HIST_SUB - 1))) << shift) +
+		(((uint64_t) 1) << shift) - 1);
+}
+
+/*
+ *	Nearest-rank percentile, to within the width of a bucket.
+ */
+static uint64_t hist_percentile(const recli_hist_t *hist, int permille)
+{
+	int i;
+	uint64_t rank, seen, ns;
+
+	rank = (hist->count * permille + 999) / 1000;
+	if (rank < 1) rank = 1;
+
+	seen = 0;
+	for (i = 0; i < RECLI_HIST_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen >= rank) break;
+	}
+
+	ns = hist_bucket_max(i);
+	if (ns > hist->max) ns = hist->max;
+
+	return ns;
+}
+
+/*
+ *	The histograms are printed from a signal handler, so we can't
+ *	use stdio.  These append to a buffer, and silently stop at
+ *	the end of it.
+ */
+static void buf_str(char **p, char *end, const char *str)
+{
+	while (*str && (*p < end)) *((*p)++) = *(str++);
+}
+
+static void buf_uint(char **p, char *end, uint64_t num)
+{
+	char digits[24];
+	int i = sizeof(digits) - 1;
+
+	digits[i] = '\0';
+	do {
+		digits[--i] = '0' + (num % 10);
+		num /= 10;
+	} while (num);
+
+	buf_str(p, end, &digits[i]);
+}
+
+static void buf_us(char **p, char *end, const char *name, uint64_t ns)
+{
+	char tenth[2];
+
+	tenth[0] = '0' + ((ns % 1000) / 100);
+	tenth[1] = '\0';
+
+	buf_str(p, end, ", \"");
+	buf_str(p, end, name);
+	buf_str(p, end, "\": ");
+	buf_uint(p, end, ns / 1000);
+	buf_str(p, end, ".");
+	buf_str(p, end, tenth);
+}
+
+/*
+ *	Format the JSON object for one step, and return its length.
+ */
+static size_t hist_format(char *buffer, size_t size, int step, const recli_hist_t *h)
+{
+	char *p = buffer;
+	char *end = buffer + size - 1;
+
+	buf_str(&p, end, "{\"step\": \"");
+	buf_str(&p, end, recli_step_names[step]);
+	buf_str(&p, end, "\", \"count\": ");
+	buf_uint(&p, end, h->count);
+
+	if (h->count) {
+		buf_us(&p, end, "mean_us", h->sum / h->count);
+		buf_us(&p, end, "p50_us", hist_percentile(h, 500));
+		buf_us(&p, end, "p90_us", hist_percentile(h, 900));
+		buf_us(&p, end, "p99_us", hist_percentile(h, 990));
+		buf_us(&p, end, "p999_us", hist_percentile(h, 999));
+		buf_us(&p, end, "max_us", h->max);
+	}
+	buf_str(&p, end, "}");
+	*(p++) = '\n';
+
+	return p - buffer;
+}
+
+/*
+ *	Write one JSON object per step.  This is safe to call from a
+ *	signal handler.  If the handler interrupts recli_hist_add(),
+ *	the counts for that step may be off by one.
+ */
+void recli_hist_write(int fd, const recli_hist_t hist[RECLI_STEP_MAX])
+{
+	int i;
+	size_t len;
+	char buffer[256];
+
+	for (i = 0; i < RECLI_STEP_MAX; i++) {
+		len = hist_format(buffer, sizeof(buffer), i, &hist[i]);
+
+		if (write(fd, buffer, len) < 0) return;
+	}
+}
+
+/*
+ *	The same, but through recli_fprintf(), for "show stats".
+ */
+void recli_hist_print(void *ctx, const recli_hist_t hist[RECLI_STEP_MAX])
+{
+	int i;
+	size_t len;
+	char buffer[256];
+
+	for (i = 0; i < RECLI_STEP_MAX; i++) {
+		len = hist_format(buffer, sizeof(buffer), i, &hist[i]);
+
+		recli_fprintf(ctx, "%.*s", (int) len, buffer);
+	}
+}
+
+/*
+ *	The phases of starting up, in the order they finished.
+ */
+#define STARTUP_MAX	(16)
+
+typedef struct startup_phase_t {
+	const char	*name;
+	recli_clock_t	used;
+} startup_phase_t;
+
+int recli_startup_profile = 0;
+static startup_phase_t startup_phases[STARTUP_MAX];
+static int startup_num = 0;
+
+static uint64_t timespec_ns(const struct timespec *ts)
+{
+	return ((uint64_t) ts->tv_sec * 1000000000) + ts->tv_nsec;
+}
+
+static uint64_t timeval_ns(const struct timeval *tv)
+{
+	return ((uint64_t) tv->tv_sec * 1000000000) + ((uint64_t) tv->tv_usec * 1000);
+}
+
+/*
+ *	When we're only tracing, just the wall clock is needed.
+ */
+void recli_clock_start(recli_clock_t *clock)
+{
+	struct timespec ts;
+	struct rusage ru;
+
+	if (!recli_startup_profile) {
+		clock->wall = recli_trace_now();
+		clock->cpu = clock->child_cpu = 0;
+		return;
+	}
+
+	clock->wall = recli_now();
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	clock->cpu = timespec_ns(&ts);
+
+	getrusage(RUSAGE_CHILDREN, &ru);
+	clock->child_cpu = timeval_ns(&ru.ru_utime) + timeval_ns(&ru.ru_stime);
+}
+
+/*
+ *	Finish one phase of starting up, and start the next one.
+ */
+void recli_startup_done(const char *name, recli_clock_t *clock)
+{
+	recli_clock_t now;
+
+	if (!clock->wall) return;
+
+	recli_trace_span("bootstrap", name, 0, clock->wall, NULL, 0, NULL, 0);
+
+	recli_clock_start(&now);
+
+	if (recli_startup_profile && (startup_num < STARTUP_MAX)) {
+		startup_phase_t *p = &startup_phases[startup_num++];
+
+		p->name = name;
+		p->used.wall = now.wall - clock->wall;
+		p->used.cpu = now.cpu - clock->cpu;
+		p->used.child_cpu = now.child_cpu - clock->child_cpu;
+	}
+
+	*clock = now;
+}
+
+/*
+ *	One JSON object per phase.  The last one is "startup", which
+ *	covers all of the others.
+ */
+void recli_startup_print(FILE *fp)
+{
+	int i;
+
+	for (i = 0; i < startup_num; i++) {
+		const startup_phase_t *p = &startup_phases[i];
+
+		fprintf(fp, "{\"phase\": \"%s\", \"wall_us\": %.1f, \"cpu_us\": %.1f, \"child_cpu_us\": %.1f}\n",
+			p->name, p->used.wall / 1000.0, p->used.cpu / 1000.0,
+			p->used.child_cpu / 1000.0);
+	}
+}
+
+static double per_op(uint64_t num, uint64_t ops)
+{
+	if (!ops) return 0;
+
+	return (double) num / ops;
+}
+
+static void counters_string(void *ctx, const char *str)
+{
+	const char *p;
+
+	recli_fprintf(ctx, "\"");
+	while (*str) {
+		for (p = str; *p && (*p != '"') && (*p != '\\') &&
+			     ((unsigned char) *p >= ' '); p++) {
+			/* nothing */
+		}
+		if (p > str) recli_fprintf(ctx, "%.*s", (int) (p - str), str);
+		if (!*p) break;
+
+		if ((*p == '"') || (*p == '\\')) recli_fprintf(ctx, "\\%c", *p);
+		str = p + 1;
+	}
+	recli_fprintf(ctx, "\"");
+}
+
+/*
+ *	Print the syntax engine counters as one JSON object.  With a
+ *	line, they're the work done for that line.  Without one,
+ *	they're the totals, with the nodes visited per operation.
+ */
+void recli_counters_print(void *ctx, const char *line, const syntax_counters_t *c)
+{
+	recli_fprintf(ctx, "{");
+	if (line) {
+		recli_fprintf(ctx, "\"line\": ");
+		counters_string(ctx, line);
+		recli_fprintf(ctx, ", ");
+	}
+
+	recli_fprintf(ctx, "\"checks\": %llu, \"check_nodes\": %llu, \"matches\": %llu, \"match_nodes\": %llu, "
+		"\"prefixes\": %llu, \"prefix_nodes\": %llu, \"skips\": %llu, \"memo_hits\": %llu, "
+		"\"backtracks\": %llu, \"datatypes\": %llu, \"allocs\": %llu",
+		(unsigned long long) c->checks, (unsigned long long) c->check_nodes,
+		(unsigned long long) c->matches, (unsigned long long) c->match_nodes,
+		(unsigned long long) c->prefixes, (unsigned long long) c->prefix_nodes,
+		(unsigned long long) c->skips, (unsigned long long) c->memo_hits,
+		(unsigned long long) c->backtracks, (unsigned long long) c->datatypes,
+		(unsigned long long) c->allocs);
+
+	if (!line) {
+		recli_fprintf(ctx, ", \"nodes_per_check\": %.1f, \"nodes_per_match\": %.1f, \"nodes_per_prefix\": %.1f",
+			per_op(c->check_nodes, c->checks),
+			per_op(c->match_nodes, c->matches),
+			per_op(c->prefix_nodes, c->prefixes));
+	}
+
+	recli_fprintf(ctx, "}\n");
+}
@@ -75,8 +75,27 @@ struct cli_syntax_t {
 	int length;		/* for concatenation nodes */
 
 	int min, max;		/* for '*', '+', and [] */
+
+	uint64_t first_words;	/* FIRST set, see syntax_freeze() */
+	uint64_t first_chars;
+	int first_flags;
+
+	int state;		/* NODE_FROZEN, etc. */
 };
 
+#define NODE_FROZEN	(1 << 0)	/* read-only, not reference counted */
+#define NODE_MARKED	(1 << 1)	/* used by syntax_collect() */
+
+/*
+ *	Counters for "-X count".  They're only updated when counting
+ *	is turned on, and they aren't locked, so they're not used with
+ *	"--check" and threads.
+ */
+int syntax_counting = 0;
+syntax_counters_t syntax_counters;
+
+#define COUNT(_x) do { if (syntax_counting) syntax_counters._x++; } while (0)
+
 #define FNV_MAGIC_INIT (0x811c9dc5)
 #define FNV_MAGIC_PRIME (0x01000193)
 
@@ -105,6 +124,8 @@ void syntax_debug(const char *msg, cli_syntax_t *this);
 
 static cli_syntax_t *syntax_concat_prefix(cli_syntax_t *prefix, int lcp,
 					  cli_syntax_t *tail);
+static void syntax_sweep(cli_syntax_t *roots[], int num_roots, int keep_types);
+static int syntax_can_be_empty(cli_syntax_t *this);
 
 /*
  *	Create a unique hash based on node contents.
@@ -185,6 +206,41 @@ static int num_entries = 0;
 static int table_size = 0;
 static cli_syntax_t **hash_table = NULL;
 
+/*
+ *	The compiled matcher for the static syntax, if there is one.
+ */
+static cli_syntax_t *static_root = NULL;
+static recli_static_check_t static_check = NULL;
+
+/*
+ *	A frozen syntax, packed into arrays for syntax_check().  Nodes
+ *	are 32-bit indexes, in dependency order.  Words are offsets
+ *	into one string table, and data types are indexes into a table
+ *	of callbacks.  See syntax_pack().  There is one image for each
+ *	packed root, and it's freed along with the root.
+ */
+#define IMAGE_DATATYPE	(1 << 6)	/* "first" is a data type */
+#define IMAGE_SKIP	(1 << 7)	/* FIRST set can reject words */
+
+struct syntax_image_t {
+	syntax_image_t		*next_image;	/* images of other roots */
+	const cli_syntax_t	*root;
+	uint32_t		num_nodes;
+
+	uint8_t			*type;
+	uint8_t			*flags;		/* FLAG_* for words, or IMAGE_* */
+	uint32_t		*first;		/* child, word, or data type */
+	uint32_t		*next;		/* child, or "min" for '+' */
+	uint64_t		*first_words;	/* FIRST set */
+
+	char			*strings;
+	recli_datatype_parse_t	*types;
+};
+
+static syntax_image_t *images = NULL;
+
+static void syntax_image_free(syntax_image_t *img);
+
 
 /*
  *	Handle error messages.
@@ -198,11 +254,47 @@ static void syntax_error(const char *p, const char *msg)
 	syntax_error_string = msg;
 }
 
+/*
+ *	Compare the fields which go into the hash.  Two different
+ *	nodes can have the same hash, so the hash alone isn't enough.
+ */
+static int syntax_equal(const cli_syntax_t *a, const cli_syntax_t *b)
+{
+	if (a->type != b->type) return 0;
+
+	switch (a->type) {
+	case CLI_TYPE_EXACT:
+		return ((a->min == b->min) &&
+			(strcmp((char *) a->first, (char *) b->first) == 0));
+
+	case CLI_TYPE_VARARGS:
+	case CLI_TYPE_MACRO:
+		return (strcmp((char *) a->first, (char *) b->first) == 0);
+
+	case CLI_TYPE_OPTIONAL:
+		return (a->first == b->first);
+
+	case CLI_TYPE_PLUS:
+		return ((a->first == b->first) && (a->min == b->min) &&
+			(a->max == b->max));
+
+	case CLI_TYPE_ALTERNATE:
+	case CLI_TYPE_CONCAT:
+		return ((a->first == b->first) && (a->next == b->next));
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
 /*
  *	Look up a node based on content.
  */
 static cli_syntax_t *syntax_find(cli_syntax_t *this)
 {
+	int i;
 	cli_syntax_t *found;
 
 	if (num_entries == 0) return NULL;
@@ -211,15 +303,85 @@ static cli_syntax_t *syntax_find(cli_syntax_t *this)
 
 	if (this->hash == 0) syntax_hash(this);
 
-	found = hash_table[this->hash & (table_size - 1)];
-	if (!found) return found;
-
-	if (found->hash == this->hash) return found;
+	/*
+	 *	The table uses linear probing, so keep looking until we
+	 *	hit an empty slot.
+	 */
+	for (i = this->hash & (table_size - 1);
+	     (found = hash_table[i]) != NULL;
+	     i = (i + 1) & (table_size - 1)) {
+		if ((found->hash == this->hash) &&
+		    syntax_equal(found, this)) return found;
+	}
 
 	return NULL;
 }
 
 
+/*
+ *	Remove a node from the hash table.  The entries after it in
+ *	the same run are moved back, so that lookups don't stop early
+ *	at the newly empty slot.
+ */
+static void syntax_unlink(cli_syntax_t *this)
+{
+	int i, j, home;
+
+	i = this->hash & (table_size - 1);
+	while (hash_table[i] != this) {
+		assert(hash_table[i] != NULL);
+		i = (i + 1) & (table_size - 1);
+	}
+
+	hash_table[i] = NULL;
+	num_entries--;
+
+	if (this == static_root) static_root = NULL;
+	if (images) {
+		syntax_image_t **last, *img;
+
+		for (last = &images; (img = *last) != NULL; last = &img->next_image) {
+			if (img->root != this) continue;
+
+			*last = img->next_image;
+			syntax_image_free(img);
+			break;
+		}
+	}
+
+	for (j = (i + 1) & (table_size - 1);
+	     hash_table[j] != NULL;
+	     j = (j + 1) & (table_size - 1)) {
+		home = hash_table[j]->hash & (table_size - 1);
+
+		/*
+		 *	Leave it alone if its home slot is
+		 *	cyclically in (i, j].
+		 */
+		if (i <= j) {
+			if ((i < home) && (home <= j)) continue;
+		} else {
+			if ((i < home) || (home <= j)) continue;
+		}
+
+		hash_table[i] = hash_table[j];
+		hash_table[j] = NULL;
+		i = j;
+	}
+}
+
+
+/*
+ *	Increment the reference count.  Frozen nodes aren't reference
+ *	counted, so pointers to them are just borrowed.
+ */
+static cli_syntax_t *syntax_incref(cli_syntax_t *this)
+{
+	if ((this->state & NODE_FROZEN) == 0) this->refcount++;
+
+	return this;
+}
+
 /*
  *	Increment the reference count, if the node exists.
  */
@@ -228,8 +390,7 @@ static cli_syntax_t *syntax_ref(cli_syntax_t *this)
 	this = syntax_find(this);
 	if (!this) return NULL;
 
-	this->refcount++;
-	return this;
+	return syntax_incref(this);
 }
 
 /*
@@ -301,6 +462,31 @@ static int syntax_order(const cli_syntax_t *a, const cli_syntax_t *b)
 		return -1;	/* a > b */
 	}
 
+	/*
+	 *	"a+" and "a*" go next to "a", so that the order doesn't
+	 *	depend on where the nodes were allocated.
+	 */
+	if ((a->type == CLI_TYPE_PLUS) && (b->type == CLI_TYPE_PLUS)) {
+		order = syntax_order(a->first, b->first);
+		if (order != 0) return order;
+
+		return b->min - a->min;	/* a+ < a* */
+	}
+
+	if (a->type == CLI_TYPE_PLUS) {
+		order = syntax_order(a->first, b);
+		if (order != 0) return order;
+
+		return +1;	/* a > b */
+	}
+
+	if (b->type == CLI_TYPE_PLUS) {
+		order = syntax_order(a, b->first);
+		if (order != 0) return order;
+
+		return -1;	/* a < b */
+	}
+
 	if ((a->type == CLI_TYPE_ALTERNATE) && (b->type != CLI_TYPE_ALTERNATE)) {
 		return +1;
 	}
@@ -331,6 +517,8 @@ static int syntax_order(const cli_syntax_t *a, const cli_syntax_t *b)
 /*
  *	Free a node by decrementing its reference count.  When the
  *	count goes to zero, free the node.
+ *
+ *	Frozen nodes are left alone.  They're freed by syntax_collect().
  */
 void syntax_free(cli_syntax_t *start)
 {
@@ -341,9 +529,14 @@ void syntax_free(cli_syntax_t *start)
 
 	if (!this) goto finish;
 
+redo:
+	if ((this->state & NODE_FROZEN) != 0) {
+		if (flag) goto finish;
+		return;
+	}
+
 	assert(this->refcount > 0);
 
-redo:
 	this->refcount--;
 	if (this->refcount > 0) {
 		if (flag) goto finish;
@@ -353,9 +546,7 @@ redo:
 	switch (this->type) {
 	case CLI_TYPE_ALTERNATE:
 	case CLI_TYPE_CONCAT:
-		assert(hash_table[this->hash & (table_size - 1)] == this);
-		hash_table[this->hash & (table_size - 1)] = NULL;
-		num_entries--;
+		syntax_unlink(this);
 
 		syntax_free(this->first);
 		next = this->next;
@@ -368,9 +559,7 @@ redo:
 
 	case CLI_TYPE_OPTIONAL:
 	case CLI_TYPE_PLUS:
-		assert(hash_table[this->hash & (table_size - 1)] == this);
-		hash_table[this->hash & (table_size - 1)] = NULL;
-		num_entries--;
+		syntax_unlink(this);
 
 		next = this->first;
 #ifndef NDEBUG
@@ -381,9 +570,7 @@ redo:
 		goto redo;
 
 	case CLI_TYPE_MACRO:
-		assert(hash_table[this->hash & (table_size - 1)] == this);
-		hash_table[this->hash & (table_size - 1)] = NULL;
-		num_entries--;
+		syntax_unlink(this);
 
 		next = this->next;
 #ifndef NDEBUG
@@ -395,9 +582,7 @@ redo:
 
 	case CLI_TYPE_EXACT:
 	case CLI_TYPE_VARARGS:
-		assert(hash_table[this->hash & (table_size - 1)] == this);
-		hash_table[this->hash & (table_size - 1)] = NULL;
-		num_entries--;
+		syntax_unlink(this);
 
 #ifndef NDEBUG
 		memset(this, 0, sizeof(*this));
@@ -413,25 +598,47 @@ redo:
 
 finish:
 	if (!start && (num_entries > 4)) {
-		int i;
+		int i, freed;
 
-		for (i = 0; i < table_size; i++) {
-			if (!hash_table[i]) continue;
+		/*
+		 *	Freeing a node can move other nodes back into
+		 *	slots we've already looked at, so loop until
+		 *	nothing changes.
+		 */
+		do {
+			freed = 0;
+
+			for (i = 0; i < table_size; i++) {
+				if (!hash_table[i]) continue;
 
-			if (hash_table[i]->type == CLI_TYPE_MACRO) {
-				assert(hash_table[i]->refcount == 1);
-				syntax_free(hash_table[i]);
+				if (hash_table[i]->type == CLI_TYPE_MACRO) {
+					assert(hash_table[i]->refcount == 1);
+					syntax_free(hash_table[i]);
+					freed = 1;
+				}
 			}
-		}
+		} while (freed);
 
-		for (i = 0; i < table_size; i++) {
-			if (!hash_table[i]) continue;
+		/*
+		 *	Nothing is using the frozen nodes any more,
+		 *	including the data types.
+		 */
+		syntax_sweep(NULL, 0, 0);
 
-			if ((hash_table[i]->type == CLI_TYPE_EXACT) &&
-			    (hash_table[i]->next != NULL)) {
-				syntax_free(hash_table[i]);
+		do {
+			freed = 0;
+
+			for (i = 0; i < table_size; i++) {
+				if (!hash_table[i]) continue;
+
+				if ((hash_table[i]->type == CLI_TYPE_EXACT) &&
+				    (hash_table[i]->next != NULL) &&
+				    ((hash_table[i]->state & NODE_FROZEN) == 0)) {
+					syntax_free(hash_table[i]);
+					freed = 1;
+				}
 			}
-		}
+		} while (freed);
 
 		if (num_entries == 0) return;
 
@@ -448,6 +655,15 @@ finish:
 	}
 }
 
+/*
+ *	How many nodes are in the hash.  After syntax_free(NULL), this
+ *	should be zero.
+ */
+int syntax_num_nodes(void)
+{
+	return num_entries;
+}
+
 
 /*
  *	Insert a new node into the hash.
@@ -459,7 +675,7 @@ static int syntax_insert(cli_syntax_t *this)
 	cli_syntax_t **new_table;
 
 	/* Create new hash table if not yet allocated */
-	if (!num_entries) {
+	if (!hash_table) {
 		hash_table = calloc(sizeof(hash_table[0]), 256);
 		if (!hash_table) return 0;
 		table_size = 256;
@@ -483,43 +699,44 @@ static int syntax_insert(cli_syntax_t *this)
 	}
 #endif
 
-retry:
 	/*
-	 *	Look for the hash in the table. If the slot is
-	 *	free, insert the entry there and return.
+	 *	Keep the table at most half full, so that the runs of
+	 *	used slots stay short.  Grow it by re-inserting all of
+	 *	the entries into a table twice the size.
 	 */
-	hash = this->hash;
-	if (!hash_table[hash & (table_size - 1)]) {
-		hash_table[hash & (table_size - 1)] = this;
-		num_entries++;
-		return 1;
+	if (((num_entries + 1) * 2) > table_size) {
+		int j;
 
-	}	
-	      
-	assert(this != hash_table[hash & (table_size - 1)]);
+		new_table = calloc(sizeof(new_table[0]), table_size * 2);
+		if (!new_table) return 0;
 
-	/*
-	 *	Slot wasn't free. We'll double the table size and
-	 *	try again. Copy all entries from old table to new
-	 *	table, inserting into the newly calculated hash
-	 *	slot.
-	 */
-	new_table = calloc(sizeof(new_table[0]), table_size * 2);
-	if (!new_table) return 0;
+		for (i = 0; i < table_size; i++) {
+			if (!hash_table[i]) continue;
 
-	for (i = 0; i < table_size; i++) {
-		if (hash_table[i]) {
-			hash = hash_table[i]->hash;
-			hash &= ((table_size * 2) - 1);
-			new_table[hash] = hash_table[i];
-			hash_table[i] = NULL;
+			j = hash_table[i]->hash & ((table_size * 2) - 1);
+			while (new_table[j]) j = (j + 1) & ((table_size * 2) - 1);
+
+			new_table[j] = hash_table[i];
 		}
+
+		free(hash_table);
+		hash_table = new_table;
+		table_size *= 2;
+	}
+
+	/*
+	 *	Insert the entry into the first free slot at or after
+	 *	its hash.
+	 */
+	hash = this->hash & (table_size - 1);
+	while (hash_table[hash]) {
+		assert(this != hash_table[hash]);
+		hash = (hash + 1) & (table_size - 1);
 	}
 
-	free(hash_table);
-	hash_table = new_table;
-	table_size *= 2;
-	goto retry;
+	hash_table[hash] = this;
+	num_entries++;
+	return 1;
 }
 
 
@@ -564,7 +781,7 @@ redo:
 	assert(b != NULL);
 
 	if (a == b) {
-		a->refcount++;
+		syntax_incref(a);
 		return a;
 	}
 
@@ -840,7 +1057,7 @@ static void recursive_prefix(cli_syntax_t **nodes, int total)
 	 *
 	 *	We catch the special case of optional nodes manually...
 	 */
-	prefix->refcount++;
+	syntax_incref(prefix);
 
 	for (i = 0; i < num_prefix; i++) {
 		suffix = syntax_skip_prefix(nodes[i], 1);
@@ -865,7 +1082,7 @@ static void recursive_prefix(cli_syntax_t **nodes, int total)
 	 *	go check for that.  But ONLY so long as
 	 *	we have a common prefix
 	 */
-	recursive_prefix(&nodes[optional], num_prefix);
+	recursive_prefix(&nodes[optional], num_prefix - optional);
 
 	/*
 	 *	Walk back up the array, manually doing alternation,
@@ -1144,7 +1361,7 @@ cli_syntax_t *syntax_skip_prefix(cli_syntax_t *a, int lcp)
 	 *	Don't skip anything == return ourselves.
 	 */
 	if (lcp == 0) {
-		a->refcount++;
+		syntax_incref(a);
 		return a;
 	}
 
@@ -1163,7 +1380,7 @@ cli_syntax_t *syntax_skip_prefix(cli_syntax_t *a, int lcp)
 		lcp--;
 	}
 
-	a->refcount++;
+	syntax_incref(a);
 	return a;
 }
 
@@ -1186,7 +1403,7 @@ static cli_syntax_t *syntax_concat_prefix(cli_syntax_t *prefix, int lcp,
 		b = NULL;
 	}
 
-	a->refcount++;
+	syntax_incref(a);
 	if (lcp == 1) {
 		if (!tail) return a;
 
@@ -1224,13 +1441,16 @@ static void syntax_debug_printf(cli_type_t type, const char *msg,
 #endif
 
 /*
- *	Allocate a new node.
+ *	Allocate a new node.  "min" is only used for '+' and '*'.  It
+ *	is part of the node's hash, so it has to be set here, and not
+ *	after the node has been added to the table.
  */
-static cli_syntax_t *syntax_alloc(cli_type_t type, void *first, void *next)
+static cli_syntax_t *syntax_alloc_min(cli_type_t type, void *first, void *next,
+				      int min)
 {
 	cli_syntax_t find;
 	cli_syntax_t *this, *a, *b, *c;
-	int flags = 0;
+	int flags = min;
 
 	memset(&find, 0, sizeof(find));
 
@@ -1350,6 +1570,30 @@ static cli_syntax_t *syntax_alloc(cli_type_t type, void *first, void *next)
 		 *	Only syntax_alternate() should be calling us here.
 		 */
 	case CLI_TYPE_ALTERNATE:
+		a = first;
+
+		/*
+		 *	alt(alt(a,b),c) ==> alt(a,alt(b,c))
+		 *
+		 *	recursive_prefix() builds alternations by hand,
+		 *	and any of its entries may already be one.
+		 */
+		if (a->type == CLI_TYPE_ALTERNATE) {
+			SYNTAX_DEBUG_PRINTF(type, "ALTERNATE<", a, next);
+
+			b = a->next;
+			syntax_incref(b);
+			c = syntax_alloc(CLI_TYPE_ALTERNATE, b, next);
+			if (!c) {
+				syntax_free(first);
+				return NULL;
+			}
+			b = a->first;
+			syntax_incref(b);
+			syntax_free(first);
+			first = b;
+			next = c;
+		}
 		break;
 
 	case CLI_TYPE_CONCAT:
@@ -1364,14 +1608,14 @@ static cli_syntax_t *syntax_alloc(cli_type_t type, void *first, void *next)
 			SYNTAX_DEBUG_PRINTF(type, "CONCAT<", a, next);
 
 			b = a->next;
-			b->refcount++;
+			syntax_incref(b);
 			c = syntax_alloc(CLI_TYPE_CONCAT, b, next);
 			if (!c) {
 				syntax_free(first);
 				return NULL;
 			}
 			b = a->first;
-			b->refcount++;
+			syntax_incref(b);
 			syntax_free(first);
 			first = b;
 			next = c;
@@ -1388,18 +1632,29 @@ static cli_syntax_t *syntax_alloc(cli_type_t type, void *first, void *next)
 
 	this = syntax_ref(&find);
 	if (this) {
+		/*
+		 *	The name of a macro isn't a node.  Macros
+		 *	belong to the node table, so defining the same
+		 *	one again doesn't add a reference.
+		 */
+		if (type == CLI_TYPE_MACRO) {
+			this->refcount--;
+			syntax_free(next);
+			return this;
+		}
+
 		if ((type == CLI_TYPE_CONCAT) ||
-		    (type == CLI_TYPE_MACRO) ||
 		    (type == CLI_TYPE_ALTERNATE) ||
-		    (type == CLI_TYPE_OPTIONAL)) {
+		    (type == CLI_TYPE_OPTIONAL) ||
+		    (type == CLI_TYPE_PLUS)) {
 #ifndef NDEBUG
 			a = first;
-			assert(a->refcount > 1);
+			assert(((a->state & NODE_FROZEN) != 0) || (a->refcount > 1));
 			
 			if (next) {
 				b = next;
 
-				assert(b->refcount > 1);
+				assert(((b->state & NODE_FROZEN) != 0) || (b->refcount > 1));
 			}
 #endif
 
@@ -1430,9 +1685,11 @@ static cli_syntax_t *syntax_alloc(cli_type_t type, void *first, void *next)
 	default:
 		this = calloc(sizeof(*this), 1);
 		if (!this) return NULL;
+		COUNT(allocs);
 
 		a = this->first = first;
 		assert(a->type != type);
+		this->min = flags;
 
 		if (type == CLI_TYPE_CONCAT) {
 			this->length = 1;
@@ -1448,11 +1705,13 @@ static cli_syntax_t *syntax_alloc(cli_type_t type, void *first, void *next)
 
 	case CLI_TYPE_VARARGS:
 	case CLI_TYPE_EXACT:
+	case CLI_TYPE_MACRO:
 		len = strlen((char *) first);		
-		assert(next == NULL);
+		assert((type == CLI_TYPE_MACRO) || (next == NULL));
 
 		this = calloc(sizeof(*this) + len + 1, 1);
 		if (!this) return NULL;
+		COUNT(allocs);
 
 		this->first = this + 1;
 		memcpy(this->first, first, len + 1);
@@ -1475,125 +1734,123 @@ static cli_syntax_t *syntax_alloc(cli_type_t type, void *first, void *next)
 	return this;
 }
 
+static cli_syntax_t *syntax_alloc(cli_type_t type, void *first, void *next)
+{
+	return syntax_alloc_min(type, first, next, 0);
+}
+
+
+/*
+ *	Add one character to the output, if there's room for it and
+ *	the trailing NUL.
+ */
+static size_t syntax_sprintf_char(char *buffer, size_t len, char c)
+{
+	if (len < 2) return 0;
+
+	buffer[0] = c;
+	buffer[1] = '\0';
+	return 1;
+}
+
+/*
+ *	snprintf() returns what it would have written.  We want what
+ *	it did write.
+ */
+static size_t syntax_sprintf_clamp(int rcode, size_t len)
+{
+	if (rcode < 0) return 0;
+	if ((size_t) rcode >= len) return len - 1;
+	return rcode;
+}
 
 /*
- *	Internal "print syntax to string"
+ *	Internal "print syntax to string".  Long syntaxes are
+ *	truncated to fit.
  */
 static size_t syntax_sprintf(char *buffer, size_t len,
 			     const cli_syntax_t *in, cli_type_t parent)
 {
-	size_t outlen, offset;
+	size_t outlen;
 	cli_syntax_t *a;
 
+	if (!len) return 0;
+	buffer[0] = '\0';
+
 	switch (in->type) {
 	case CLI_TYPE_EXACT:
 	case CLI_TYPE_VARARGS:
-		outlen = snprintf(buffer, len, "%s", (char *) in->first);
+		outlen = syntax_sprintf_clamp(snprintf(buffer, len, "%s", (char *) in->first), len);
 		break;
 
 	case CLI_TYPE_MACRO:
-		outlen = snprintf(buffer, len, "%s=", (char *) in->first);
-		buffer += outlen;
-		len -= outlen;
-		outlen += syntax_sprintf(buffer, len, in->next,
+		outlen = syntax_sprintf_clamp(snprintf(buffer, len, "%s=", (char *) in->first), len);
+		outlen += syntax_sprintf(buffer + outlen, len - outlen, in->next,
 					 CLI_TYPE_MACRO);
 		break;
 
 	case CLI_TYPE_CONCAT:
 		outlen = syntax_sprintf(buffer, len, in->first,
 					CLI_TYPE_CONCAT);
-		buffer += outlen;
-		len -= outlen;
-		buffer[0] = ' ';
-
-		buffer++;
-		len--;
-		outlen++;
-
-		outlen += syntax_sprintf(buffer, len, in->next,
+		outlen += syntax_sprintf_char(buffer + outlen, len - outlen, ' ');
+		outlen += syntax_sprintf(buffer + outlen, len - outlen, in->next,
 					 CLI_TYPE_CONCAT);
 		break;
 
 	case CLI_TYPE_OPTIONAL:
-		buffer[0] = '[';
-		buffer++;
-		len--;
-		outlen = syntax_sprintf(buffer, len, in->first,
-					CLI_TYPE_OPTIONAL);
-		buffer += outlen;
-		len -= outlen;
-		buffer[0] = ']';
-		buffer[1] = '\0';
-		outlen += 2;
+		outlen = syntax_sprintf_char(buffer, len, '[');
+		outlen += syntax_sprintf(buffer + outlen, len - outlen, in->first,
+					 CLI_TYPE_OPTIONAL);
+		outlen += syntax_sprintf_char(buffer + outlen, len - outlen, ']');
 		break;
 
 	case CLI_TYPE_PLUS:
 		a = in->first;
-		offset = 0;
+		outlen = 0;
 		if (a->type == CLI_TYPE_CONCAT) {
-			buffer[0] = '(';
-			buffer++;
-			len--;
-			offset++;
+			outlen += syntax_sprintf_char(buffer, len, '(');
 		} else {
 			a = NULL;
 		}
-		outlen = syntax_sprintf(buffer, len, in->first,
-					CLI_TYPE_PLUS);
-		buffer += outlen;
-		len -= outlen;
+		outlen += syntax_sprintf(buffer + outlen, len - outlen, in->first,
+					 CLI_TYPE_PLUS);
 
 		if (a) {
-			buffer[0] = ')';
-			buffer++;
-			len--;
-			offset++;
+			outlen += syntax_sprintf_char(buffer + outlen, len - outlen, ')');
 		}
 
 		if (in->max == 0) {
-			if (in->min == 0) {
-				buffer[0] = '*';
-			} else {
-				buffer[0] = '+';
-			}
-		} else {
-			if (in->min == in->max) {
-				outlen += snprintf(buffer, len, "{%d}", in->min);
-			} else {
-				outlen += snprintf(buffer, len, "{%d,%d}", in->min, in->max);
-			}
+			outlen += syntax_sprintf_char(buffer + outlen, len - outlen,
+						      (in->min == 0) ? '*' : '+');
 
+		} else if (in->min == in->max) {
+			outlen += syntax_sprintf_clamp(snprintf(buffer + outlen, len - outlen,
+								"{%d}", in->min), len - outlen);
+
+		} else {
+			outlen += syntax_sprintf_clamp(snprintf(buffer + outlen, len - outlen,
+								"{%d,%d}", in->min, in->max), len - outlen);
 		}
-		buffer[1] = '\0';
-		outlen++;
-		outlen += offset;
 		break;
 
 	case CLI_TYPE_ALTERNATE:
 		outlen = 0;
 		if (parent != CLI_TYPE_ALTERNATE) {
-			buffer[0] = '(';
-			len--;
-			outlen++;
+			outlen += syntax_sprintf_char(buffer, len, '(');
 		}
-		outlen += syntax_sprintf(buffer + outlen, len,
+		outlen += syntax_sprintf(buffer + outlen, len - outlen,
 					 in->first, CLI_TYPE_ALTERNATE);
-		buffer[outlen] = '|';
-		len--;
-		outlen++;
-
-		outlen += syntax_sprintf(buffer + outlen, len, in->next,
+		outlen += syntax_sprintf_char(buffer + outlen, len - outlen, '|');
+		outlen += syntax_sprintf(buffer + outlen, len - outlen, in->next,
 					 CLI_TYPE_ALTERNATE);
 		if (((cli_syntax_t *)in->next)->type != CLI_TYPE_ALTERNATE) {
-			buffer[outlen] = ')';
-			buffer[outlen + 1] = '\0';
-			outlen++;
+			outlen += syntax_sprintf_char(buffer + outlen, len - outlen, ')');
 		}
 		break;
 
 	default:
 		assert(0 == 1);
-		outlen = snprintf(buffer, len, "?");
+		outlen = syntax_sprintf_clamp(snprintf(buffer, len, "?"), len);
 		break;
 	}
 
@@ -1620,7 +1877,7 @@ void syntax_printf(const cli_syntax_t *a)
  */
 void syntax_print_lines(const cli_syntax_t *in)
 {
-	char buffer[1024];
+	char buffer[8192];
 
 	if (!in) return;
 
@@ -1645,7 +1902,8 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 	int rcode;
 	const char *p, *q, *start;
 	cli_syntax_t *this, *first;
-	char tmp[256];
+	char word[256], *tmp;
+	size_t tmp_size;
 
 #if DEBUG_PRINT
 	printf("PARSING %s\n", *buffer);
@@ -1656,6 +1914,8 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 	if (!*p) return 0;
 
 	this = first = NULL;
+	tmp = word;
+	tmp_size = sizeof(word);
 
 	while (*p) {
 		if (isspace((int) *p)) p++;
@@ -1668,32 +1928,28 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 
 		if (*p < ' ') {
 			syntax_error(start, "Cannot parse binary data");
-			syntax_free(first);
-			return 0;
+			goto fail;
 		}
 
 		if (*p == '|') {
 			if (type == CLI_TYPE_ALTERNATE) break;
 
 			syntax_error(start, "Unexpected '|'");
-			syntax_free(first);
-			return 0;
+			goto fail;
 		}
 
 		if (*p == ')') {
 			if (type == CLI_TYPE_ALTERNATE) break;
 
 			syntax_error(start, "Unexpected ')'");
-			syntax_free(first);
-			return 0;
+			goto fail;
 		}
 
 		if (*p == ']') {
 			if (type == CLI_TYPE_OPTIONAL) break;
 
 			syntax_error(start, "Unexpected ']'");
-			syntax_free(first);
-			return 0;
+			goto fail;
 		}
 
 		if (*p == '[') {
@@ -1701,23 +1957,24 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 			p++;
 
 			rcode = str2syntax(&p, &a, CLI_TYPE_OPTIONAL);
-			if (!rcode) {
-				syntax_free(first);
-				return 0;
+			if (!rcode) goto fail;
+
+			if (!a) {
+				syntax_error(start, "Empty [...]");
+				goto fail;
 			}
 
 			if (*p != ']') {
 				syntax_error(start, "No matching ']'");
-				syntax_free(first);
-				return 0;
+				syntax_free(a);
+				goto fail;
 			}
 
 			p++;
 			this = syntax_alloc(CLI_TYPE_OPTIONAL, a, NULL);
 			if (!this) {
 				syntax_error(start, "Failed creating [...]");
-				syntax_free(first);
-				return 0;
+				goto fail;
 			}
 			goto next;
 		}
@@ -1728,14 +1985,15 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 
 			if ((*p == '|') || (*p == ')')) {
 				syntax_error(start, "Empty alternation");
-				syntax_free(first);
-				return 0;
+				goto fail;
 			}
 			
 			rcode = str2syntax(&p, &a, CLI_TYPE_ALTERNATE);
-			if (!rcode) {
-				syntax_free(first);
-				return 0;
+			if (!rcode) goto fail;
+
+			if (!a) {
+				syntax_error(start, "Empty alternation");
+				goto fail;
 			}
 
 			/*
@@ -1749,8 +2007,8 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 
 			if (*p != '|') {
 				syntax_error(start, "Expected '|' in alternation");
-				syntax_free(first);
-				return 0;
+				syntax_free(a);
+				goto fail;
 			}
 
 			while (*p == '|') {
@@ -1759,23 +2017,28 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 
 				rcode = str2syntax(&p, &b, CLI_TYPE_ALTERNATE);
 				if (!rcode) {
-					syntax_free(first);
-					return 0;
+					syntax_free(a);
+					goto fail;
+				}
+
+				if (!b) {
+					syntax_error(q, "Empty alternative");
+					syntax_free(a);
+					goto fail;
 				}
 
 				this = syntax_alternate(a, b);
 				if (!this) {
 					syntax_error(q, "Failed createing (|...)");
-					syntax_free(first);
-					return 0;
+					goto fail;
 				}
 				a = this;
 			}
 
 			if (*p != ')') {
 				syntax_error(start, "No matching ')'");
-				syntax_free(first);
-				return 0;
+				syntax_free(a);
+				goto fail;
 			}
 			this = a;
 			p++;
@@ -1790,15 +2053,13 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 		if (*p == '.') {
 			if ((p[1] != '.') || (p[2] != '.') || (p[3])) {
 				syntax_error(start, "Invalid use of variable arguments");
-				syntax_free(first);
-				return 0;
+				goto fail;
 			}
 
 			this = syntax_alloc(CLI_TYPE_VARARGS, "...", NULL);
 			if (!this) {
 				syntax_error(start, "Failed creating ...");
-				syntax_free(first);
-				return 0;
+				goto fail;
 			}
 
 			p += 3;
@@ -1807,8 +2068,7 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 
 		if ((*p > ' ') && (*p != '-') && (*p < '0') && (*p != '+') && (*p != '*')) {
 			syntax_error(start, "Invalid character");
-			syntax_free(first);
-			return 0;
+			goto fail;
 		}
 
 		while (*p) {
@@ -1821,6 +2081,22 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 			p++;
 		}
 
+		/*
+		 *	Words are usually short, so they go into a buffer
+		 *	on the stack.  Long ones go onto the heap.
+		 */
+		if ((size_t) (p - start) >= tmp_size) {
+			char *grown;
+
+			tmp_size = (p - start) * 2;
+			grown = realloc((tmp == word) ? NULL : tmp, tmp_size);
+			if (!grown) {
+				syntax_error(start, "Out of memory");
+				goto fail;
+			}
+			tmp = grown;
+		}
+
 		memcpy(tmp, start, p - start);
 		tmp[p - start] = '\0';
 
@@ -1832,16 +2108,12 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 
 			p++;
 			rcode = str2syntax(&p, &next, CLI_TYPE_MACRO);
-			if (!rcode) {
-				syntax_free(first);
-				return 0;
-			}
+			if (!rcode) goto fail;
 
 			this = syntax_alloc(CLI_TYPE_MACRO, tmp, next);
 			if (!this) {
 				syntax_error(start, "Failed creating macro");
-				syntax_free(first);
-				return 0;
+				goto fail;
 			}
 			this = NULL;
 			continue;
@@ -1859,7 +2131,7 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 			find.next = NULL;
 			this = syntax_find(&find);
 			if (this) {
-				this->refcount++;
+				syntax_incref(this);
 				goto next;
 			}
 
@@ -1868,7 +2140,7 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 			this = syntax_find(&find);
 			if (this) {
 				this = this->next;
-				this->refcount++;
+				syntax_incref(this);
 				goto next;
 			}
 		}
@@ -1883,8 +2155,7 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 		this = syntax_alloc(CLI_TYPE_EXACT, tmp, NULL);
 		if (!this) {
 			syntax_error(start, "Failed creating word");
-			syntax_free(first);
-			return 0;
+			goto fail;
 		}
 
 	next:
@@ -1898,23 +2169,25 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 					syntax_error(start, "Unexpected '+'");
 				}
 				syntax_free(this);
-				syntax_free(first);
-				return 0;
+				goto fail;
 			}
 
 
+			/*
+			 *	"[a]+" would match nothing forever.
+			 */
+			if (syntax_can_be_empty(this)) {
+				syntax_error(start, "Cannot repeat something which can match nothing");
+				syntax_free(this);
+				goto fail;
+			}
+
 			assert(this->type != CLI_TYPE_MACRO);
-			a = syntax_alloc(CLI_TYPE_PLUS, this, NULL);
+			a = syntax_alloc_min(CLI_TYPE_PLUS, this, NULL,
+					     (*p == '*') ? 0 : 1);
 			if (!a) {
 				syntax_error(start, "Failed creating +");
-				syntax_free(first);
-				return 0;
-			}
-
-			if (*p == '*') {
-				a->min = 0;
-			} else {
-				a->min = 1;
+				goto fail;
 			}
 
 			this = a;
@@ -1931,8 +2204,7 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 			a = syntax_alloc(CLI_TYPE_CONCAT, first, this);
 			if (!a) {
 				syntax_error(start, "Failed appending word");
-				syntax_free(first);
-				return 0;
+				goto fail;
 			}
 			this = NULL;
 			first = a;
@@ -1944,14 +2216,20 @@ static int str2syntax(const char **buffer, cli_syntax_t **out, cli_type_t type)
 	 */
 	if (first && (first->type == CLI_TYPE_VARARGS)) {
 		syntax_error(start, "Variable arguments cannot be the only syntax");
-		syntax_free(first);
-		return 0;
+		goto fail;
 	}
 
+	if (tmp != word) free(tmp);
+
 	*buffer = p;
 	*out = first;
 
 	return 1;
+
+fail:
+	if (tmp != word) free(tmp);
+	if (first) syntax_free(first);	/* syntax_free(NULL) frees everything */
+	return 0;
 }
 
 /*
@@ -2030,6 +2308,8 @@ static int syntax_prefix_words(int argc, char *argv[], char const *word, int sen
 
 	if (argc == 0) return 0;
 
+	COUNT(prefix_nodes);
+
 	switch (this->type) {
 	case CLI_TYPE_EXACT:
 		/*
@@ -2076,25 +2356,24 @@ static int syntax_prefix_words(int argc, char *argv[], char const *word, int sen
 
 	case CLI_TYPE_PLUS:
 		/*
-		 *	Count '*' and '+' as equivalent for prefix words, and always
-		 *	show one option.
+		 *	Always show one option.  "a+" has to start with
+		 *	"a", but "a*" can be skipped.
 		 */
 		matches = syntax_prefix_words(argc, argv, word, sense, this->first, next);
 		argc -= matches;
 		argv += matches;
 		total = matches;
 
-		if (!next) return total;
+		if (!next || (this->min > 0)) return total;
 
 		return total + syntax_prefix_words(argc, argv, word, sense, next, NULL);
 
 	case CLI_TYPE_CONCAT:
 		a = this->next;
 		if (next) {
-			a->refcount++;
-			next->refcount++;
+			syntax_incref(a);
+			syntax_incref(next);
 			a = syntax_alloc(CLI_TYPE_CONCAT, this->next, next);
-			assert(a != this);
 		}
 		matches = syntax_prefix_words(argc, argv, word, sense, this->first, a);
 		if (next) syntax_free(a);
@@ -2319,24 +2598,329 @@ static int syntax_print_post(UNUSED void *ctx, cli_syntax_t *this)
 	return 1;
 }
 
+/*
+ *	FIRST sets.  Each node has a summary of the words which can
+ *	start it, so that the matchers can skip an alternative without
+ *	descending into it.  Keywords are summarized as bits in a
+ *	mask, indexed by a hash of the lower-case word.  Their first
+ *	characters are kept, too, for matching prefixes.
+ *
+ *	Nodes never change once they've been created, so the FIRST
+ *	set is calculated once, when the graph is frozen.  Nodes which
+ *	are created after that don't have one, and are never skipped.
+ */
+#define FIRST_DONE	(1 << 0)	/* FIRST set is valid */
+#define FIRST_EMPTY	(1 << 1)	/* can match no words */
+#define FIRST_ANY	(1 << 2)	/* can start with any word */
+
+static uint64_t syntax_word_mask(const char *word)
+{
+	uint32_t hash = FNV_MAGIC_INIT;
+
+	while (*word) {
+		hash *= FNV_MAGIC_PRIME;
+		hash ^= (uint32_t) tolower((uint8_t) *word);
+		word++;
+	}
+
+	hash ^= hash >> 16;
+
+	return ((uint64_t) 1) << (hash & 63);
+}
+
+static uint64_t syntax_char_mask(const char *word)
+{
+	return ((uint64_t) 1) << (tolower((uint8_t) *word) & 63);
+}
+
+/*
+ *	Get the mask to check against the FIRST sets for a word.
+ *	An empty prefix matches everything.
+ */
+static uint64_t syntax_first_mask(const char *word, int sense)
+{
+	if (sense == CLI_MATCH_EXACT) return syntax_word_mask(word);
+
+	if (!*word) return ~((uint64_t) 0);
+
+	return syntax_char_mask(word);
+}
+
+/*
+ *	Returns 1 if the node can't start with the word, and has to
+ *	match at least one word.  Matching it would fail on the first
+ *	word, with "No matching command".
+ */
+static int syntax_first_skip(const cli_syntax_t *this, uint64_t mask, int sense)
+{
+	if ((this->first_flags & (FIRST_DONE | FIRST_EMPTY | FIRST_ANY)) != FIRST_DONE) {
+		return 0;
+	}
+
+	if (sense == CLI_MATCH_EXACT) return ((this->first_words & mask) == 0);
+
+	return ((this->first_chars & mask) == 0);
+}
+
+/*
+ *	Calculate the FIRST set for a node, and its children.  This
+ *	mirrors how syntax_check() matches the first word.
+ */
+static void syntax_first(cli_syntax_t *this)
+{
+	cli_syntax_t *a, *b;
+
+	if ((this->first_flags & FIRST_DONE) != 0) return;
+
+	switch (this->type) {
+	case CLI_TYPE_EXACT:
+		if (this->next) { /* data type */
+			this->first_flags = FIRST_ANY;
+			break;
+		}
+
+		this->first_words = syntax_word_mask(this->first);
+		this->first_chars = syntax_char_mask(this->first);
+		break;
+
+	case CLI_TYPE_OPTIONAL:
+	case CLI_TYPE_PLUS:
+		a = this->first;
+		syntax_first(a);
+
+		this->first_words = a->first_words;
+		this->first_chars = a->first_chars;
+		this->first_flags = a->first_flags & (FIRST_EMPTY | FIRST_ANY);
+
+		if ((this->type == CLI_TYPE_OPTIONAL) || (this->min == 0)) {
+			this->first_flags |= FIRST_EMPTY;
+		}
+		break;
+
+	case CLI_TYPE_CONCAT:
+		a = this->first;
+		b = this->next;
+		syntax_first(a);
+		syntax_first(b);
+
+		this->first_words = a->first_words;
+		this->first_chars = a->first_chars;
+		this->first_flags = a->first_flags & FIRST_ANY;
+
+		/*
+		 *	If the first one can be skipped, the next one can
+		 *	start the concatenation, too.
+		 */
+		if ((a->first_flags & FIRST_EMPTY) != 0) {
+			this->first_words |= b->first_words;
+			this->first_chars |= b->first_chars;
+			this->first_flags |= b->first_flags & (FIRST_EMPTY | FIRST_ANY);
+		}
+		break;
+
+	case CLI_TYPE_ALTERNATE:
+		a = this->first;
+		b = this->next;
+		syntax_first(a);
+		syntax_first(b);
+
+		this->first_words = a->first_words | b->first_words;
+		this->first_chars = a->first_chars | b->first_chars;
+		this->first_flags = (a->first_flags | b->first_flags) & (FIRST_EMPTY | FIRST_ANY);
+		break;
+
+	default:		/* "..." and anything else */
+		this->first_flags = FIRST_ANY;
+		break;
+	}
+
+	this->first_flags |= FIRST_DONE;
+}
+
+/*
+ *	Whether a node can match no words at all.
+ */
+static int syntax_can_be_empty(cli_syntax_t *this)
+{
+	syntax_first(this);
+
+	return ((this->first_flags & FIRST_EMPTY) != 0);
+}
+
+/*
+ *	Mark a node and its children as frozen.  The children of a
+ *	frozen node are already frozen, so we stop there.
+ */
+static void syntax_freeze_node(cli_syntax_t *this)
+{
+	while ((this->state & NODE_FROZEN) == 0) {
+		this->state |= NODE_FROZEN;
+
+		switch (this->type) {
+		case CLI_TYPE_CONCAT:
+		case CLI_TYPE_ALTERNATE:
+			syntax_freeze_node(this->first);
+			this = this->next;
+			break;
+
+		case CLI_TYPE_OPTIONAL:
+		case CLI_TYPE_PLUS:
+			this = this->first;
+			break;
+
+		default:
+			return;
+		}
+	}
+}
+
+/*
+ *	Freeze a graph, once it's been built.  The FIRST sets are
+ *	calculated, and the nodes become read-only.
+ *
+ *	Frozen nodes aren't reference counted.  Anything which walks
+ *	the graph just borrows the pointers, and syntax_free() ignores
+ *	them.  Nodes which are built on top of a frozen graph (e.g.
+ *	while matching) are still reference counted as usual.
+ *
+ *	Freezing is one-way.  Frozen nodes stay around until they are
+ *	no longer reachable, and syntax_collect() is called.
+ */
+void syntax_freeze(cli_syntax_t *head)
+{
+	if (!head) return;
+
+	syntax_first(head);
+	syntax_freeze_node(head);
+}
+
+static void syntax_mark(cli_syntax_t *this)
+{
+	while ((this->state & NODE_MARKED) == 0) {
+		this->state |= NODE_MARKED;
+
+		switch (this->type) {
+		case CLI_TYPE_CONCAT:
+		case CLI_TYPE_ALTERNATE:
+			syntax_mark(this->first);
+			this = this->next;
+			break;
+
+		case CLI_TYPE_OPTIONAL:
+		case CLI_TYPE_PLUS:
+			this = this->first;
+			break;
+
+		case CLI_TYPE_MACRO:
+			this = this->next;
+			break;
+
+		default:
+			return;
+		}
+	}
+}
+
+/*
+ *	Free the frozen nodes which can't be reached from the roots,
+ *	or from a node which is still reference counted.  Data types
+ *	are kept, unless we're shutting down.
+ */
+static void syntax_sweep(cli_syntax_t *roots[], int num_roots, int keep_types)
+{
+	int i, num;
+	cli_syntax_t *this, **dead;
+
+	for (i = 0; i < num_roots; i++) {
+		if (roots[i]) syntax_mark(roots[i]);
+	}
+
+	for (i = 0; i < table_size; i++) {
+		this = hash_table[i];
+		if (!this) continue;
+
+		if (((this->state & NODE_FROZEN) == 0) ||
+		    (keep_types && (this->type == CLI_TYPE_EXACT) && this->next)) {
+			syntax_mark(this);
+		}
+	}
+
+	/*
+	 *	Removing nodes from the table moves the others around,
+	 *	so find them all first.
+	 */
+	dead = NULL;
+	num = 0;
+	for (i = 0; i < table_size; i++) {
+		this = hash_table[i];
+		if (!this) continue;
+
+		if ((this->state & NODE_MARKED) == 0) num++;
+	}
+
+	if (num > 0) dead = malloc(num * sizeof(dead[0]));
+
+	num = 0;
+	for (i = 0; i < table_size; i++) {
+		this = hash_table[i];
+		if (!this) continue;
+
+		if ((this->state & NODE_MARKED) != 0) {
+			this->state &= ~NODE_MARKED;
+			continue;
+		}
+
+		if (dead) dead[num++] = this;
+	}
+
+	for (i = 0; i < num; i++) {
+		this = dead[i];
+
+		syntax_unlink(this);
+#ifndef NDEBUG
+		memset(this, 0, sizeof(*this));
+#endif
+		free(this);
+	}
+
+	free(dead);
+}
+
+/*
+ *	Free the frozen nodes which are no longer used.  The caller
+ *	passes in every graph it's still holding on to.  Pointers to
+ *	any other frozen nodes are no longer valid after this.
+ */
+void syntax_collect(cli_syntax_t *roots[], int num_roots)
+{
+	if (num_entries == 0) return;
+
+	syntax_sweep(roots, num_roots, 1);
+}
+
 /*
  *	Returns a NEW ref which matches the word
  */
 static cli_syntax_t *syntax_match_word(const char *word, int sense,
 				       cli_syntax_t *this, cli_syntax_t *next)
 {
+	uint64_t mask;
 	cli_syntax_t *a, *found;
 
 	assert(this != NULL);
 	assert(word != NULL);
 
+	COUNT(match_nodes);
+
 	switch (this->type) {
 	case CLI_TYPE_VARARGS:
-		this->refcount++; /* always matches */
+		syntax_incref(this); /* always matches */
 		goto do_concat;
 
 	case CLI_TYPE_EXACT:
 		if (this->next) { /* call syntax checker */
+			COUNT(datatypes);
+
 			/* FIXME: add somewhere for any errors to go */
 			if (!((recli_datatype_parse_t)this->next)(word, NULL)) {
 				return NULL; /* failed to match */
@@ -2362,14 +2946,14 @@ static cli_syntax_t *syntax_match_word(const char *word, int sense,
 			}
 		}
 
-		this->refcount++;
+		syntax_incref(this);
 	do_concat:
 		if (!next) return this;
 
-		assert(this->refcount > 0);
-		assert(next->refcount > 0);
+		assert(((this->state & NODE_FROZEN) != 0) || (this->refcount > 0));
+		assert(((next->state & NODE_FROZEN) != 0) || (next->refcount > 0));
 
-		next->refcount++;
+		syntax_incref(next);
 		return syntax_alloc(CLI_TYPE_CONCAT, this, next);
 
 	case CLI_TYPE_OPTIONAL:
@@ -2378,29 +2962,79 @@ static cli_syntax_t *syntax_match_word(const char *word, int sense,
 
 		if (!next) return NULL; /* matched, but nothing more to match */
 
+		COUNT(backtracks);
+		return syntax_match_word(word, sense, next, NULL);
+
+	case CLI_TYPE_PLUS:
+		/*
+		 *	"a+" is "a" followed by "a*".  "a*" is the same,
+		 *	or nothing at all.
+		 */
+		if (this->min > 0) {
+			syntax_incref(this->first);
+			a = syntax_alloc_min(CLI_TYPE_PLUS, this->first, NULL, 0);
+			if (!a) return NULL;
+		} else {
+			a = syntax_incref(this);
+		}
+
+		if (next) {
+			syntax_incref(next);
+			a = syntax_alloc(CLI_TYPE_CONCAT, a, next);
+			if (!a) return NULL;
+		}
+
+		found = syntax_match_word(word, sense, this->first, a);
+		syntax_free(a);
+		if (found || (this->min > 0)) return found;
+
+		if (!next) return NULL;
+
+		COUNT(backtracks);
 		return syntax_match_word(word, sense, next, NULL);
 
 	case CLI_TYPE_CONCAT:
 		a = this->next;
 		if (next) {
-			a->refcount++;
-			next->refcount++;
+			syntax_incref(a);
+			syntax_incref(next);
 			a = syntax_alloc(CLI_TYPE_CONCAT, this->next, next);
-			assert(a != this);
 		}
 		found = syntax_match_word(word, sense, this->first, a);
 		if (next) syntax_free(a);
 		return found;
 
 	case CLI_TYPE_ALTERNATE:
+		mask = syntax_first_mask(word, sense);
+
 		while (this->type == CLI_TYPE_ALTERNATE) {
-			found = syntax_match_word(word, sense,
-						  this->first, next);
-			if (found) return found;
+			/*
+			 *	None of the remaining alternatives can
+			 *	start with this word.
+			 */
+			if (syntax_first_skip(this, mask, sense)) {
+				COUNT(skips);
+				return NULL;
+			}
+
+			if (!syntax_first_skip(this->first, mask, sense)) {
+				found = syntax_match_word(word, sense,
+							  this->first, next);
+				if (found) return found;
+
+				COUNT(backtracks);
+			} else {
+				COUNT(skips);
+			}
 			this = this->next;
 		}
 		assert(this->type != CLI_TYPE_ALTERNATE);
 
+		if (syntax_first_skip(this, mask, sense)) {
+			COUNT(skips);
+			return NULL;
+		}
+
 		return syntax_match_word(word, sense, this, next);
 
 	default:
@@ -2413,65 +3047,177 @@ static cli_syntax_t *syntax_match_word(const char *word, int sense,
 
 
 /*
- *	Check argv against a syntax.
- *
- *	Returns:
- *
- *	-N		syntax error (or match failure) in argument N
- *	0		argc was zero
- *	N < argc	a partial command
- *	N = argc	a full command can be executed
- *	N > argc        we want more argc to run a full command
- *
- *	want_more is set if we matched, but needed more input.
- *	i.e. argc == 0, but we still have nodes to match.
+ *	The memo table starts out in the syntax_memo_t, which is
+ *	usually on the stack.  It moves to the heap if it gets too big,
+ *	up to a limit.  Past that, results just aren't saved.
  */
-int syntax_check(cli_syntax_t *head, int argc, char *argv[],
-		 const char **error, int *flags)
-{
-	int words, total;
-	cli_syntax_t *a;
-	char const *alt_error = NULL;
+#define SYNTAX_MEMO_MAX		(1 << 16)
 
-	*error = NULL;
-
-	if (!head || (argc < 0)) return -1;
+static uint32_t syntax_memo_hash(const void *node, int argc)
+{
+	uint64_t p = (uintptr_t) node;
+	uint32_t hash;
 
-	a = head;
+	hash = (uint32_t) ((p >> 4) ^ (p >> 32));
+	hash ^= (uint32_t) argc * 0x9e3779b1;
+	hash *= FNV_MAGIC_PRIME;
 
-	switch (a->type) {
-	case CLI_TYPE_EXACT:
-		if (argc == 0) return 1; /* want one more argument */
+	return hash ^ (hash >> 16);
+}
 
-		if (a->next) { /* call syntax checker */
-			/*
-			 *	Call registered data type such as IPADDR, etc.
-			 */
-			*error = NULL;
-			if (((recli_datatype_parse_t)a->next)(argv[0], error)) {
-				return 1;
-			}
+void syntax_memo_init(syntax_memo_t *memo)
+{
+	memo->num_entries = 0;
+	memo->size = SYNTAX_MEMO_FIXED;
+	memo->table = memo->fixed;
+	memo->word = NULL;
+	memo->word_mask = 0;
+	memset(memo->fixed, 0, sizeof(memo->fixed));
+}
 
-			if (!*error) *error = "Input does not match required syntax";
-			return -1;
+/*
+ *	Get the FIRST mask for a word.  The same word is checked
+ *	against many nodes in a row, so the last one is cached.
+ */
+uint64_t syntax_memo_word(syntax_memo_t *memo, const char *word)
+{
+	if (memo->word != word) {
+		memo->word = word;
+		memo->word_mask = syntax_word_mask(word);
+	}
 
-			/*
-			 *	FIXME: have the parser take an error, too!
-			 */
+	return memo->word_mask;
+}
 
-		} else if ((a->min & FLAG_CASE_INSENSITIVE) != 0) {
-			if (strcasecmp((char *)a->first, argv[0]) == 0) {
-				if (flags) *flags |= a->min & FLAGS_EXPORT;
-				return 1;
-			}
+void syntax_memo_free(syntax_memo_t *memo)
+{
+	if (memo->table != memo->fixed) free(memo->table);
+	memo->table = NULL;
+	memo->num_entries = memo->size = 0;
+}
 
-		} else if (strcmp((char *)a->first, argv[0]) == 0) {
-			if (flags) *flags |= a->min & FLAGS_EXPORT;
-			return 1;
+const syntax_memo_entry_t *syntax_memo_find(const syntax_memo_t *memo,
+					    const void *node, int argc)
+{
+	uint32_t i;
+
+	for (i = syntax_memo_hash(node, argc) & (memo->size - 1);
+	     memo->table[i].node != NULL;
+	     i = (i + 1) & (memo->size - 1)) {
+		if ((memo->table[i].node == node) &&
+		    (memo->table[i].argc == argc)) {
+			return &memo->table[i];
 		}
+	}
 
-		*error = "No matching command";
-		return -1;	/* didn't match */
+	return NULL;
+}
+
+static void syntax_memo_insert(syntax_memo_entry_t *table, int size,
+			       const syntax_memo_entry_t *e)
+{
+	uint32_t i;
+
+	for (i = syntax_memo_hash(e->node, e->argc) & (size - 1);
+	     table[i].node != NULL;
+	     i = (i + 1) & (size - 1)) {
+		/* nothing */
+	}
+
+	table[i] = *e;
+}
+
+void syntax_memo_add(syntax_memo_t *memo, const void *node, int argc,
+		     int words, const char *error, int flags)
+{
+	int i;
+	syntax_memo_entry_t e;
+
+	if (((memo->num_entries + 1) * 2) > memo->size) {
+		syntax_memo_entry_t *table;
+
+		if (memo->size >= SYNTAX_MEMO_MAX) return;
+
+		table = calloc(memo->size * 2, sizeof(table[0]));
+		if (!table) return;
+
+		for (i = 0; i < memo->size; i++) {
+			if (!memo->table[i].node) continue;
+
+			syntax_memo_insert(table, memo->size * 2, &memo->table[i]);
+		}
+
+		if (memo->table != memo->fixed) free(memo->table);
+		memo->table = table;
+		memo->size *= 2;
+	}
+
+	e.node = node;
+	e.argc = argc;
+	e.words = words;
+	e.flags = flags;
+	e.error = error;
+
+	syntax_memo_insert(memo->table, memo->size, &e);
+	memo->num_entries++;
+}
+
+
+static int syntax_check_memo(syntax_memo_t *memo, cli_syntax_t *head,
+			     int argc, char *argv[],
+			     const char **error, int *flags);
+
+/*
+ *	Check one node.  See syntax_check() for the return codes.
+ */
+static int syntax_check_node(syntax_memo_t *memo, cli_syntax_t *head,
+			     int argc, char *argv[],
+			     const char **error, int *flags)
+{
+	int words, total;
+	cli_syntax_t *a;
+	char const *alt_error = NULL;
+
+	*error = NULL;
+
+	a = head;
+
+	COUNT(check_nodes);
+
+	switch (a->type) {
+	case CLI_TYPE_EXACT:
+		if (argc == 0) return 1; /* want one more argument */
+
+		if (a->next) { /* call syntax checker */
+			/*
+			 *	Call registered data type such as IPADDR, etc.
+			 */
+			COUNT(datatypes);
+			*error = NULL;
+			if (((recli_datatype_parse_t)a->next)(argv[0], error)) {
+				return 1;
+			}
+
+			if (!*error) *error = "Input does not match required syntax";
+			return -1;
+
+			/*
+			 *	FIXME: have the parser take an error, too!
+			 */
+
+		} else if ((a->min & FLAG_CASE_INSENSITIVE) != 0) {
+			if (strcasecmp((char *)a->first, argv[0]) == 0) {
+				if (flags) *flags |= a->min & FLAGS_EXPORT;
+				return 1;
+			}
+
+		} else if (strcmp((char *)a->first, argv[0]) == 0) {
+			if (flags) *flags |= a->min & FLAGS_EXPORT;
+			return 1;
+		}
+
+		*error = "No matching command";
+		return -1;	/* didn't match */
 
 	case CLI_TYPE_VARARGS:
 		if (argc == 0) return 1; /* want one more argument */
@@ -2484,8 +3230,11 @@ int syntax_check(cli_syntax_t *head, int argc, char *argv[],
 		/*
 		 *	If it didn't match, we return "no words for us".
 		 */
-		words = syntax_check(a->first, argc, argv, error, flags);
-		if (words < 0) return 0;
+		words = syntax_check_memo(memo, a->first, argc, argv, error, flags);
+		if (words < 0) {
+			COUNT(backtracks);
+			return 0;
+		}
 		return words;
 
 	case CLI_TYPE_PLUS:
@@ -2493,7 +3242,7 @@ int syntax_check(cli_syntax_t *head, int argc, char *argv[],
 		 *	Has to match at least 'min' times.
 		 */
 		if (a->min == 1) {
-			words = syntax_check(a->first, argc, argv, error, flags);
+			words = syntax_check_memo(memo, a->first, argc, argv, error, flags);
 			if (words <= 0) return words;
 
 			if (words > argc) return words;
@@ -2508,18 +3257,16 @@ int syntax_check(cli_syntax_t *head, int argc, char *argv[],
 		}
 
 		while (argc > 0) {
-			words = syntax_check(a->first, argc, argv, error, flags);
+			words = syntax_check_memo(memo, a->first, argc, argv, error, flags);
 
 			/*
-			 *	No match on '*' is OK.
+			 *	The repetition stops at the first thing
+			 *	which doesn't match.  The words after it
+			 *	are for whatever follows us.
 			 */
-			if (a->min == total) return 0;
-
-			if (words < 0) return words - total;
+			if (words <= 0) break;
 
-			if (words == 0) break; /* didn't match anything */
-
-			if (words > argc) return words;
+			if (words > argc) return total + words;
 
 			argc -= words;
 			argv += words;
@@ -2532,7 +3279,7 @@ int syntax_check(cli_syntax_t *head, int argc, char *argv[],
 		 *	Check first entry, which might not match
 		 *	anything if it's optional.
 		 */
-		words = syntax_check(a->first, argc, argv, error, flags);
+		words = syntax_check_memo(memo, a->first, argc, argv, error, flags);
 		if (words < 0) {
 			return words;
 		}
@@ -2543,7 +3290,7 @@ int syntax_check(cli_syntax_t *head, int argc, char *argv[],
 		argv += words;
 		total = words;
 
-		words = syntax_check(a->next, argc, argv, error, flags);
+		words = syntax_check_memo(memo, a->next, argc, argv, error, flags);
 		if (words < 0) {
 			return words - total;
 		}
@@ -2555,8 +3302,20 @@ int syntax_check(cli_syntax_t *head, int argc, char *argv[],
 
 	case CLI_TYPE_ALTERNATE:
 		total = 0;
-		words = syntax_check(a->first, argc, argv, &alt_error, flags);
-		if (words > 0) return words; /* found a match */
+		words = syntax_check_memo(memo, a->first, argc, argv, &alt_error, flags);
+		if (words > 0) {
+			/*
+			 *	The first alternative wants more words than
+			 *	there are.  If another one uses all of the
+			 *	words, the command is complete.
+			 */
+			if ((words > argc) &&
+			    (syntax_check_memo(memo, a->next, argc, argv, &alt_error, flags) == argc)) {
+				return argc;
+			}
+
+			return words; /* found a match */
+		}
 
 		/*
 		 *	We're at the end of the input, and at the end
@@ -2564,10 +3323,20 @@ int syntax_check(cli_syntax_t *head, int argc, char *argv[],
 		 */
 		if ((argc == 0) && (words == 0)) return 0;
 
-		total = syntax_check(a->next, argc, argv, error, flags);
+		COUNT(backtracks);
+		total = syntax_check_memo(memo, a->next, argc, argv, error, flags);
 
 		if (total >= 0) return total;
 
+		/*
+		 *	The first alternative matched nothing, which is
+		 *	allowed, e.g. "(a*|b)".
+		 */
+		if (words == 0) {
+			*error = NULL;
+			return 0;
+		}
+
 		/*
 		 *	Return the longest error.
 		 */
@@ -2587,816 +3356,2284 @@ int syntax_check(cli_syntax_t *head, int argc, char *argv[],
 }
 
 
-cli_syntax_t *syntax_match_max(cli_syntax_t *head, int argc, char *argv[])
+/*
+ *	Check a node, re-using the result if the same node has already
+ *	been checked against the same words.  Words and "..." are
+ *	cheap to check, so only the nodes which recurse are saved.
+ *	Nodes which can't start with the first word are skipped
+ *	entirely.
+ */
+static int syntax_check_memo(syntax_memo_t *memo, cli_syntax_t *head,
+			     int argc, char *argv[],
+			     const char **error, int *flags)
 {
-	int i, match;
-	cli_syntax_t *this, *next;
-	cli_syntax_t *a;
-
-	if (!head) return NULL;	/* no syntax checking */
-
-	this = head;
-	this->refcount++;
-	match = 0;
-
-	if (argc == 0) return this;
-
-	while (this && (match < argc)) {
-		next = syntax_match_word(argv[match], CLI_MATCH_EXACT,
-					 this, NULL);
-		if (!next) break;
-
-		syntax_free(this);
+	int words, found;
+	const syntax_memo_entry_t *e;
 
-		this = syntax_skip_prefix(next, 1);
-
-		assert(this != next);
-		syntax_free(next);
-		match++;
+	if ((head->type == CLI_TYPE_EXACT) ||
+	    (head->type == CLI_TYPE_VARARGS)) {
+		return syntax_check_node(memo, head, argc, argv, error, flags);
 	}
 
-	if (match == 0) {
-		syntax_free(this);
-		return NULL;
+	if ((argc > 0) &&
+	    syntax_first_skip(head, syntax_memo_word(memo, argv[0]), CLI_MATCH_EXACT)) {
+		COUNT(skips);
+		*error = "No matching command";
+		return -1;
 	}
 
-	next = this;
-	for (i = match - 1; i >= 0; i--) {
-		a = syntax_alloc(CLI_TYPE_FORCE_EXACT, argv[i], NULL); /* don't do case checking */
-		assert(a != NULL);
-
-		this = syntax_alloc(CLI_TYPE_CONCAT, a, next);
-		assert(this != NULL);
-		next = this;
+	e = syntax_memo_find(memo, head, argc);
+	if (e) {
+		COUNT(memo_hits);
+		*error = e->error;
+		if (flags) *flags |= e->flags;
+		return e->words;
 	}
 
-	return this;
+	/*
+	 *	The flags are saved, too, so that a cached result
+	 *	sets the same flags as checking it again.
+	 */
+	found = 0;
+	words = syntax_check_node(memo, head, argc, argv, error, &found);
+	syntax_memo_add(memo, head, argc, words, *error, found);
+
+	if (flags) *flags |= found;
+	return words;
 }
 
 
-#ifndef NDEBUG
-void syntax_debug(const char *msg, cli_syntax_t *this)
+/*
+ *	Check argv against a syntax.
+ *
+ *	Returns:
+ *
+ *	-N		syntax error (or match failure) in argument N
+ *	0		argc was zero
+ *	N < argc	a partial command
+ *	N = argc	a full command can be executed
+ *	N > argc        we want more argc to run a full command
+ *
+ *	want_more is set if we matched, but needed more input.
+ *	i.e. argc == 0, but we still have nodes to match.
+ */
+int syntax_check(cli_syntax_t *head, int argc, char *argv[],
+		 const char **error, int *flags)
 {
-	recli_fprintf(recli_stdout, "%s ", msg);
-	syntax_printf(this);
-	recli_fprintf(recli_stdout, "\r\n");
-}
-#endif
+	int rcode;
+	syntax_memo_t memo;
+	const syntax_image_t *img;
 
+	*error = NULL;
 
-int syntax_tab_complete(cli_syntax_t *head, const char *in, size_t len,
-			int max_tabs, char *tabs[])
-{
-	int i, argc, match, exact;
-	size_t out;
-	cli_syntax_t *this, *next;
-	char *argv[256];
-	char *word;
-	char *p, buffer[256];
-	char mybuf[1024];
+	if (!head || (argc < 0)) return -1;
 
-	if (!head) return 0;	/* no syntax checking */
+	COUNT(checks);
 
-	if (sizeof(mybuf) < len + 1) return 0;	/* don't overflow */
+	if (head == static_root) return static_check(argc, argv, error, flags);
 
-	memcpy(mybuf, in, len + 1);
-	argc = str2argv(mybuf, len, 256, argv);
-	if (argc < 0) return 0;
+	img = syntax_image(head);
+	if (img) return syntax_image_check(img, argc, argv, error, flags);
 
-	this = head;
-	this->refcount++;	/* so we can free it later */
+	/*
+	 *	The memo table is local to this call, so that
+	 *	syntax_check() can be called from many threads.
+	 */
+	syntax_memo_init(&memo);
+	rcode = syntax_check_memo(&memo, head, argc, argv, error, flags);
+	syntax_memo_free(&memo);
 
-	match = 0;
-	exact = CLI_MATCH_EXACT;
+	return rcode;
+}
 
-	while (this && (match < argc)) {
+
+/*
+ *	The keywords and data types which can start a node, for
+ *	syntax_lint().
+ */
+typedef struct syntax_words_t {
+	const cli_syntax_t	**words;
+	int			num_words;
+	int			size;
+} syntax_words_t;
+
+static int syntax_words_add(syntax_words_t *w, syntax_memo_t *seen,
+			    const cli_syntax_t *this)
+{
+	if (syntax_memo_find(seen, this, 0)) return 0;
+	syntax_memo_add(seen, this, 0, 0, NULL, 0);
+
+	switch (this->type) {
+	case CLI_TYPE_EXACT:
 		/*
-		 *	Check if any ONE word matches.
+		 *	Data types are added by name.  Two of the same
+		 *	data type match the same words.
 		 */
-		next = syntax_match_word(argv[match], exact, this, NULL);
-		if (!next && ((match + 1) == argc)) {
-			exact = CLI_MATCH_PREFIX;
-			next = syntax_match_word(argv[match], exact, this, NULL);
-		}
+		if (w->num_words == w->size) {
+			const cli_syntax_t **words;
 
-		if (!next) {
-			syntax_free(this);
-			return 0;
-		}
+			words = realloc(w->words, (w->size + 16) * 2 * sizeof(words[0]));
+			if (!words) return -1;
 
-		if (exact != CLI_MATCH_EXACT) {
-			syntax_free(next);
-			next = NULL;
-			break;
+			w->words = words;
+			w->size = (w->size + 16) * 2;
 		}
+		w->words[w->num_words++] = this;
+		return 0;
 
-		syntax_free(this);
+	case CLI_TYPE_OPTIONAL:
+	case CLI_TYPE_PLUS:
+		return syntax_words_add(w, seen, this->first);
 
-		this = syntax_skip_prefix(next, 1);
-		assert(this != next);
-		syntax_free(next);
-		next = NULL;
-		match++;
-	}
+	case CLI_TYPE_CONCAT:
+		if (syntax_words_add(w, seen, this->first) < 0) return -1;
 
-	out = 0;
-	p = buffer;
-	match = argc;
+		if ((((cli_syntax_t *) this->first)->first_flags & FIRST_EMPTY) == 0) return 0;
 
-	if (this && (exact == CLI_MATCH_PREFIX)) {
-		match--;
+		return syntax_words_add(w, seen, this->next);
 
-		word = strdup(argv[match]);
-	} else {
-		word = NULL;
-	}
+	case CLI_TYPE_ALTERNATE:
+		if (syntax_words_add(w, seen, this->first) < 0) return -1;
 
-	for (i = 0; i < match; i++) {
-		out = snprintf(p, buffer + sizeof(buffer) - p, "%s ", argv[i]);
-		p += out;
-	}
+		return syntax_words_add(w, seen, this->next);
 
-	if (!this) return 0;
+	default:
+		break;
+	}
 
-	argc = syntax_prefix_words(256, argv, word, exact, this, NULL);
-	if (argc > max_tabs) argc = max_tabs;
+	return 0;
+}
 
-	for (i = 0; i < argc; i++) {
-		assert(argv[i] != NULL);
-		strcpy(p, argv[i]);
-		strcat(p, " ");
-		tabs[i] = strdup(buffer);
+static int syntax_words_equal(const cli_syntax_t *a, const cli_syntax_t *b)
+{
+	if (((a->min | b->min) & FLAG_CASE_INSENSITIVE) != 0) {
+		return (strcasecmp(a->first, b->first) == 0);
 	}
 
-	syntax_free(this);
-	free(word);
-
-	return argc;
+	return (strcmp(a->first, b->first) == 0);
 }
 
-
-int syntax_merge(cli_syntax_t **phead, char *str)
+/*
+ *	Whether two nodes might start with the same keyword.  Data
+ *	types aren't in the FIRST sets, so they always might.
+ */
+static int syntax_first_overlap(const cli_syntax_t *a, const cli_syntax_t *b)
 {
-	char *p;
-	const char *q;
-	cli_syntax_t *this, *a;
+	if (((a->first_flags | b->first_flags) & FIRST_ANY) != 0) return 1;
 
-	if (!phead || !str) {
-		syntax_error(str, "Invalid parameter");
-		return -1;
-	}
+	return ((a->first_words & b->first_words) != 0);
+}
 
-	p = strchr(str, '\r');
-	if (p) *p = '\0';
-	
-	p = strchr(str, '\n');
-	if (p) *p = '\0';
-	
-	p = str;
-	while (isspace((int) *p)) p++;
-	if (!*p) return 0;
-	
-	q = p;
-	
-#ifdef USE_UTF8
-	if (!utf8_strvalid(p)) {
-		syntax_error(p, "Invalid UTF-8 character");
-		syntax_free(*phead);
-		return -1;
+/*
+ *	Check the alternatives in one alternation.  They shouldn't
+ *	match nothing, and they shouldn't start with the same word.
+ *	syntax_check() takes the first alternative which matches, so
+ *	the second one may never be used.
+ */
+static int syntax_lint_alternate(const cli_syntax_t *head)
+{
+	int i, j, k, l, num, warnings;
+	char buffer[8192];
+	const cli_syntax_t *this, **branches;
+	syntax_words_t *words;
+	syntax_memo_t seen;
+
+	num = 1;
+	for (this = head; this->type == CLI_TYPE_ALTERNATE; this = this->next) num++;
+
+	branches = calloc(num, sizeof(branches[0]));
+	words = calloc(num, sizeof(words[0]));
+	if (!branches || !words) {
+		free(branches);
+		free(words);
+		return 0;
 	}
-#endif
 
-	if (!str2syntax(&q, &this, CLI_TYPE_EXACT)) {
-		syntax_free(*phead);
-		return -1;
+	i = 0;
+	for (this = head; this->type == CLI_TYPE_ALTERNATE; this = this->next) {
+		branches[i++] = this->first;
 	}
+	branches[i] = this;
 
-	if (!this) return 0;
-	
-	if (!*phead) {
-#if DEBUG_PRINT
-		printf("{ ");
-		syntax_printf(this);
-		printf(" } SET\n");
-#endif
-		*phead = this;
-		return 0;
+	warnings = 0;
+	for (i = 0; i < num; i++) {
+		syntax_memo_init(&seen);
+		(void) syntax_words_add(&words[i], &seen, branches[i]);
+		syntax_memo_free(&seen);
+
+		if ((branches[i]->first_flags & FIRST_EMPTY) == 0) continue;
+
+		syntax_sprintf(buffer, sizeof(buffer), branches[i], CLI_TYPE_EXACT);
+		recli_fprintf(recli_stderr, "Warning: alternative can match nothing:\n\t%s\n",
+			      buffer);
+		warnings++;
 	}
 
-#if DEBUG_PRINT
-	printf("{ ");
-	syntax_printf(*phead);
-	printf(" } MERGE { ");
-	syntax_printf(this);
-	printf(" }\n");
-#endif
+	for (i = 0; i < num; i++) {
+		for (j = i + 1; j < num; j++) {
+			if (!syntax_first_overlap(branches[i], branches[j])) continue;
 
-	a = syntax_alternate(*phead, this);
-	if (!a) {
-		if (!syntax_error_string) {
-			syntax_error(str, "Syntax is incompatible with previous commands");
-		} else {
-			syntax_error_ptr = str;
+			for (k = 0; k < words[i].num_words; k++) {
+				for (l = 0; l < words[j].num_words; l++) {
+					if (syntax_words_equal(words[i].words[k],
+							       words[j].words[l])) break;
+				}
+				if (l < words[j].num_words) break;
+			}
+			if (k == words[i].num_words) continue;
+
+			recli_fprintf(recli_stderr, "Warning: alternatives both start with \"%s\":\n",
+				      (char *) words[i].words[k]->first);
+			syntax_sprintf(buffer, sizeof(buffer), branches[i], CLI_TYPE_EXACT);
+			recli_fprintf(recli_stderr, "\t%s\n", buffer);
+			syntax_sprintf(buffer, sizeof(buffer), branches[j], CLI_TYPE_EXACT);
+			recli_fprintf(recli_stderr, "\t%s\n", buffer);
+			warnings++;
 		}
-		return -1;
 	}
 
-	*phead = a;
-	return 0;
-}
+	for (i = 0; i < num; i++) free(words[i].words);
+	free(words);
+	free(branches);
 
-static const char *spaces = "                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                ";
+	return warnings;
+}
 
 /*
- *	Parse a file into a syntax, ignoring blank lines and comments.
+ *	The words which can continue a node at a point where it could
+ *	also stop.  e.g. "[a]" or "b [a]" can stop before the "a".
  */
-int syntax_parse_file(const char *filename, cli_syntax_t **phead)
+static int syntax_words_more(syntax_words_t *w, syntax_memo_t *seen,
+			     const cli_syntax_t *this)
 {
-	int lineno;
-	FILE *fp;
-	char buffer[1024];
-	cli_syntax_t *head;
+	const cli_syntax_t *a;
 
-	if (!phead) {
-		recli_fprintf(recli_stderr, "Reading syntax: internal error\n");
-		return -1;
-	}
+	if (syntax_memo_find(seen, this, 1)) return 0;
+	syntax_memo_add(seen, this, 1, 0, NULL, 0);
 
-	if (!*phead) {
-		recli_datatypes_init();
-	}
+	switch (this->type) {
+	case CLI_TYPE_OPTIONAL:
+	case CLI_TYPE_PLUS:
+		if (syntax_words_add(w, seen, this->first) < 0) return -1;
 
-	fp = fopen(filename, "r");
-	if (!fp) {
-		recli_fprintf(recli_stderr, "Failed opening %s: %s\n",
-			filename, strerror(errno));
-		return -1;
-	}
+		return syntax_words_more(w, seen, this->first);
 
-	lineno = 0;
-	head = NULL;
+	case CLI_TYPE_CONCAT:
+		if (syntax_words_more(w, seen, this->next) < 0) return -1;
 
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-		lineno++;
+		a = this->next;
+		if ((a->first_flags & FIRST_EMPTY) == 0) return 0;
 
-		if (syntax_merge(&head, buffer) < 0) {
-			if ((syntax_error_ptr >= buffer) &&
-			    (syntax_error_ptr < (buffer + sizeof(buffer)))) {
-				recli_fprintf(recli_stderr, "%s\n", buffer);
-				recli_fprintf(recli_stderr, "%.*s^\n",
-					      syntax_error_ptr - buffer, spaces);
-			}
-			recli_fprintf(recli_stderr, "ERROR in %s line %d: %s\n",
-				      filename, lineno, syntax_error_string);
-			return -1;
-		}
-	}
+		if (syntax_words_add(w, seen, this->next) < 0) return -1;
 
-	fclose(fp);
+		return syntax_words_more(w, seen, this->first);
 
-	if (0) {
-		syntax_walk_all(head, NULL, syntax_print_pre, syntax_print_in,
-				syntax_print_post);
-	}
+	case CLI_TYPE_ALTERNATE:
+		if (syntax_words_more(w, seen, this->first) < 0) return -1;
 
-	*phead = head;
+		return syntax_words_more(w, seen, this->next);
+
+	default:
+		break;
+	}
 
 	return 0;
 }
 
-
-static void add_help(cli_syntax_t **phead, cli_syntax_t *last,
-		     const char *help, int flag)
+/*
+ *	Check a part which can be skipped, repeated, or stop early,
+ *	against what follows it.  They shouldn't take the same word.
+ *	syntax_check() gives the word to the first part, and
+ *	completion only follows that part.
+ */
+static int syntax_lint_follow(const cli_syntax_t *first, const cli_syntax_t *next)
 {
-	cli_syntax_t *this;
+	int i, j, warnings;
+	char buffer[8192];
+	syntax_words_t words[2];
+	syntax_memo_t seen;
 
-	this = syntax_alloc(CLI_TYPE_FORCE_EXACT, (void *) help, NULL);
-	assert(this != NULL);
-	this->length = flag; /* internal flag... */
+	memset(words, 0, sizeof(words));
 
-	this = syntax_alloc(CLI_TYPE_CONCAT, last, this);
-	assert(this != NULL);
+	syntax_memo_init(&seen);
+	(void) syntax_words_more(&words[0], &seen, first);
+	if ((first->first_flags & FIRST_EMPTY) != 0) {
+		(void) syntax_words_add(&words[0], &seen, first);
+	}
+	syntax_memo_free(&seen);
 
-	if (!*phead) {
-		*phead = this;
-	} else {
-		cli_syntax_t *a;
-		
-		a = syntax_alternate(*phead, this);
-		assert(a != NULL);
-		
-		*phead = a;
+	if (words[0].num_words > 0) {
+		syntax_memo_init(&seen);
+		(void) syntax_words_add(&words[1], &seen, next);
+		syntax_memo_free(&seen);
 	}
-}
 
+	warnings = 0;
+	for (i = 0; (i < words[0].num_words) && !warnings; i++) {
+		for (j = 0; j < words[1].num_words; j++) {
+			if (!syntax_words_equal(words[0].words[i], words[1].words[j])) continue;
+
+			recli_fprintf(recli_stderr, "Warning: optional part and what follows both start with \"%s\":\n",
+				      (char *) words[0].words[i]->first);
+			syntax_sprintf(buffer, sizeof(buffer), first, CLI_TYPE_EXACT);
+			recli_fprintf(recli_stderr, "\t%s\n", buffer);
+			syntax_sprintf(buffer, sizeof(buffer), next, CLI_TYPE_EXACT);
+			recli_fprintf(recli_stderr, "\t%s\n", buffer);
+			warnings++;
+			break;
+		}
+	}
 
-/*
- *	Parse a simplified Markdown "help" file into a syntax.
- */
-int syntax_parse_help(const char *filename, cli_syntax_t **plong, cli_syntax_t **pshort)
-{
-	int lineno, done;
-	FILE *fp;
-	char buffer[1024];
-	char *h, help[8192];
-	cli_syntax_t *this, *last;
-	cli_syntax_t *long_syntax, *short_syntax;
+	free(words[0].words);
+	free(words[1].words);
 
-	if (!plong || !pshort) return -1;
+	return warnings;
+}
 
-	fp = fopen(filename, "r");
-	if (!fp) {
-		recli_fprintf(recli_stderr, "Failed opening %s: %s\n",
-			filename, strerror(errno));
-		return -1;
-	}
+static int syntax_lint_walk(syntax_memo_t *seen, const cli_syntax_t *this, int tail)
+{
+	int warnings = 0;
 
-	done = lineno = 0;
-	last = long_syntax = short_syntax = NULL;
-	h = NULL;
+	if (syntax_memo_find(seen, this, tail)) return 0;
+	syntax_memo_add(seen, this, tail, 0, NULL, 0);
 
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-		size_t len;
-		char *p;
-		char *q;
+	switch (this->type) {
+	case CLI_TYPE_OPTIONAL:
+	case CLI_TYPE_PLUS:
+		warnings += syntax_lint_walk(seen, this->first, 0);
+		break;
 
-		lineno++;
-		p = buffer;
-		
-#ifdef USE_UTF8
-		if (!utf8_strvalid(p)) {
-			recli_fprintf(recli_stderr, "%s line %d: Invalid UTF-8 character in input \n",
-				       filename, lineno);
-			syntax_free(head);
-			if (last) syntax_free(last);
-			fclose(fp);
-			return -1;
-		}
-#endif
+	case CLI_TYPE_CONCAT:
+		warnings += syntax_lint_follow(this->first, this->next);
+
+		warnings += syntax_lint_walk(seen, this->first, 0);
+		warnings += syntax_lint_walk(seen, this->next, 0);
+		break;
 
+	case CLI_TYPE_ALTERNATE:
 		/*
-		 *	Had previous command and help text.  Add it in.
+		 *	Check each alternation once, from the top.
 		 */
-		if ((*p == '#') && last) {
-		do_last:
-			if (!h) goto error;
+		if (!tail) warnings += syntax_lint_alternate(this);
 
-			h = help;
-			while (isspace((int) *h)) h++;
-			if (*h) {
-				add_help(&long_syntax, last, help, 1);
-			} else {
-				syntax_free(last);
-			}
-			last = NULL;
-			h = NULL;
-			if (done) break;
-		}
+		warnings += syntax_lint_walk(seen, this->first, 0);
+		warnings += syntax_lint_walk(seen, this->next, 1);
+		break;
 
-		if (*p == '#') {
-			assert(last == NULL);
-			assert(h == NULL);
+	default:
+		break;
+	}
 
-			while (*p == '#') p++;
-			q = p;
+	return warnings;
+}
 
-			p = strchr(q, '\r');
-			if (p) *p = '\0';
-			
-			p = strchr(q, '\n');
-			if (p) *p = '\0';
-			
-			while (isspace((int) *q)) q++;
-			if (!*q) goto error;
+/*
+ *	Look for problems in a syntax, using the FIRST sets.  The
+ *	warnings are printed to stderr.
+ *
+ *	Returns the number of warnings.
+ */
+int syntax_lint(cli_syntax_t *head)
+{
+	int warnings;
+	syntax_memo_t seen;
 
-			p = q;
-			while (*p) {
-				if ((*p == '(') || (*p == '|') || (*p == ')') ||
-				    (*p == '[') || (*p == ']')) goto error;
-				p++;
-			}
+	if (!head) return 0;
 
-			if (!str2syntax((const char **)&q, &this, CLI_TYPE_EXACT)) {
-			error:
-				recli_fprintf(recli_stderr, "%s line %d: Invalid syntax \"%s\"\n",
-					filename, lineno, buffer);
-				syntax_free(long_syntax);
-				syntax_free(short_syntax);
-				if (last) syntax_free(last);
-				fclose(fp);
-				return -1;
-			}
+	syntax_first(head);
 
-			assert(this != NULL);
+	syntax_memo_init(&seen);
+	warnings = syntax_lint_walk(&seen, head, 0);
+	syntax_memo_free(&seen);
 
-			last = this;
-			h = help;
-			*h = '\0';
-			continue;
-		}
+	return warnings;
+}
 
-		p = strchr(buffer, '\r');
-		if (p) *p = '\0';
-		p = strchr(buffer, '\n');
-		if (p) *p = '\0';
 
-		if ((p == buffer) && !*p) continue; /* skip leading blank lines */
+/*
+ *	Match as many words as possible.  The number of words which
+ *	matched is returned in "pmatch".
+ */
+static cli_syntax_t *syntax_match_prefix(cli_syntax_t *head, int argc, char *argv[],
+					 int *pmatch)
+{
+	int i, match;
+	cli_syntax_t *this, *next;
+	cli_syntax_t *a;
 
-		if (last && (strncmp(buffer, "    ", 4) == 0)) {
-			last->refcount++;
-			add_help(&short_syntax, last, buffer + 4, 2);
-			continue;
-		}
+	*pmatch = 0;
 
-		len = strlen(buffer);
-		if (len > sizeof(buffer) - 3) goto too_long;
+	if (!head) return NULL;	/* no syntax checking */
 
-		strcat(buffer, "\r\n");
-		len += 2;
+	this = head;
+	syntax_incref(this);
+	match = 0;
 
-		if ((h + len) >= (help + sizeof(help))) {
-		too_long:
-			recli_fprintf(recli_stderr, "%s line %d: Too much help text\n",
-				filename, lineno);
-			syntax_free(long_syntax);
-			syntax_free(short_syntax);
-			if (last) syntax_free(last);
-			return -1;
-		}
+	if (argc == 0) return this;
 
-		memcpy(h, buffer, len);
-		h += len;
-		*h = '\0';
+	while (this && (match < argc)) {
+		COUNT(matches);
+		next = syntax_match_word(argv[match], CLI_MATCH_EXACT,
+					 this, NULL);
+		if (!next) break;
+
+		syntax_free(this);
+
+		this = syntax_skip_prefix(next, 1);
+
+		assert(this != next);
+		syntax_free(next);
+		match++;
 	}
 
-	if (last) {
-		assert(done == 0);
-		done = 1;
-		goto do_last;
+	if (match == 0) {
+		syntax_free(this);
+		return NULL;
 	}
 
-	fclose(fp);
+	next = this;
+	for (i = match - 1; i >= 0; i--) {
+		a = syntax_alloc(CLI_TYPE_FORCE_EXACT, argv[i], NULL); /* don't do case checking */
+		assert(a != NULL);
 
-	*plong = long_syntax;
-	*pshort = short_syntax;
-       
+		this = syntax_alloc(CLI_TYPE_CONCAT, a, next);
+		assert(this != NULL);
+		next = this;
+	}
 
-	return 0;
+	*pmatch = match;
+	return this;
+}
+
+cli_syntax_t *syntax_match_max(cli_syntax_t *head, int argc, char *argv[])
+{
+	int match;
+
+	return syntax_match_prefix(head, argc, argv, &match);
+}
+
+
+#ifndef NDEBUG
+void syntax_debug(const char *msg, cli_syntax_t *this)
+{
+	recli_fprintf(recli_stdout, "%s ", msg);
+	syntax_printf(this);
+	recli_fprintf(recli_stdout, "\r\n");
+}
+#endif
+
+
+int syntax_tab_complete(cli_syntax_t *head, const char *in, size_t len,
+			int max_tabs, char *tabs[])
+{
+	int i, argc, match, exact;
+	size_t out;
+	cli_syntax_t *this, *next;
+	char *argv[256];
+	char *word;
+	char *p, buffer[256];
+	char mybuf[1024];
+
+	if (!head) return 0;	/* no syntax checking */
+
+	if (sizeof(mybuf) < len + 1) return 0;	/* don't overflow */
+
+	memcpy(mybuf, in, len + 1);
+	argc = str2argv(mybuf, len, 256, argv);
+	if (argc < 0) return 0;
+
+	this = head;
+	syntax_incref(this);	/* so we can free it later */
+
+	match = 0;
+	exact = CLI_MATCH_EXACT;
+
+	while (this && (match < argc)) {
+		/*
+		 *	Check if any ONE word matches.
+		 */
+		COUNT(matches);
+		next = syntax_match_word(argv[match], exact, this, NULL);
+		if (!next && ((match + 1) == argc)) {
+			COUNT(matches);
+			exact = CLI_MATCH_PREFIX;
+			next = syntax_match_word(argv[match], exact, this, NULL);
+		}
+
+		if (!next) {
+			syntax_free(this);
+			return 0;
+		}
+
+		if (exact != CLI_MATCH_EXACT) {
+			syntax_free(next);
+			next = NULL;
+			break;
+		}
+
+		syntax_free(this);
+
+		this = syntax_skip_prefix(next, 1);
+		assert(this != next);
+		syntax_free(next);
+		next = NULL;
+		match++;
+	}
+
+	out = 0;
+	p = buffer;
+	match = argc;
+
+	if (this && (exact == CLI_MATCH_PREFIX)) {
+		match--;
+
+		word = strdup(argv[match]);
+	} else {
+		word = NULL;
+	}
+
+	for (i = 0; i < match; i++) {
+		out = snprintf(p, buffer + sizeof(buffer) - p, "%s ", argv[i]);
+		p += out;
+	}
+
+	if (!this) return 0;
+
+	COUNT(prefixes);
+	argc = syntax_prefix_words(256, argv, word, exact, this, NULL);
+	if (argc > max_tabs) argc = max_tabs;
+
+	for (i = 0; i < argc; i++) {
+		assert(argv[i] != NULL);
+		strcpy(p, argv[i]);
+		strcat(p, " ");
+		tabs[i] = strdup(buffer);
+	}
+
+	syntax_free(this);
+	free(word);
+
+	return argc;
+}
+
+
+/*
+ *	Add one line of syntax to *phead.  On error, *phead is left
+ *	alone, and it's up to the caller to keep it or free it.  The
+ *	plugins are merged one after another into the same head, and
+ *	one which prints bad syntax mustn't take the others with it.
+ */
+int syntax_merge(cli_syntax_t **phead, char *str)
+{
+	char *p;
+	const char *q;
+	cli_syntax_t *this, *a;
+
+	if (!phead || !str) {
+		syntax_error(str, "Invalid parameter");
+		return -1;
+	}
+
+	p = strchr(str, '\r');
+	if (p) *p = '\0';
+	
+	p = strchr(str, '\n');
+	if (p) *p = '\0';
+	
+	p = str;
+	while (isspace((int) *p)) p++;
+	if (!*p) return 0;
+	
+	q = p;
+	
+#ifdef USE_UTF8
+	if (!utf8_strvalid(p)) {
+		syntax_error(p, "Invalid UTF-8 character");
+		return -1;
+	}
+#endif
+
+	if (!str2syntax(&q, &this, CLI_TYPE_EXACT)) {
+		return -1;
+	}
+
+	if (!this) return 0;
+	
+	if (!*phead) {
+#if DEBUG_PRINT
+		printf("{ ");
+		syntax_printf(this);
+		printf(" } SET\n");
+#endif
+		*phead = this;
+		return 0;
+	}
+
+#if DEBUG_PRINT
+	printf("{ ");
+	syntax_printf(*phead);
+	printf(" } MERGE { ");
+	syntax_printf(this);
+	printf(" }\n");
+#endif
+
+	/*
+	 *	syntax_alternate() frees both on error.
+	 */
+	a = syntax_alternate(syntax_incref(*phead), this);
+	if (!a) {
+		if (!syntax_error_string) {
+			syntax_error(str, "Syntax is incompatible with previous commands");
+		} else {
+			syntax_error_ptr = str;
+		}
+		return -1;
+	}
+
+	syntax_free(*phead);
+	*phead = a;
+	return 0;
+}
+
+static const char *spaces = "                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                ";
+
+/*
+ *	Parse a file into a syntax, ignoring blank lines and comments.
+ *	On error, the lines merged so far are freed, and *phead isn't
+ *	changed.
+ */
+int syntax_parse_file(const char *filename, cli_syntax_t **phead)
+{
+	char *buffer;
+	size_t len;
+	recli_input_t input;
+	cli_syntax_t *head;
+
+	if (!phead) {
+		recli_fprintf(recli_stderr, "Reading syntax: internal error\n");
+		return -1;
+	}
+
+	if (!*phead) {
+		recli_datatypes_init();
+	}
+
+	if (recli_input_open(&input, filename) < 0) {
+		recli_fprintf(recli_stderr, "Failed opening %s: %s\n",
+			filename, strerror(errno));
+		return -1;
+	}
+
+	head = NULL;
+
+	while ((buffer = recli_input_line(&input, &len)) != NULL) {
+		if (syntax_merge(&head, buffer) < 0) {
+			if ((syntax_error_ptr >= buffer) &&
+			    (syntax_error_ptr <= (buffer + len))) {
+				recli_fprintf(recli_stderr, "%s\n", buffer);
+				recli_fprintf(recli_stderr, "%*s^\n",
+					      (int) (syntax_error_ptr - buffer), "");
+			}
+			recli_fprintf(recli_stderr, "ERROR in %s line %d: %s\n",
+				      filename, input.lineno, syntax_error_string);
+			recli_input_free(&input);
+			syntax_free(head);
+			return -1;
+		}
+	}
+
+	recli_input_free(&input);
+
+	if (0) {
+		syntax_walk_all(head, NULL, syntax_print_pre, syntax_print_in,
+				syntax_print_post);
+	}
+
+	*phead = head;
+
+	return 0;
+}
+
+
+static void add_help(cli_syntax_t **phead, cli_syntax_t *last,
+		     const char *help, int flag)
+{
+	cli_syntax_t *this;
+
+	this = syntax_alloc(CLI_TYPE_FORCE_EXACT, (void *) help, NULL);
+	assert(this != NULL);
+	this->length = flag; /* internal flag... */
+
+	this = syntax_alloc(CLI_TYPE_CONCAT, last, this);
+	assert(this != NULL);
+
+	if (!*phead) {
+		*phead = this;
+	} else {
+		cli_syntax_t *a;
+		
+		a = syntax_alternate(*phead, this);
+		assert(a != NULL);
+		
+		*phead = a;
+	}
+}
+
+
+/*
+ *	Parse a simplified Markdown "help" file into a syntax.
+ */
+int syntax_parse_help(const char *filename, cli_syntax_t **plong, cli_syntax_t **pshort)
+{
+	int done;
+	char *buffer;
+	size_t len;
+	recli_input_t input;
+	char *h, *help;
+	size_t help_len, help_size;
+	cli_syntax_t *this, *last;
+	cli_syntax_t *long_syntax, *short_syntax;
+
+	if (!plong || !pshort) return -1;
+
+	if (recli_input_open(&input, filename) < 0) {
+		recli_fprintf(recli_stderr, "Failed opening %s: %s\n",
+			filename, strerror(errno));
+		return -1;
+	}
+
+	help_size = 8192;
+	help = malloc(help_size);
+	if (!help) {
+		recli_input_free(&input);
+		return -1;
+	}
+
+	done = 0;
+	help_len = 0;
+	last = long_syntax = short_syntax = NULL;
+	h = NULL;
+
+	while ((buffer = recli_input_line(&input, &len)) != NULL) {
+		char *p;
+		char *q;
+
+		p = buffer;
+
+#ifdef USE_UTF8
+		if (!utf8_strvalid(p)) {
+			recli_fprintf(recli_stderr, "%s line %d: Invalid UTF-8 character in input \n",
+				       filename, input.lineno);
+			goto fail;
+		}
+#endif
+
+		/*
+		 *	Had previous command and help text.  Add it in.
+		 */
+		if ((*p == '#') && last) {
+		do_last:
+			if (!h) goto error;
+
+			h = help;
+			while (isspace((int) *h)) h++;
+			if (*h) {
+				add_help(&long_syntax, last, help, 1);
+			} else {
+				syntax_free(last);
+			}
+			last = NULL;
+			h = NULL;
+			if (done) break;
+		}
+
+		if (*p == '#') {
+			assert(last == NULL);
+			assert(h == NULL);
+
+			while (*p == '#') p++;
+			q = p;
+
+			p = strchr(q, '\r');
+			if (p) *p = '\0';
+
+			while (isspace((int) *q)) q++;
+			if (!*q) goto error;
+
+			p = q;
+			while (*p) {
+				if ((*p == '(') || (*p == '|') || (*p == ')') ||
+				    (*p == '[') || (*p == ']')) goto error;
+				p++;
+			}
+
+			if (!str2syntax((const char **)&q, &this, CLI_TYPE_EXACT)) {
+			error:
+				recli_fprintf(recli_stderr, "%s line %d: Invalid syntax \"%s\"\n",
+					filename, input.lineno, buffer);
+				goto fail;
+			}
+
+			assert(this != NULL);
+
+			last = this;
+			h = help;
+			help_len = 0;
+			*help = '\0';
+			continue;
+		}
+
+		if (!len) continue; /* skip leading blank lines */
+
+		p = memchr(buffer, '\r', len);
+		if (p) {
+			*p = '\0';
+			len = p - buffer;
+		}
+
+		if (last && (strncmp(buffer, "    ", 4) == 0)) {
+			syntax_incref(last);
+			add_help(&short_syntax, last, buffer + 4, 2);
+			continue;
+		}
+
+		if (!h) continue;
+
+		/*
+		 *	Room for the line, CRLF, and the trailing NUL.
+		 */
+		if ((help_len + len + 3) > help_size) {
+			char *grown;
+
+			help_size = (help_len + len + 3) * 2;
+			grown = realloc(help, help_size);
+			if (!grown) {
+				recli_fprintf(recli_stderr, "%s line %d: Too much help text\n",
+					filename, input.lineno);
+				goto fail;
+			}
+			help = grown;
+		}
+
+		memcpy(help + help_len, buffer, len);
+		help_len += len;
+		memcpy(help + help_len, "\r\n", 3);
+		help_len += 2;
+		h = help + help_len;
+	}
+
+	if (last) {
+		assert(done == 0);
+		done = 1;
+		goto do_last;
+	}
+
+	free(help);
+	recli_input_free(&input);
+
+	*plong = long_syntax;
+	*pshort = short_syntax;
+
+	return 0;
+
+fail:
+	syntax_free(long_syntax);
+	syntax_free(short_syntax);
+	if (last) syntax_free(last);
+	free(help);
+	recli_input_free(&input);
+	return -1;
+}
+
+
+/*
+ *	Show help for a given argv[]
+ */
+const char *syntax_show_help(cli_syntax_t *head, int argc, char *argv[])
+{
+	int i, match;
+	cli_syntax_t *help, *a, *b;
+
+	if (!head || (argc < 0)) return NULL;
+
+	help = syntax_match_prefix(head, argc, argv, &match);
+	if (!help) return NULL;
+
+	/*
+	 *	There's no help for the whole command.
+	 */
+	if (match < argc) {
+		syntax_free(help);
+		return NULL;
+	}
+
+	/*
+	 *	Skip the prefix
+	 */
+	a = help;
+
+	for (i = 0; i < argc; i++) {
+		b = a->first;
+		assert(a->type == CLI_TYPE_CONCAT);
+		assert(b->type == CLI_TYPE_EXACT);
+
+		a = a->next;
+	}
+
+	while (a->type == CLI_TYPE_ALTERNATE) {
+		b = a->first;
+
+		if ((b->type == CLI_TYPE_EXACT) && (b->length == 1)) {
+			syntax_free(help);
+			return (char *) b->first;
+		}
+
+		a = a->next;
+	}
+
+	b = a;
+
+	if ((b->type == CLI_TYPE_EXACT) && (b->length == 1)) {
+		syntax_free(help);
+		return (char *) b->first;
+	}
+
+	syntax_free(help);
+
+	return NULL;
+}
+
+int syntax_print_context_help(cli_syntax_t *head, int argc, char *argv[])
+{
+	int i;
+	size_t len, bufsize;
+	cli_syntax_t *help, *a, *b;
+	char *p;
+	char buffer[1024];
+
+	if (!head || (argc < 0)) return -1;
+
+	help = syntax_match_max(head, argc, argv);
+	if (!help) return -1;
+
+	p = buffer;
+	*p = '\0';
+	bufsize = sizeof(buffer);
+
+	for (i = 0; i < argc; i++) {
+		len = snprintf(p, bufsize, "%s ", argv[i]);
+		p += len;
+		bufsize -= len;
+	}
+
+	/*
+	 *	Skip the prefix
+	 */
+	a = help;
+
+	for (i = 0; i < argc; i++) {
+		if (a->type != CLI_TYPE_CONCAT) {
+			if (i != (argc - 1)) {
+				syntax_free(help);
+				return 0;
+			}
+			break;
+		}
+
+		b = a->first;
+
+		assert(b->type == CLI_TYPE_EXACT);
+		a = a->next;
+	}
+
+	while (a->type == CLI_TYPE_ALTERNATE) {
+		b = a->first;
+
+		if ((b->type == CLI_TYPE_EXACT) && (b->length == 2)) {
+			if (!*buffer) {
+				recli_fprintf(recli_stdout, "%s\r\n\r\n",
+					      (char *) b->first);
+			} else {
+				recli_fprintf(recli_stdout, "%s- %s\r\n",
+					      buffer, (char *) b->first);
+			}
+			syntax_free(help);
+			return 1;
+		}
+
+		a = a->next;
+	}
+
+	b = a;
+
+	if ((b->type == CLI_TYPE_EXACT) && (b->length == 2)) {
+		recli_fprintf(recli_stdout, "%s- %s\r\n",
+			      buffer, (char *) b->first);
+		syntax_free(help);
+		return 1;
+	}
+
+	syntax_free(help);
+
+	return 0;
+}
+
+static int syntax_prefix_help(int argc, char *argv[], char *help_text[],
+			       cli_syntax_t *this, cli_syntax_t *next)
+{
+	int matches, total;
+	cli_syntax_t *a, *b, *c;
+
+	assert(this != NULL);
+
+	if (argc == 0) return 0;
+
+	switch (this->type) {
+	case CLI_TYPE_EXACT:
+		if (this->length != 2) {
+			argv[0] = this->first;
+			help_text[0] = NULL;
+		} else {
+			argv[0] = NULL;
+			help_text[0] = this->first;
+		}
+		return 1;
+
+	case CLI_TYPE_VARARGS:
+		argv[0] = this->first;
+		help_text[0] = NULL;
+		return 1;
+
+	case CLI_TYPE_OPTIONAL:
+		/*
+		 *	Note first that there's an empty option.
+		 */
+		argv[0] = "";
+		help_text[0] = "";
+		argc--;
+		argv++;
+		help_text++;
+		total = 1;
+
+		matches = syntax_prefix_help(argc, argv, help_text, this->first, next);
+		argc -= matches;
+		argv += matches;
+		help_text += matches;
+		total += matches;
+
+		if (!next) return total;
+
+		return total + syntax_prefix_help(argc, argv, help_text, next, NULL);
+
+	case CLI_TYPE_PLUS:
+		/*
+		 *	Count '*' and '+' as equivalent for prefix words, and always
+		 *	show one option.
+		 */
+		matches = syntax_prefix_help(argc, argv, help_text, this->first, next);
+		argc -= matches;
+		argv += matches;
+		help_text += matches;
+		total = matches;
+
+		if (!next) return total;
+
+		return total + syntax_prefix_help(argc, argv, help_text, next, NULL);
+
+	case CLI_TYPE_CONCAT:
+		a = this->first;
+		b = this->next;
+
+		c = this->next;
+		if (next) {
+			syntax_incref(c);
+			syntax_incref(next);
+			c = syntax_alloc(CLI_TYPE_CONCAT, this->next, next);
+			assert(c != this);
+		}
+
+		/*
+		 *	Catch the special case of "cmd HELP_TEXT"
+		 *
+		 *	FIXME: this is all complicated... we should switch the
+		 *	entire implementation to just fan-out tries.  The only
+		 *	reason to have the complexity of the "normal form" is for
+		 *	longest common suffix, which we no longer have.
+		 */
+		if (a->type == CLI_TYPE_EXACT) {
+			if ((b->type == CLI_TYPE_EXACT) &&
+			    (b->length == 2)) {
+				if (next) syntax_free(c);
+
+				argv[0] = a->first;
+				help_text[0] = b->first;
+				return 1;
+			}
+
+			matches = syntax_prefix_help(argc, argv, help_text, b->first, c);
+
+			/*
+			 *	Over-write anything...
+			 */
+			argv[0] = a->first;
+			matches = 1;
+		} else {
+			matches = syntax_prefix_help(argc, argv, help_text, this->first, c);
+		}
+		if (next) syntax_free(c);
+		return matches;
+
+	case CLI_TYPE_ALTERNATE:
+		total = 0;
+		while (this->type == CLI_TYPE_ALTERNATE) {
+			matches = syntax_prefix_help(argc, argv, help_text,
+						      this->first, next);
+			argc -= matches;
+			argv += matches;
+			help_text += matches;
+			total += matches;
+			this = this->next;
+		}
+		assert(this->type != CLI_TYPE_ALTERNATE);
+
+		return total + syntax_prefix_help(argc, argv, help_text, this, next);
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+int syntax_print_context_help_subcommands(cli_syntax_t *syntax, cli_syntax_t *head, int argc, char *argv[])
+{
+	int i, j, k, cmds_argc, help_argc;
+	cli_syntax_t *help, *cmds, *a;
+	size_t max_len;
+	char *cmds_argv[256];
+	size_t cmds_len[256];
+	char *help_argv[256];
+	char *help_text[256];
+
+	if (!head || (argc < 0)) return -1;
+
+	/*
+	 *	Try to find the help.  If there is none, print the
+	 *	syntax at the current point.
+	 */
+	help = syntax_match_max(head, argc, argv);
+	cmds = syntax_match_max(syntax, argc, argv);
+
+	if (!help && !cmds) return -1;
+
+	cmds_argc = 0;
+	if (cmds) {
+		a = syntax_skip_prefix(cmds, argc);
+		syntax_free(cmds);
+		cmds = a;
+
+		memset(cmds_argv, 0, sizeof(cmds_argv));
+		if (cmds) {
+			COUNT(prefixes);
+			cmds_argc = syntax_prefix_words(256, cmds_argv, NULL, CLI_MATCH_EXACT, cmds, NULL);
+		}
+	}
+
+	help_argc = 0;
+	if (help) {
+		a = syntax_skip_prefix(help, argc);
+		syntax_free(help);
+		help = a;
+
+		memset(help_argv, 0, sizeof(help_argv));
+		if (help) help_argc = syntax_prefix_help(256, help_argv, help_text, help, NULL);
+	}
+
+	k = 0;
+
+#if 0
+	printf("CMDS %d\r\n", cmds_argc);
+	for (i = 0; i < cmds_argc; i++) {
+		printf("%d - %s\r\n", i, cmds_argv[i]);
+	}
+
+	printf("HELP %d\r\n", help_argc);
+	for (i = 0; i < help_argc; i++) {
+		printf("%d - %s\r\n", i, help_argv[i]);
+	}
+
+	for (i = 0; i < help_argc; i++) {
+		printf("%d - %s\r\n", i, help_text[i]);
+	}
+#endif
+
+	max_len = 0;
+	for (i = 0; i < cmds_argc; i++) {
+		if (!cmds_argv[i]) {
+			cmds_len[i] = 0;
+			continue;
+		}
+
+		cmds_len[i] = strlen(cmds_argv[i]);
+		if (max_len < cmds_len[i]) max_len = cmds_len[i];
+	}
+	max_len += 4;
+
+	for (i = 0; i < cmds_argc; i++) {
+		if (!cmds_argv[i]) continue;
+
+		if (argc > 0) recli_fprintf(recli_stdout, "... ");
+
+		for (j = k; j < help_argc; j++) {
+			if (!help_argv[j]) continue; /* e.g. "show" versus "show subscriber" */
+
+			if ((strcmp(cmds_argv[i], help_argv[j]) == 0) && help_text[j]) {
+				recli_fprintf(recli_stdout, "%s%.*s%s\r\n", cmds_argv[i],
+					      (int) max_len - cmds_len[i], spaces, help_text[j]);
+				k++;
+				break;
+			}
+		}
+
+		/*
+		 *	No help, just print out the command.
+		 *
+		 *	FIXME: print out automatic help for built-in data types.
+		 */
+		if (j == help_argc) {
+			if (!*cmds_argv[i]) cmds_argv[i] = "<cr>";
+
+			recli_fprintf(recli_stdout, "%s\r\n", cmds_argv[i]);
+		}
+	}
+
+	if (help) syntax_free(help);
+	if (cmds) syntax_free(cmds);
+
+	return 0;
+}
+
+
+/*
+ *	Map nodes to their index in the compiled output.
+ */
+typedef struct syntax_index_t {
+	int			num_nodes;
+	int			size;
+	const cli_syntax_t	**keys;
+	int			*values;
+	const cli_syntax_t	**nodes;	/* in dependency order */
+} syntax_index_t;
+
+static int syntax_index_find(syntax_index_t *idx, const cli_syntax_t *this)
+{
+	uint32_t i;
+
+	for (i = this->hash & (idx->size - 1);
+	     idx->keys[i] != NULL;
+	     i = (i + 1) & (idx->size - 1)) {
+		if (idx->keys[i] == this) return idx->values[i];
+	}
+
+	return -1;
+}
+
+/*
+ *	Add a node and all of its children, children first.
+ */
+static int syntax_index_add(syntax_index_t *idx, const cli_syntax_t *this)
+{
+	uint32_t i;
+	int rcode;
+
+	rcode = syntax_index_find(idx, this);
+	if (rcode >= 0) return rcode;
+
+	switch (this->type) {
+	case CLI_TYPE_OPTIONAL:
+	case CLI_TYPE_PLUS:
+		if (syntax_index_add(idx, this->first) < 0) return -1;
+		break;
+
+	case CLI_TYPE_CONCAT:
+	case CLI_TYPE_ALTERNATE:
+		if (syntax_index_add(idx, this->first) < 0) return -1;
+		if (syntax_index_add(idx, this->next) < 0) return -1;
+		break;
+
+	case CLI_TYPE_EXACT:
+	case CLI_TYPE_VARARGS:
+		break;
+
+	default:
+		return -1;
+	}
+
+	if (idx->num_nodes >= (idx->size / 2)) return -1;
+
+	for (i = this->hash & (idx->size - 1);
+	     idx->keys[i] != NULL;
+	     i = (i + 1) & (idx->size - 1)) {
+		/* nothing */
+	}
+
+	idx->keys[i] = this;
+	idx->values[i] = idx->num_nodes;
+	idx->nodes[idx->num_nodes] = this;
+
+	return idx->num_nodes++;
+}
+
+/*
+ *	Find the data type for a node, or -1 for a normal word.
+ */
+static int syntax_datatype(const cli_syntax_t *this)
+{
+	int i;
+
+	if ((this->type != CLI_TYPE_EXACT) || !this->next) return -1;
+
+	for (i = 0; recli_datatypes[i].name != NULL; i++) {
+		if (recli_datatypes[i].parse == (recli_datatype_parse_t) this->next) {
+			return i;
+		}
+	}
+
+	return -2;
+}
+
+/*
+ *	Write out the code which matches one node.  It mirrors
+ *	syntax_check(), with the graph turned into direct calls.
+ */
+static void syntax_compile_match(FILE *fp, syntax_index_t *idx, int i)
+{
+	int dt;
+	const cli_syntax_t *this = idx->nodes[i];
+
+	/*
+	 *	Words and data types don't always use all of the
+	 *	arguments.  The nodes which recurse are wrapped in a
+	 *	function which checks the FIRST set and the memo table
+	 *	first, as in syntax_check_memo().
+	 */
+	if ((this->type == CLI_TYPE_EXACT) || (this->type == CLI_TYPE_VARARGS)) {
+		fprintf(fp, "static int match_%d(syntax_memo_t *memo UNUSED, int argc, char *argv[]%s, const char **error, int *flags%s)\n{\n",
+			i, (this->type == CLI_TYPE_VARARGS) ? " UNUSED" : "",
+			((this->type == CLI_TYPE_VARARGS) ||
+			 (this->next != NULL) ||
+			 ((this->min & FLAGS_EXPORT) == 0)) ? " UNUSED" : "");
+	} else {
+		fprintf(fp, "static int check_%d(syntax_memo_t *memo, int argc, char *argv[], const char **error, int *flags)\n{\n", i);
+	}
+
+	switch (this->type) {
+	case CLI_TYPE_EXACT:
+		fprintf(fp, "\t*error = NULL;\n");
+		fprintf(fp, "\tif (argc == 0) return 1;\n\n");
+
+		dt = syntax_datatype(this);
+		if (dt >= 0) {
+			fprintf(fp, "\tif (recli_datatypes[%d].parse(argv[0], error)) return 1; /* %s */\n\n",
+				dt, (char *) this->first);
+			fprintf(fp, "\tif (!*error) *error = \"Input does not match required syntax\";\n");
+			fprintf(fp, "\treturn -1;\n");
+			break;
+		}
+
+		if ((this->min & FLAG_CASE_INSENSITIVE) != 0) {
+			fprintf(fp, "\tif (strcasecmp(argv[0], ");
+		} else {
+			fprintf(fp, "\tif (strcmp(argv[0], ");
+		}
+		fprint_cstring(fp, this->first);
+		fprintf(fp, ") == 0) {\n");
+		if ((this->min & FLAGS_EXPORT) != 0) {
+			fprintf(fp, "\t\tif (flags) *flags |= %d;\n", this->min & FLAGS_EXPORT);
+		}
+		fprintf(fp, "\t\treturn 1;\n\t}\n\n");
+		fprintf(fp, "\t*error = \"No matching command\";\n");
+		fprintf(fp, "\treturn -1;\n");
+		break;
+
+	case CLI_TYPE_VARARGS:
+		fprintf(fp, "\t*error = NULL;\n");
+		fprintf(fp, "\tif (argc == 0) return 1;\n\n");
+		fprintf(fp, "\treturn argc;\n");
+		break;
+
+	case CLI_TYPE_OPTIONAL:
+		fprintf(fp, "\tint words;\n\n");
+		fprintf(fp, "\t*error = NULL;\n");
+		fprintf(fp, "\tif (!argc) return 0;\n\n");
+		fprintf(fp, "\twords = match_%d(memo, argc, argv, error, flags);\n",
+			syntax_index_find(idx, this->first));
+		fprintf(fp, "\tif (words < 0) return 0;\n");
+		fprintf(fp, "\treturn words;\n");
+		break;
+
+	case CLI_TYPE_PLUS:
+		fprintf(fp, "\tint words, total;\n\n");
+		fprintf(fp, "\t*error = NULL;\n");
+		if (this->min == 1) {
+			fprintf(fp, "\twords = match_%d(memo, argc, argv, error, flags);\n",
+				syntax_index_find(idx, this->first));
+			fprintf(fp, "\tif (words <= 0) return words;\n");
+			fprintf(fp, "\tif (words > argc) return words;\n\n");
+			fprintf(fp, "\targc -= words;\n\targv += words;\n\ttotal = words;\n\n");
+		} else {
+			fprintf(fp, "\ttotal = 0;\n");
+			fprintf(fp, "\tif (!argc) return 0;\n\n");
+		}
+		fprintf(fp, "\twhile (argc > 0) {\n");
+		fprintf(fp, "\t\twords = match_%d(memo, argc, argv, error, flags);\n",
+			syntax_index_find(idx, this->first));
+		fprintf(fp, "\t\tif (words <= 0) break;\n");
+		fprintf(fp, "\t\tif (words > argc) return total + words;\n\n");
+		fprintf(fp, "\t\targc -= words;\n\t\targv += words;\n\t\ttotal += words;\n\t}\n\n");
+		fprintf(fp, "\treturn total;\n");
+		break;
+
+	case CLI_TYPE_CONCAT:
+		fprintf(fp, "\tint words, total;\n\n");
+		fprintf(fp, "\twords = match_%d(memo, argc, argv, error, flags);\n",
+			syntax_index_find(idx, this->first));
+		fprintf(fp, "\tif (words < 0) return words;\n");
+		fprintf(fp, "\tif (words > argc) return words;\n\n");
+		fprintf(fp, "\targc -= words;\n\targv += words;\n\ttotal = words;\n\n");
+		fprintf(fp, "\twords = match_%d(memo, argc, argv, error, flags);\n",
+			syntax_index_find(idx, this->next));
+		fprintf(fp, "\tif (words < 0) return words - total;\n");
+		fprintf(fp, "\tif (words > argc) return total + words;\n\n");
+		fprintf(fp, "\treturn total + words;\n");
+		break;
+
+	case CLI_TYPE_ALTERNATE:
+		fprintf(fp, "\tint words, total;\n");
+		fprintf(fp, "\tconst char *alt_error = NULL;\n\n");
+		fprintf(fp, "\twords = match_%d(memo, argc, argv, &alt_error, flags);\n",
+			syntax_index_find(idx, this->first));
+		fprintf(fp, "\tif (words > 0) {\n");
+		fprintf(fp, "\t\tif ((words > argc) && (match_%d(memo, argc, argv, &alt_error, flags) == argc)) return argc;\n",
+			syntax_index_find(idx, this->next));
+		fprintf(fp, "\t\treturn words;\n");
+		fprintf(fp, "\t}\n");
+		fprintf(fp, "\tif ((argc == 0) && (words == 0)) return 0;\n\n");
+		fprintf(fp, "\ttotal = match_%d(memo, argc, argv, error, flags);\n",
+			syntax_index_find(idx, this->next));
+		fprintf(fp, "\tif (total >= 0) return total;\n");
+		fprintf(fp, "\tif (words == 0) {\n");
+		fprintf(fp, "\t\t*error = NULL;\n");
+		fprintf(fp, "\t\treturn 0;\n");
+		fprintf(fp, "\t}\n");
+		fprintf(fp, "\tif (total < words) return total;\n\n");
+		fprintf(fp, "\t*error = alt_error;\n");
+		fprintf(fp, "\treturn words;\n");
+		break;
+
+	default:
+		fprintf(fp, "\t*error = \"Internal sanity check failed\";\n");
+		fprintf(fp, "\treturn -1;\n");
+		break;
+	}
+
+	fprintf(fp, "}\n\n");
+
+	if ((this->type == CLI_TYPE_EXACT) || (this->type == CLI_TYPE_VARARGS)) return;
+
+	fprintf(fp, "static int match_%d(syntax_memo_t *memo, int argc, char *argv[], const char **error, int *flags)\n{\n", i);
+	fprintf(fp, "\tint words, found;\n");
+	fprintf(fp, "\tconst syntax_memo_entry_t *e;\n\n");
+	if ((this->first_flags & (FIRST_DONE | FIRST_EMPTY | FIRST_ANY)) == FIRST_DONE) {
+		fprintf(fp, "\tif ((argc > 0) &&\n\t    ((syntax_memo_word(memo, argv[0]) & 0x%llxULL) == 0)) {\n",
+			(unsigned long long) this->first_words);
+		fprintf(fp, "\t\t*error = \"No matching command\";\n");
+		fprintf(fp, "\t\treturn -1;\n\t}\n\n");
+	}
+	fprintf(fp, "\te = syntax_memo_find(memo, &recli_static_nodes[%d], argc);\n", i);
+	fprintf(fp, "\tif (e) {\n");
+	fprintf(fp, "\t\t*error = e->error;\n");
+	fprintf(fp, "\t\tif (flags) *flags |= e->flags;\n");
+	fprintf(fp, "\t\treturn e->words;\n");
+	fprintf(fp, "\t}\n\n");
+	fprintf(fp, "\tfound = 0;\n");
+	fprintf(fp, "\twords = check_%d(memo, argc, argv, error, &found);\n", i);
+	fprintf(fp, "\tsyntax_memo_add(memo, &recli_static_nodes[%d], argc, words, *error, found);\n\n", i);
+	fprintf(fp, "\tif (flags) *flags |= found;\n");
+	fprintf(fp, "\treturn words;\n");
+	fprintf(fp, "}\n\n");
 }
 
-
 /*
- *	Show help for a given argv[]
+ *	Write the syntax and help out as C source.  The nodes go into
+ *	a const table, and the syntax also gets a matcher function.
+ *	"roots" gets the index of the syntax, long help and short help.
+ *
+ *	Returns the number of nodes, or -1 on error.
  */
-const char *syntax_show_help(cli_syntax_t *head, int argc, char *argv[])
+int syntax_compile(FILE *fp, cli_syntax_t *syntax,
+		   cli_syntax_t *long_help, cli_syntax_t *short_help,
+		   int *roots)
 {
-	int i;
-	cli_syntax_t *help, *a, *b;
+	int i, num_match;
+	syntax_index_t idx;
+	const cli_syntax_t *this;
 
-	if (!head || (argc < 0)) return NULL;
+	if (syntax) syntax_first(syntax);
 
-	help = syntax_match_max(head, argc, argv);
-	if (!help) return NULL;
+	memset(&idx, 0, sizeof(idx));
+	idx.size = 256;
+	while (idx.size <= (num_entries * 2)) idx.size *= 2;
+
+	idx.keys = calloc(idx.size, sizeof(idx.keys[0]));
+	idx.values = calloc(idx.size, sizeof(idx.values[0]));
+	idx.nodes = calloc(idx.size / 2, sizeof(idx.nodes[0]));
+	if (!idx.keys || !idx.values || !idx.nodes) goto fail;
 
 	/*
-	 *	Skip the prefix
+	 *	The syntax goes first, so that the matchers only have
+	 *	to be written for the nodes before "num_match".
 	 */
-	a = help;
+	roots[0] = roots[1] = roots[2] = -1;
 
-	for (i = 0; i < argc; i++) {
-		b = a->first;
-		assert(a->type == CLI_TYPE_CONCAT);
-		assert(b->type == CLI_TYPE_EXACT);
+	if (syntax && ((roots[0] = syntax_index_add(&idx, syntax)) < 0)) goto fail;
+	num_match = idx.num_nodes;
 
-		a = a->next;
+	if (long_help && ((roots[1] = syntax_index_add(&idx, long_help)) < 0)) goto fail;
+	if (short_help && ((roots[2] = syntax_index_add(&idx, short_help)) < 0)) goto fail;
+
+	for (i = 0; i < idx.num_nodes; i++) {
+		if (syntax_datatype(idx.nodes[i]) == -2) {
+			recli_fprintf(recli_stderr, "Cannot compile data type %s\n",
+				      (char *) idx.nodes[i]->first);
+			goto fail;
+		}
 	}
 
-	while (a->type == CLI_TYPE_ALTERNATE) {
-		b = a->first;
+	fprintf(fp, "static const recli_static_node_t recli_static_nodes[] = {\n");
 
-		if ((b->type == CLI_TYPE_EXACT) && (b->length == 1)) {
-			syntax_free(help);
-			return (char *) b->first;
+	for (i = 0; i < idx.num_nodes; i++) {
+		const char *suffix = "";
+
+		this = idx.nodes[i];
+
+		fprintf(fp, "\t{ %d, ", this->type);
+
+		switch (this->type) {
+		case CLI_TYPE_EXACT:
+			/*
+			 *	Flags are re-created from the suffix
+			 *	when the node is loaded.
+			 */
+			if ((this->min & FLAG_CASE_INSENSITIVE) != 0) suffix = "/i";
+			if ((this->min & FLAG_NEEDS_TTY) != 0) suffix = "/t";
+
+			fprint_cstring(fp, this->first);
+			fprintf(fp, "%s%s%s, -1, %d, 0, 0, %d },\n",
+				*suffix ? " \"" : "", suffix, *suffix ? "\"" : "",
+				syntax_datatype(this), this->length);
+			break;
+
+		case CLI_TYPE_VARARGS:
+			fprintf(fp, "\"...\", -1, -1, 0, 0, 0 },\n");
+			break;
+
+		case CLI_TYPE_OPTIONAL:
+		case CLI_TYPE_PLUS:
+			fprintf(fp, "NULL, %d, -1, %d, %d, 0 },\n",
+				syntax_index_find(&idx, this->first),
+				this->min, this->max);
+			break;
+
+		default:
+			fprintf(fp, "NULL, %d, %d, 0, 0, 0 },\n",
+				syntax_index_find(&idx, this->first),
+				syntax_index_find(&idx, this->next));
+			break;
 		}
+	}
 
-		a = a->next;
+	fprintf(fp, "\t{ 0, NULL, -1, -1, 0, 0, 0 }\n};\n\n");
+
+	for (i = 0; i < num_match; i++) {
+		syntax_compile_match(fp, &idx, i);
 	}
 
-	b = a;
+	if (syntax) {
+		fprintf(fp, "static int recli_static_check(int argc, char *argv[], const char **error, int *flags)\n{\n");
+		fprintf(fp, "\tint rcode;\n");
+		fprintf(fp, "\tsyntax_memo_t memo;\n\n");
+		fprintf(fp, "\t*error = NULL;\n");
+		fprintf(fp, "\tif (argc < 0) return -1;\n\n");
+		fprintf(fp, "\tsyntax_memo_init(&memo);\n");
+		fprintf(fp, "\trcode = match_%d(&memo, argc, argv, error, flags);\n", roots[0]);
+		fprintf(fp, "\tsyntax_memo_free(&memo);\n\n");
+		fprintf(fp, "\treturn rcode;\n}\n\n");
+	}
 
-	if ((b->type == CLI_TYPE_EXACT) && (b->length == 1)) {
-		syntax_free(help);
-		return (char *) b->first;
+	free(idx.keys);
+	free(idx.values);
+	free(idx.nodes);
+	return idx.num_nodes;
+
+fail:
+	free(idx.keys);
+	free(idx.values);
+	free(idx.nodes);
+	return -1;
+}
+
+/*
+ *	Create the nodes for a compiled syntax.  There's no parsing or
+ *	merging to do, as the nodes were normalized when they were
+ *	compiled.
+ */
+int syntax_load_static(const recli_static_t *in, cli_syntax_t **psyntax,
+		       cli_syntax_t **plong, cli_syntax_t **pshort)
+{
+	int i;
+	size_t size = 0;
+	char *word = NULL;
+	cli_syntax_t **nodes, *this, *a, *b;
+
+	if (recli_datatypes_init() < 0) return -1;
+
+	nodes = calloc(in->num_nodes + 1, sizeof(nodes[0]));
+	if (!nodes) return -1;
+
+	for (i = 0; i < in->num_nodes; i++) {
+		const recli_static_node_t *n = &in->nodes[i];
+
+		a = b = NULL;
+		if (n->first >= 0) {
+			assert(n->first < i);
+			a = nodes[n->first];
+			syntax_incref(a);
+		}
+
+		if ((n->type != CLI_TYPE_EXACT) && (n->next >= 0)) {
+			assert(n->next < i);
+			b = nodes[n->next];
+			syntax_incref(b);
+		}
+
+		switch (n->type) {
+		case CLI_TYPE_EXACT:
+			if (n->next >= 0) {
+				cli_syntax_t find;
+
+				/*
+				 *	The data types have to be the same
+				 *	as when the syntax was compiled.
+				 */
+				if (strcmp(recli_datatypes[n->next].name, n->name) != 0) {
+					recli_fprintf(recli_stderr, "Compiled syntax uses unknown data type %s\n",
+						      n->name);
+					goto fail;
+				}
+
+				memset(&find, 0, sizeof(find));
+				find.type = CLI_TYPE_EXACT;
+				find.first = (void *) n->name;
+				this = syntax_ref(&find);
+				break;
+			}
+
+			/*
+			 *	syntax_alloc() edits the suffix, so it
+			 *	needs a copy of the name.
+			 */
+			if (strlen(n->name) >= size) {
+				free(word);
+				size = (strlen(n->name) + 1) * 2;
+				word = malloc(size);
+				if (!word) goto fail;
+			}
+			strcpy(word, n->name);
+
+			if (n->length) {
+				this = syntax_alloc(CLI_TYPE_FORCE_EXACT, word, NULL);
+				if (this) this->length = n->length;
+			} else {
+				this = syntax_alloc(CLI_TYPE_EXACT, word, NULL);
+			}
+			break;
+
+		case CLI_TYPE_VARARGS:
+			this = syntax_alloc(CLI_TYPE_VARARGS, (void *) "...", NULL);
+			break;
+
+		case CLI_TYPE_PLUS:
+			this = syntax_alloc_min(CLI_TYPE_PLUS, a, NULL, n->min);
+			break;
+
+		case CLI_TYPE_OPTIONAL:
+		case CLI_TYPE_CONCAT:
+		case CLI_TYPE_ALTERNATE:
+			this = syntax_alloc(n->type, a, b);
+			break;
+
+		default:
+			this = NULL;
+			break;
+		}
+
+		if (!this) {
+			recli_fprintf(recli_stderr, "Failed creating compiled syntax node %d\n", i);
+			goto fail;
+		}
+
+		nodes[i] = this;
 	}
 
-	syntax_free(help);
+	if (in->syntax >= 0) {
+		*psyntax = nodes[in->syntax];
+		syntax_incref(*psyntax);
+
+		if (in->check) {
+			static_root = *psyntax;
+			static_check = in->check;
+		}
+	}
+
+	if (in->long_help >= 0) {
+		*plong = nodes[in->long_help];
+		syntax_incref(*plong);
+	}
+
+	if (in->short_help >= 0) {
+		*pshort = nodes[in->short_help];
+		syntax_incref(*pshort);
+	}
+
+	for (i = 0; i < in->num_nodes; i++) syntax_free(nodes[i]);
+	free(nodes);
+	free(word);
+	return 0;
+
+fail:
+	while (--i >= 0) syntax_free(nodes[i]);
+	free(nodes);
+	free(word);
+	return -1;
+}
+
+
+/*
+ *	The packed image of a syntax, or NULL if it hasn't been packed.
+ */
+const syntax_image_t *syntax_image(const cli_syntax_t *head)
+{
+	const syntax_image_t *img;
+
+	for (img = images; img != NULL; img = img->next_image) {
+		if (img->root == head) return img;
+	}
 
 	return NULL;
 }
 
-int syntax_print_context_help(cli_syntax_t *head, int argc, char *argv[])
+static void syntax_image_free(syntax_image_t *img)
 {
-	int i;
-	size_t len, bufsize;
-	cli_syntax_t *help, *a, *b;
-	char *p;
-	char buffer[1024];
+	if (!img) return;
+
+	free(img->type);
+	free(img->flags);
+	free(img->first);
+	free(img->next);
+	free(img->first_words);
+	free(img->strings);
+	free(img->types);
+	free(img);
+}
 
-	if (!head || (argc < 0)) return -1;
+/*
+ *	Pack a syntax into arrays, so that syntax_check() doesn't have
+ *	to chase pointers through the nodes.  The syntax is frozen
+ *	first.  The image is freed when syntax_collect() frees the
+ *	syntax, so an old syntax which is still in use keeps its image.
+ */
+int syntax_pack(cli_syntax_t *head)
+{
+	int i, num_types;
+	size_t len, used;
+	syntax_index_t idx;
+	syntax_image_t *img;
+	const cli_syntax_t *this;
 
-	help = syntax_match_max(head, argc, argv);
-	if (!help) return -1;
+	if (!head) return 0;
 
-	p = buffer;
-	*p = '\0';
-	bufsize = sizeof(buffer);
+	if (syntax_image(head)) return 0;
 
-	for (i = 0; i < argc; i++) {
-		len = snprintf(p, bufsize, "%s ", argv[i]);
-		p += len;
-		bufsize -= len;
+	syntax_freeze(head);
+
+	memset(&idx, 0, sizeof(idx));
+	idx.size = 256;
+	while (idx.size <= (num_entries * 2)) idx.size *= 2;
+
+	img = calloc(1, sizeof(*img));
+	idx.keys = calloc(idx.size, sizeof(idx.keys[0]));
+	idx.values = calloc(idx.size, sizeof(idx.values[0]));
+	idx.nodes = calloc(idx.size / 2, sizeof(idx.nodes[0]));
+	if (!img || !idx.keys || !idx.values || !idx.nodes) goto fail;
+
+	if (syntax_index_add(&idx, head) < 0) goto fail;
+
+	len = 0;
+	for (i = 0; i < idx.num_nodes; i++) {
+		this = idx.nodes[i];
+
+		if ((this->type == CLI_TYPE_EXACT) && !this->next) {
+			len += strlen(this->first) + 1;
+		}
 	}
 
-	/*
-	 *	Skip the prefix
-	 */
-	a = help;
+	img->root = head;
+	img->num_nodes = idx.num_nodes;
+	img->type = malloc(idx.num_nodes * sizeof(img->type[0]));
+	img->flags = malloc(idx.num_nodes * sizeof(img->flags[0]));
+	img->first = malloc(idx.num_nodes * sizeof(img->first[0]));
+	img->next = malloc(idx.num_nodes * sizeof(img->next[0]));
+	img->first_words = malloc(idx.num_nodes * sizeof(img->first_words[0]));
+	img->strings = malloc(len + 1);
+	img->types = malloc(idx.num_nodes * sizeof(img->types[0]));
+	if (!img->type || !img->flags || !img->first || !img->next ||
+	    !img->first_words || !img->strings || !img->types) goto fail;
+
+	used = 0;
+	num_types = 0;
+	for (i = 0; i < idx.num_nodes; i++) {
+		this = idx.nodes[i];
+
+		img->type[i] = this->type;
+		img->flags[i] = 0;
+		img->first[i] = 0;
+		img->next[i] = 0;
+		img->first_words[i] = this->first_words;
+
+		if ((this->first_flags & (FIRST_DONE | FIRST_EMPTY | FIRST_ANY)) == FIRST_DONE) {
+			img->flags[i] |= IMAGE_SKIP;
+		}
 
-	for (i = 0; i < argc; i++) {
-		if (a->type != CLI_TYPE_CONCAT) {
-			if (i != (argc - 1)) {
-				syntax_free(help);
-				return 0;
+		switch (this->type) {
+		case CLI_TYPE_EXACT:
+			img->flags[i] |= this->min & (FLAG_NEEDS_TTY | FLAG_CASE_INSENSITIVE);
+
+			if (this->next) {
+				int j;
+
+				for (j = 0; j < num_types; j++) {
+					if (img->types[j] == (recli_datatype_parse_t) this->next) break;
+				}
+				if (j == num_types) img->types[num_types++] = (recli_datatype_parse_t) this->next;
+
+				img->flags[i] |= IMAGE_DATATYPE;
+				img->first[i] = j;
+				break;
 			}
+
+			img->first[i] = used;
+			strcpy(img->strings + used, this->first);
+			used += strlen(this->first) + 1;
 			break;
-		}
 
-		b = a->first;
+		case CLI_TYPE_OPTIONAL:
+			img->first[i] = syntax_index_find(&idx, this->first);
+			break;
 
-		assert(b->type == CLI_TYPE_EXACT);
-		a = a->next;
+		case CLI_TYPE_PLUS:
+			img->first[i] = syntax_index_find(&idx, this->first);
+			img->next[i] = this->min;
+			break;
+
+		case CLI_TYPE_CONCAT:
+		case CLI_TYPE_ALTERNATE:
+			img->first[i] = syntax_index_find(&idx, this->first);
+			img->next[i] = syntax_index_find(&idx, this->next);
+			break;
+
+		default:
+			break;
+		}
 	}
 
-	while (a->type == CLI_TYPE_ALTERNATE) {
-		b = a->first;
+	free(idx.keys);
+	free(idx.values);
+	free(idx.nodes);
 
-		if ((b->type == CLI_TYPE_EXACT) && (b->length == 2)) {
-			if (!*buffer) {
-				recli_fprintf(recli_stdout, "%s\r\n\r\n",
-					      (char *) b->first);
+	img->next_image = images;
+	images = img;
+
+	return 0;
+
+fail:
+	free(idx.keys);
+	free(idx.values);
+	free(idx.nodes);
+
+	syntax_image_free(img);
+
+	return -1;
+}
+
+
+/*
+ *	Values computed for each node by syntax_print_stats(), in
+ *	dependency order.
+ */
+typedef struct syntax_stats_t {
+	double		commands;	/* commands it accepts */
+	double		tree;		/* nodes, if nothing was shared */
+	int		depth;
+	int		fanout;		/* alternatives, for '|' */
+} syntax_stats_t;
+
+/*
+ *	Print one JSON object describing the size and shape of a
+ *	syntax, and of the hash table which holds all of the nodes.
+ *
+ *	Each node is visited once, children first, so even a huge
+ *	DAG costs time linear in the number of nodes.  Data types,
+ *	"..." and repeated words count as one command each, and
+ *	alternatives which overlap are counted twice.
+ */
+int syntax_print_stats(void *ctx, cli_syntax_t *head)
+{
+	int i, max_depth, max_fanout, datatypes;
+	int types[CLI_TYPE_FORCE_EXACT];
+	size_t string_bytes, image_bytes;
+	syntax_index_t idx;
+	syntax_stats_t *st;
+	const cli_syntax_t *this;
+
+	if (!head) return 0;
+
+	memset(&idx, 0, sizeof(idx));
+	idx.size = 256;
+	while (idx.size <= (num_entries * 2)) idx.size *= 2;
+
+	st = NULL;
+	idx.keys = calloc(idx.size, sizeof(idx.keys[0]));
+	idx.values = calloc(idx.size, sizeof(idx.values[0]));
+	idx.nodes = calloc(idx.size / 2, sizeof(idx.nodes[0]));
+	if (!idx.keys || !idx.values || !idx.nodes) goto fail;
+
+	if (syntax_index_add(&idx, head) < 0) goto fail;
+
+	st = calloc(idx.num_nodes, sizeof(st[0]));
+	if (!st) goto fail;
+
+	memset(types, 0, sizeof(types));
+	string_bytes = 0;
+	max_depth = max_fanout = datatypes = 0;
+
+	for (i = 0; i < idx.num_nodes; i++) {
+		const syntax_stats_t *a, *b;
+
+		this = idx.nodes[i];
+		types[this->type]++;
+
+		st[i].commands = 1;
+		st[i].tree = 1;
+		st[i].depth = 1;
+
+		switch (this->type) {
+		case CLI_TYPE_EXACT:
+			if (this->next) {
+				datatypes++;
 			} else {
-				recli_fprintf(recli_stdout, "%s- %s\r\n",
-					      buffer, (char *) b->first);
+				string_bytes += strlen(this->first) + 1;
 			}
-			syntax_free(help);
+			break;
+
+		case CLI_TYPE_OPTIONAL:
+		case CLI_TYPE_PLUS:
+			a = &st[syntax_index_find(&idx, this->first)];
+
+			st[i].commands = a->commands + (this->type == CLI_TYPE_OPTIONAL);
+			st[i].tree += a->tree;
+			st[i].depth += a->depth;
+			break;
+
+		case CLI_TYPE_CONCAT:
+		case CLI_TYPE_ALTERNATE:
+			a = &st[syntax_index_find(&idx, this->first)];
+			b = &st[syntax_index_find(&idx, this->next)];
+
+			if (this->type == CLI_TYPE_CONCAT) {
+				st[i].commands = a->commands * b->commands;
+			} else {
+				st[i].commands = a->commands + b->commands;
+				st[i].fanout = 1 + (b->fanout ? b->fanout : 1);
+				if (st[i].fanout > max_fanout) max_fanout = st[i].fanout;
+			}
+			st[i].tree += a->tree + b->tree;
+			st[i].depth += (a->depth > b->depth) ? a->depth : b->depth;
+			break;
+
+		default:
+			break;
+		}
+
+		if (st[i].depth > max_depth) max_depth = st[i].depth;
+	}
+
+	/*
+	 *	What syntax_pack() allocates for this syntax.
+	 */
+	image_bytes = sizeof(syntax_image_t) + string_bytes + 1 +
+		idx.num_nodes * (sizeof(uint8_t) * 2 + sizeof(uint32_t) * 2 +
+				 sizeof(uint64_t) + sizeof(recli_datatype_parse_t));
+
+	recli_fprintf(ctx, "{\"nodes\": %d, \"words\": %d, \"data_types\": %d, \"varargs\": %d, "
+		      "\"optional\": %d, \"concat\": %d, \"alternate\": %d, \"plus\": %d, "
+		      "\"node_bytes\": %zu, \"string_bytes\": %zu, \"image_bytes\": %zu, \"packed\": %d, "
+		      "\"table_size\": %d, \"table_entries\": %d, \"load_factor\": %.2f, \"table_bytes\": %zu, "
+		      "\"tree_nodes\": %.0f, \"sharing\": %.2f, \"max_depth\": %d, \"max_fanout\": %d, "
+		      "\"commands\": %.0f}\n",
+		      idx.num_nodes,
+		      types[CLI_TYPE_EXACT] - datatypes, datatypes,
+		      types[CLI_TYPE_VARARGS],
+		      types[CLI_TYPE_OPTIONAL], types[CLI_TYPE_CONCAT],
+		      types[CLI_TYPE_ALTERNATE], types[CLI_TYPE_PLUS],
+		      idx.num_nodes * sizeof(cli_syntax_t), string_bytes, image_bytes,
+		      (syntax_image(head) != NULL),
+		      table_size, num_entries, (double) num_entries / table_size,
+		      table_size * sizeof(hash_table[0]),
+		      st[idx.num_nodes - 1].tree, st[idx.num_nodes - 1].tree / idx.num_nodes,
+		      max_depth, max_fanout,
+		      st[idx.num_nodes - 1].commands);
+
+	free(st);
+	free(idx.keys);
+	free(idx.values);
+	free(idx.nodes);
+
+	return 0;
+
+fail:
+	free(st);
+	free(idx.keys);
+	free(idx.values);
+	free(idx.nodes);
+
+	return -1;
+}
+
+static int syntax_image_check_memo(syntax_memo_t *memo, const syntax_image_t *img,
+				   uint32_t i, int argc, char *argv[],
+				   const char **error, int *flags);
+
+/*
+ *	Check one packed node.  This mirrors syntax_check_node().
+ */
+static int syntax_image_check_node(syntax_memo_t *memo, const syntax_image_t *img,
+				   uint32_t i, int argc, char *argv[],
+				   const char **error, int *flags)
+{
+	int words, total, min;
+	const char *word;
+	char const *alt_error = NULL;
+
+	*error = NULL;
+
+	COUNT(check_nodes);
+
+	switch (img->type[i]) {
+	case CLI_TYPE_EXACT:
+		if (argc == 0) return 1; /* want one more argument */
+
+		if ((img->flags[i] & IMAGE_DATATYPE) != 0) {
+			COUNT(datatypes);
+			*error = NULL;
+			if (img->types[img->first[i]](argv[0], error)) {
+				return 1;
+			}
+
+			if (!*error) *error = "Input does not match required syntax";
+			return -1;
+		}
+
+		word = img->strings + img->first[i];
+
+		if ((img->flags[i] & FLAG_CASE_INSENSITIVE) != 0) {
+			if (strcasecmp(word, argv[0]) == 0) {
+				if (flags) *flags |= img->flags[i] & FLAGS_EXPORT;
+				return 1;
+			}
+
+		} else if (strcmp(word, argv[0]) == 0) {
+			if (flags) *flags |= img->flags[i] & FLAGS_EXPORT;
 			return 1;
 		}
 
-		a = a->next;
-	}
+		*error = "No matching command";
+		return -1;	/* didn't match */
 
-	b = a;
+	case CLI_TYPE_VARARGS:
+		if (argc == 0) return 1; /* want one more argument */
 
-	if ((b->type == CLI_TYPE_EXACT) && (b->length == 2)) {
-		recli_fprintf(recli_stdout, "%s- %s\r\n",
-			      buffer, (char *) b->first);
-		syntax_free(help);
-		return 1;
-	}
+		return argc; /* eat all of the following arguments */
 
-	syntax_free(help);
+	case CLI_TYPE_OPTIONAL:
+		if (!argc) return 0; /* that's OK. */
 
-	return 0;
-}
+		words = syntax_image_check_memo(memo, img, img->first[i], argc, argv, error, flags);
+		if (words < 0) {
+			COUNT(backtracks);
+			return 0;
+		}
+		return words;
 
-static int syntax_prefix_help(int argc, char *argv[], char *help_text[],
-			       cli_syntax_t *this, cli_syntax_t *next)
-{
-	int matches, total;
-	cli_syntax_t *a, *b, *c;
+	case CLI_TYPE_PLUS:
+		min = img->next[i];
 
-	assert(this != NULL);
+		if (min == 1) {
+			words = syntax_image_check_memo(memo, img, img->first[i], argc, argv, error, flags);
+			if (words <= 0) return words;
 
-	if (argc == 0) return 0;
+			if (words > argc) return words;
 
-	switch (this->type) {
-	case CLI_TYPE_EXACT:
-		if (this->length != 2) {
-			argv[0] = this->first;
-			help_text[0] = NULL;
+			argc -= words;
+			argv += words;
+			total = words;
 		} else {
-			argv[0] = NULL;
-			help_text[0] = this->first;
+			total = 0;
+
+			if (!argc) return 0; /* that's OK. */
 		}
-		return 1;
 
-	case CLI_TYPE_VARARGS:
-		argv[0] = this->first;
-		help_text[0] = NULL;
-		return 1;
+		while (argc > 0) {
+			words = syntax_image_check_memo(memo, img, img->first[i], argc, argv, error, flags);
 
-	case CLI_TYPE_OPTIONAL:
-		/*
-		 *	Note first that there's an empty option.
-		 */
-		argv[0] = "";
-		help_text[0] = "";
-		argc--;
-		argv++;
-		help_text++;
-		total = 1;
+			if (words <= 0) break;
 
-		matches = syntax_prefix_help(argc, argv, help_text, this->first, next);
-		argc -= matches;
-		argv += matches;
-		help_text += matches;
-		total += matches;
+			if (words > argc) return total + words;
 
-		if (!next) return total;
+			argc -= words;
+			argv += words;
+			total += words;
+		}
+		return total;
 
-		return total + syntax_prefix_help(argc, argv, help_text, next, NULL);
+	case CLI_TYPE_CONCAT:
+		words = syntax_image_check_memo(memo, img, img->first[i], argc, argv, error, flags);
+		if (words < 0) return words;
 
-	case CLI_TYPE_PLUS:
-		/*
-		 *	Count '*' and '+' as equivalent for prefix words, and always
-		 *	show one option.
-		 */
-		matches = syntax_prefix_help(argc, argv, help_text, this->first, next);
-		argc -= matches;
-		argv += matches;
-		help_text += matches;
-		total = matches;
+		if (words > argc) return words;
 
-		if (!next) return total;
+		argc -= words;
+		argv += words;
+		total = words;
 
-		return total + syntax_prefix_help(argc, argv, help_text, next, NULL);
+		words = syntax_image_check_memo(memo, img, img->next[i], argc, argv, error, flags);
+		if (words < 0) return words - total;
 
-	case CLI_TYPE_CONCAT:
-		a = this->first;
-		b = this->next;
+		if (words > argc) return total + words;
 
-		c = this->next;
-		if (next) {
-			c->refcount++;
-			next->refcount++;
-			c = syntax_alloc(CLI_TYPE_CONCAT, this->next, next);
-			assert(c != this);
+		return total + words;
+
+	case CLI_TYPE_ALTERNATE:
+		words = syntax_image_check_memo(memo, img, img->first[i], argc, argv, &alt_error, flags);
+		if (words > 0) {
+			if ((words > argc) &&
+			    (syntax_image_check_memo(memo, img, img->next[i], argc, argv, &alt_error, flags) == argc)) {
+				return argc;
+			}
+
+			return words; /* found a match */
 		}
 
-		/*
-		 *	Catch the special case of "cmd HELP_TEXT"
-		 *
-		 *	FIXME: this is all complicated... we should switch the
-		 *	entire implementation to just fan-out tries.  The only
-		 *	reason to have the complexity of the "normal form" is for
-		 *	longest common suffix, which we no longer have.
-		 */
-		if (a->type == CLI_TYPE_EXACT) {
-			if ((b->type == CLI_TYPE_EXACT) &&
-			    (b->length == 2)) {
-				if (next) syntax_free(c);
+		if ((argc == 0) && (words == 0)) return 0;
 
-				argv[0] = a->first;
-				help_text[0] = b->first;
-				return 1;
-			}
+		COUNT(backtracks);
+		total = syntax_image_check_memo(memo, img, img->next[i], argc, argv, error, flags);
 
-			matches = syntax_prefix_help(argc, argv, help_text, b->first, c);
+		if (total >= 0) return total;
 
-			/*
-			 *	Over-write anything...
-			 */
-			argv[0] = a->first;
-			matches = 1;
-		} else {
-			matches = syntax_prefix_help(argc, argv, help_text, this->first, c);
+		/*
+		 *	The first alternative matched nothing, which is
+		 *	allowed, e.g. "(a*|b)".
+		 */
+		if (words == 0) {
+			*error = NULL;
+			return 0;
 		}
-		if (next) syntax_free(c);
-		return matches;
 
-	case CLI_TYPE_ALTERNATE:
-		total = 0;
-		while (this->type == CLI_TYPE_ALTERNATE) {
-			matches = syntax_prefix_help(argc, argv, help_text,
-						      this->first, next);
-			argc -= matches;
-			argv += matches;
-			help_text += matches;
-			total += matches;
-			this = this->next;
-		}
-		assert(this->type != CLI_TYPE_ALTERNATE);
+		/*
+		 *	Return the longest error.
+		 */
+		if (total < words) return total;
 
-		return total + syntax_prefix_help(argc, argv, help_text, this, next);
+		*error = alt_error;
+		return words;
 
 	default:
 		break;
 	}
 
-	return 0;
+	*error = "Internal sanity check failed";
+	return -1;
 }
 
-int syntax_print_context_help_subcommands(cli_syntax_t *syntax, cli_syntax_t *head, int argc, char *argv[])
+/*
+ *	The memo table is keyed by the address of each node's entry in
+ *	the "type" array, which is unique to the node.
+ */
+static int syntax_image_check_memo(syntax_memo_t *memo, const syntax_image_t *img,
+				   uint32_t i, int argc, char *argv[],
+				   const char **error, int *flags)
 {
-	int i, j, k, cmds_argc, help_argc;
-	cli_syntax_t *help, *cmds, *a;
-	size_t max_len;
-	char *cmds_argv[256];
-	size_t cmds_len[256];
-	char *help_argv[256];
-	char *help_text[256];
-
-	if (!head || (argc < 0)) return -1;
-
-	/*
-	 *	Try to find the help.  If there is none, print the
-	 *	syntax at the current point.
-	 */
-	help = syntax_match_max(head, argc, argv);
-	cmds = syntax_match_max(syntax, argc, argv);
-
-	if (!help && !cmds) return -1;
-
-	cmds_argc = 0;
-	if (cmds) {
-		a = syntax_skip_prefix(cmds, argc);
-		syntax_free(cmds);
-		cmds = a;
-
-		memset(cmds_argv, 0, sizeof(cmds_argv));
-		if (cmds) cmds_argc = syntax_prefix_words(256, cmds_argv, NULL, CLI_MATCH_EXACT, cmds, NULL);
-	}
-
-	help_argc = 0;
-	if (help) {
-		a = syntax_skip_prefix(help, argc);
-		syntax_free(help);
-		help = a;
-
-		memset(help_argv, 0, sizeof(help_argv));
-		if (help) help_argc = syntax_prefix_help(256, help_argv, help_text, help, NULL);
-	}
-
-	k = 0;
+	int words, found;
+	const syntax_memo_entry_t *e;
 
-#if 0
-	printf("CMDS %d\r\n", cmds_argc);
-	for (i = 0; i < cmds_argc; i++) {
-		printf("%d - %s\r\n", i, cmds_argv[i]);
-	}
-
-	printf("HELP %d\r\n", help_argc);
-	for (i = 0; i < help_argc; i++) {
-		printf("%d - %s\r\n", i, help_argv[i]);
+	if ((img->type[i] == CLI_TYPE_EXACT) ||
+	    (img->type[i] == CLI_TYPE_VARARGS)) {
+		return syntax_image_check_node(memo, img, i, argc, argv, error, flags);
 	}
 
-	for (i = 0; i < help_argc; i++) {
-		printf("%d - %s\r\n", i, help_text[i]);
+	if ((argc > 0) && ((img->flags[i] & IMAGE_SKIP) != 0) &&
+	    ((syntax_memo_word(memo, argv[0]) & img->first_words[i]) == 0)) {
+		COUNT(skips);
+		*error = "No matching command";
+		return -1;
 	}
-#endif
-
-	max_len = 0;
-	for (i = 0; i < cmds_argc; i++) {
-		if (!cmds_argv[i]) {
-			cmds_len[i] = 0;
-			continue;
-		}
 
-		cmds_len[i] = strlen(cmds_argv[i]);
-		if (max_len < cmds_len[i]) max_len = cmds_len[i];
+	e = syntax_memo_find(memo, &img->type[i], argc);
+	if (e) {
+		COUNT(memo_hits);
+		*error = e->error;
+		if (flags) *flags |= e->flags;
+		return e->words;
 	}
-	max_len += 4;
 
-	for (i = 0; i < cmds_argc; i++) {
-		if (!cmds_argv[i]) continue;
-
-		if (argc > 0) recli_fprintf(recli_stdout, "... ");
+	found = 0;
+	words = syntax_image_check_node(memo, img, i, argc, argv, error, &found);
+	syntax_memo_add(memo, &img->type[i], argc, words, *error, found);
 
-		for (j = k; j < help_argc; j++) {
-			if (!help_argv[j]) continue; /* e.g. "show" versus "show subscriber" */
+	if (flags) *flags |= found;
+	return words;
+}
 
-			if ((strcmp(cmds_argv[i], help_argv[j]) == 0) && help_text[j]) {
-				recli_fprintf(recli_stdout, "%s%.*s%s\r\n", cmds_argv[i],
-					      (int) max_len - cmds_len[i], spaces, help_text[j]);
-				k++;
-				break;
-			}
-		}
+/*
+ *	Check argv against a packed syntax.  This only reads the image,
+ *	so other threads can call it while the nodes are being changed,
+ *	so long as the image isn't freed.
+ */
+int syntax_image_check(const syntax_image_t *img, int argc, char *argv[],
+		       const char **error, int *flags)
+{
+	int rcode;
+	syntax_memo_t memo;
 
-		/*
-		 *	No help, just print out the command.
-		 *
-		 *	FIXME: print out automatic help for built-in data types.
-		 */
-		if (j == help_argc) {
-			if (!*cmds_argv[i]) cmds_argv[i] = "<cr>";
+	*error = NULL;
 
-			recli_fprintf(recli_stdout, "%s\r\n", cmds_argv[i]);
-		}
-	}
+	if (!img || (argc < 0)) return -1;
 
-	if (help) syntax_free(help);
-	if (cmds) syntax_free(cmds);
+	syntax_memo_init(&memo);
+	rcode = syntax_image_check_memo(&memo, img, img->num_nodes - 1,
+					argc, argv, error, flags);
+	syntax_memo_free(&memo);
 
-	return 0;
+	return rcode;
 }
@@ -0,0 +1,182 @@
+/*
+ * Tracing, written out as Chrome trace events.
+ *
+ * See LICENSE for licence details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "recli.h"
+
+/*
+ *	The events go into a ring buffer, and are written out when
+ *	recli exits.  When the ring is full, the oldest events are
+ *	overwritten.  Slots are claimed with an atomic add, so any
+ *	thread can record events without taking a lock.
+ */
+#define TRACE_EVENTS	(1 << 16)
+
+typedef struct trace_event_t {
+	uint64_t	seq;		/* claim number + 1, once complete */
+	uint64_t	start;
+	uint64_t	dur;
+	int		tid;
+	const char	*cat;
+	char		name[32];
+	const char	*arg[2];
+	int64_t		value[2];
+} trace_event_t;
+
+static trace_event_t *trace_ring = NULL;
+static uint64_t trace_head = 0;
+static uint64_t trace_epoch = 0;
+static pid_t trace_pid = 0;
+static char *trace_file = NULL;
+
+static void trace_exit(void);
+
+/*
+ *	Start tracing.  The events are written to "filename" on exit.
+ */
+int recli_trace_open(const char *filename)
+{
+	if (trace_ring) return 0;
+
+	trace_file = strdup(filename);
+	trace_ring = calloc(TRACE_EVENTS, sizeof(trace_ring[0]));
+	if (!trace_file || !trace_ring) {
+		free(trace_file);
+		free(trace_ring);
+		trace_file = NULL;
+		trace_ring = NULL;
+		return -1;
+	}
+
+	trace_pid = getpid();
+	trace_epoch = recli_now();
+	atexit(trace_exit);
+
+	return 0;
+}
+
+/*
+ *	The start time of a span, or 0 if we're not tracing.
+ */
+uint64_t recli_trace_now(void)
+{
+	if (!trace_ring) return 0;
+
+	return recli_now();
+}
+
+/*
+ *	Record a span from "start" until now.  "tid" is 0 for recli
+ *	itself, or the PID of a child.  Each of the arguments is
+ *	recorded if its name isn't NULL.
+ */
+void recli_trace_span(const char *cat, const char *name, int tid, uint64_t start,
+		      const char *arg1, int64_t value1,
+		      const char *arg2, int64_t value2)
+{
+	uint64_t seq;
+	trace_event_t *e;
+
+	if (!trace_ring || !start) return;
+
+	seq = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+	e = &trace_ring[seq & (TRACE_EVENTS - 1)];
+
+	e->start = start;
+	e->dur = recli_now() - start;
+	e->tid = tid;
+	e->cat = cat;
+	strlcpy(e->name, name, sizeof(e->name));
+	e->arg[0] = arg1;
+	e->value[0] = value1;
+	e->arg[1] = arg2;
+	e->value[1] = value2;
+
+	__atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+void recli_json_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for (; *str; str++) {
+		if ((*str == '"') || (*str == '\\')) {
+			fputc('\\', fp);
+		} else if ((unsigned char) *str < ' ') {
+			continue;
+		}
+		fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+/*
+ *	Write the events as Chrome trace JSON.  Spans are "complete"
+ *	events, with times in microseconds since tracing started.
+ */
+static int trace_write(const char *filename)
+{
+	int i;
+	uint64_t seq, first;
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed opening %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	fprintf(fp, "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"recli\"}}",
+		(int) trace_pid, (int) trace_pid);
+
+	seq = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+	first = (seq > TRACE_EVENTS) ? seq - TRACE_EVENTS : 0;
+
+	for (; first < seq; first++) {
+		const trace_event_t *e = &trace_ring[first & (TRACE_EVENTS - 1)];
+
+		if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != first + 1) continue;
+
+		fprintf(fp, ",\n{\"ph\": \"X\", \"cat\": \"%s\", \"name\": ", e->cat);
+		recli_json_string(fp, e->name);
+		fprintf(fp, ", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+			(int) trace_pid, e->tid ? e->tid : (int) trace_pid,
+			(e->start - trace_epoch) / 1000.0, e->dur / 1000.0);
+
+		if (e->arg[0] || e->arg[1]) {
+			fprintf(fp, ", \"args\": {");
+			for (i = 0; i < 2; i++) {
+				if (!e->arg[i]) continue;
+
+				fprintf(fp, "%s\"%s\": %lld", (i && e->arg[0]) ? ", " : "",
+					e->arg[i], (long long) e->value[i]);
+			}
+			fprintf(fp, "}");
+		}
+		fprintf(fp, "}");
+	}
+
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp) != 0) return -1;
+
+	return 0;
+}
+
+/*
+ *	Children which fail to exec() call exit() too.  They don't
+ *	write anything.
+ */
+static void trace_exit(void)
+{
+	if (getpid() != trace_pid) return;
+
+	(void) trace_write(trace_file);
+}
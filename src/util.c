@@ -7,6 +7,10 @@
 #include "recli.h"
 
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 ssize_t strquotelen(const char *str)
 {
 	char c = *str;
@@ -30,72 +34,201 @@ ssize_t strquotelen(const char *str)
 	return p - str;
 }
 
-int str2argv(char *buf, size_t len, int max_argc, char *argv[])
+#define IS_SPACE(_c) (((_c) == ' ') || (((_c) >= '\t') && ((_c) <= '\r')))
+#define IS_QUOTE(_c) (((_c) == '"') || ((_c) == '\'') || ((_c) == '`'))
+
+/*
+ *	Find the end of a bare word: the first whitespace, quote, or
+ *	NUL at or after "p".  Returns "end" if there is none.
+ */
+static const char *word_end(const char *p, const char *end)
 {
-	int argc;
-	char *p;
+#ifdef __SSE2__
+	const __m128i nine = _mm_set1_epi8('\t');
+	const __m128i four = _mm_set1_epi8('\r' - '\t');
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i dquote = _mm_set1_epi8('"');
+	const __m128i squote = _mm_set1_epi8('\'');
+	const __m128i bquote = _mm_set1_epi8('`');
+	const __m128i zero = _mm_setzero_si128();
 
-	if ((len == 0) || (max_argc == 0)) return 0;
+	while ((end - p) >= 16) {
+		__m128i v, t, m;
+		int mask;
+
+		v = _mm_loadu_si128((const __m128i *) p);
+
+		/*
+		 *	'\t' through '\r' is (c - '\t') <= 4, unsigned.
+		 */
+		t = _mm_sub_epi8(v, nine);
+		m = _mm_cmpeq_epi8(_mm_min_epu8(t, four), t);
+
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, space));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, dquote));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, squote));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bquote));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, zero));
+
+		mask = _mm_movemask_epi8(m);
+		if (mask) return p + __builtin_ctz(mask);
+
+		p += 16;
+	}
+#endif
+
+	while ((p < end) && *p && !IS_SPACE(*p) && !IS_QUOTE(*p)) p++;
+
+	return p;
+}
+
+/*
+ *	Find the closing quote "c" of a string, skipping backslash
+ *	escapes.  Returns NULL if the string isn't terminated.
+ */
+static const char *quote_end(const char *p, const char *end, char c,
+			     int *escaped)
+{
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8(c);
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i zero = _mm_setzero_si128();
+
+	while ((end - p) >= 16) {
+		__m128i v, m;
+		int mask;
+
+		v = _mm_loadu_si128((const __m128i *) p);
+		m = _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+				 _mm_cmpeq_epi8(v, backslash));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, zero));
+
+		mask = _mm_movemask_epi8(m);
+		if (!mask) {
+			p += 16;
+			continue;
+		}
+
+		p += __builtin_ctz(mask);
+		if (*p != '\\') break;
+
+		*escaped = 1;
+		if ((p + 1 >= end) || !p[1]) return NULL;
+		p += 2;
+	}
+#endif
+
+	while ((p < end) && *p) {
+		if (*p == '\\') {
+			*escaped = 1;
+			if ((p + 1 >= end) || !p[1]) return NULL;
+			p += 2;
+			continue;
+		}
 
-	while (isspace((int) *buf)) buf++;
+		if (*p == c) return p;
+		p++;
+	}
+
+	if ((p < end) && (*p == c)) return p;
+
+	return NULL;
+}
 
-	if (!*buf || (*buf == ';') || (*buf == '#')) return 0;
+/*
+ *	Split a line into tokens, without modifying or copying it.
+ *	Words are separated by whitespace.  Quoted strings are one
+ *	token, including the quotes.  A ';' or '#' at the start of a
+ *	word begins a comment.
+ *
+ *	Returns the number of tokens, or -1 on error, with "*error"
+ *	set to the offset of the offending character.
+ */
+int str2tokens(const char *buf, size_t len, int max_tokens,
+	       recli_token_t *tokens, size_t *error)
+{
+	int num = 0;
+	const char *p, *q, *end;
 
-	argc = 0;
 	p = buf;
+	end = buf + len;
+
+	while (p < end) {
+		while ((p < end) && IS_SPACE(*p)) p++;
+
+		if ((p == end) || !*p) break;
 
-	while (*p && (argc < max_argc)) {
-		while (isspace((int) *p)) if (argv) *(p++) = '\0';
+		if ((*p == ';') || (*p == '#')) break;
 
-		if (!*p) return argc;
+		if (num >= max_tokens) goto fail;
 
-		if ((*p == ';') || (*p == '#')) return argc;
+		tokens[num].offset = p - buf;
+		tokens[num].escaped = 0;
 
 		/*
 		 *	String: treat it as one block
 		 */
-		if ((*p == '"') || (*p == '\'') || (*p == '`')) {
-			ssize_t quote;
+		if (IS_QUOTE(*p)) {
+			tokens[num].quote = *p;
 
-			quote = strquotelen(p);
-			if (quote < 0) return -(p - buf);
+			q = quote_end(p + 1, end, *p, &tokens[num].escaped);
+			if (!q) goto fail;
+			q++;
 
-			if (p[quote] && !isspace((int) p[quote])) {
-				return -(p + quote - buf);
+			if ((q < end) && *q && !IS_SPACE(*q)) {
+				p = q;
+				goto fail;
 			}
 
-			if (argv) {
-				argv[argc++] = p;
-				p += quote;
-
-				if (!*p) return argc;
-				*(p++) = '\0';
-				continue;
+		} else {
+			/*
+			 *	Anything else: must be a word all by itself.
+			 */
+			tokens[num].quote = '\0';
+
+			q = word_end(p, end);
+			if ((q < end) && IS_QUOTE(*q)) {
+				p = q;
+				goto fail;
 			}
-
-			argc++;
-			continue;
 		}
 
-		/*
-		 *	Anything else: must be a word all by itself.
-		 */
+		tokens[num].length = q - p;
+		num++;
+		p = q;
+	}
 
-		if (argv) argv[argc] = p;
-		argc++;
+	return num;
 
-		while (*p && (*p != '"') && (*p != '\'') && (*p != '`') &&
-		       !isspace((int) *p)) {
-			p++;
-		}
+fail:
+	if (error) *error = p - buf;
+	return -1;
+}
+
+/*
+ *	Split a line into words, in place.  Returns the number of
+ *	words, or -1 on error: bad quoting, or more than "max_argc"
+ *	words.  "max_argc" is capped at STR2ARGV_MAX.
+ */
+int str2argv(char *buf, size_t len, int max_argc, char *argv[])
+{
+	int i, argc;
+	size_t error;
+	recli_token_t tokens[STR2ARGV_MAX];
+
+	if ((len == 0) || (max_argc == 0)) return 0;
 
-		if (!*p) return argc;
+	if (max_argc > STR2ARGV_MAX) max_argc = STR2ARGV_MAX;
 
-		if (!isspace((int) *p)) return -(p - buf);
+	argc = str2tokens(buf, len, max_argc, tokens, &error);
+	if (argc < 0) return -1;
 
+	for (i = 0; i < argc; i++) {
+		buf[tokens[i].offset + tokens[i].length] = '\0';
+		if (argv) argv[i] = buf + tokens[i].offset;
 	}
 
-	return -(p - buf);
+	return argc;
 }
 
 void print_argv(int argc, char *argv[])
@@ -120,6 +253,47 @@ void print_argv_string(int argc, char *argv[])
 	}
 }
 
+/*
+ *	Print a string as a C string literal.
+ */
+void fprint_cstring(FILE *fp, const char *str)
+{
+	const unsigned char *p;
+
+	fputc('"', fp);
+
+	for (p = (const unsigned char *) str; *p; p++) {
+		switch (*p) {
+		case '"':
+		case '\\':
+			fprintf(fp, "\\%c", *p);
+			break;
+
+		case '\r':
+			fputs("\\r", fp);
+			break;
+
+		case '\n':
+			fputs("\\n", fp);
+			break;
+
+		case '\t':
+			fputs("\\t", fp);
+			break;
+
+		default:
+			if ((*p < ' ') || (*p >= 0x7f) || (*p == '?')) {
+				fprintf(fp, "\\%03o", *p); /* no trigraphs */
+			} else {
+				fputc(*p, fp);
+			}
+			break;
+		}
+	}
+
+	fputc('"', fp);
+}
+
 static size_t linelen(const char *buffer, size_t cols)
 {
 	size_t len;
@@ -6,12 +6,18 @@ OUTPUT="$1.tmp"
 EXPECTED="$1.out"
 DIFF="$1.diff"
 PERM=
+HELP=
 
 if [ -f "$1.perm" ]
 then
     PERM="-p $1.perm"
 fi
 
+if [ -f "$1.md" ]
+then
+    HELP="-H $1.md"
+fi
+
 if [ -f "$1.norm" ]
 then
   ../src/recli -s $SYNTAX -qX syntax < /dev/null > $1.tmp 2>&1
@@ -32,7 +38,21 @@ then
   fi    
 fi
 
-../src/recli -s $SYNTAX $PERM < $INPUT > $OUTPUT 2>&1
+if [ -f "$1.check" ]
+then
+  ../src/recli -s $SYNTAX $PERM --check $1.check > $OUTPUT 2>&1
+  diff $OUTPUT $1.checked 2>&1 > $DIFF
+  if [ "$?" != "0" ]
+  then
+     echo "FAILED check output diff: $1"
+     echo "../src/recli -s $SYNTAX $PERM --check $1.check"
+     echo "diff $OUTPUT $1.checked 2>&1 > $DIFF"
+     echo $1 >> .failed
+     exit 1
+  fi
+fi
+
+../src/recli -s $SYNTAX $PERM $HELP < $INPUT > $OUTPUT 2>&1
 if [ "$?" != "0" ]
 then
    echo "FAILED running CLI: $1"
@@ -45,7 +65,7 @@ then
     rm -f $OUTPUT $DIFF
 else
     echo "FAILED output diff: $1"
-    echo "../src/recli -s $SYNTAX $PERM < $INPUT"
+    echo "../src/recli -s $SYNTAX $PERM $HELP < $INPUT"
     echo "diff $OUTPUT $EXPECTED 2>&1 > $DIFF"
     echo $1 >> .failed
     exit 1
@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+#  Run each input in corpus/ through recli-fuzz once.  They are
+#  inputs which the fuzzer found bugs with, so that the bugs stay
+#  fixed.
+#
+OUTPUT="corpus.tmp"
+
+for x in corpus/*
+do
+  ../src/recli-fuzz $x > $OUTPUT 2>&1
+  if [ "$?" != "0" ]
+  then
+     echo "FAILED fuzzing: ../src/recli-fuzz $x"
+     cat $OUTPUT
+     echo corpus >> .failed
+     exit 1
+  fi
+done
+
+rm -f $OUTPUT
+echo "Success: corpus"
@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+#  Each line of errors.syntax is loaded on its own, and has to be
+#  rejected with an error, and not an assertion or a crash.  The
+#  errors are compared with errors.out.
+#
+INPUT="errors.syntax"
+SYNTAX="errors.tmp.syntax"
+OUTPUT="errors.tmp"
+EXPECTED="errors.out"
+DIFF="errors.diff"
+
+rm -f $OUTPUT
+grep -v '^#' $INPUT | while read -r line
+do
+  echo "$line" > $SYNTAX
+  ../src/recli -s $SYNTAX -qX syntax < /dev/null >> $OUTPUT 2>&1
+  if [ "$?" != "1" ]
+  then
+     echo "NOT REJECTED: $line" >> $OUTPUT
+  fi
+done
+
+diff $OUTPUT $EXPECTED 2>&1 > $DIFF
+if [ "$?" != "0" ]
+then
+   echo "FAILED syntax errors: diff $OUTPUT $EXPECTED"
+   echo errors >> .failed
+   exit 1
+fi
+
+rm -f $SYNTAX $OUTPUT $DIFF
+echo "Success: errors"
@@ -0,0 +1,98 @@
+#!/bin/sh
+#
+#  Check the output filters after a '|'.  The command prints more
+#  than a pipe's worth, so that lines are split across reads.
+#
+DIR="filter.d"
+
+fail() {
+   echo "FAILED filter: $1"
+   echo filter >> .failed
+   exit 1
+}
+
+rm -rf $DIR
+mkdir -p $DIR/bin $DIR/cache
+
+cat > $DIR/cache/syntax.txt <<EOT
+show config
+show numbers
+EOT
+
+cat > $DIR/bin/show <<'EOT'
+#!/bin/sh
+if [ "$1" = "config" ]; then
+  printf 'hostname router\ninterface eth0\n address 10.0.0.1\n mtu 1500\n'
+  printf 'interface eth1\n address 10.0.1.1\nrouter bgp 65000\n neighbor 10.0.0.2\n'
+  printf 'line vty\n timeout 10'
+else
+  seq 1 20000
+fi
+EOT
+chmod +x $DIR/bin/show
+
+../src/recli -d $DIR > filter.out.tmp 2>&1 <<'EOT'
+show config | include interface
+show config | exclude "^ "
+show config | include 10\.0\.0\.
+show config | section interface
+show config | section "^(router|line)"
+show config | begin "^router" | count
+show config | include address | exclude eth1 | count
+show numbers | include 777
+show numbers | begin 19998
+show numbers | exclude 1 | count
+show numbers | include ^ | count
+show config | exclude "x*" | count
+show config | include ^ | exclude "x*"
+show config | include
+show config | count | include x
+show config | grep x
+| count
+show | count
+EOT
+
+cat > filter.expected.tmp <<EOT
+interface eth0
+interface eth1
+hostname router
+interface eth0
+interface eth1
+router bgp 65000
+line vty
+ address 10.0.0.1
+ neighbor 10.0.0.2
+interface eth0
+ address 10.0.0.1
+ mtu 1500
+interface eth1
+ address 10.0.1.1
+router bgp 65000
+ neighbor 10.0.0.2
+line vty
+ timeout 10
+4
+2
+$(seq 1 20000 | grep 777)
+19998
+19999
+20000
+6561
+20000
+0
+show config | include
+                     ^ Expected a pattern.
+show config | count | include x
+                      ^ Nothing can follow 'count'.
+show config | grep x
+              ^ Unknown filter.
+| count
+^ Expected a command.
+show | count
+     ^ The command isn't complete.
+EOT
+
+cmp -s filter.out.tmp filter.expected.tmp || fail "diff filter.expected.tmp filter.out.tmp"
+
+rm -rf filter.*.tmp $DIR
+echo "Success: filter"
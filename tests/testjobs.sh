@@ -0,0 +1,86 @@
+#!/bin/sh
+#
+#  Check background jobs, and "jobs", "fg" and "kill".  The PIDs
+#  which are printed when the jobs start are removed.
+#
+DIR="jobs.d"
+
+fail() {
+   echo "FAILED jobs: $1"
+   echo jobs >> .failed
+   exit 1
+}
+
+rm -rf $DIR
+mkdir -p $DIR/bin $DIR/cache
+
+cat > $DIR/cache/syntax.txt <<EOT
+show sleeper
+show numbers
+show later
+EOT
+
+cat > $DIR/bin/show <<'EOT'
+#!/bin/sh
+if [ "$1" = "sleeper" ]; then
+  sleep 10
+  echo end
+elif [ "$1" = "later" ]; then
+  sleep 1
+  echo later
+else
+  seq 1 20000
+fi
+EOT
+chmod +x $DIR/bin/show
+
+START=$(date +%s)
+
+../src/recli -d $DIR 2>&1 <<'EOT' | sed 's/^\(\[[0-9]*\]\) [0-9]*$/\1 PID/' > jobs.out.tmp
+show sleeper &
+jobs
+show numbers | count &
+fg 2
+show numbers | include 1999 &
+fg
+kill %1
+fg
+jobs
+fg
+fg 7
+show &
+show numbers
+EOT
+
+END=$(date +%s)
+[ $(($END - $START)) -ge 8 ] && fail "'kill' didn't stop the job"
+
+cat > jobs.expected.tmp <<EOT
+[1] PID
+[1] Running  show sleeper
+[2] PID
+20000
+[2] PID
+$(seq 1 20000 | grep 1999)
+No current job
+No such job: 7
+show &
+     ^ The command isn't complete.
+$(seq 1 20000)
+EOT
+
+cmp -s jobs.out.tmp jobs.expected.tmp || fail "diff jobs.expected.tmp jobs.out.tmp"
+
+#
+#  When the input ends, the jobs which are still running are waited
+#  for, and not hung up on.
+#
+printf 'show later &\n' | ../src/recli -d $DIR 2>&1 | \
+	sed 's/^\(\[[0-9]*\]\) [0-9]*$/\1 PID/' > jobs.out.tmp
+
+printf '[1] PID\nlater\n' > jobs.expected.tmp
+
+cmp -s jobs.out.tmp jobs.expected.tmp || fail "diff jobs.expected.tmp jobs.out.tmp"
+
+rm -rf jobs.*.tmp $DIR
+echo "Success: jobs"
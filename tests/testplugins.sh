@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+#  Check that a plugin which prints bad syntax doesn't lose the
+#  syntax of the plugins which were loaded before it, or break the
+#  ones which are loaded after it.
+#
+DIR="plugins.d"
+OUTPUT="plugins.tmp"
+
+rm -rf $DIR
+mkdir -p $DIR/bin
+
+for x in alpha beta broken gamma delta
+do
+   cat > $DIR/bin/$x <<'EOT'
+#!/bin/sh
+if [ "$1" = "--config" ]; then
+  [ "$2" = "syntax" ] && echo "one two"
+  exit 0
+fi
+echo "$@"
+EOT
+   chmod +x $DIR/bin/$x
+done
+
+cat > $DIR/bin/broken <<'EOT'
+#!/bin/sh
+[ "$1" = "--config" ] && [ "$2" = "syntax" ] && echo "(broken"
+exit 0
+EOT
+
+../src/recli -d $DIR > $OUTPUT 2>&1 <<EOT
+alpha one two
+delta one two
+EOT
+if [ "$?" != "0" ]
+then
+   echo "FAILED plugins: ../src/recli -d $DIR"
+   cat $OUTPUT
+   echo plugins >> .failed
+   exit 1
+fi
+
+if [ "$(grep -c '^one two$' $OUTPUT)" != "2" ]
+then
+   echo "FAILED plugins: the good plugins didn't run"
+   cat $OUTPUT
+   echo plugins >> .failed
+   exit 1
+fi
+
+rm -rf $DIR $OUTPUT
+echo "Success: plugins"
@@ -0,0 +1,142 @@
+#!/bin/sh
+#
+#  Check the commands in rest.txt, which are sent to a stand-in
+#  REST server.  The connection is kept open between commands,
+#  until the server closes it.
+#
+SOCKET="./rest.sock.tmp"
+DIR="rest.d"
+
+fail() {
+   echo "FAILED rest: $1"
+   echo rest >> .failed
+   kill $MOCK 2> /dev/null
+   exit 1
+}
+
+rm -rf $DIR $SOCKET
+mkdir -p $DIR/bin $DIR/cache
+
+cat > $DIR/cache/syntax.txt <<EOT
+show interface STRING
+get stats
+set hostname STRING
+get chunked STRING STRING
+get closing
+get missing
+get hanging
+get big
+get huge
+get badlength
+hello
+EOT
+
+cat > $DIR/rest.txt <<EOT
+# Everything but "hello" goes to the server
+endpoint $SOCKET
+show interface * = GET /interfaces/\$3
+get stats = GET /stats
+set hostname * = PUT /hostname "{\"name\": \"\$3\"}"
+get chunked = GET /chunked/\$*
+get closing = GET /close/it
+get missing = GET /status/404
+get hanging = GET /hang/now
+get big = GET /big/100000
+get huge = GET /huge/it
+get badlength = GET /badlength/it
+EOT
+
+printf '#!/bin/sh\necho hello\n' > $DIR/bin/hello
+chmod +x $DIR/bin/hello
+
+../src/recli-mockrest $SOCKET &
+MOCK=$!
+
+i=0
+while [ ! -S $SOCKET ]
+do
+   i=$(($i + 1))
+   [ $i -gt 50 ] && fail "mock server is not listening on $SOCKET"
+   sleep 0.1
+done
+
+../src/recli -d $DIR > rest.out.tmp 2>&1 <<EOT
+show interface eth0
+show interface "a b/c"
+set hostname "foo"
+set hostname 'a"b'
+get chunked one two
+get closing
+get missing
+hello
+get stats &
+get stats
+get stats | include requests
+EOT
+
+cat > rest.expected.tmp <<EOT
+GET /interfaces/eth0
+GET /interfaces/a%20b%2Fc
+PUT /hostname {"name": "foo"}
+PUT /hostname {"name": "a\"b"}
+GET /chunked/one/two
+GET /close/it
+GET /status/404 failed: 404 Failed
+status 404
+hello
+get stats &
+          ^ A REST command can't be run in the background.
+connections 2 requests 8
+connections 2 requests 9
+EOT
+
+cmp -s rest.out.tmp rest.expected.tmp || fail "diff rest.expected.tmp rest.out.tmp"
+
+#
+#  Sizes which can't be read are errors.  The reason is printed
+#  after a large body has been read.
+#
+../src/recli -d $DIR > rest.out.tmp 2>&1 <<EOT
+get big
+get huge
+get badlength
+hello
+EOT
+
+grep -q "^GET /big/100000 failed: 500 Failed$" rest.out.tmp || \
+	fail "no reason after a large body: see rest.out.tmp"
+grep -q "Failed talking to '$SOCKET': Message too long" rest.out.tmp || \
+	fail "no error for a huge chunk: see rest.out.tmp"
+grep -q "Failed talking to '$SOCKET': Protocol error" rest.out.tmp || \
+	fail "no error for a bad Content-Length: see rest.out.tmp"
+grep -q "^hello$" rest.out.tmp || fail "no command after the errors: see rest.out.tmp"
+
+#
+#  On a server, every session waits for a request, so one which
+#  doesn't get a response fails after a second.
+#
+../src/recli -d $DIR --daemon ./rest.server.tmp > /dev/null &
+SERVER=$!
+
+i=0
+while [ ! -S ./rest.server.tmp ]
+do
+   i=$(($i + 1))
+   [ $i -gt 50 ] && fail "server is not listening"
+   sleep 0.1
+done
+
+START=$(date +%s)
+(echo "get hanging"; echo "hello"; echo quit) | \
+	../src/recli --client ./rest.server.tmp > rest.out.tmp
+END=$(date +%s)
+kill $SERVER
+
+grep -q "Failed talking to '$SOCKET': Connection timed out" rest.out.tmp || \
+	fail "no timeout: see rest.out.tmp"
+grep -q "> hello$" rest.out.tmp || fail "no command after the timeout: see rest.out.tmp"
+[ $(($END - $START)) -lt 5 ] || fail "the request took $(($END - $START)) seconds"
+
+kill $MOCK
+rm -rf rest.*.tmp $DIR
+echo "Success: rest"
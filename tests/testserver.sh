@@ -0,0 +1,110 @@
+#!/bin/sh
+#
+#  Check the server: many clients at once, each of which runs
+#  commands, and sees only its own output.  The configuration has a
+#  cached syntax, so that the plugins aren't scanned after each
+#  command.  One client uses TCP, which is only on the loopback
+#  address.
+#
+CLIENTS=${SERVER_CLIENTS:-20}
+SOCKET="./server.sock.tmp"
+PORT=${SERVER_PORT:-$((20000 + $$ % 20000))}
+DIR="server.d"
+
+fail() {
+   echo "FAILED server: $1"
+   echo server >> .failed
+   kill $SERVER 2> /dev/null
+   exit 1
+}
+
+rm -rf $DIR $SOCKET
+mkdir -p $DIR/bin $DIR/cache
+cp ../config/bin/ping $DIR/bin/
+echo "ping [STRING]" > $DIR/cache/syntax.txt
+echo "Welcome to the server test" > $DIR/banner.txt
+
+../src/recli -d $DIR --daemon $PORT --daemon $SOCKET > /dev/null &
+SERVER=$!
+
+#
+#  Wait for it to listen.
+#
+i=0
+while [ ! -S $SOCKET ]
+do
+   i=$(($i + 1))
+   [ $i -gt 50 ] && fail "not listening on $SOCKET"
+   sleep 0.1
+done
+
+#
+#  Nothing is listening on the wildcard address.
+#
+if [ -r /proc/net/tcp ]
+then
+   PORTHEX=$(printf '%04X' $PORT)
+   grep -Eq " 0+:$PORTHEX " /proc/net/tcp /proc/net/tcp6 2> /dev/null && \
+	fail "port $PORT is on every address"
+fi
+
+PIDS=""
+for x in $(seq 1 $CLIENTS)
+do
+   ADDR=$SOCKET
+   [ $x -eq 1 ] && ADDR=$PORT
+
+   (for y in $(seq 1 10); do echo "ping $x"; done; echo quit) | \
+	../src/recli --client $ADDR > server.$x.tmp &
+   PIDS="$PIDS $!"
+done
+wait $PIDS
+
+for x in $(seq 1 $CLIENTS)
+do
+   (cat $DIR/banner.txt
+    printf "recli> "
+    for y in $(seq 1 10); do printf "pong $x\nrecli> "; done) > server.expected.tmp
+   cmp -s server.$x.tmp server.expected.tmp || fail "client $x: see server.$x.tmp"
+done
+
+kill $SERVER
+wait $SERVER || fail "server exited with error"
+[ -S $SOCKET ] && fail "$SOCKET was not removed"
+
+#
+#  Without a cached syntax, the plugins are scanned when the server
+#  starts, and again only when one is added.
+#
+SCANS="$(pwd)/server.scans.tmp"
+rm -f $DIR/cache/syntax.txt
+(echo '#!/bin/sh'
+ echo "[ \"\$1\" = \"--config\" ] && echo scan >> $SCANS"
+ cat ../config/bin/ping) > $DIR/bin/ping
+touch -t 200001010000 $DIR/bin
+
+../src/recli -d $DIR --daemon $SOCKET > /dev/null &
+SERVER=$!
+
+i=0
+while [ ! -S $SOCKET ]
+do
+   i=$(($i + 1))
+   [ $i -gt 50 ] && fail "not listening on $SOCKET"
+   sleep 0.1
+done
+
+(for y in $(seq 1 10); do echo "ping $y"; done; echo quit) | \
+	../src/recli --client $SOCKET > server.out.tmp
+[ $(grep -c pong server.out.tmp) -eq 10 ] || fail "no cached syntax: see server.out.tmp"
+[ $(wc -l < $SCANS) -eq 1 ] || fail "plugins were scanned $(wc -l < $SCANS) times"
+
+cp $DIR/bin/ping $DIR/bin/pong
+(echo "ping 1"; echo "pong 2"; echo quit) | ../src/recli --client $SOCKET > server.out.tmp
+grep -q "pong 2" server.out.tmp || fail "new plugin wasn't found: see server.out.tmp"
+
+kill $SERVER
+wait $SERVER || fail "server exited with error"
+
+rm -rf server.*.tmp $DIR
+echo "Success: server"
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+#  Check that starting up with the bundled configuration directory
+#  stays inside a time budget.  The budget is wall clock time in
+#  milliseconds, and is generous, so that a busy machine doesn't
+#  fail the test.  It's there to catch large regressions, such as
+#  a plugin scan which is run more than once.
+#
+BUDGET=${STARTUP_BUDGET_MS:-500}
+OUTPUT="startup.tmp"
+
+../src/recli -d ../config --startup-profile < /dev/null 2> $OUTPUT > /dev/null
+if [ "$?" != "0" ]
+then
+   echo "FAILED starting up: ../src/recli -d ../config --startup-profile"
+   echo startup >> .failed
+   exit 1
+fi
+
+WALL=$(sed -n 's/^{"phase": "startup", "wall_us": \([0-9]*\).*/\1/p' $OUTPUT)
+if [ "$WALL" = "" ]
+then
+   echo "FAILED startup profile: no \"startup\" phase in $OUTPUT"
+   echo startup >> .failed
+   exit 1
+fi
+
+if [ "$WALL" -gt $(($BUDGET * 1000)) ]
+then
+   echo "FAILED startup budget: ${WALL}us > ${BUDGET}ms"
+   cat $OUTPUT
+   echo startup >> .failed
+   exit 1
+fi
+
+rm -f $OUTPUT
+echo "Success: startup"
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+#  Compile the syntax into recli, and check that it gives the same
+#  output as loading the syntax at run time.
+#
+SYNTAX="$1.syntax"
+INPUT="$1.cli"
+OUTPUT="$1.static.tmp"
+EXPECTED="$1.out"
+DIFF="$1.static.diff"
+PERM=
+HELP=
+
+if [ -f "$1.perm" ]
+then
+    PERM="-p $1.perm"
+fi
+
+if [ -f "$1.md" ]
+then
+    HELP="-H $1.md"
+fi
+
+../src/recli-compile -s $SYNTAX $PERM $HELP -o $1.static.c
+if [ "$?" != "0" ]
+then
+   echo "FAILED compiling syntax: $1"
+   echo $1 >> .failed
+   exit 1
+fi
+
+make -s -C ../src ../tests/$1.static > /dev/null
+if [ "$?" != "0" ]
+then
+   echo "FAILED building static binary: $1"
+   echo $1 >> .failed
+   exit 1
+fi
+
+./$1.static < $INPUT > $OUTPUT 2>&1
+if [ "$?" != "0" ]
+then
+   echo "FAILED running static CLI: $1"
+   echo $1 >> .failed
+   exit 1
+fi
+
+diff $OUTPUT $EXPECTED 2>&1 > $DIFF
+if [ "$?" = "0" ]
+then
+    rm -f $OUTPUT $DIFF $1.static.c $1.static
+else
+    echo "FAILED static output diff: $1"
+    echo "./$1.static < $INPUT"
+    echo "diff $OUTPUT $EXPECTED 2>&1 > $DIFF"
+    echo $1 >> .failed
+    exit 1
+fi
+echo "Success: static $1"